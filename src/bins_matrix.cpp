@@ -0,0 +1,352 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "bins_matrix.hpp"
+
+#include "cpg_index.hpp"
+#include "cpg_index_meta.hpp"
+#include "genomic_interval.hpp"
+#include "methylome.hpp"
+#include "methylome_metadata.hpp"
+#include "utilities.hpp"  // for pread_all
+#include "zlib_adapter.hpp"
+
+#include <fcntl.h>   // for open, O_RDONLY
+#include <unistd.h>  // for close
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>  // for std::size_t
+#include <cstdint>
+#include <cstring>  // for std::memcpy
+#include <filesystem>
+#include <fstream>
+#include <iterator>  // for std::size, std::distance
+#include <limits>
+#include <span>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <unordered_set>
+#include <utility>  // for std::move, std::exchange
+#include <vector>
+
+struct matrix_header {
+  char magic[8]{};
+  std::uint64_t index_hash{};
+  std::uint32_t bin_size{};
+  std::uint32_t chunk_size{};
+  std::uint32_t n_bins{};
+  std::uint32_t n_samples{};
+  std::uint64_t directory_offset{};
+};
+
+static constexpr std::uint64_t matrix_header_size = sizeof(matrix_header);
+
+[[nodiscard]] static auto
+read_directory(const int fd, const matrix_header &hdr,
+               const std::uint64_t filesize,
+               bins_matrix &matrix) -> std::error_code {
+  if (hdr.directory_offset < matrix_header_size ||
+      hdr.directory_offset > filesize)
+    return bins_matrix_error::invalid_matrix_header;
+
+  std::vector<char> buf(filesize - hdr.directory_offset);
+  if (!pread_all(fd, buf.data(), std::size(buf), hdr.directory_offset))
+    return bins_matrix_error::error_reading_matrix;
+
+  auto cursor = buf.data();
+  const auto buf_end = buf.data() + std::size(buf);
+  const auto remaining = [&] {
+    return static_cast<std::size_t>(std::distance(cursor, buf_end));
+  };
+
+  for (std::uint32_t i = 0; i < hdr.n_samples; ++i) {
+    std::uint32_t accession_size{};
+    if (remaining() < sizeof(accession_size))
+      return bins_matrix_error::invalid_matrix_directory;
+    std::memcpy(&accession_size, cursor, sizeof(accession_size));
+    cursor += sizeof(accession_size);
+    if (remaining() < accession_size)
+      return bins_matrix_error::invalid_matrix_directory;
+    matrix.samples.emplace_back(cursor, accession_size);
+    cursor += accession_size;
+  }
+
+  const auto n_blocks =
+    static_cast<std::uint64_t>(hdr.n_samples) * matrix.get_n_chunks();
+  const auto n_offset_bytes = (n_blocks + 1) * sizeof(std::uint64_t);
+  if (remaining() != n_offset_bytes)
+    return bins_matrix_error::invalid_matrix_directory;
+  matrix.block_offsets.resize(n_blocks + 1);
+  std::memcpy(matrix.block_offsets.data(), cursor, n_offset_bytes);
+
+  // ADS: blocks are contiguous, so offsets only increase, and all are
+  // between the header and the directory
+  if (matrix.block_offsets.front() < matrix_header_size ||
+      matrix.block_offsets.back() > hdr.directory_offset ||
+      !std::ranges::is_sorted(matrix.block_offsets))
+    return bins_matrix_error::invalid_matrix_directory;
+  return {};
+}
+
+[[nodiscard]] static auto
+write_directory(std::ostream &out, const std::vector<std::string> &samples,
+                const std::vector<std::uint64_t> &block_offsets) -> bool {
+  for (const auto &accession : samples) {
+    const std::uint32_t accession_size = std::size(accession);
+    if (!out.write(reinterpret_cast<const char *>(&accession_size),
+                   sizeof(accession_size)) ||
+        !out.write(accession.data(), accession_size))
+      return false;
+  }
+  return static_cast<bool>(
+    out.write(reinterpret_cast<const char *>(block_offsets.data()),
+              std::size(block_offsets) * sizeof(std::uint64_t)));
+}
+
+// ADS: first bin of each chrom, as get_bins puts bins for each chrom
+// in order starting at 0, bin_size, ...
+[[nodiscard]] static auto
+get_chrom_bin_offsets(const cpg_index_meta &cim,
+                      const std::uint32_t bin_size)
+  -> std::vector<std::uint32_t> {
+  std::vector<std::uint32_t> offsets{0};
+  for (const auto chrom_size : cim.chrom_size)
+    offsets.push_back(offsets.back() +
+                      (std::uint64_t{chrom_size} + bin_size - 1) / bin_size);
+  return offsets;
+}
+
+bins_matrix::bins_matrix(bins_matrix &&other) noexcept :
+  filename{std::move(other.filename)}, fd{std::exchange(other.fd, -1)},
+  index_hash{other.index_hash}, bin_size{other.bin_size},
+  chunk_size{other.chunk_size}, n_bins{other.n_bins},
+  samples{std::move(other.samples)},
+  block_offsets{std::move(other.block_offsets)} {}
+
+bins_matrix &
+bins_matrix::operator=(bins_matrix &&other) noexcept {
+  if (this != &other) {
+    if (fd >= 0)
+      ::close(fd);
+    filename = std::move(other.filename);
+    fd = std::exchange(other.fd, -1);
+    index_hash = other.index_hash;
+    bin_size = other.bin_size;
+    chunk_size = other.chunk_size;
+    n_bins = other.n_bins;
+    samples = std::move(other.samples);
+    block_offsets = std::move(other.block_offsets);
+  }
+  return *this;
+}
+
+bins_matrix::~bins_matrix() {
+  if (fd >= 0)
+    ::close(fd);
+}
+
+[[nodiscard]] auto
+bins_matrix::build(const std::string &filename, const cpg_index &index,
+                   const cpg_index_meta &cim, const std::uint32_t bin_size,
+                   const std::uint32_t chunk_size,
+                   const std::vector<source> &sources) -> std::error_code {
+  if (bin_size == 0 || chunk_size == 0)
+    return bins_matrix_error::invalid_chunk_size;
+
+  std::unordered_set<std::string> accessions;
+  for (const auto &src : sources)
+    if (!accessions.insert(src.accession).second)
+      return bins_matrix_error::duplicate_sample;
+
+  std::ofstream out(filename, std::ios::binary);
+  if (!out)
+    return std::make_error_code(std::errc(errno));
+
+  // ADS: placeholder header until the directory has been written, so
+  // a matrix that failed part way cannot be opened
+  matrix_header hdr;
+  if (!out.write(reinterpret_cast<const char *>(&hdr), matrix_header_size))
+    return bins_matrix_error::error_writing_matrix;
+
+  // ADS: the header holds the number of bins in 32 bits
+  const auto n_bins_total = cim.get_n_bins(bin_size);
+  if (n_bins_total > std::numeric_limits<std::uint32_t>::max())
+    return bins_matrix_error::invalid_bin_range;
+  const std::uint32_t n_bins = n_bins_total;
+  const auto n_chunks = (n_bins + chunk_size - 1) / chunk_size;
+  std::vector<std::uint64_t> block_offsets;
+  block_offsets.reserve(std::size(sources) * n_chunks + 1);
+  std::uint64_t offset = matrix_header_size;
+  std::vector<std::uint8_t> buf;
+
+  for (const auto &src : sources) {
+    const auto [meta, meta_err] = methylome_metadata::read(src.metadata_file);
+    if (meta_err)
+      return meta_err;
+    if (meta.index_hash != cim.index_hash)
+      return bins_matrix_error::inconsistent_index;
+    const auto [meth, meth_err] = methylome::read(src.methylome_file, meta);
+    if (meth_err)
+      return meth_err;
+
+    const auto bins = meth.get_bins_cov(bin_size, index, cim);
+    if (std::size(bins) != n_bins)
+      return bins_matrix_error::inconsistent_index;
+
+    for (std::uint32_t i = 0; i < n_chunks; ++i) {
+      const auto first = i * chunk_size;
+      const std::span<const counts_res_cov> chunk(
+        bins.data() + first, std::min(chunk_size, n_bins - first));
+      if (const auto compress_err = compress(chunk, buf))
+        return compress_err;
+      if (!out.write(reinterpret_cast<const char *>(buf.data()),
+                     std::size(buf)))
+        return bins_matrix_error::error_writing_matrix;
+      block_offsets.push_back(offset);
+      offset += std::size(buf);
+    }
+  }
+  block_offsets.push_back(offset);
+
+  std::vector<std::string> samples;
+  for (const auto &src : sources)
+    samples.push_back(src.accession);
+  if (!write_directory(out, samples, block_offsets))
+    return bins_matrix_error::error_writing_matrix;
+
+  std::ranges::copy(magic, hdr.magic);
+  hdr.index_hash = cim.index_hash;
+  hdr.bin_size = bin_size;
+  hdr.chunk_size = chunk_size;
+  hdr.n_bins = n_bins;
+  hdr.n_samples = std::size(sources);
+  hdr.directory_offset = offset;
+  out.seekp(0);
+  if (!out.write(reinterpret_cast<const char *>(&hdr), matrix_header_size) ||
+      !out.flush())
+    return bins_matrix_error::error_writing_matrix;
+
+  return bins_matrix_error::ok;
+}
+
+[[nodiscard]] auto
+bins_matrix::open(const std::string &filename)
+  -> std::tuple<bins_matrix, std::error_code> {
+  std::error_code ec;
+  const auto filesize = std::filesystem::file_size(filename, ec);
+  if (ec)
+    return {bins_matrix{}, ec};
+  if (filesize < matrix_header_size)
+    return {bins_matrix{}, bins_matrix_error::invalid_matrix_header};
+
+  bins_matrix matrix;
+  matrix.filename = filename;
+  matrix.fd = ::open(filename.data(), O_RDONLY, 0);
+  if (matrix.fd < 0)
+    return {bins_matrix{}, std::make_error_code(std::errc(errno))};
+
+  matrix_header hdr;
+  if (!pread_all(matrix.fd, &hdr, matrix_header_size, 0))
+    return {bins_matrix{}, bins_matrix_error::error_reading_matrix};
+  if (!std::ranges::equal(hdr.magic, magic) || hdr.bin_size == 0 ||
+      hdr.chunk_size == 0)
+    return {bins_matrix{}, bins_matrix_error::invalid_matrix_header};
+  matrix.index_hash = hdr.index_hash;
+  matrix.bin_size = hdr.bin_size;
+  matrix.chunk_size = hdr.chunk_size;
+  matrix.n_bins = hdr.n_bins;
+
+  if (const auto dir_err = read_directory(matrix.fd, hdr, filesize, matrix))
+    return {bins_matrix{}, dir_err};
+
+  return {std::move(matrix), bins_matrix_error::ok};
+}
+
+[[nodiscard]] auto
+bins_matrix::get_sample_indexes(const std::vector<std::string> &accessions)
+  const -> std::tuple<std::vector<std::uint32_t>, std::error_code> {
+  std::vector<std::uint32_t> indexes;
+  for (const auto &accession : accessions) {
+    const auto itr = std::ranges::find(samples, accession);
+    if (itr == std::cend(samples))
+      return {{}, bins_matrix_error::sample_not_in_matrix};
+    indexes.push_back(std::distance(std::cbegin(samples), itr));
+  }
+  return {std::move(indexes), bins_matrix_error::ok};
+}
+
+[[nodiscard]] auto
+bins_matrix::get_bin_range(const cpg_index_meta &cim,
+                           const genomic_interval &region) const
+  -> std::tuple<std::uint32_t, std::uint32_t> {
+  const auto chrom_offsets = get_chrom_bin_offsets(cim, bin_size);
+  const auto chrom_first = chrom_offsets[region.ch_id];
+  const auto stop = std::min(region.stop, cim.chrom_size[region.ch_id]);
+  if (region.start >= stop)
+    return {chrom_first, chrom_first};
+  return {chrom_first + region.start / bin_size,
+          static_cast<std::uint32_t>(
+            chrom_first + (std::uint64_t{stop} + bin_size - 1) / bin_size)};
+}
+
+[[nodiscard]] auto
+bins_matrix::read(const std::vector<std::uint32_t> &sample_indexes,
+                  const std::uint32_t first, const std::uint32_t last) const
+  -> std::tuple<std::vector<counts_res_cov>, std::error_code> {
+  if (first > last || last > n_bins)
+    return {{}, bins_matrix_error::invalid_bin_range};
+  const auto n_chunks = get_n_chunks();
+  const auto n = last - first;
+  std::vector<counts_res_cov> counts(std::size(sample_indexes) * n);
+  if (n == 0)
+    return {std::move(counts), bins_matrix_error::ok};
+
+  const auto first_chunk = first / chunk_size;
+  const auto last_chunk = (last - 1) / chunk_size;
+  std::vector<std::uint8_t> buf;
+  std::vector<counts_res_cov> chunk;
+  auto cursor = std::begin(counts);
+  for (const auto i : sample_indexes) {
+    if (i >= std::size(samples))
+      return {{}, bins_matrix_error::sample_not_in_matrix};
+    for (auto j = first_chunk; j <= last_chunk; ++j) {
+      const auto k = static_cast<std::uint64_t>(i) * n_chunks + j;
+      buf.resize(block_offsets[k + 1] - block_offsets[k]);
+      if (!pread_all(fd, buf.data(), std::size(buf), block_offsets[k]))
+        return {{}, bins_matrix_error::error_reading_matrix};
+      const auto chunk_first = j * chunk_size;
+      chunk.resize(std::min(chunk_size, n_bins - chunk_first));
+      if (const auto decompress_err = decompress(buf, chunk))
+        return {{}, decompress_err};
+      // ADS: only the part of the chunk inside [first, last)
+      const auto b = std::max(first, chunk_first) - chunk_first;
+      const auto e = std::min<std::uint32_t>(last - chunk_first,
+                                             std::size(chunk));
+      cursor = std::copy(std::cbegin(chunk) + b, std::cbegin(chunk) + e,
+                         cursor);
+    }
+  }
+  return {std::move(counts), bins_matrix_error::ok};
+}
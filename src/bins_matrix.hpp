@@ -0,0 +1,171 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_BINS_MATRIX_HPP_
+#define SRC_BINS_MATRIX_HPP_
+
+#include "methylome_results_types.hpp"  // for counts_res_cov
+
+#include <cstdint>  // for std::uint32_t, std::uint64_t
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>  // for std::true_type
+#include <utility>      // for std::to_underlying, std::unreachable
+#include <variant>      // for std::tuple
+#include <vector>
+
+enum class bins_matrix_error : std::uint32_t {
+  ok = 0,
+  error_reading_matrix = 1,
+  error_writing_matrix = 2,
+  invalid_matrix_header = 3,
+  invalid_matrix_directory = 4,
+  sample_not_in_matrix = 5,
+  duplicate_sample = 6,
+  inconsistent_index = 7,
+  invalid_chunk_size = 8,
+  invalid_bin_range = 9,
+};
+
+// register bins_matrix_error as error code enum
+template <>
+struct std::is_error_code_enum<bins_matrix_error> : public std::true_type {};
+
+// category to provide text descriptions
+struct bins_matrix_error_category : std::error_category {
+  auto
+  name() const noexcept -> const char * override {
+    return "bins_matrix_error";
+  }
+  auto
+  message(int code) const -> std::string override {
+    using std::string_literals::operator""s;
+    // clang-format off
+    switch (code) {
+    case 0: return "ok"s;
+    case 1: return "error reading bins matrix"s;
+    case 2: return "error writing bins matrix"s;
+    case 3: return "invalid bins matrix header"s;
+    case 4: return "invalid bins matrix directory"s;
+    case 5: return "sample not in bins matrix"s;
+    case 6: return "sample given more than once"s;
+    case 7: return "methylome or index inconsistent with bins matrix"s;
+    case 8: return "bin size and chunk size must be positive"s;
+    case 9: return "bins outside the bins matrix"s;
+    }
+    // clang-format on
+    std::unreachable();  // hopefully this is unreacheable
+  }
+};
+
+inline auto
+make_error_code(bins_matrix_error e) -> std::error_code {
+  static auto category = bins_matrix_error_category{};
+  return std::error_code(std::to_underlying(e), category);
+}
+
+struct cpg_index;
+struct cpg_index_meta;
+struct genomic_interval;
+
+/*
+  bins_matrix: counts in the bins of one size for many samples, all
+  with the same assembly, so values for a region across a cohort come
+  from one file instead of one bins request per sample. Bins are
+  numbered along the genome in the order of get_bins and split into
+  chunks of chunk_size bins. Each sample's counts for a chunk are
+  compressed separately and the directory at the end of the file has
+  the offset of every block, so a query reads only the blocks for its
+  chunks and samples. Blocks are written one sample after another,
+  which lets the builder hold only one methylome at a time.
+ */
+struct bins_matrix {
+  static constexpr auto filename_extension{".bmx"};
+  static constexpr char magic[8] = {'x', 'f', 'r', 'b', 'm', 'a', 't', '1'};
+  static constexpr std::uint32_t default_chunk_size{4096};
+
+  // one sample to put in a matrix
+  struct source {
+    std::string accession;
+    std::string methylome_file;
+    std::string metadata_file;
+  };
+
+  bins_matrix() = default;
+  bins_matrix(const bins_matrix &) = delete;
+  bins_matrix &
+  operator=(const bins_matrix &) = delete;
+  bins_matrix(bins_matrix &&other) noexcept;
+  bins_matrix &
+  operator=(bins_matrix &&other) noexcept;
+  ~bins_matrix();
+
+  // compute bins for each source and write them as a new matrix
+  [[nodiscard]] static auto
+  build(const std::string &filename, const cpg_index &index,
+        const cpg_index_meta &cim, const std::uint32_t bin_size,
+        const std::uint32_t chunk_size,
+        const std::vector<source> &sources) -> std::error_code;
+
+  // open a matrix and read its directory; the matrix stays open
+  [[nodiscard]] static auto
+  open(const std::string &filename)
+    -> std::tuple<bins_matrix, std::error_code>;
+
+  [[nodiscard]] auto
+  get_n_chunks() const -> std::uint32_t {
+    return (n_bins + chunk_size - 1) / chunk_size;
+  }
+
+  // position of each accession in samples
+  [[nodiscard]] auto
+  get_sample_indexes(const std::vector<std::string> &accessions) const
+    -> std::tuple<std::vector<std::uint32_t>, std::error_code>;
+
+  // bins [first, last) that overlap a region; the index must be the
+  // one used to build the matrix
+  [[nodiscard]] auto
+  get_bin_range(const cpg_index_meta &cim, const genomic_interval &region)
+    const -> std::tuple<std::uint32_t, std::uint32_t>;
+
+  // counts for bins [first, last) of each sample given by index, one
+  // sample after another
+  [[nodiscard]] auto
+  read(const std::vector<std::uint32_t> &sample_indexes,
+       const std::uint32_t first, const std::uint32_t last) const
+    -> std::tuple<std::vector<counts_res_cov>, std::error_code>;
+
+  std::string filename;
+  int fd{-1};
+  std::uint64_t index_hash{};
+  std::uint32_t bin_size{};
+  std::uint32_t chunk_size{};
+  std::uint32_t n_bins{};
+  std::vector<std::string> samples;
+  // ADS: block for sample i and chunk j is [block_offsets[k],
+  // block_offsets[k + 1]) with k = i * n_chunks + j
+  std::vector<std::uint64_t> block_offsets;
+};
+
+#endif  // SRC_BINS_MATRIX_HPP_
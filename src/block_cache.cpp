@@ -0,0 +1,281 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "block_cache.hpp"
+
+#include "methylome.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>  // for std::size_t
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>  // for std::plus, std::bit_or
+#include <iterator>  // for std::size, std::distance
+#include <numeric>   // for std::transform_reduce
+#include <span>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <utility>  // for std::move
+#include <vector>
+
+#include <fcntl.h>     // for ::open, O_RDWR
+#include <sys/file.h>  // for flock, LOCK_EX
+#include <unistd.h>    // for close, getpid
+
+[[nodiscard]] static inline auto
+get_n_blocks(const std::uint32_t n_cpgs) -> std::uint32_t {
+  return (n_cpgs + block_cache::block_size - 1) / block_cache::block_size;
+}
+
+// ADS: one byte per block, 1 for each block overlapping the offsets
+[[nodiscard]] static auto
+get_needed_blocks(const std::uint32_t n_cpgs,
+                  const std::vector<methylome::offset_pair> &offsets)
+  -> std::vector<std::uint8_t> {
+  std::vector<std::uint8_t> needed(get_n_blocks(n_cpgs));
+  for (const auto [first, last] : offsets)
+    if (first < last && last <= n_cpgs)
+      std::fill(std::begin(needed) + first / block_cache::block_size,
+                std::begin(needed) + (last - 1) / block_cache::block_size + 1,
+                1);
+  return needed;
+}
+
+// ADS: consecutive blocks that satisfy 'pred' become one range of cpgs
+template <typename P>
+[[nodiscard]] static auto
+get_block_ranges(const std::uint32_t n_cpgs, const std::uint32_t n_blocks,
+                 P pred) -> std::vector<methylome::offset_pair> {
+  std::vector<methylome::offset_pair> ranges;
+  for (std::uint32_t i = 0; i < n_blocks;) {
+    if (!pred(i)) {
+      ++i;
+      continue;
+    }
+    const auto first = i;
+    while (i < n_blocks && pred(i))
+      ++i;
+    ranges.emplace_back(first * block_cache::block_size,
+                        std::min(i * block_cache::block_size, n_cpgs));
+  }
+  return ranges;
+}
+
+[[nodiscard]] auto
+block_cache::open(const std::string &directory,
+                  const std::uint64_t methylome_hash,
+                  const std::uint32_t n_cpgs)
+  -> std::tuple<block_cache, std::error_code> {
+  std::error_code ec;
+  std::filesystem::create_directories(directory, ec);
+  if (ec)
+    return {{}, ec};
+
+  block_cache bc;
+  bc.n_cpgs = n_cpgs;
+  const auto base = std::format("{}/{:016x}", directory, methylome_hash);
+  bc.data_filename = base + data_extension;
+  bc.blocks_filename = base + blocks_extension;
+  bc.has_block.resize(get_n_blocks(n_cpgs));
+
+  const std::uint64_t data_size =
+    static_cast<std::uint64_t>(n_cpgs) * methylome::record_size;
+  if (!std::filesystem::exists(bc.data_filename, ec)) {
+    if (ec)
+      return {{}, ec};
+    // ADS: the file gets the size of the methylome but only blocks
+    // that are written take space; appending does not truncate a file
+    // another process created after the check above
+    if (!std::ofstream(bc.data_filename, std::ios::binary | std::ios::app))
+      return {{}, std::make_error_code(std::errc(errno))};
+    std::filesystem::resize_file(bc.data_filename, data_size, ec);
+    if (ec)
+      return {{}, ec};
+    return {std::move(bc), {}};
+  }
+
+  const auto filesize = std::filesystem::file_size(bc.data_filename, ec);
+  if (ec)
+    return {{}, ec};
+  if (filesize != data_size)
+    return {{}, block_cache_error::inconsistent_cache_size};
+
+  // ADS: without the blocks file nothing is known to be cached
+  std::ifstream in(bc.blocks_filename, std::ios::binary);
+  if (!in)
+    return {std::move(bc), {}};
+  std::vector<std::uint8_t> has_block(std::size(bc.has_block));
+  if (!in.read(reinterpret_cast<char *>(has_block.data()),
+               std::size(has_block)) ||
+      in.peek() != std::ifstream::traits_type::eof())
+    return {{}, block_cache_error::inconsistent_cache_size};
+  bc.has_block = std::move(has_block);
+  return {std::move(bc), {}};
+}
+
+[[nodiscard]] auto
+block_cache::get_missing(
+  const std::vector<methylome::offset_pair> &offsets) const
+  -> std::vector<methylome::offset_pair> {
+  const auto needed = get_needed_blocks(n_cpgs, offsets);
+  return get_block_ranges(n_cpgs, std::size(has_block), [&](const auto i) {
+    return needed[i] && !has_block[i];
+  });
+}
+
+[[nodiscard]] auto
+block_cache::add(const std::vector<methylome::offset_pair> &ranges,
+                 std::span<const methylome::m_elem> cpgs) -> std::error_code {
+  const auto n_sites = std::transform_reduce(
+    std::cbegin(ranges), std::cend(ranges), std::uint64_t{}, std::plus{},
+    [](const auto &r) { return r.second - r.first; });
+  if (n_sites != std::size(cpgs))
+    return block_cache_error::inconsistent_counts;
+
+  // ADS: other processes may add to the same cache; the lock is held
+  // on the data file, which is never replaced, until the blocks file
+  // has been updated
+  const auto lock_fd = ::open(data_filename.data(), O_RDWR, 0);
+  if (lock_fd < 0)
+    return std::make_error_code(std::errc(errno));
+  const auto add_err = add_locked(lock_fd, ranges, cpgs);
+  ::close(lock_fd);  // releases the lock
+  return add_err;
+}
+
+[[nodiscard]] auto
+block_cache::add_locked(const int lock_fd,
+                        const std::vector<methylome::offset_pair> &ranges,
+                        std::span<const methylome::m_elem> cpgs)
+  -> std::error_code {
+  if (::flock(lock_fd, LOCK_EX) != 0)
+    return std::make_error_code(std::errc(errno));
+
+  std::fstream out(data_filename,
+                   std::ios::in | std::ios::out | std::ios::binary);
+  if (!out)
+    return std::make_error_code(std::errc(errno));
+  auto cpgs_itr = std::cbegin(cpgs);
+  for (const auto [first, last] : ranges) {
+    if (first % block_size != 0 || last > n_cpgs ||
+        (last % block_size != 0 && last != n_cpgs))
+      return block_cache_error::inconsistent_counts;
+    const auto n = last - first;
+    out.seekp(static_cast<std::streamoff>(first) * methylome::record_size);
+    if (!out.write(reinterpret_cast<const char *>(&*cpgs_itr),
+                   static_cast<std::streamsize>(n) * methylome::record_size))
+      return block_cache_error::error_writing_cache;
+    cpgs_itr += n;
+  }
+  if (!out.flush())
+    return block_cache_error::error_writing_cache;
+
+  // ADS: blocks are marked only after their counts are written, and
+  // blocks other processes cached since this one opened are kept
+  std::vector<std::uint8_t> on_disk(std::size(has_block));
+  if (std::ifstream in(blocks_filename, std::ios::binary);
+      in && in.read(reinterpret_cast<char *>(on_disk.data()),
+                    std::size(on_disk)))
+    std::ranges::transform(has_block, on_disk, std::begin(has_block),
+                           std::bit_or{});
+  for (const auto [first, last] : ranges)
+    std::fill(std::begin(has_block) + first / block_size,
+              std::begin(has_block) + get_n_blocks(last), 1);
+
+  // ADS: written to a temporary file and renamed, so a process that
+  // opens the cache never reads a partly written blocks file
+  const auto tmp_filename =
+    std::format("{}.{}.tmp", blocks_filename, ::getpid());
+  std::error_code write_err;
+  {
+    std::ofstream blocks_out(tmp_filename, std::ios::binary);
+    if (!blocks_out.write(reinterpret_cast<const char *>(has_block.data()),
+                          std::size(has_block)))
+      write_err = block_cache_error::error_writing_cache;
+  }
+  if (!write_err)
+    std::filesystem::rename(tmp_filename, blocks_filename, write_err);
+  if (write_err) {
+    std::error_code ec;
+    std::filesystem::remove(tmp_filename, ec);
+    return write_err;
+  }
+  return {};
+}
+
+[[nodiscard]] auto
+block_cache::load(const std::vector<methylome::offset_pair> &offsets) const
+  -> std::tuple<methylome, std::vector<methylome::offset_pair>,
+                std::error_code> {
+  const auto needed = get_needed_blocks(n_cpgs, offsets);
+  const auto ranges = get_block_ranges(
+    n_cpgs, std::size(has_block), [&](const auto i) { return needed[i]; });
+
+  // ADS: only the blocks covering the offsets are read, one after
+  // the other, so memory follows the query and not the methylome
+  std::vector<std::uint32_t> starts(std::size(ranges));
+  std::uint32_t n_sites{};
+  for (std::size_t i = 0; i < std::size(ranges); ++i) {
+    starts[i] = n_sites;
+    n_sites += ranges[i].second - ranges[i].first;
+  }
+
+  methylome meth;
+  meth.cpgs.resize(n_sites);
+  std::ifstream in(data_filename, std::ios::binary);
+  if (!in)
+    return {{}, {}, std::make_error_code(std::errc(errno))};
+  for (std::size_t i = 0; i < std::size(ranges); ++i) {
+    const auto [first, last] = ranges[i];
+    if (!std::all_of(std::cbegin(has_block) + first / block_size,
+                     std::cbegin(has_block) + get_n_blocks(last),
+                     [](const auto x) { return x != 0; }))
+      return {{}, {}, block_cache_error::block_not_cached};
+    in.seekg(static_cast<std::streamoff>(first) * methylome::record_size);
+    if (!in.read(reinterpret_cast<char *>(meth.cpgs.data() + starts[i]),
+                 static_cast<std::streamsize>(last - first) *
+                   methylome::record_size))
+      return {{}, {}, block_cache_error::error_reading_cache};
+  }
+
+  // ADS: every offset is inside one range, because the blocks it
+  // overlaps are consecutive and needed; offsets that cover no cpgs
+  // stay empty
+  std::vector<methylome::offset_pair> local_offsets(std::size(offsets));
+  std::ranges::transform(
+    offsets, std::begin(local_offsets), [&](const auto &o) {
+      const auto [first, last] = o;
+      if (first >= last || last > n_cpgs)
+        return methylome::offset_pair{};
+      const auto r = std::ranges::upper_bound(ranges, first, {},
+                                              &methylome::offset_pair::first);
+      const auto i = std::distance(std::cbegin(ranges), r) - 1;
+      const auto shift = starts[i] - ranges[i].first;
+      return methylome::offset_pair{first + shift, last + shift};
+    });
+  return {std::move(meth), std::move(local_offsets), {}};
+}
@@ -0,0 +1,126 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_BLOCK_CACHE_HPP_
+#define SRC_BLOCK_CACHE_HPP_
+
+#include "methylome.hpp"
+
+#include <cstdint>  // for std::uint32_t, std::uint64_t
+#include <span>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>  // for std::true_type
+#include <utility>      // for std::to_underlying, std::unreachable
+#include <vector>
+
+enum class block_cache_error : std::uint32_t {
+  ok = 0,
+  error_reading_cache = 1,
+  error_writing_cache = 2,
+  inconsistent_cache_size = 3,
+  inconsistent_counts = 4,
+  block_not_cached = 5,
+};
+
+// register block_cache_error as error code enum
+template <>
+struct std::is_error_code_enum<block_cache_error> : public std::true_type {};
+
+// category to provide text descriptions
+struct block_cache_error_category : std::error_category {
+  auto
+  name() const noexcept -> const char * override {
+    return "block_cache_error";
+  }
+  auto
+  message(int code) const -> std::string override {
+    using std::string_literals::operator""s;
+    // clang-format off
+    switch (code) {
+    case 0: return "ok"s;
+    case 1: return "error reading block cache"s;
+    case 2: return "error writing block cache"s;
+    case 3: return "block cache size inconsistent with methylome"s;
+    case 4: return "counts inconsistent with requested blocks"s;
+    case 5: return "block not in cache"s;
+    }
+    // clang-format on
+    std::unreachable();  // hopefully this is unreacheable
+  }
+};
+
+inline auto
+make_error_code(block_cache_error e) -> std::error_code {
+  static auto category = block_cache_error_category{};
+  return std::error_code(std::to_underlying(e), category);
+}
+
+/*
+  block_cache: blocks of a remote methylome kept in local files, so
+  counts for regions fetched before need no request to the server.
+  Each methylome is one sparse file of its full size named by its
+  methylome_hash, so a methylome that changes on the server is never
+  confused with the old one, and a second file has one byte for each
+  block that is 1 once the block is cached.
+ */
+struct block_cache {
+  static constexpr auto data_extension{".m16"};
+  static constexpr auto blocks_extension{".blocks"};
+  static constexpr std::uint32_t block_size{methylome::default_block_size};
+
+  [[nodiscard]] static auto
+  open(const std::string &directory, const std::uint64_t methylome_hash,
+       const std::uint32_t n_cpgs) -> std::tuple<block_cache, std::error_code>;
+
+  // ranges of whole blocks, covering the offsets, that are not cached
+  [[nodiscard]] auto
+  get_missing(const std::vector<methylome::offset_pair> &offsets) const
+    -> std::vector<methylome::offset_pair>;
+
+  // store counts for the ranges given by get_missing, in the same order
+  [[nodiscard]] auto
+  add(const std::vector<methylome::offset_pair> &ranges,
+      std::span<const methylome::m_elem> cpgs) -> std::error_code;
+
+  // a methylome of only the blocks covering the offsets, read from
+  // the cache, and the offsets moved to index that methylome
+  [[nodiscard]] auto
+  load(const std::vector<methylome::offset_pair> &offsets) const
+    -> std::tuple<methylome, std::vector<methylome::offset_pair>,
+                  std::error_code>;
+
+  std::string data_filename;
+  std::string blocks_filename;
+  std::uint32_t n_cpgs{};
+  std::vector<std::uint8_t> has_block;  // 1 if the block is cached
+
+private:
+  [[nodiscard]] auto
+  add_locked(const int lock_fd,
+             const std::vector<methylome::offset_pair> &ranges,
+             std::span<const methylome::m_elem> cpgs) -> std::error_code;
+};
+
+#endif  // SRC_BLOCK_CACHE_HPP_
@@ -185,6 +185,26 @@ client<counts_type, req_type>::handle_connect(const std::error_code err) {
             },
             [this](auto error, auto) { this->handle_write_request(error); });
         }
+        else if constexpr (std::is_same<req_type, bins_request>::value ||
+                           std::is_same<req_type, windows_request>::value) {
+          boost::asio::async_write(
+            socket,
+            std::vector<boost::asio::const_buffer>{
+              boost::asio::buffer(req_hdr_buf),
+              boost::asio::buffer(req.regions),
+            },
+            [this](auto error, auto) { this->handle_write_request(error); });
+        }
+        else if constexpr (std::is_same<req_type, profile_request>::value) {
+          // ADS: no anchors if they are a named set on the server
+          boost::asio::async_write(
+            socket,
+            std::vector<boost::asio::const_buffer>{
+              boost::asio::buffer(req_hdr_buf),
+              boost::asio::buffer(req.anchors),
+            },
+            [this](auto error, auto) { this->handle_write_request(error); });
+        }
         else {
           boost::asio::async_write(
             socket, boost::asio::buffer(req_hdr_buf),
@@ -0,0 +1,115 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "client_limits.hpp"
+
+#include "logger.hpp"
+
+#include <algorithm>  // for std::max
+#include <cstdint>
+#include <iterator>  // for std::begin, std::size
+#include <mutex>
+#include <string>
+
+// ADS: a burst smaller than one request, or than one second of bytes,
+// would refuse clients that are within their rate
+[[nodiscard]] static inline auto
+request_capacity(const client_limits_config &config) -> double {
+  return std::max<double>(config.request_burst, 1.0);
+}
+
+[[nodiscard]] static inline auto
+byte_capacity(const client_limits_config &config) -> double {
+  return std::max(config.byte_burst, config.bytes_per_second);
+}
+
+auto
+client_limits::erase_idle(const clock::time_point now) -> void {
+  const auto req_cap = request_capacity(config);
+  const auto byte_cap = byte_capacity(config);
+  for (auto itr = std::begin(clients); itr != std::end(clients);) {
+    auto &state = itr->second;
+    state.requests.refill(config.requests_per_second, req_cap, now);
+    state.bytes.refill(config.bytes_per_second, byte_cap, now);
+    if (state.requests.tokens >= req_cap && state.bytes.tokens >= byte_cap)
+      itr = clients.erase(itr);
+    else
+      ++itr;
+  }
+}
+
+[[nodiscard]] auto
+client_limits::get_client(const std::string &client,
+                          const clock::time_point now) -> client_state & {
+  if (std::size(clients) >= max_clients_tracked && !clients.contains(client))
+    erase_idle(now);
+  const auto [itr, inserted] = clients.try_emplace(client);
+  auto &state = itr->second;
+  if (inserted) {
+    // a new client starts with full buckets
+    state.requests = {request_capacity(config), now};
+    state.bytes = {byte_capacity(config), now};
+    return state;
+  }
+  state.requests.refill(config.requests_per_second, request_capacity(config),
+                        now);
+  state.bytes.refill(config.bytes_per_second, byte_capacity(config), now);
+  return state;
+}
+
+[[nodiscard]] auto
+client_limits::admit(const std::string &client) -> bool {
+  std::scoped_lock lock{mtx};
+  auto &state = get_client(client, clock::now());
+  const bool requests_ok =
+    config.requests_per_second == 0 || state.requests.tokens >= 1.0;
+  const bool bytes_ok = config.bytes_per_second == 0 || state.bytes.tokens > 0;
+  if (!requests_ok || !bytes_ok) {
+    ++state.counters.n_refused;
+    return false;
+  }
+  if (config.requests_per_second > 0)
+    state.requests.tokens -= 1.0;
+  ++state.counters.n_requests;
+  return true;
+}
+
+auto
+client_limits::charge_bytes(const std::string &client,
+                            const std::uint64_t n_bytes) -> void {
+  std::scoped_lock lock{mtx};
+  auto &state = get_client(client, clock::now());
+  if (config.bytes_per_second > 0)
+    state.bytes.tokens -= static_cast<double>(n_bytes);
+  state.counters.n_bytes += n_bytes;
+}
+
+auto
+client_limits::log_counters() -> void {
+  auto &lgr = logger::instance();
+  std::scoped_lock lock{mtx};
+  for (const auto &[client, state] : clients)
+    lgr.info("Client {}: requests={} refused={} bytes={}", client,
+             state.counters.n_requests, state.counters.n_refused,
+             state.counters.n_bytes);
+}
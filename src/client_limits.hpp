@@ -0,0 +1,122 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_CLIENT_LIMITS_HPP_
+#define SRC_CLIENT_LIMITS_HPP_
+
+#include <algorithm>  // for std::min
+#include <chrono>
+#include <cstddef>  // for std::size_t
+#include <cstdint>  // for std::uint32_t, std::uint64_t
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct client_limits_config {
+  std::uint32_t requests_per_second{};  // 0: no limit
+  std::uint32_t request_burst{};
+  std::uint64_t bytes_per_second{};  // 0: no limit
+  std::uint64_t byte_burst{};
+  std::uint32_t stats_seconds{};  // 0: counters are not logged
+};
+
+/*
+  token_bucket: holds up to 'capacity' tokens, refilled at 'rate'
+  tokens per second. Tokens can be taken beyond what is held, so a
+  large response puts the bucket in debt and later requests wait until
+  it is paid back.
+ */
+struct token_bucket {
+  typedef std::chrono::steady_clock clock;
+
+  auto
+  refill(const double rate, const double capacity,
+         const clock::time_point now) -> void {
+    const std::chrono::duration<double> elapsed = now - last;
+    tokens = std::min(capacity, tokens + elapsed.count() * rate);
+    last = now;
+  }
+
+  double tokens{};
+  clock::time_point last{};
+};
+
+struct client_counters {
+  std::uint64_t n_requests{};  // admitted
+  std::uint64_t n_refused{};
+  std::uint64_t n_bytes{};  // sent in responses
+};
+
+// per-client token buckets for requests and bytes, along with counts
+// of what each client has done; clients are identified by address. A
+// client whose buckets have refilled is no different from a new one,
+// except for its counters, so such clients are forgotten once many
+// are tracked.
+struct client_limits {
+  typedef token_bucket::clock clock;
+  static constexpr std::size_t max_clients_tracked = 1024;
+
+  client_limits(const client_limits &) = delete;
+  client_limits &
+  operator=(const client_limits &) = delete;
+
+  explicit client_limits(const client_limits_config &config) :
+    config{config} {}
+
+  // take a request token if the client has one and is not in debt
+  // for bytes; returns false if the request should be refused. ADS: a
+  // refused request gets its error response right away instead of
+  // being delayed until a token is available: a delay would hold the
+  // connection and its buffers for a client already over its limit,
+  // and the too_many_requests response lets the client back off
+  [[nodiscard]] auto
+  admit(const std::string &client) -> bool;
+
+  // charge the client for bytes sent
+  auto
+  charge_bytes(const std::string &client, const std::uint64_t n_bytes) -> void;
+
+  // log the counters for each client still tracked
+  auto
+  log_counters() -> void;
+
+  struct client_state {
+    token_bucket requests;
+    token_bucket bytes;
+    client_counters counters;
+  };
+
+  [[nodiscard]] auto
+  get_client(const std::string &client,
+             const clock::time_point now) -> client_state &;
+
+  // forget clients whose buckets are full
+  auto
+  erase_idle(const clock::time_point now) -> void;
+
+  client_limits_config config;
+  std::unordered_map<std::string, client_state> clients;
+  std::mutex mtx;
+};
+
+#endif  // SRC_CLIENT_LIMITS_HPP_
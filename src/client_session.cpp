@@ -0,0 +1,67 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "client_session.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/system.hpp>  // for boost::system::error_code
+
+#include <string>
+#include <system_error>
+
+namespace xfrase {
+
+auto
+client_session::connect() -> std::error_code {
+  boost::asio::ip::tcp::resolver resolver(ioc);
+  boost::system::error_code resolve_ec;
+  const auto endpoints = resolver.resolve(hostname, port, resolve_ec);
+  if (resolve_ec) {
+    lgr.debug("Error resolving server: {}", resolve_ec);
+    return resolve_ec;
+  }
+  if (const auto connect_err = run_with_timeout([&](auto token) {
+        boost::asio::async_connect(socket, endpoints, token);
+      })) {
+    lgr.debug("Error connecting: {}", connect_err);
+    close();
+    return connect_err;
+  }
+  ++n_connects;
+  lgr.debug("Connected to server: {}",
+            boost::lexical_cast<std::string>(socket.remote_endpoint()));
+  return {};
+}
+
+auto
+client_session::close() -> void {
+  if (!socket.is_open())
+    return;
+  boost::system::error_code shutdown_ec;  // for non-throwing
+  socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, shutdown_ec);
+  boost::system::error_code socket_close_ec;  // for non-throwing
+  socket.close(socket_close_ec);
+}
+
+}  // namespace xfrase
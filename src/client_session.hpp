@@ -0,0 +1,217 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_CLIENT_SESSION_HPP_
+#define SRC_CLIENT_SESSION_HPP_
+
+#include "logger.hpp"
+#include "request.hpp"
+#include "response.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/system.hpp>  // for boost::system::error_code
+
+#include <chrono>
+#include <cstddef>  // for std::size_t
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>  // for std::is_same
+#include <utility>      // for std::move
+#include <vector>
+
+namespace xfrase {
+/*
+  client_session: one connection to a server that is kept open for
+  many queries, one at a time. The server keeps a connection alive
+  after each response, so queries after the first skip the resolve
+  and connect. A connection the server closed while idle is replaced
+  once, transparently, because queries are only lookups.
+ */
+class client_session {
+public:
+  client_session(const client_session &) = delete;
+  client_session &
+  operator=(const client_session &) = delete;
+
+  client_session(const std::string &hostname, const std::string &port) :
+    hostname{hostname}, port{port}, socket{ioc}, lgr{logger::instance()} {}
+
+  ~client_session() { close(); }
+
+  template <typename counts_type, typename req_type>
+  [[nodiscard]] auto
+  query(const request_header &hdr, const req_type &req)
+    -> std::tuple<std::vector<counts_type>, std::error_code>;
+
+  auto
+  close() -> void;
+
+  [[nodiscard]] auto
+  get_n_connects() const -> std::uint32_t {
+    return n_connects;
+  }
+
+private:
+  [[nodiscard]] auto
+  connect() -> std::error_code;
+
+  // run the io_context until the operation started by 'start'
+  // completes, closing the socket if that takes too long
+  template <typename start_op>
+  [[nodiscard]] auto
+  run_with_timeout(start_op &&start) -> std::error_code;
+
+  template <typename counts_type, typename req_type>
+  [[nodiscard]] auto
+  transact(const request_header_buffer &req_hdr_buf, const req_type &req)
+    -> std::tuple<std::vector<counts_type>, std::error_code>;
+
+  std::string hostname;
+  std::string port;
+  boost::asio::io_context ioc;
+  boost::asio::ip::tcp::socket socket;
+  logger &lgr;
+  std::chrono::seconds read_timeout_seconds{10};
+  std::uint32_t n_connects{};
+};
+
+template <typename start_op>
+auto
+client_session::run_with_timeout(start_op &&start) -> std::error_code {
+  boost::system::error_code result = boost::asio::error::would_block;
+  start([&result](const boost::system::error_code ec, auto &&) {
+    result = ec;
+  });
+  ioc.restart();
+  ioc.run_for(read_timeout_seconds);
+  if (!ioc.stopped()) {
+    // ADS: timed out; closing cancels the operation, and running
+    // again lets its handler finish before 'result' goes away
+    close();
+    ioc.restart();
+    ioc.run();
+    return std::make_error_code(std::errc::timed_out);
+  }
+  return result;
+}
+
+template <typename counts_type, typename req_type>
+auto
+client_session::transact(const request_header_buffer &req_hdr_buf,
+                         const req_type &req)
+  -> std::tuple<std::vector<counts_type>, std::error_code> {
+  if (!socket.is_open())
+    if (const auto connect_err = connect())
+      return {{}, connect_err};
+
+  std::vector<boost::asio::const_buffer> bufs{
+    boost::asio::buffer(req_hdr_buf),
+  };
+  if constexpr (std::is_same<req_type, request>::value)
+    bufs.emplace_back(boost::asio::buffer(req.offsets));
+  else if constexpr (std::is_same<req_type, bins_request>::value ||
+                     std::is_same<req_type, windows_request>::value)
+    bufs.emplace_back(boost::asio::buffer(req.regions));
+  else if constexpr (std::is_same<req_type, profile_request>::value)
+    bufs.emplace_back(boost::asio::buffer(req.anchors));
+
+  if (const auto write_err = run_with_timeout([&](auto token) {
+        boost::asio::async_write(socket, bufs, token);
+      })) {
+    lgr.debug("Error writing request: {}", write_err);
+    return {{}, write_err};
+  }
+
+  response_header_buffer resp_hdr_buf{};
+  if (const auto read_err = run_with_timeout([&](auto token) {
+        boost::asio::async_read(socket, boost::asio::buffer(resp_hdr_buf),
+                                token);
+      })) {
+    lgr.debug("Error reading response header: {}", read_err);
+    return {{}, read_err};
+  }
+
+  response_header resp_hdr;
+  if (const auto resp_hdr_parse = parse(resp_hdr_buf, resp_hdr);
+      resp_hdr_parse.error) {
+    lgr.debug("Error: {}", resp_hdr_parse.error);
+    return {{}, resp_hdr_parse.error};
+  }
+  lgr.debug("Response header: {}", resp_hdr.summary());
+  if (resp_hdr.status)
+    return {{}, resp_hdr.status};
+
+  std::vector<counts_type> counts(resp_hdr.response_size);
+  if (const auto read_err = run_with_timeout([&](auto token) {
+        boost::asio::async_read(socket, boost::asio::buffer(counts), token);
+      })) {
+    lgr.error("Error reading counts: {}", read_err);
+    return {{}, read_err};
+  }
+  return {std::move(counts), {}};
+}
+
+[[nodiscard]] inline auto
+is_stale_connection(const std::error_code err) -> bool {
+  return err == boost::asio::error::eof ||
+         err == boost::asio::error::connection_reset ||
+         err == boost::asio::error::broken_pipe;
+}
+
+template <typename counts_type, typename req_type>
+auto
+client_session::query(const request_header &hdr, const req_type &req)
+  -> std::tuple<std::vector<counts_type>, std::error_code> {
+  request_header_buffer req_hdr_buf{};
+  const auto req_hdr_compose = compose(req_hdr_buf, hdr);
+  if (req_hdr_compose.error) {
+    lgr.debug("Error forming request header: {}", req_hdr_compose.error);
+    return {{}, req_hdr_compose.error};
+  }
+  const auto req_body_compose = compose(
+    req_hdr_compose.ptr, req_hdr_buf.data() + request_header_buf_size, req);
+  if (req_body_compose.error) {
+    lgr.debug("Error forming request body: {}", req_body_compose.error);
+    return {{}, req_body_compose.error};
+  }
+
+  const bool reused = socket.is_open();
+  auto result = transact<counts_type>(req_hdr_buf, req);
+  // ADS: the server may have closed this connection since the last
+  // query, which looks like a failure to send or an early end of
+  // stream; a new connection is enough to recover
+  if (reused && is_stale_connection(std::get<1>(result))) {
+    lgr.debug("Reconnecting: {}", std::get<1>(result));
+    close();
+    result = transact<counts_type>(req_hdr_buf, req);
+  }
+  // ADS: the server closes connections after an error response
+  if (std::get<1>(result))
+    close();
+  return result;
+}
+}  // namespace xfrase
+
+#endif  // SRC_CLIENT_SESSION_HPP_
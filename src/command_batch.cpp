@@ -0,0 +1,588 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "command_batch.hpp"
+
+static constexpr auto about = R"(
+run many intervals and bins queries in one process
+)";
+
+static constexpr auto description = R"(
+The batch command reads a stream of queries, one per line, and writes
+the result of each query to the output file it names. Indexes,
+intervals with their offsets, and the connection to the server are
+kept across queries, so a pipeline that issues many queries pays for
+each of these once. Each query is either a JSON object or a line of
+tab-separated fields:
+
+  intervals  <methylome>  <intervals-file>  <output>  [covered,score]
+  bins       <methylome>  <bin-size>        <output>  [covered,score]
+
+In remote mode the methylome is an accession on the server, and in
+local mode it is a methylome file. JSON queries use the keys type,
+methylome, intervals, bin_size, output, covered, score and index; the
+index, if given, replaces the one on the command line for that query.
+Empty lines and lines starting with '#' are skipped. An output of '-'
+is standard output. A query that fails is logged and the rest of the
+queries still run.
+)";
+
+static constexpr auto examples = R"(
+Examples:
+
+xfrase batch remote -x hg38.cpg_idx -s example.com -i queries.tsv
+cat queries.jsonl | xfrase batch local -x hg38.cpg_idx
+)";
+
+#include "client_session.hpp"
+#include "cpg_index.hpp"
+#include "cpg_index_meta.hpp"
+#include "genomic_interval.hpp"
+#include "genomic_interval_output.hpp"
+#include "logger.hpp"
+#include "methylome.hpp"
+#include "methylome_metadata.hpp"
+#include "methylome_results_types.hpp"
+#include "request.hpp"
+#include "utilities.hpp"
+
+#include <boost/json.hpp>
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>  // for std::from_chars
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>  // for EXIT_FAILURE, EXIT_SUCCESS
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>  // for std::size
+#include <memory>    // for std::unique_ptr
+#include <print>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <type_traits>  // for std::is_same
+#include <unordered_map>
+#include <utility>  // for std::move
+#include <vector>
+
+enum class batch_query_type : std::uint8_t {
+  intervals,
+  bins,
+};
+
+struct batch_query {
+  batch_query_type type{};
+  std::string methylome;  // accession (remote) or methylome file (local)
+  std::string intervals;  // intervals file for an intervals query
+  std::uint32_t bin_size{};
+  std::string output;
+  std::string index;
+  bool covered{};
+  bool score{};
+};
+
+[[nodiscard]] static inline auto
+trim_query_line(const std::string_view s) -> std::string_view {
+  static constexpr auto whitespace = " \t\r\n";
+  const auto first = s.find_first_not_of(whitespace);
+  if (first == std::string_view::npos)
+    return {};
+  const auto last = s.find_last_not_of(whitespace);
+  return s.substr(first, last - first + 1);
+}
+
+[[nodiscard]] static inline auto
+parse_query_type(const std::string_view s, batch_query_type &type) -> bool {
+  if (s == "intervals")
+    type = batch_query_type::intervals;
+  else if (s == "bins")
+    type = batch_query_type::bins;
+  else
+    return false;
+  return true;
+}
+
+[[nodiscard]] static inline auto
+parse_bin_size(const std::string_view s, std::uint32_t &bin_size) -> bool {
+  const auto s_end = s.data() + size(s);
+  const auto [ptr, ec] = std::from_chars(s.data(), s_end, bin_size);
+  return ec == std::errc{} && ptr == s_end && bin_size > 0;
+}
+
+[[nodiscard]] static auto
+parse_tsv_query(const std::string_view line)
+  -> std::tuple<batch_query, std::string> {
+  std::vector<std::string_view> fields;
+  for (const auto f : line | std::views::split('\t'))
+    fields.emplace_back(std::cbegin(f), std::cend(f));
+  if (size(fields) < 4 || size(fields) > 5)
+    return {{}, "expected 4 or 5 tab-separated fields"};
+
+  batch_query q;
+  if (!parse_query_type(fields[0], q.type))
+    return {{}, std::format("unknown query type: {}", fields[0])};
+  q.methylome = fields[1];
+  if (q.type == batch_query_type::intervals)
+    q.intervals = fields[2];
+  else if (!parse_bin_size(fields[2], q.bin_size))
+    return {{}, std::format("invalid bin size: {}", fields[2])};
+  q.output = fields[3];
+  if (size(fields) == 5)
+    for (const auto f : fields[4] | std::views::split(',')) {
+      const std::string_view flag(std::cbegin(f), std::cend(f));
+      if (flag == "covered")
+        q.covered = true;
+      else if (flag == "score")
+        q.score = true;
+      else if (!flag.empty())
+        return {{}, std::format("unknown flag: {}", flag)};
+    }
+  return {std::move(q), {}};
+}
+
+[[nodiscard]] static auto
+parse_json_query(const std::string_view line)
+  -> std::tuple<batch_query, std::string> {
+  boost::system::error_code ec;
+  const auto value = boost::json::parse(line, ec);
+  if (ec || !value.is_object())
+    return {{}, "not a JSON object"};
+  const auto &obj = value.as_object();
+
+  const auto get_string = [&obj](const std::string_view key) {
+    const auto v = obj.if_contains(key);
+    return v && v->is_string() ? std::string(v->as_string()) : std::string{};
+  };
+  const auto get_bool = [&obj](const std::string_view key) {
+    const auto v = obj.if_contains(key);
+    return v && v->is_bool() && v->as_bool();
+  };
+
+  batch_query q;
+  const auto type = get_string("type");
+  if (!parse_query_type(type, q.type))
+    return {{}, std::format("unknown query type: {}", type)};
+  q.methylome = get_string("methylome");
+  q.intervals = get_string("intervals");
+  q.output = get_string("output");
+  q.index = get_string("index");
+  q.covered = get_bool("covered");
+  q.score = get_bool("score");
+  if (q.type == batch_query_type::bins) {
+    const auto v = obj.if_contains("bin_size");
+    if (v) {
+      boost::system::error_code num_ec;
+      q.bin_size = v->to_number<std::uint32_t>(num_ec);
+      if (num_ec)
+        q.bin_size = 0;
+    }
+    if (q.bin_size == 0)
+      return {{}, "missing or invalid bin_size"};
+  }
+  if (q.methylome.empty() || q.output.empty())
+    return {{}, "missing methylome or output"};
+  if (q.type == batch_query_type::intervals && q.intervals.empty())
+    return {{}, "missing intervals"};
+  return {std::move(q), {}};
+}
+
+struct loaded_index {
+  cpg_index index;
+  cpg_index_meta cim;
+};
+
+struct loaded_intervals {
+  std::vector<genomic_interval> gis;  // sorted
+  std::vector<std::uint32_t> order;   // input order, if they were not
+  request req;  // offsets for the intervals, ready to send
+};
+
+/*
+  batch_state: everything kept between queries. Indexes are cached by
+  filename, and intervals by index and intervals filename. In remote
+  mode the session keeps one connection to the server; in local mode
+  the most recently used methylome is kept, so consecutive queries on
+  the same methylome read it once.
+ */
+struct batch_state {
+  std::string default_index;
+  std::unique_ptr<xfrase::client_session> session;
+  std::unordered_map<std::string, loaded_index> indexes;
+  std::unordered_map<std::string, loaded_intervals> intervals;
+  std::string meth_file;
+  methylome meth;
+
+  [[nodiscard]] auto
+  get_index(const std::string &index_file)
+    -> std::tuple<const loaded_index *, std::error_code>;
+
+  [[nodiscard]] auto
+  get_intervals(const std::string &index_file, const loaded_index &idx,
+                const std::string &intervals_file)
+    -> std::tuple<const loaded_intervals *, std::error_code>;
+
+  [[nodiscard]] auto
+  get_methylome(const std::string &filename)
+    -> std::tuple<const methylome *, std::error_code>;
+};
+
+auto
+batch_state::get_index(const std::string &index_file)
+  -> std::tuple<const loaded_index *, std::error_code> {
+  if (const auto itr = indexes.find(index_file); itr != std::cend(indexes))
+    return {&itr->second, {}};
+  auto [index, cim, index_read_err] = read_cpg_index(index_file);
+  if (index_read_err) {
+    logger::instance().error("Failed to read cpg index: {} ({})", index_file,
+                             index_read_err);
+    return {nullptr, index_read_err};
+  }
+  logger::instance().debug("Loaded index: {}", index_file);
+  const auto [itr, inserted] = indexes.emplace(
+    index_file, loaded_index{std::move(index), std::move(cim)});
+  return {&itr->second, {}};
+}
+
+auto
+batch_state::get_intervals(const std::string &index_file,
+                           const loaded_index &idx,
+                           const std::string &intervals_file)
+  -> std::tuple<const loaded_intervals *, std::error_code> {
+  auto key = std::format("{}\t{}", index_file, intervals_file);
+  if (const auto itr = intervals.find(key); itr != std::cend(intervals))
+    return {&itr->second, {}};
+  logger &lgr = logger::instance();
+  auto [gis, ec] = genomic_interval::load(idx.cim, intervals_file);
+  if (ec) {
+    lgr.error("Error reading intervals file: {} ({})", intervals_file, ec);
+    return {nullptr, ec};
+  }
+  std::vector<std::uint32_t> order;
+  if (!intervals_sorted(idx.cim, gis)) {
+    lgr.debug("Intervals not sorted; sorting: {}", intervals_file);
+    order = sort_intervals(gis);
+  }
+  if (!intervals_valid(gis)) {
+    lgr.error("Intervals not valid: {} (negative size found)", intervals_file);
+    return {nullptr, std::make_error_code(std::errc::invalid_argument)};
+  }
+  auto offsets = idx.index.get_offsets(idx.cim, gis);
+  const std::uint32_t n_intervals = size(offsets);
+  const auto [itr, inserted] = intervals.emplace(
+    std::move(key),
+    loaded_intervals{std::move(gis), std::move(order),
+                     request{n_intervals, std::move(offsets)}});
+  return {&itr->second, {}};
+}
+
+auto
+batch_state::get_methylome(const std::string &filename)
+  -> std::tuple<const methylome *, std::error_code> {
+  if (filename == meth_file)
+    return {&meth, {}};
+  logger &lgr = logger::instance();
+  const auto meta_file = get_default_methylome_metadata_filename(filename);
+  const auto [meta, meta_err] = methylome_metadata::read(meta_file);
+  if (meta_err) {
+    lgr.error("Error reading file {}: {}", meta_file, meta_err);
+    return {nullptr, meta_err};
+  }
+  auto [m, meth_err] = methylome::read(filename, meta);
+  if (meth_err) {
+    lgr.error("Error reading file {}: {}", filename, meth_err);
+    return {nullptr, meth_err};
+  }
+  meth = std::move(m);
+  meth_file = filename;
+  return {&meth, {}};
+}
+
+template <typename counts_res_type>
+[[nodiscard]] static auto
+get_results(batch_state &state, const batch_query &q, const loaded_index &idx,
+            const loaded_intervals *ivs)
+  -> std::tuple<std::vector<counts_res_type>, std::error_code> {
+  static constexpr auto cov =
+    std::is_same<counts_res_type, counts_res_cov>::value;
+  using rq = request_header::request_type;
+  if (state.session) {
+    if (q.type == batch_query_type::intervals) {
+      const request_header hdr{q.methylome, idx.cim.n_cpgs,
+                               cov ? rq::counts_cov : rq::counts};
+      return state.session->query<counts_res_type>(hdr, ivs->req);
+    }
+    const request_header hdr{q.methylome, idx.cim.n_cpgs,
+                             cov ? rq::bin_counts_cov : rq::bin_counts};
+    return state.session->query<counts_res_type>(
+      hdr, bins_request{q.bin_size, 0, {}});
+  }
+
+  const auto [meth, meth_err] = state.get_methylome(q.methylome);
+  if (meth_err)
+    return {{}, meth_err};
+  if constexpr (cov) {
+    if (q.type == batch_query_type::intervals)
+      return {meth->get_counts_cov(ivs->req.offsets), {}};
+    return {meth->get_bins_cov(q.bin_size, idx.index, idx.cim), {}};
+  }
+  else {
+    if (q.type == batch_query_type::intervals)
+      return {meth->get_counts(ivs->req.offsets), {}};
+    return {meth->get_bins(q.bin_size, idx.index, idx.cim), {}};
+  }
+}
+
+static const std::vector<genomic_interval> no_intervals{};
+
+[[nodiscard]] static auto
+write_results(std::ostream &out, const batch_query &q, const loaded_index &idx,
+              const std::vector<genomic_interval> &gis,
+              const auto &results) -> std::error_code {
+  if (q.score) {
+    const auto to_score = [](const auto &x) {
+      return x.n_meth /
+             std::max(1.0, static_cast<double>(x.n_meth + x.n_unmeth));
+    };
+    const auto scores = std::views::transform(results, to_score);
+    return q.type == batch_query_type::intervals
+             ? write_intervals_bedgraph(out, idx.cim, gis, scores)
+             : write_bins_bedgraph(out, idx.cim, q.bin_size, scores);
+  }
+  return q.type == batch_query_type::intervals
+           ? write_intervals(out, idx.cim, gis, results)
+           : write_bins(out, idx.cim, q.bin_size, results);
+}
+
+template <typename counts_res_type>
+[[nodiscard]] static auto
+do_query(batch_state &state, const batch_query &q) -> std::error_code {
+  logger &lgr = logger::instance();
+  const auto &index_file = q.index.empty() ? state.default_index : q.index;
+  if (index_file.empty()) {
+    lgr.error("No index for query with output: {}", q.output);
+    return std::make_error_code(std::errc::invalid_argument);
+  }
+  const auto [idx, index_err] = state.get_index(index_file);
+  if (index_err)
+    return index_err;
+
+  const loaded_intervals *ivs{};
+  if (q.type == batch_query_type::intervals) {
+    const auto [loaded, intervals_err] =
+      state.get_intervals(index_file, *idx, q.intervals);
+    if (intervals_err)
+      return intervals_err;
+    ivs = loaded;
+  }
+
+  const auto query_start{std::chrono::high_resolution_clock::now()};
+  const auto [results, query_err] =
+    get_results<counts_res_type>(state, q, *idx, ivs);
+  const auto query_stop{std::chrono::high_resolution_clock::now()};
+  lgr.debug("Elapsed time for query: {:.3}s",
+            duration(query_start, query_stop));
+  if (query_err) {
+    lgr.error("Query failed for {}: {}", q.methylome, query_err);
+    return query_err;
+  }
+
+  std::ofstream out_file;
+  if (q.output != "-") {
+    out_file.open(q.output);
+    if (!out_file) {
+      const auto open_err = std::make_error_code(std::errc(errno));
+      lgr.error("Failed to open output file: {} ({})", q.output, open_err);
+      return open_err;
+    }
+  }
+  std::ostream &out = q.output == "-" ? std::cout : out_file;
+  // ADS: results for intervals that were sorted go back in input order
+  if (ivs && !ivs->order.empty())
+    return write_results(out, q, *idx,
+                         restore_input_order(ivs->gis, ivs->order),
+                         restore_input_order(results, ivs->order));
+  return write_results(out, q, *idx, ivs ? ivs->gis : no_intervals, results);
+}
+
+auto
+command_batch_main(int argc, char *argv[]) -> int {
+  static constexpr auto command = "batch";
+  static const auto usage =
+    std::format("Usage: xfrase batch [local|remote] [options]\n");
+  static const auto about_msg =
+    std::format("xfrase {}: {}", strip(command), strip(about));
+  static const auto description_msg =
+    std::format("{}\n{}", strip(description), strip(examples));
+
+  static constexpr auto default_port = "5000";
+
+  std::string port{};
+  std::string index_file{};
+  std::string queries_file{};
+  std::string hostname{};
+  xfrase_log_level log_level{};
+
+  std::string subcmd;
+
+  namespace po = boost::program_options;
+
+  po::options_description subcmds;
+  subcmds.add_options()
+    // clang-format off
+    ("subcmd", po::value(&subcmd))
+    ("subargs", po::value<std::vector<std::string>>())
+    // clang-format on
+    ;
+  // positional; one for "subcmd" and the rest else parser throws
+  po::positional_options_description p;
+  p.add("subcmd", 1).add("subargs", -1);
+
+  po::options_description general("General");
+  // clang-format off
+  general.add_options()
+    ("help,h", "print this message and exit")
+    ("index,x", po::value(&index_file), "index file for queries without one")
+    ("queries,i", po::value(&queries_file)->default_value("-"),
+     "queries file (default: standard input)")
+    ("log-level,v", po::value(&log_level)->default_value(logger::default_level),
+     "log level {debug,info,warning,error,critical}")
+    ;
+  po::options_description remote("Remote");
+  remote.add_options()
+    ("hostname,s", po::value(&hostname)->required(), "server hostname")
+    ("port,p", po::value(&port)->default_value(default_port), "port")
+    ;
+  // clang-format on
+
+  po::variables_map vm_subcmd;
+  po::store(po::command_line_parser(argc, argv)
+              .options(subcmds)
+              .positional(p)
+              .allow_unregistered()
+              .run(),
+            vm_subcmd);
+  po::notify(vm_subcmd);
+
+  bool force_help_message{};
+  po::options_description all("Options");
+  if (subcmd == "local")
+    all.add(general);
+  else if (subcmd == "remote")
+    all.add(general).add(remote);
+  else {
+    force_help_message = true;
+    all.add(general).add(remote);
+  }
+
+  try {
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc - 1, argv + 1, all), vm);
+    if (force_help_message || vm.count("help") || argc == 1) {
+      if (!subcmd.empty() && subcmd != "local" && subcmd != "remote")
+        std::println("One of local or remote must be specified\n");
+      std::println("{}\n{}", about_msg, usage);
+      all.print(std::cout);
+      std::println("\n{}", description_msg);
+      return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+  }
+  catch (po::error &e) {
+    std::println("{}", e.what());
+    std::println("{}\n{}", about_msg, usage);
+    all.print(std::cout);
+    std::println("\n{}", description_msg);
+    return EXIT_FAILURE;
+  }
+
+  const bool remote_mode = (subcmd == "remote");
+
+  // ADS: results can go to stdout, so the log goes to stderr
+  logger &lgr = logger::instance(shared_from_cerr(), command, log_level);
+  if (!lgr) {
+    std::println(std::cerr, "Failure initializing logging: {}.",
+                 lgr.get_status());
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::tuple<std::string, std::string>> args_to_log{
+    {"Index", index_file},
+    {"Queries", queries_file},
+  };
+  if (remote_mode)
+    args_to_log.emplace_back("Hostname:port",
+                             std::format("{}:{}", hostname, port));
+  log_args<xfrase_log_level::info>(args_to_log);
+
+  std::ifstream queries_in;
+  if (queries_file != "-") {
+    queries_in.open(queries_file);
+    if (!queries_in) {
+      lgr.error("Failed to open queries file: {} ({})", queries_file,
+                std::make_error_code(std::errc(errno)));
+      return EXIT_FAILURE;
+    }
+  }
+  std::istream &in = queries_file == "-" ? std::cin : queries_in;
+
+  batch_state state;
+  state.default_index = index_file;
+  if (remote_mode)
+    state.session = std::make_unique<xfrase::client_session>(hostname, port);
+
+  std::uint32_t line_number{};
+  std::uint32_t n_queries{};
+  std::uint32_t n_failed{};
+  std::string line;
+  while (std::getline(in, line)) {
+    ++line_number;
+    const auto spec = trim_query_line(line);
+    if (spec.empty() || spec.front() == '#')
+      continue;
+    ++n_queries;
+    const auto [q, parse_err] =
+      spec.front() == '{' ? parse_json_query(spec) : parse_tsv_query(spec);
+    if (!parse_err.empty()) {
+      lgr.error("Bad query on line {}: {}", line_number, parse_err);
+      ++n_failed;
+      continue;
+    }
+    const auto query_err = q.covered ? do_query<counts_res_cov>(state, q)
+                                     : do_query<counts_res>(state, q);
+    if (query_err)
+      ++n_failed;
+    else
+      lgr.info("Wrote {} (line {})", q.output, line_number);
+  }
+
+  lgr.info("Queries: {} (failed: {})", n_queries, n_failed);
+  if (state.session)
+    lgr.debug("Connections to server: {}", state.session->get_n_connects());
+  return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
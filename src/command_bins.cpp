@@ -30,11 +30,15 @@ summarize methylation levels in non-overlapping genomic bins
 static constexpr auto description = R"(
 The bins command accepts a bin size and a methylome, and it
 generates a summary of the methylation levels in each non-overlapping
-bin of the given size. This command runs in two modes, local and
-remote. The local mode is for analyzing data on your local storage:
-either your own data or data that you downloaded. The remote mode is
-for analyzing methylomes in a remote database on a server. Depending
-on the mode you select, the options you must specify will differ.
+bin of the given size. If more than one bin size is given, the bins
+for all sizes are computed together, and the output for each size
+goes to its own file, named by adding the bin size before the
+extension of the output filename. This command runs in two modes,
+local and remote. The local mode is for analyzing data on your local
+storage: either your own data or data that you downloaded. The remote
+mode is for analyzing methylomes in a remote database on a server.
+Depending on the mode you select, the options you must specify will
+differ.
 )";
 
 static constexpr auto examples = R"(
@@ -42,11 +46,14 @@ Examples:
 
 xfrase bins local -x hg38.cpg_idx -o output.bed -m methylome.m16 -b 1000
 xfrase bins remote -x hg38.cpg_idx -o output.bed -s example.com -a SRX012345 -b 1000
+xfrase bins remote -x hg38.cpg_idx -o output.bed -s example.com -a SRX012345 -b 1000 -r chr1:1000000-2000000 chr2
+xfrase bins remote -x hg38.cpg_idx -o output.bed -s example.com -a SRX012345 -b 1000 10000 100000
 )";
 
 #include "client.hpp"
 #include "cpg_index.hpp"
 #include "cpg_index_meta.hpp"
+#include "genomic_interval.hpp"
 #include "genomic_interval_output.hpp"
 #include "logger.hpp"
 #include "methylome.hpp"
@@ -63,11 +70,13 @@ xfrase bins remote -x hg38.cpg_idx -o output.bed -s example.com -a SRX012345 -b
 #include <chrono>
 #include <cstdint>
 #include <cstdlib>  // for EXIT_FAILURE, EXIT_SUCCESS
+#include <filesystem>
 #include <format>
 #include <fstream>
 #include <iostream>
 #include <print>
 #include <ranges>  // for std::views
+#include <span>
 #include <string>
 #include <string_view>
 #include <system_error>
@@ -83,7 +92,8 @@ using std::vector;
 template <typename counts_res_type>
 [[nodiscard]] static inline auto
 do_remote_bins(const string &accession, const cpg_index_meta &cim,
-               const std::uint32_t bin_size, const string &hostname,
+               const vector<std::uint32_t> &bin_sizes,
+               const vector<genomic_interval> &regions, const string &hostname,
                const string &port)
   -> std::tuple<vector<counts_res_type>, std::error_code> {
   request_header hdr{accession, cim.n_cpgs, {}};
@@ -93,7 +103,11 @@ do_remote_bins(const string &accession, const cpg_index_meta &cim,
   else
     hdr.rq_type = request_header::request_type::bin_counts_cov;
 
-  bins_request req{bin_size};
+  const std::uint32_t n_regions = std::size(regions);
+  // ADS: all bin sizes go in one request
+  bins_request req{bin_sizes.front(), n_regions, regions,
+                   vector<std::uint32_t>(std::cbegin(bin_sizes) + 1,
+                                         std::cend(bin_sizes))};
   xfrase::client<counts_res_type, bins_request> cl(hostname, port, hdr, req);
   const auto status = cl.run();
   if (status) {
@@ -107,7 +121,8 @@ template <typename counts_res_type>
 [[nodiscard]] static inline auto
 do_local_bins(const string &meth_file, const string &meta_file,
               const cpg_index &index, const cpg_index_meta &cim,
-              const std::uint32_t bin_size)
+              const vector<std::uint32_t> &bin_sizes,
+              const vector<genomic_interval> &regions)
   -> std::tuple<vector<counts_res_type>, std::error_code> {
   const auto [meta, meta_err] = methylome_metadata::read(meta_file);
   if (meta_err) {
@@ -120,6 +135,26 @@ do_local_bins(const string &meth_file, const string &meta_file,
     logger::instance().error("Error: {} ({})", meth_read_err, meth_file);
     return {{}, meth_read_err};
   }
+  if (std::size(bin_sizes) > 1) {
+    constexpr auto cov = std::is_same<counts_res_type, counts_res_cov>::value;
+    if (!regions.empty()) {
+      if constexpr (cov)
+        return {meth.get_multi_bins_cov(bin_sizes, index, cim, regions), {}};
+      else
+        return {meth.get_multi_bins(bin_sizes, index, cim, regions), {}};
+    }
+    if constexpr (cov)
+      return {meth.get_multi_bins_cov(bin_sizes, index, cim), {}};
+    else
+      return {meth.get_multi_bins(bin_sizes, index, cim), {}};
+  }
+  const auto bin_size = bin_sizes.front();
+  if (!regions.empty()) {
+    if constexpr (std::is_same<counts_res_type, counts_res_cov>::value)
+      return {std::move(meth.get_bins_cov(bin_size, index, cim, regions)), {}};
+    else
+      return {std::move(meth.get_bins(bin_size, index, cim, regions)), {}};
+  }
   if constexpr (std::is_same<counts_res_type, counts_res_cov>::value)
     return {std::move(meth.get_bins_cov(bin_size, index, cim)), {}};
   else
@@ -128,8 +163,13 @@ do_local_bins(const string &meth_file, const string &meta_file,
 
 [[nodiscard]] static inline auto
 write_output(std::ostream &out, const cpg_index_meta &cim,
-             const std::uint32_t bin_size, const auto &results,
+             const std::uint32_t bin_size,
+             const vector<genomic_interval> &regions, const auto &results,
              const bool write_scores) {
+  // ADS: bins inside regions are written the same way as intervals
+  const auto bins = regions.empty()
+                      ? vector<genomic_interval>{}
+                      : get_bins_in_regions(cim, bin_size, regions);
   if (write_scores) {
     // ADS: counting intervals that have no reads
     std::uint32_t zero_coverage = 0;
@@ -140,26 +180,52 @@ write_output(std::ostream &out, const cpg_index_meta &cim,
     };
     logger::instance().debug("Number of bins without reads: {}", zero_coverage);
     const auto scores = std::views::transform(results, to_score);
-    return write_bins_bedgraph(out, cim, bin_size, scores);
+    return regions.empty()
+             ? write_bins_bedgraph(out, cim, bin_size, scores)
+             : write_intervals_bedgraph(out, cim, bins, scores);
   }
   else
-    return write_bins(out, cim, bin_size, results);
+    return regions.empty() ? write_bins(out, cim, bin_size, results)
+                           : write_intervals(out, cim, bins, results);
+}
+
+[[nodiscard]] static inline auto
+format_bin_sizes(const vector<std::uint32_t> &bin_sizes) -> string {
+  string s;
+  for (const auto bin_size : bin_sizes)
+    s += std::format("{}{}", s.empty() ? "" : ",", bin_size);
+  return s;
+}
+
+// ADS: with several bin sizes, output.bed becomes output.1000.bed
+// for bin size 1000
+[[nodiscard]] static inline auto
+get_output_filename(const string &outfile,
+                    const vector<std::uint32_t> &bin_sizes,
+                    const std::uint32_t bin_size) -> string {
+  if (std::size(bin_sizes) == 1)
+    return outfile;
+  std::filesystem::path p(outfile);
+  const auto ext = p.extension().string();
+  p.replace_extension(std::format("{}{}", bin_size, ext));
+  return p.string();
 }
 
 template <typename counts_res_type>
 static auto
 do_bins(const string &accession, const cpg_index &index,
-        const cpg_index_meta &cim, const std::uint32_t bin_size,
-        const string &hostname, const string &port, const string &meth_file,
-        const string &meta_file, std::ostream &out, const bool write_scores,
+        const cpg_index_meta &cim, const vector<std::uint32_t> &bin_sizes,
+        const vector<genomic_interval> &regions, const string &hostname,
+        const string &port, const string &meth_file, const string &meta_file,
+        const string &outfile, const bool write_scores,
         const bool remote_mode) -> std::error_code {
   logger &lgr = logger::instance();
   const auto bins_start{std::chrono::high_resolution_clock::now()};
   const auto [results, bins_err] =
-    remote_mode ? do_remote_bins<counts_res_type>(accession, cim, bin_size,
-                                                  hostname, port)
+    remote_mode ? do_remote_bins<counts_res_type>(accession, cim, bin_sizes,
+                                                  regions, hostname, port)
                 : do_local_bins<counts_res_type>(meth_file, meta_file, index,
-                                                 cim, bin_size);
+                                                 cim, bin_sizes, regions);
   const auto bins_stop{std::chrono::high_resolution_clock::now()};
   lgr.debug("Elapsed time for bins query: {:.3}s",
             duration(bins_start, bins_stop));
@@ -168,10 +234,31 @@ do_bins(const string &accession, const cpg_index &index,
     return std::make_error_code(std::errc::invalid_argument);
 
   const auto output_start{std::chrono::high_resolution_clock::now()};
-  const auto write_err =
-    write_output(out, cim, bin_size, results, write_scores);
-  if (write_err)
-    return write_err;
+  // ADS: the bins for each size are found in the results by the same
+  // offsets the server used to put them there
+  const auto offsets = regions.empty()
+                         ? cim.get_bins_offsets(bin_sizes)
+                         : cim.get_bins_offsets(bin_sizes, regions);
+  if (std::size(results) != offsets.back()) {
+    lgr.error("Unexpected number of bins: {} (expected {})", std::size(results),
+              offsets.back());
+    return std::make_error_code(std::errc::invalid_argument);
+  }
+  for (const auto [i, bin_size] : std::views::enumerate(bin_sizes)) {
+    const auto filename = get_output_filename(outfile, bin_sizes, bin_size);
+    std::ofstream out(filename);
+    if (!out) {
+      const auto err = std::make_error_code(std::errc(errno));
+      lgr.error("Failed to open output file {}: {}", filename, err);
+      return err;
+    }
+    const std::span bins(std::cbegin(results) + offsets[i],
+                         std::cbegin(results) + offsets[i + 1]);
+    const auto write_err =
+      write_output(out, cim, bin_size, regions, bins, write_scores);
+    if (write_err)
+      return write_err;
+  }
   const auto output_stop{std::chrono::high_resolution_clock::now()};
   // ADS: elapsed time for output will include conversion to scores
   lgr.debug("Elapsed time for output: {:.3}s",
@@ -202,7 +289,8 @@ command_bins_main(int argc, char *argv[]) -> int {
   bool count_covered{};
   bool write_scores{};
   xfrase_log_level log_level{};
-  std::uint32_t bin_size{};
+  vector<std::uint32_t> bin_sizes{};
+  vector<string> region_strs{};
 
   namespace po = boost::program_options;
 
@@ -222,7 +310,10 @@ command_bins_main(int argc, char *argv[]) -> int {
   general.add_options()
     ("help,h", "print this message and exit")
     ("index,x", po::value(&index_file)->required(), "index file")
-    ("bin-size,b", po::value(&bin_size)->required(), "size of bins")
+    ("bin-size,b", po::value(&bin_sizes)->multitoken()->required(),
+     "size of bins (more than one gives one output file for each)")
+    ("region,r", po::value(&region_strs)->multitoken(),
+     "only bins in these regions (chrom or chrom:start-stop)")
     ("log-level,v", po::value(&log_level)->default_value(logger::default_level),
      "log level {debug,info,warning,error,critical}")
     ;
@@ -301,7 +392,8 @@ command_bins_main(int argc, char *argv[]) -> int {
   // ADS: log the command line arguments (assuming right log level)
   vector<std::tuple<string, string>> args_to_log{
     {"Index", index_file},
-    {"Binsize", std::format("{}", bin_size)},
+    {"Binsize", format_bin_sizes(bin_sizes)},
+    {"Regions", std::format("{}", region_strs.size())},
     {"Output", outfile},
     {"Covered", std::format("{}", count_covered)},
     {"Bedgraph", std::format("{}", write_scores)},
@@ -325,21 +417,34 @@ command_bins_main(int argc, char *argv[]) -> int {
 
   lgr.debug("Number of CpGs in index: {}", cim.n_cpgs);
 
-  std::ofstream out(outfile);
-  if (!out) {
-    lgr.error("Failed to open output file {}: {}", outfile,
-              std::make_error_code(std::errc(errno)));
+  vector<genomic_interval> regions;
+  for (const auto &region_str : region_strs) {
+    const auto [region, region_err] =
+      genomic_interval::parse_region(cim, region_str);
+    if (region_err) {
+      lgr.error("Error in region {}: {}", region_str, region_err);
+      return EXIT_FAILURE;
+    }
+    regions.push_back(region);
+  }
+
+  if (std::ranges::find(bin_sizes, 0u) != std::cend(bin_sizes)) {
+    lgr.error("Bin sizes must be positive: {}", format_bin_sizes(bin_sizes));
+    return EXIT_FAILURE;
+  }
+  if (std::size(bin_sizes) > bins_request::max_bin_sizes) {
+    lgr.error("At most {} bin sizes allowed", bins_request::max_bin_sizes);
     return EXIT_FAILURE;
   }
 
   const auto bins_err =
     count_covered
-      ? do_bins<counts_res_cov>(accession, index, cim, bin_size, hostname, port,
-                                meth_file, meta_file, out, write_scores,
-                                remote_mode)
-      : do_bins<counts_res>(accession, index, cim, bin_size, hostname, port,
-                            meth_file, meta_file, out, write_scores,
-                            remote_mode);
+      ? do_bins<counts_res_cov>(accession, index, cim, bin_sizes, regions,
+                                hostname, port, meth_file, meta_file, outfile,
+                                write_scores, remote_mode)
+      : do_bins<counts_res>(accession, index, cim, bin_sizes, regions,
+                            hostname, port, meth_file, meta_file, outfile,
+                            write_scores, remote_mode);
 
   return bins_err == std::errc() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -32,8 +32,9 @@ Perform 3 kinds of checks. First, the index is checked internally to
 verify that the index data and the index metadata are consistent.
 Second, the methylomes are each checked internally to verify that the
 methylome data and methylome metadata is consistent for each given
-methylome. Finally, each given methylome is checked for consistency
-with the given index. Not output is written except that logged to the
+methylome, including the checksum of each block when the metadata has
+block checksums; blocks are verified in parallel. Finally, each given
+methylome is checked for consistency with the given index. Not output is written except that logged to the
 console. The exit code of the app will be non-zero if any of the
 consistency checks fails. At a log-level of 'debug' the outcome of
 each check will be logged so the cause of any failure can be
@@ -44,6 +45,7 @@ static constexpr auto examples = R"(
 Examples:
 
 xfrase check -x indexes/hg38.cpg_idx -m SRX012345.m16 SRX612345.m16
+xfrase check -t 8 -x indexes/hg38.cpg_idx -m SRX012345.m16
 )";
 
 #include "cpg_index.hpp"
@@ -57,6 +59,7 @@ xfrase check -x indexes/hg38.cpg_idx -m SRX012345.m16 SRX612345.m16
 
 #include <boost/program_options.hpp>
 
+#include <cstdint>  // for std::uint32_t
 #include <cstdlib>  // for EXIT_FAILURE, EXIT_SUCCESS
 #include <format>
 #include <iostream>
@@ -102,6 +105,21 @@ check_methylome_consistency(const methylome_metadata &meta,
   return n_cpgs_match_ret && hashes_match_ret;
 }
 
+[[nodiscard]] static auto
+check_methylome_blocks(const methylome_metadata &meta, const methylome &meth,
+                       const std::uint32_t n_threads) -> bool {
+  auto &lgr = logger::instance();
+
+  lgr.debug("methylome block size: {} ({} blocks)", meta.block_size,
+            std::size(meta.block_hashes));
+  if (meta.block_size == 0)
+    return true;  // ADS: older metadata has no block checksums
+
+  const auto blocks_err = meth.verify_all_blocks(n_threads);
+  lgr.debug("methylome block checksums match: {}", !blocks_err);
+  return !blocks_err;
+}
+
 [[nodiscard]] static auto
 check_metadata_consistency(const methylome_metadata &meta,
                            const cpg_index_meta &cim) -> bool {
@@ -134,6 +152,7 @@ command_check_main(int argc, char *argv[]) -> int {
     std::format("{}\n{}", strip(description), strip(examples));
 
   std::string index_file{};
+  std::uint32_t n_threads{};
   xfrase_log_level log_level{};
 
   namespace po = boost::program_options;
@@ -145,6 +164,8 @@ command_check_main(int argc, char *argv[]) -> int {
     ("index,x", po::value(&index_file)->required(), "index file")
     ("methylomes,m", po::value<std::vector<std::string>>()->multitoken()->required(),
      "methylome files")
+    ("threads,t", po::value(&n_threads)->default_value(1),
+     "number of threads for verifying blocks")
     ("log-level,v", po::value(&log_level)->default_value(logger::default_level),
      "log level {debug,info,warning,error,critical}")
     // clang-format on
@@ -182,6 +203,7 @@ command_check_main(int argc, char *argv[]) -> int {
     // clang-format off
     {"Index", index_file},
     {"Methylomes", std::string(std::cbegin(joined), std::cend(joined))},
+    {"Threads", std::format("{}", n_threads)},
     // clang-format on
   };
   log_args<xfrase_log_level::info>(args_to_log);
@@ -211,7 +233,9 @@ command_check_main(int argc, char *argv[]) -> int {
     lgr.info("Methylome total counts: {}", meth.total_counts());
     lgr.info("Methylome total counts covered: {}", meth.total_counts_cov());
 
-    const auto methylome_consitency = check_methylome_consistency(meta, meth);
+    const auto methylome_consitency =
+      check_methylome_consistency(meta, meth) &&
+      check_methylome_blocks(meta, meth, n_threads);
     lgr.info("Methylome data and metadata consistent: {}",
              methylome_consitency);
     all_methylomes_consitent = all_methylomes_consitent && methylome_consitency;
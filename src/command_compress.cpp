@@ -36,7 +36,9 @@ is roughly 4-5x faster, with a cost of 1.2x in size, and decompress
 slightly faster. The compression status is not encoded in the
 methylome data files, but in the metadata files, so be careful not to
 confuse the methylome metadata files for original and compressed
-files.
+files. The count width can also be changed, and a width of 8 bits
+halves the size for samples with few reads at each site; counts at
+any site with more than 255 reads are rounded.
 )";
 
 static constexpr auto examples = R"(
@@ -44,6 +46,7 @@ Examples:
 
 xfrase compress -o compressed.m16 -i original.m16
 xfrase compress -u -o original.m16 -i compressed.m16
+xfrase compress --count-width 8 -o compressed.m16 -i original.m16
 )";
 
 #include "logger.hpp"
@@ -55,6 +58,7 @@ xfrase compress -u -o original.m16 -i compressed.m16
 #include <boost/program_options.hpp>
 
 #include <chrono>
+#include <cstdint>  // for std::uint32_t
 #include <cstdlib>  // for EXIT_FAILURE, EXIT_SUCCESS
 #include <format>
 #include <iostream>
@@ -82,6 +86,8 @@ command_compress_main(int argc, char *argv[]) -> int {
   std::string metadata_output{};
   xfrase_log_level log_level{};
   bool uncompress{false};
+  std::uint32_t count_width{};
+  std::uint32_t file_version{};
 
   namespace po = boost::program_options;
 
@@ -93,6 +99,10 @@ command_compress_main(int argc, char *argv[]) -> int {
     ("output,o", po::value(&methylome_output)->required(),
      "output file")
     ("uncompress,u", po::bool_switch(&uncompress), "uncompress the file")
+    ("count-width", po::value(&count_width),
+     "bits per stored count, 16 or 8 (default: same as input)")
+    ("file-version", po::value(&file_version)->default_value(1),
+     "output file version, 1 or 2 (2 starts with a header)")
     ("meta", po::value(&metadata_input), "metadata input (default: input.json)")
     ("meta-out", po::value(&metadata_output),
      "metadata output (default: output.json)")
@@ -138,6 +148,8 @@ command_compress_main(int argc, char *argv[]) -> int {
     {"Output", methylome_output},
     {"Metadata output", metadata_output},
     {"Uncompress", std::format("{}", uncompress)},
+    {"Count width", std::format("{}", count_width)},
+    {"File version", std::format("{}", file_version)},
     // clang-format on
   };
   log_args<xfrase_log_level::info>(args_to_log);
@@ -158,8 +170,19 @@ command_compress_main(int argc, char *argv[]) -> int {
     return EXIT_FAILURE;
   }
 
+  if (count_width == 0)
+    count_width = meta.count_width;
+  if (!methylome::is_valid_count_width(count_width)) {
+    lgr.error("Count width must be 16 or 8 (given: {})", count_width);
+    return EXIT_FAILURE;
+  }
+  if (file_version != 1 && file_version != 2) {
+    lgr.error("File version must be 1 or 2 (given: {})", file_version);
+    return EXIT_FAILURE;
+  }
+
   const auto meth_read_start = std::chrono::high_resolution_clock::now();
-  const auto [meth, meth_read_err] = methylome::read(methylome_input, meta);
+  auto [meth, meth_read_err] = methylome::read(methylome_input, meta);
   const auto meth_read_stop = std::chrono::high_resolution_clock::now();
   if (meth_read_err) {
     lgr.error("Error reading methylome {}: {}", methylome_input, meth_read_err);
@@ -168,9 +191,26 @@ command_compress_main(int argc, char *argv[]) -> int {
   lgr.debug("Methylome read time: {}s",
             duration(meth_read_start, meth_read_stop));
 
+  // ADS: checksums are of the counts as stored, so they are taken
+  // again only if narrowing rounded any counts
+  if (count_width != meta.count_width) {
+    meth.round_to_width(count_width);
+    if (meth.hash() != meta.methylome_hash) {
+      lgr.info("Counts rounded to fit count width: {}", count_width);
+      if (const auto update_err = meta.update(meth)) {
+        lgr.error("Error updating metadata: {}", update_err);
+        return EXIT_FAILURE;
+      }
+    }
+    meta.count_width = count_width;
+  }
+  meta.is_compressed = !meta.is_compressed;
+
   const auto meth_write_start = std::chrono::high_resolution_clock::now();
-  if (const auto meth_write_err = meth.write(methylome_output, !uncompress);
-      meth_write_err) {
+  const auto meth_write_err =
+    file_version == 2 ? meth.write_v2(methylome_output, meta)
+                      : meth.write(methylome_output, !uncompress, count_width);
+  if (meth_write_err) {
     lgr.error("Error writing output {}: {}", methylome_output, meth_write_err);
     return EXIT_FAILURE;
   }
@@ -178,8 +218,6 @@ command_compress_main(int argc, char *argv[]) -> int {
   lgr.debug("Methylome write time: {}s",
             duration(meth_write_start, meth_write_stop));
 
-  meta.is_compressed = !meta.is_compressed;
-
   if (const auto meta_write_err = meta.write(metadata_output); meta_write_err) {
     lgr.error("Error writing metadata {}: {}", metadata_output, meta_write_err);
     return EXIT_FAILURE;
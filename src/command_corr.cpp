@@ -0,0 +1,540 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "command_corr.hpp"
+
+static constexpr auto about = R"(
+correlation of methylation levels between methylomes
+)";
+
+static constexpr auto description = R"(
+The corr command computes the correlation of methylation levels
+between every pair of a set of methylomes. Levels are either for
+individual CpG sites or for bins of a given size along each
+chromosome. A site or bin only contributes to the correlation of a
+pair of methylomes if it has at least the minimum number of reads in
+both. The methylomes are processed in blocks of sites, and the
+pairwise statistics are accumulated for tiles of the matrix in
+parallel. The output is a tab-separated matrix with a header line, and
+optionally the same matrix as row-major binary doubles.
+)";
+
+static constexpr auto examples = R"(
+Examples:
+
+xfrase corr -x hg38.cpg_idx -o corr.tsv -m SRX0123*.m16
+xfrase corr -x hg38.cpg_idx -b 1000 -t 8 -o corr.tsv --binary corr.bin -m SRX0123*.m16
+)";
+
+#include "cpg_index.hpp"
+#include "cpg_index_meta.hpp"
+#include "logger.hpp"
+#include "methylome.hpp"
+#include "methylome_metadata.hpp"
+#include "methylome_results_types.hpp"
+#include "utilities.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <array>
+#include <barrier>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>  // for EXIT_FAILURE, EXIT_SUCCESS
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>  // for std::size
+#include <limits>
+#include <print>
+#include <ranges>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <utility>  // for std::move
+#include <variant>  // IWYU pragma: keep
+#include <vector>
+
+// ADS: number of sites (or bins) processed at a time; this keeps the
+// levels and masks for a pair of methylomes within L2 cache
+static constexpr std::uint32_t corr_block_size{1u << 14};
+// ADS: tiles of the NxN matrix are corr_tile_dim x corr_tile_dim
+static constexpr std::uint32_t corr_tile_dim{8};
+// ADS: independent accumulators so the inner loop vectorizes without
+// needing -ffast-math to reorder the floating point sums
+static constexpr std::uint32_t corr_n_lanes{16};
+
+// sufficient statistics for the correlation of one pair of methylomes
+struct pair_stats {
+  double n{};
+  double sum_x{};
+  double sum_y{};
+  double sum_xx{};
+  double sum_yy{};
+  double sum_xy{};
+
+  [[nodiscard]] auto
+  corr() const -> double {
+    if (n < 2.0)
+      return std::numeric_limits<double>::quiet_NaN();
+    const auto cov = sum_xy - sum_x * sum_y / n;
+    const auto var_x = sum_xx - sum_x * sum_x / n;
+    const auto var_y = sum_yy - sum_y * sum_y / n;
+    if (var_x <= 0.0 || var_y <= 0.0)
+      return std::numeric_limits<double>::quiet_NaN();
+    return cov / std::sqrt(var_x * var_y);
+  }
+};
+
+// levels and coverage masks for a block of sites from every methylome
+struct level_block {
+  std::uint32_t n_sites{};
+  std::vector<std::vector<float>> levels;
+  std::vector<std::vector<float>> masks;
+};
+
+[[nodiscard]] static inline auto
+accumulate_pair(const float *x, const float *mx, const float *y,
+                const float *my, const std::uint32_t n) -> pair_stats {
+  std::array<float, corr_n_lanes> w{}, sx{}, sy{}, sxx{}, syy{}, sxy{};
+  std::uint32_t i = 0;
+  for (; i + corr_n_lanes <= n; i += corr_n_lanes)
+    for (std::uint32_t j = 0; j < corr_n_lanes; ++j) {
+      const float m = mx[i + j] * my[i + j];
+      const float a = m * x[i + j];
+      const float b = m * y[i + j];
+      w[j] += m;
+      sx[j] += a;
+      sy[j] += b;
+      sxx[j] += a * x[i + j];
+      syy[j] += b * y[i + j];
+      sxy[j] += a * y[i + j];
+    }
+  for (std::uint32_t j = 0; i < n; ++i, ++j) {
+    const float m = mx[i] * my[i];
+    const float a = m * x[i];
+    const float b = m * y[i];
+    w[j] += m;
+    sx[j] += a;
+    sy[j] += b;
+    sxx[j] += a * x[i];
+    syy[j] += b * y[i];
+    sxy[j] += a * y[i];
+  }
+  pair_stats s;
+  for (std::uint32_t j = 0; j < corr_n_lanes; ++j) {
+    s.n += w[j];
+    s.sum_x += sx[j];
+    s.sum_y += sy[j];
+    s.sum_xx += sxx[j];
+    s.sum_yy += syy[j];
+    s.sum_xy += sxy[j];
+  }
+  return s;
+}
+
+[[nodiscard]] static inline auto
+get_tiles(const std::uint32_t n_samples)
+  -> std::vector<std::pair<std::uint32_t, std::uint32_t>> {
+  // ADS: only tiles on or above the diagonal; the matrix is symmetric
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> tiles;
+  for (std::uint32_t i = 0; i < n_samples; i += corr_tile_dim)
+    for (std::uint32_t j = i; j < n_samples; j += corr_tile_dim)
+      tiles.emplace_back(i, j);
+  return tiles;
+}
+
+static auto
+accumulate_tiles(const level_block &blk,
+                 const std::vector<std::pair<std::uint32_t, std::uint32_t>>
+                   &tiles,
+                 const std::uint32_t thread_id, const std::uint32_t n_threads,
+                 std::vector<pair_stats> &stats) -> void {
+  const std::uint32_t n_samples = std::size(blk.levels);
+  // ADS: tiles are dealt round-robin; each tile owns its entries of
+  // the stats matrix so no synchronization is needed
+  for (auto t = thread_id; t < std::size(tiles); t += n_threads) {
+    const auto [i_beg, j_beg] = tiles[t];
+    const auto i_end = std::min(i_beg + corr_tile_dim, n_samples);
+    const auto j_end = std::min(j_beg + corr_tile_dim, n_samples);
+    for (auto i = i_beg; i < i_end; ++i)
+      for (auto j = std::max(i, j_beg); j < j_end; ++j) {
+        const auto s =
+          accumulate_pair(blk.levels[i].data(), blk.masks[i].data(),
+                          blk.levels[j].data(), blk.masks[j].data(),
+                          blk.n_sites);
+        auto &acc = stats[i * n_samples + j];
+        acc.n += s.n;
+        acc.sum_x += s.sum_x;
+        acc.sum_y += s.sum_y;
+        acc.sum_xx += s.sum_xx;
+        acc.sum_yy += s.sum_yy;
+        acc.sum_xy += s.sum_xy;
+      }
+  }
+}
+
+// ADS: the threads that accumulate tiles are started once for all
+// blocks; for each block they wait at a barrier until the levels are
+// read, and again until every tile is done so the next block can be
+// read into the same buffers. The calling thread does the share of
+// thread 0.
+struct tile_workers {
+  tile_workers(const level_block &blk,
+               const std::vector<std::pair<std::uint32_t, std::uint32_t>>
+                 &tiles,
+               const std::uint32_t n_threads, std::vector<pair_stats> &stats) :
+    blk{blk}, tiles{tiles}, n_threads{n_threads}, stats{stats},
+    sync(n_threads) {
+    for (std::uint32_t i = 1; i < n_threads; ++i)
+      threads.emplace_back([this, i] {
+        while (true) {
+          sync.arrive_and_wait();
+          if (done)
+            return;
+          accumulate_tiles(this->blk, this->tiles, i, this->n_threads,
+                           this->stats);
+          sync.arrive_and_wait();
+        }
+      });
+  }
+
+  tile_workers(const tile_workers &) = delete;
+  auto
+  operator=(const tile_workers &) -> tile_workers & = delete;
+
+  ~tile_workers() {
+    done = true;
+    sync.arrive_and_wait();
+  }
+
+  // accumulate the block currently in blk
+  auto
+  run() -> void {
+    sync.arrive_and_wait();
+    accumulate_tiles(blk, tiles, 0, n_threads, stats);
+    sync.arrive_and_wait();
+  }
+
+  const level_block &blk;
+  const std::vector<std::pair<std::uint32_t, std::uint32_t>> &tiles;
+  std::uint32_t n_threads{};
+  std::vector<pair_stats> &stats;
+  std::barrier<> sync;
+  bool done{};
+  // ADS: declared last so the threads are joined before the barrier
+  // is destroyed
+  std::vector<std::jthread> threads;
+};
+
+template <typename T>
+static inline auto
+to_levels(const T b, const T e, const std::uint32_t min_reads, float *levels,
+          float *mask) -> void {
+  for (auto cursor = b; cursor != e; ++cursor, ++levels, ++mask) {
+    const counts_res c = *cursor;
+    const auto n_reads = c.n_meth + c.n_unmeth;
+    const bool covered = n_reads >= min_reads && n_reads > 0;
+    *levels = covered ? static_cast<float>(c.n_meth) / n_reads : 0.0f;
+    *mask = covered;
+  }
+}
+
+// ADS: source of levels for one methylome; uncompressed methylomes
+// at CpG resolution with 16-bit counts are streamed from disk one
+// block at a time, while others must be read in full, and bins are always
+// computed in memory before starting.
+struct level_source {
+  std::ifstream in;
+  methylome meth;
+  std::vector<counts_res> bins;
+  methylome::vec buf;
+  bool streamed{};
+
+  [[nodiscard]] auto
+  get_block(const std::uint32_t offset, const std::uint32_t n,
+            const std::uint32_t min_reads, float *levels,
+            float *mask) -> std::error_code {
+    const auto to_counts = [](const auto &x) {
+      return counts_res{x.first, x.second};
+    };
+    if (!std::empty(bins)) {
+      const auto b = std::cbegin(bins) + offset;
+      to_levels(b, b + n, min_reads, levels, mask);
+      return {};
+    }
+    if (streamed) {
+      buf.resize(n);
+      in.read(reinterpret_cast<char *>(buf.data()), n * methylome::record_size);
+      if (!in)
+        return std::make_error_code(std::errc::io_error);
+      const auto counts = buf | std::views::transform(to_counts);
+      to_levels(std::cbegin(counts), std::cend(counts), min_reads, levels,
+                mask);
+      return {};
+    }
+    const auto counts =
+      meth.cpgs | std::views::drop(offset) | std::views::take(n) |
+      std::views::transform(to_counts);
+    to_levels(std::cbegin(counts), std::cend(counts), min_reads, levels, mask);
+    return {};
+  }
+};
+
+[[nodiscard]] static auto
+open_level_source(const std::string &meth_file, const cpg_index &index,
+                  const cpg_index_meta &cim, const std::uint32_t bin_size,
+                  level_source &src) -> std::error_code {
+  const auto meta_file = get_default_methylome_metadata_filename(meth_file);
+  const auto [meta, meta_err] = methylome_metadata::read(meta_file);
+  if (meta_err)
+    return meta_err;
+  if (meta.n_cpgs != cim.n_cpgs || meta.index_hash != cim.index_hash)
+    return methylome_metadata_error::inconsistent;
+
+  if (bin_size == 0 && !meta.is_compressed &&
+      meta.count_width == methylome::default_count_width) {
+    std::error_code ec;
+    const auto filesize = std::filesystem::file_size(meth_file, ec);
+    if (ec)
+      return ec;
+    src.in.open(meth_file, std::ios::binary);
+    if (!src.in)
+      return std::make_error_code(std::errc(errno));
+    // ADS: this skips the header of a v2 file
+    const auto [hdr, hdr_err] = methylome_file_header::read(src.in, filesize);
+    if (hdr_err)
+      return hdr_err;
+    src.streamed = true;
+    return {};
+  }
+  auto [meth, meth_err] = methylome::read(meth_file, meta);
+  if (meth_err)
+    return meth_err;
+  if (bin_size == 0)
+    src.meth = std::move(meth);
+  else
+    src.bins = meth.get_bins(bin_size, index, cim);
+  return {};
+}
+
+[[nodiscard]] static auto
+write_matrix(const std::string &outfile, const std::vector<std::string> &names,
+             const std::vector<double> &matrix) -> std::error_code {
+  std::ofstream out(outfile);
+  if (!out)
+    return std::make_error_code(std::errc(errno));
+  const auto n_samples = std::size(names);
+  std::print(out, "{}", "sample");
+  for (const auto &name : names)
+    std::print(out, "\t{}", name);
+  std::print(out, "\n");
+  for (std::size_t i = 0; i < n_samples; ++i) {
+    std::print(out, "{}", names[i]);
+    for (std::size_t j = 0; j < n_samples; ++j)
+      std::print(out, "\t{:.6f}", matrix[i * n_samples + j]);
+    std::print(out, "\n");
+  }
+  return out ? std::error_code{} : std::make_error_code(std::errc(errno));
+}
+
+[[nodiscard]] static auto
+write_matrix_binary(const std::string &outfile,
+                    const std::vector<double> &matrix) -> std::error_code {
+  std::ofstream out(outfile, std::ios::binary);
+  if (!out)
+    return std::make_error_code(std::errc(errno));
+  out.write(reinterpret_cast<const char *>(matrix.data()),
+            std::size(matrix) * sizeof(double));
+  return out ? std::error_code{} : std::make_error_code(std::errc(errno));
+}
+
+auto
+command_corr_main(int argc, char *argv[]) -> int {
+  static constexpr auto command = "corr";
+  static const auto usage =
+    std::format("Usage: xfrase {} [options]\n", strip(command));
+  static const auto about_msg =
+    std::format("xfrase {}: {}", strip(command), strip(about));
+  static const auto description_msg =
+    std::format("{}\n{}", strip(description), strip(examples));
+
+  xfrase_log_level log_level{};
+  std::string index_file{};
+  std::string outfile{};
+  std::string binary_outfile{};
+  std::uint32_t bin_size{};
+  std::uint32_t min_reads{};
+  std::uint32_t n_threads{};
+
+  namespace po = boost::program_options;
+
+  po::options_description desc("Options");
+  desc.add_options()
+    // clang-format off
+    ("help,h", "print this message and exit")
+    ("index,x", po::value(&index_file)->required(), "index file")
+    ("methylomes,m", po::value<std::vector<std::string>>()->multitoken()->required(),
+     "methylome files")
+    ("output,o", po::value(&outfile)->required(), "output file")
+    ("binary", po::value(&binary_outfile), "also write the matrix as binary")
+    ("bin-size,b", po::value(&bin_size)->default_value(0),
+     "size of bins (0 for individual sites)")
+    ("min-reads,r", po::value(&min_reads)->default_value(1),
+     "min reads for a site or bin to be used")
+    ("threads,t", po::value(&n_threads)->default_value(1), "number of threads")
+    ("log-level,v", po::value(&log_level)->default_value(logger::default_level),
+     "log level {debug,info,warning,error,critical}")
+    // clang-format on
+    ;
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("help") || argc == 1) {
+      std::println("{}\n{}", about_msg, usage);
+      desc.print(std::cout);
+      std::println("\n{}", description_msg);
+      return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+  }
+  catch (po::error &e) {
+    std::println("{}", e.what());
+    std::println("{}\n{}", about_msg, usage);
+    desc.print(std::cout);
+    std::println("\n{}", description_msg);
+    return EXIT_FAILURE;
+  }
+
+  logger &lgr = logger::instance(shared_from_cout(), command, log_level);
+  if (!lgr) {
+    std::println("Failure initializing logging: {}.", lgr.get_status());
+    return EXIT_FAILURE;
+  }
+
+  const auto meth_files = vm["methylomes"].as<std::vector<std::string>>();
+  const std::uint32_t n_samples = std::size(meth_files);
+  n_threads = std::max(n_threads, 1u);
+
+  std::vector<std::tuple<std::string, std::string>> args_to_log{
+    // clang-format off
+    {"Index", index_file},
+    {"Output", outfile},
+    {"Binary output", binary_outfile},
+    {"Binsize", std::format("{}", bin_size)},
+    {"Min reads", std::format("{}", min_reads)},
+    {"Threads", std::format("{}", n_threads)},
+    {"Number of methylomes", std::format("{}", n_samples)},
+    // clang-format on
+  };
+  log_args<xfrase_log_level::info>(args_to_log);
+
+  std::vector<std::tuple<std::string, std::string>> filenames_to_log;
+  for (const auto [i, filename] : std::views::enumerate(meth_files))
+    filenames_to_log.emplace_back(std::format("Methylome{}", i), filename);
+  log_args<xfrase_log_level::debug>(filenames_to_log);
+
+  const auto [index, cim, index_read_err] = read_cpg_index(index_file);
+  if (index_read_err) {
+    lgr.error("Failed to read cpg index: {} ({})", index_file, index_read_err);
+    return EXIT_FAILURE;
+  }
+
+  const auto prepare_start = std::chrono::high_resolution_clock::now();
+  std::vector<level_source> sources(n_samples);
+  for (const auto [meth_file, src] : std::views::zip(meth_files, sources))
+    if (const auto err =
+          open_level_source(meth_file, index, cim, bin_size, src)) {
+      lgr.error("Error reading methylome {}: {}", meth_file, err);
+      return EXIT_FAILURE;
+    }
+  const auto prepare_stop = std::chrono::high_resolution_clock::now();
+
+  const std::uint32_t n_sites =
+    bin_size == 0 ? cim.n_cpgs : cim.get_n_bins(bin_size);
+  lgr.debug("Number of {}: {}", bin_size == 0 ? "sites" : "bins", n_sites);
+
+  level_block blk;
+  blk.levels.resize(n_samples, std::vector<float>(corr_block_size));
+  blk.masks.resize(n_samples, std::vector<float>(corr_block_size));
+
+  const auto tiles = get_tiles(n_samples);
+  n_threads = std::min(n_threads, static_cast<std::uint32_t>(std::size(tiles)));
+  std::vector<pair_stats> stats(n_samples * n_samples);
+
+  tile_workers workers(blk, tiles, n_threads, stats);
+  double read_time{};
+  double accumulate_time{};
+  for (std::uint32_t offset = 0; offset < n_sites; offset += corr_block_size) {
+    blk.n_sites = std::min(corr_block_size, n_sites - offset);
+    const auto read_start = std::chrono::high_resolution_clock::now();
+    for (std::uint32_t i = 0; i < n_samples; ++i)
+      if (const auto err =
+            sources[i].get_block(offset, blk.n_sites, min_reads,
+                                 blk.levels[i].data(), blk.masks[i].data())) {
+        lgr.error("Error reading methylome {}: {}", meth_files[i], err);
+        return EXIT_FAILURE;
+      }
+    const auto read_stop = std::chrono::high_resolution_clock::now();
+    workers.run();
+    const auto accumulate_stop = std::chrono::high_resolution_clock::now();
+    read_time += duration(read_start, read_stop);
+    accumulate_time += duration(read_stop, accumulate_stop);
+  }
+
+  std::vector<double> matrix(n_samples * n_samples);
+  for (std::uint32_t i = 0; i < n_samples; ++i)
+    for (std::uint32_t j = i; j < n_samples; ++j)
+      matrix[i * n_samples + j] = matrix[j * n_samples + i] =
+        stats[i * n_samples + j].corr();
+
+  std::vector<std::string> names;
+  for (const auto &meth_file : meth_files)
+    names.emplace_back(std::filesystem::path(meth_file).stem().string());
+
+  if (const auto err = write_matrix(outfile, names, matrix)) {
+    lgr.error("Error writing output {}: {}", outfile, err);
+    return EXIT_FAILURE;
+  }
+  if (!binary_outfile.empty())
+    if (const auto err = write_matrix_binary(binary_outfile, matrix)) {
+      lgr.error("Error writing output {}: {}", binary_outfile, err);
+      return EXIT_FAILURE;
+    }
+
+  std::vector<std::tuple<std::string, std::string>> timing_to_log{
+    // clang-format off
+    {"prepare time", std::format("{:.3}s", duration(prepare_start, prepare_stop))},
+    {"read time", std::format("{:.3}s", read_time)},
+    {"accumulate time", std::format("{:.3}s", accumulate_time)},
+    // clang-format on
+  };
+  log_args<xfrase_log_level::debug>(timing_to_log);
+
+  return EXIT_SUCCESS;
+}
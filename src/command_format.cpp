@@ -39,7 +39,12 @@ json_pp). These two files should reside in the same directory and
 typically only the methylome data file is specified when it is used.
 If xfrase is used remotely, the methylome will reside on the server.  If
 you are analyzing your own DNA methylation data, you will need to
-format your methylomes with this command.
+format your methylomes with this command. For samples with few reads
+at each site, a count width of 8 bits halves the size of the methylome
+on disk; counts at any site with more than 255 reads are rounded. A
+version 2 methylome file starts with a header holding what the server
+needs from the metadata, so the server can load it with one open; the
+metadata file is still written.
 )";
 
 static constexpr auto examples = R"(
@@ -263,7 +268,7 @@ process_cpg_sites(const std::string &infile, const cpg_index &index,
     cpgs_flat.insert(std::end(cpgs_flat), std::cbegin(c), std::cend(c));
 
   // tuple is move-returned, but making the tuple would copy
-  return {methylome{std::move(cpgs_flat)}, std::error_code{}};
+  return {methylome{std::move(cpgs_flat), {}}, std::error_code{}};
 }
 
 static auto
@@ -344,7 +349,7 @@ process_cpg_sites_counts(const std::string &infile, const cpg_index &index,
     cpgs_flat.insert(std::end(cpgs_flat), std::cbegin(c), std::cend(c));
 
   // tuple is move-returned, but making the tuple would copy
-  return {methylome{std::move(cpgs_flat)}, std::error_code{}};
+  return {methylome{std::move(cpgs_flat), {}}, std::error_code{}};
 }
 
 auto
@@ -364,6 +369,8 @@ command_format_main(int argc, char *argv[]) -> int {
   std::string index_file{};
   xfrase_log_level log_level{};
   bool zip{false};
+  std::uint32_t count_width{};
+  std::uint32_t file_version{};
 
   namespace po = boost::program_options;
 
@@ -377,6 +384,11 @@ command_format_main(int argc, char *argv[]) -> int {
     ("output,o", po::value(&methylome_output)->required(),
      std::format("output file (must end in {})", methylome::filename_extension).data())
     ("zip,z", po::bool_switch(&zip), "zip the output")
+    ("count-width", po::value(&count_width)
+     ->default_value(methylome::default_count_width),
+     "bits per stored count, 16 or 8 (8 rounds deep sites)")
+    ("file-version", po::value(&file_version)->default_value(1),
+     "methylome file version, 1 or 2 (2 starts with a header)")
     ("log-level,v", po::value(&log_level)->default_value(logger::default_level),
      "log level {debug,info,warning,error,critical}")
     // clang-format on
@@ -406,6 +418,15 @@ command_format_main(int argc, char *argv[]) -> int {
     return EXIT_FAILURE;
   }
 
+  if (!methylome::is_valid_count_width(count_width)) {
+    lgr.error("Count width must be 16 or 8 (given: {})", count_width);
+    return EXIT_FAILURE;
+  }
+  if (file_version != 1 && file_version != 2) {
+    lgr.error("File version must be 1 or 2 (given: {})", file_version);
+    return EXIT_FAILURE;
+  }
+
   const auto output_check = check_output_file(methylome_output);
   if (output_check) {
     lgr.error("Methylome output file {}: {}", methylome_output);
@@ -430,6 +451,8 @@ command_format_main(int argc, char *argv[]) -> int {
     {"Methylome output", methylome_output},
     {"Metadata output", metadata_output},
     {"Zip", std::format("{}", zip)},
+    {"Count width", std::format("{}", count_width)},
+    {"File version", std::format("{}", file_version)},
     // clang-format on
   };
   log_args<xfrase_log_level::info>(args_to_log);
@@ -447,7 +470,7 @@ command_format_main(int argc, char *argv[]) -> int {
   }
   lgr.info("Input file format: {}", message(format_id));
 
-  const auto [meth, meth_err] =
+  auto [meth, meth_err] =
     (format_id == counts_format::xcounts)
       ? process_cpg_sites(methylation_input, index, cim)
       : process_cpg_sites_counts(methylation_input, index, cim);
@@ -457,14 +480,23 @@ command_format_main(int argc, char *argv[]) -> int {
     return EXIT_FAILURE;
   }
 
-  const auto [meta, meta_err] = methylome_metadata::init(cim, meth, zip);
+  // ADS: rounding comes before the metadata so checksums are of the
+  // counts as stored
+  meth.round_to_width(count_width);
+
+  auto [meta, meta_err] = methylome_metadata::init(cim, meth, zip);
   if (meta_err) {
     lgr.error("Error initializing metadata: {}", meta_err);
     return EXIT_FAILURE;
   }
-
-  if (const auto write_err = meth.write(methylome_output, zip); write_err) {
-    lgr.error("Error writing methylome {}: {}", methylome_output, write_err);
+  meta.count_width = count_width;
+
+  const auto meth_write_err =
+    file_version == 2 ? meth.write_v2(methylome_output, meta)
+                      : meth.write(methylome_output, zip, count_width);
+  if (meth_write_err) {
+    lgr.error("Error writing methylome {}: {}", methylome_output,
+              meth_write_err);
     return EXIT_FAILURE;
   }
 
@@ -44,6 +44,7 @@ xfrase intervals local -x hg38.cpg_idx -o output.bed -m methylome.m16 -i input.b
 xfrase intervals remote -x hg38.cpg_idx -o output.bed -s example.com -a SRX012345 -i input.bed
 )";
 
+#include "block_cache.hpp"
 #include "client.hpp"
 #include "cpg_index.hpp"
 #include "cpg_index_meta.hpp"
@@ -89,6 +90,8 @@ do_remote_intervals(const std::string &accession, const cpg_index_meta &cim,
 
   if constexpr (std::is_same<counts_res_type, counts_res>::value)
     hdr.rq_type = request_header::request_type::counts;
+  else if constexpr (std::is_same<counts_res_type, counts_res_ext>::value)
+    hdr.rq_type = request_header::request_type::counts_ext;
   else
     hdr.rq_type = request_header::request_type::counts_cov;
 
@@ -102,6 +105,51 @@ do_remote_intervals(const std::string &accession, const cpg_index_meta &cim,
   return {std::move(cl.take_counts()), {}};
 }
 
+// ADS: the server has the intervals, so only the name of the set is
+// sent along with the number of intervals and their checksum as a
+// check
+template <typename counts_res_type>
+[[nodiscard]] static inline auto
+do_remote_named_intervals(const std::string &accession,
+                          const cpg_index_meta &cim,
+                          const std::string &interval_set,
+                          const std::vector<genomic_interval> &gis,
+                          const std::string &hostname, const std::string &port)
+  -> std::tuple<std::vector<counts_res_type>, std::error_code> {
+  request_header hdr{accession, cim.n_cpgs, {}};
+
+  if constexpr (std::is_same<counts_res_type, counts_res>::value)
+    hdr.rq_type = request_header::request_type::named_counts;
+  else if constexpr (std::is_same<counts_res_type, counts_res_ext>::value)
+    hdr.rq_type = request_header::request_type::named_counts_ext;
+  else
+    hdr.rq_type = request_header::request_type::named_counts_cov;
+
+  const std::uint32_t n_intervals = std::size(gis);
+  named_request req{interval_set, n_intervals, get_intervals_hash(gis)};
+  xfrase::client<counts_res_type, named_request> cl(hostname, port, hdr, req);
+  const auto status = cl.run();
+  if (status) {
+    logger::instance().error("Transaction status: {}", status);
+    return {{}, status};
+  }
+  return {std::move(cl.take_counts()), {}};
+}
+
+// ADS: the same kernels for a local methylome or one from the cache
+template <typename counts_res_type>
+[[nodiscard]] static inline auto
+get_counts_for(const methylome &meth,
+               const std::vector<methylome::offset_pair> &offsets)
+  -> std::vector<counts_res_type> {
+  if constexpr (std::is_same<counts_res_type, counts_res_ext>::value)
+    return meth.get_counts_ext(offsets);
+  else if constexpr (std::is_same<counts_res_type, counts_res_cov>::value)
+    return meth.get_counts_cov(offsets);
+  else
+    return meth.get_counts(offsets);
+}
+
 template <typename counts_res_type>
 [[nodiscard]] static inline auto
 do_local_intervals(const std::string &meth_file,
@@ -119,10 +167,69 @@ do_local_intervals(const std::string &meth_file,
     lgr.error("Error reading file {}: {}", meth_file, meth_err);
     return {{}, meth_err};
   }
-  if constexpr (std::is_same<counts_res_type, counts_res_cov>::value)
-    return {std::move(meth.get_counts_cov(offsets)), {}};
-  else
-    return {std::move(meth.get_counts(offsets)), {}};
+  return {get_counts_for<counts_res_type>(meth, offsets), {}};
+}
+
+// ADS: blocks of the methylome covering the offsets are fetched from
+// the server only if they are not already in the cache, so queries
+// over regions seen before need no network beyond the hash request
+template <typename counts_res_type>
+[[nodiscard]] static inline auto
+do_cached_intervals(const std::string &accession, const cpg_index_meta &cim,
+                    const std::vector<methylome::offset_pair> &offsets,
+                    const std::string &hostname, const std::string &port,
+                    const std::string &cache_dir)
+  -> std::tuple<std::vector<counts_res_type>, std::error_code> {
+  logger &lgr = logger::instance();
+
+  request_header hash_hdr{accession, cim.n_cpgs,
+                          request_header::request_type::methylome_hash};
+  request hash_req{};
+  xfrase::client<std::uint64_t, request> hash_cl(hostname, port, hash_hdr,
+                                                 hash_req);
+  if (const auto status = hash_cl.run()) {
+    lgr.error("Transaction status: {}", status);
+    return {{}, status};
+  }
+  const auto hash = hash_cl.take_counts();
+  if (std::size(hash) != 1) {
+    lgr.error("Unexpected response to methylome hash request");
+    return {{}, std::make_error_code(std::errc::bad_message)};
+  }
+
+  auto [cache, cache_err] = block_cache::open(cache_dir, hash.front(),
+                                              cim.n_cpgs);
+  if (cache_err) {
+    lgr.error("Failed to open block cache in {}: {}", cache_dir, cache_err);
+    return {{}, cache_err};
+  }
+
+  const auto missing = cache.get_missing(offsets);
+  lgr.debug("Block ranges to fetch for {}: {}", accession, std::size(missing));
+  if (!missing.empty()) {
+    request_header raw_hdr{accession, cim.n_cpgs,
+                           request_header::request_type::raw_counts};
+    request raw_req{static_cast<std::uint32_t>(std::size(missing)), missing};
+    xfrase::client<methylome::m_elem, request> raw_cl(hostname, port, raw_hdr,
+                                                      raw_req);
+    if (const auto status = raw_cl.run()) {
+      lgr.error("Transaction status: {}", status);
+      return {{}, status};
+    }
+    if (const auto add_err = cache.add(missing, raw_cl.take_counts())) {
+      lgr.error("Failed to add blocks to cache {}: {}", cache.data_filename,
+                add_err);
+      return {{}, add_err};
+    }
+  }
+
+  const auto [meth, local_offsets, load_err] = cache.load(offsets);
+  if (load_err) {
+    lgr.error("Failed to load blocks from cache {}: {}", cache.data_filename,
+              load_err);
+    return {{}, load_err};
+  }
+  return {get_counts_for<counts_res_type>(meth, local_offsets), {}};
 }
 
 static inline auto
@@ -154,16 +261,24 @@ static auto
 do_intervals(const std::string &accession, const cpg_index_meta &cim,
              const std::vector<methylome::offset_pair> &offsets,
              const std::string &hostname, const std::string &port,
-             const std::string &meth_file, const std::string &meth_meta_file,
-             std::ostream &out, const std::vector<genomic_interval> &gis,
-             const bool write_scores,
+             const std::string &interval_set, const std::string &cache_dir,
+             const std::string &meth_file,
+             const std::string &meth_meta_file, std::ostream &out,
+             const std::vector<genomic_interval> &gis,
+             const std::vector<std::uint32_t> &order, const bool write_scores,
              const bool remote_mode) -> std::error_code {
   const auto intervals_start{std::chrono::high_resolution_clock::now()};
   const auto [results, intervals_err] =
-    remote_mode
+    !remote_mode
+      ? do_local_intervals<counts_res_type>(meth_file, meth_meta_file, offsets)
+    : !cache_dir.empty()
+      ? do_cached_intervals<counts_res_type>(accession, cim, offsets, hostname,
+                                             port, cache_dir)
+    : interval_set.empty()
       ? do_remote_intervals<counts_res_type>(accession, cim, offsets, hostname,
                                              port)
-      : do_local_intervals<counts_res_type>(meth_file, meth_meta_file, offsets);
+      : do_remote_named_intervals<counts_res_type>(
+          accession, cim, interval_set, gis, hostname, port);
   const auto intervals_stop{std::chrono::high_resolution_clock::now()};
   logger::instance().debug("Elapsed time for query: {:.3}s",
                            duration(intervals_start, intervals_stop));
@@ -172,7 +287,12 @@ do_intervals(const std::string &accession, const cpg_index_meta &cim,
     return std::make_error_code(std::errc::invalid_argument);
 
   const auto output_start{std::chrono::high_resolution_clock::now()};
-  const auto write_err = write_output(out, gis, cim, results, write_scores);
+  // ADS: results for intervals that were sorted go back in input order
+  const auto write_err =
+    order.empty()
+      ? write_output(out, gis, cim, results, write_scores)
+      : write_output(out, restore_input_order(gis, order), cim,
+                     restore_input_order(results, order), write_scores);
   const auto output_stop{std::chrono::high_resolution_clock::now()};
   // ADS: elapsed time for output will include conversion to scores
   logger::instance().debug("Elapsed time for output: {:.3}s",
@@ -194,12 +314,16 @@ command_intervals_main(int argc, char *argv[]) -> int {
 
   bool write_scores{};
   bool count_covered{};
+  bool extended_stats{};
+  std::uint32_t n_threads{};
   std::string port{};
   std::string accession{};
   std::string index_file{};
   std::string meth_file{};
   std::string meth_meta_file{};
   std::string intervals_file{};
+  std::string interval_set{};
+  std::string cache_dir{};
   std::string hostname{};
   std::string output_file{};
   xfrase_log_level log_level{};
@@ -225,6 +349,8 @@ command_intervals_main(int argc, char *argv[]) -> int {
     ("help,h", "print this message and exit")
     ("index,x", po::value(&index_file)->required(), "index file")
     ("intervals,i", po::value(&intervals_file)->required(), "intervals file")
+    ("threads,t", po::value(&n_threads)->default_value(1),
+     "threads for sorting intervals that are not sorted")
     ("log-level,v", po::value(&log_level)->default_value(logger::default_level),
      "log level {debug,info,warning,error,critical}")
     ;
@@ -232,6 +358,8 @@ command_intervals_main(int argc, char *argv[]) -> int {
   output.add_options()
     ("output,o", po::value(&output_file)->required(), "output file")
     ("covered", po::bool_switch(&count_covered), "count covered sites per interval")
+    ("extended", po::bool_switch(&extended_stats),
+     "also covered sites, sites, mean and variance of site levels")
     ("score", po::bool_switch(&write_scores), "weighted methylation bedgraph format")
     ;
   po::options_description remote("Remote");
@@ -239,6 +367,10 @@ command_intervals_main(int argc, char *argv[]) -> int {
     ("hostname,s", po::value(&hostname)->required(), "server hostname")
     ("port,p", po::value(&port)->default_value(default_port), "port")
     ("accession,a", po::value(&accession)->required(), "methylome accession")
+    ("interval-set", po::value(&interval_set),
+     "name of the intervals on the server (intervals file is not sent)")
+    ("cache-dir", po::value(&cache_dir),
+     "keep methylome blocks here and count locally")
     ;
   po::options_description local("Local");
   local.add_options()
@@ -306,11 +438,14 @@ command_intervals_main(int argc, char *argv[]) -> int {
     {"Intervals", intervals_file},
     {"Output", output_file},
     {"Covered", std::format("{}", count_covered)},
+    {"Extended", std::format("{}", extended_stats)},
     {"Bedgraph", std::format("{}", write_scores)},
   };
   std::vector<std::tuple<std::string, std::string>> remote_args{
     {"Hostname:port", std::format("{}:{}", hostname, port)},
     {"Accession", accession},
+    {"Interval set", interval_set},
+    {"Cache dir", cache_dir},
   };
   std::vector<std::tuple<std::string, std::string>> local_args{
     {"Methylome", meth_file},
@@ -328,14 +463,21 @@ command_intervals_main(int argc, char *argv[]) -> int {
   lgr.debug("Number of CpGs in index: {}", cim.n_cpgs);
 
   // Read query intervals and validate them
-  const auto [gis, ec] = genomic_interval::load(cim, intervals_file);
+  auto [gis, ec] = genomic_interval::load(cim, intervals_file);
   if (ec) {
     lgr.error("Error reading intervals file: {} ({})", intervals_file, ec);
     return EXIT_FAILURE;
   }
+  // ADS: offsets are found for sorted intervals; 'order' puts results
+  // back in the order of the input
+  std::vector<std::uint32_t> order;
   if (!intervals_sorted(cim, gis)) {
-    lgr.error("Intervals not sorted: {}", intervals_file);
-    return EXIT_FAILURE;
+    lgr.info("Intervals not sorted; sorting: {}", intervals_file);
+    const auto sort_start{std::chrono::high_resolution_clock::now()};
+    order = sort_intervals(gis, n_threads);
+    const auto sort_stop{std::chrono::high_resolution_clock::now()};
+    lgr.debug("Elapsed time to sort intervals: {:.3}s",
+              duration(sort_start, sort_stop));
   }
   if (!intervals_valid(gis)) {
     lgr.error("Intervals not valid: {} (negative size found)", intervals_file);
@@ -343,9 +485,12 @@ command_intervals_main(int argc, char *argv[]) -> int {
   }
   lgr.info("Number of intervals: {}", size(gis));
 
-  // Convert intervals into offsets
+  // Convert intervals into offsets; the server has the offsets for a
+  // named interval set
   const auto get_offsets_start{std::chrono::high_resolution_clock::now()};
-  const auto offsets = index.get_offsets(cim, gis);
+  const auto offsets = remote_mode && !interval_set.empty() && cache_dir.empty()
+                         ? std::vector<methylome::offset_pair>{}
+                         : index.get_offsets(cim, gis);
   const auto get_offsets_stop{std::chrono::high_resolution_clock::now()};
   lgr.debug("Elapsed time to get offsets: {:.3}s",
             duration(get_offsets_start, get_offsets_stop));
@@ -358,13 +503,20 @@ command_intervals_main(int argc, char *argv[]) -> int {
   }
 
   const auto intervals_err =
-    count_covered
+    extended_stats
+      ? do_intervals<counts_res_ext>(accession, cim, offsets, hostname, port,
+                                     interval_set, cache_dir, meth_file,
+                                     meth_meta_file, out, gis, order,
+                                     write_scores, remote_mode)
+    : count_covered
       ? do_intervals<counts_res_cov>(accession, cim, offsets, hostname, port,
-                                     meth_file, meth_meta_file, out, gis,
+                                     interval_set, cache_dir, meth_file,
+                                     meth_meta_file, out, gis, order,
                                      write_scores, remote_mode)
       : do_intervals<counts_res>(accession, cim, offsets, hostname, port,
-                                 meth_file, meth_meta_file, out, gis,
-                                 write_scores, remote_mode);
+                                 interval_set, cache_dir, meth_file,
+                                 meth_meta_file, out, gis, order, write_scores,
+                                 remote_mode);
 
   return intervals_err == std::errc() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,347 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "command_matrix.hpp"
+
+static constexpr auto about = R"(
+build or query a matrix of bins for many methylomes
+)";
+
+static constexpr auto description = R"(
+The matrix command has two modes, build and query. The build mode
+computes bins of one size for each of many methylomes, all for the
+same reference genome, and writes them to one bins matrix file, with
+bins in chunks along the genome and compressed separately for each
+methylome. The query mode gives the methylation levels in the bins
+that overlap the given regions for all or some of the methylomes in a
+bins matrix, and reads only the chunks covering those regions for
+those methylomes. The output has one line for each bin and one column
+for each methylome, with NA for bins that have no reads. The sample
+names are the methylome filenames without the extension.
+)";
+
+static constexpr auto examples = R"(
+Examples:
+
+xfrase matrix build -x hg38.cpg_idx -o cohort.bmx -b 1000 -m SRX012345.m16 SRX012346.m16
+xfrase matrix query -x hg38.cpg_idx -i cohort.bmx -o output.tsv -r chr1:1000000-2000000
+xfrase matrix query -x hg38.cpg_idx -i cohort.bmx -o output.tsv -r chr2 -a SRX012346
+)";
+
+#include "bins_matrix.hpp"
+#include "cpg_index.hpp"
+#include "cpg_index_meta.hpp"
+#include "genomic_interval.hpp"
+#include "logger.hpp"
+#include "methylome_metadata.hpp"
+#include "methylome_results_types.hpp"
+#include "utilities.hpp"  // duration()
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>  // for std::min
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>  // for EXIT_FAILURE, EXIT_SUCCESS
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <print>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+[[nodiscard]] static auto
+do_build(const string &index_file, const string &outfile,
+         const std::uint32_t bin_size, const std::uint32_t chunk_size,
+         const vector<string> &meth_files) -> std::error_code {
+  auto &lgr = logger::instance();
+  const auto [index, cim, index_read_err] = read_cpg_index(index_file);
+  if (index_read_err) {
+    lgr.error("Failed to read cpg index: {} ({})", index_file, index_read_err);
+    return index_read_err;
+  }
+
+  vector<bins_matrix::source> sources;
+  for (const auto &meth_file : meth_files)
+    sources.push_back({
+      std::filesystem::path(meth_file).stem().string(),
+      meth_file,
+      get_default_methylome_metadata_filename(meth_file),
+    });
+
+  const auto build_start = std::chrono::high_resolution_clock::now();
+  const auto build_err =
+    bins_matrix::build(outfile, index, cim, bin_size, chunk_size, sources);
+  const auto build_stop = std::chrono::high_resolution_clock::now();
+  if (build_err) {
+    lgr.error("Error building bins matrix {}: {}", outfile, build_err);
+    return build_err;
+  }
+  lgr.debug("Bins matrix build time: {}s", duration(build_start, build_stop));
+  return {};
+}
+
+[[nodiscard]] static auto
+write_region(std::ostream &out, const bins_matrix &matrix,
+             const cpg_index_meta &cim, const genomic_interval &region,
+             const vector<std::uint32_t> &sample_indexes) -> std::error_code {
+  const auto [first, last] = matrix.get_bin_range(cim, region);
+  const auto [counts, read_err] = matrix.read(sample_indexes, first, last);
+  if (read_err)
+    return read_err;
+
+  const auto &chrom = cim.chrom_order[region.ch_id];
+  const auto chrom_size = cim.chrom_size[region.ch_id];
+  // ADS: bins in a region are consecutive, so the first bin of the
+  // chrom is found from the bin holding the region start
+  const auto chrom_first = first - region.start / matrix.bin_size;
+  const auto n = last - first;
+  for (auto b = first; b < last; ++b) {
+    const auto start = (b - chrom_first) * matrix.bin_size;
+    const auto stop = std::min(start + matrix.bin_size, chrom_size);
+    std::print(out, "{}\t{}\t{}", chrom, start, stop);
+    for (std::uint32_t i = 0; i < std::size(sample_indexes); ++i) {
+      const auto &c = counts[i * n + (b - first)];
+      const auto n_reads = c.n_meth + c.n_unmeth;
+      if (n_reads == 0)
+        std::print(out, "\tNA");
+      else
+        std::print(out, "\t{:.6f}", static_cast<double>(c.n_meth) / n_reads);
+    }
+    std::print(out, "\n");
+  }
+  return out ? std::error_code{} : std::make_error_code(std::errc(errno));
+}
+
+[[nodiscard]] static auto
+do_query(const string &index_file, const string &matrix_file,
+         const string &outfile, const vector<string> &region_strs,
+         const vector<string> &accessions) -> std::error_code {
+  auto &lgr = logger::instance();
+  // ADS: only the index metadata is needed to find bins for regions
+  const auto index_meta_file = get_default_cpg_index_meta_filename(index_file);
+  const auto [cim, cim_read_err] = cpg_index_meta::read(index_meta_file);
+  if (cim_read_err) {
+    lgr.error("Failed to read cpg index metadata: {} ({})", index_meta_file,
+              cim_read_err);
+    return cim_read_err;
+  }
+
+  const auto [matrix, open_err] = bins_matrix::open(matrix_file);
+  if (open_err) {
+    lgr.error("Error opening bins matrix {}: {}", matrix_file, open_err);
+    return open_err;
+  }
+  if (matrix.index_hash != cim.index_hash) {
+    lgr.error("Bins matrix {} was not built with index {}", matrix_file,
+              index_file);
+    return bins_matrix_error::inconsistent_index;
+  }
+  lgr.debug("Bins matrix: {} samples, bin size {}, {} bins",
+            std::size(matrix.samples), matrix.bin_size, matrix.n_bins);
+
+  const auto [sample_indexes, sample_err] =
+    matrix.get_sample_indexes(accessions.empty() ? matrix.samples : accessions);
+  if (sample_err) {
+    lgr.error("Error finding samples: {}", sample_err);
+    return sample_err;
+  }
+
+  vector<genomic_interval> regions;
+  for (const auto &region_str : region_strs) {
+    const auto [region, region_err] =
+      genomic_interval::parse_region(cim, region_str);
+    if (region_err) {
+      lgr.error("Error in region {}: {}", region_str, region_err);
+      return region_err;
+    }
+    regions.push_back(region);
+  }
+
+  std::ofstream out(outfile);
+  if (!out) {
+    const auto err = std::make_error_code(std::errc(errno));
+    lgr.error("Error opening output {}: {}", outfile, err);
+    return err;
+  }
+  std::print(out, "chrom\tstart\tstop");
+  for (const auto i : sample_indexes)
+    std::print(out, "\t{}", matrix.samples[i]);
+  std::print(out, "\n");
+
+  const auto query_start = std::chrono::high_resolution_clock::now();
+  for (const auto &region : regions) {
+    const auto err = write_region(out, matrix, cim, region, sample_indexes);
+    if (err) {
+      lgr.error("Error querying bins matrix {}: {}", matrix_file, err);
+      return err;
+    }
+  }
+  const auto query_stop = std::chrono::high_resolution_clock::now();
+  lgr.debug("Bins matrix query time: {}s", duration(query_start, query_stop));
+  return {};
+}
+
+auto
+command_matrix_main(int argc, char *argv[]) -> int {
+  static constexpr auto command = "matrix";
+  static const auto usage =
+    std::format("Usage: xfrase matrix [build|query] [options]\n");
+  static const auto about_msg =
+    std::format("xfrase {}: {}", strip(command), strip(about));
+  static const auto description_msg =
+    std::format("{}\n{}", strip(description), strip(examples));
+
+  string index_file{};
+  string matrix_file{};
+  string outfile{};
+  string subcmd;
+  std::uint32_t bin_size{};
+  std::uint32_t chunk_size{};
+  xfrase_log_level log_level{};
+  vector<string> meth_files{};
+  vector<string> region_strs{};
+  vector<string> accessions{};
+
+  namespace po = boost::program_options;
+
+  po::options_description subcmds;
+  subcmds.add_options()
+    // clang-format off
+    ("subcmd", po::value(&subcmd))
+    ("subargs", po::value<vector<string>>())
+    // clang-format on
+    ;
+  // positional; one for "subcmd" and the rest else parser throws
+  po::positional_options_description p;
+  p.add("subcmd", 1).add("subargs", -1);
+
+  po::options_description general("General");
+  // clang-format off
+  general.add_options()
+    ("help,h", "print this message and exit")
+    ("index,x", po::value(&index_file)->required(), "index file")
+    ("output,o", po::value(&outfile)->required(), "output file")
+    ("log-level,v", po::value(&log_level)->default_value(logger::default_level),
+     "log level {debug,info,warning,error,critical}")
+    ;
+  po::options_description build("Build");
+  build.add_options()
+    ("bin-size,b", po::value(&bin_size)->required(), "size of bins")
+    ("chunk-size,c",
+     po::value(&chunk_size)->default_value(bins_matrix::default_chunk_size),
+     "bins in each chunk")
+    ("methylomes,m", po::value(&meth_files)->multitoken()->required(),
+     "methylome files")
+    ;
+  po::options_description query("Query");
+  query.add_options()
+    ("matrix,i", po::value(&matrix_file)->required(), "bins matrix file")
+    ("region,r", po::value(&region_strs)->multitoken()->required(),
+     "regions to query (chrom or chrom:start-stop)")
+    ("accessions,a", po::value(&accessions)->multitoken(),
+     "samples to query (default: all)")
+    ;
+  // clang-format on
+
+  po::variables_map vm_subcmd;
+  po::store(po::command_line_parser(argc, argv)
+              .options(subcmds)
+              .positional(p)
+              .allow_unregistered()
+              .run(),
+            vm_subcmd);
+  po::notify(vm_subcmd);
+
+  bool force_help_message{};
+  po::options_description all("Options");
+  if (subcmd == "build")
+    all.add(general).add(build);
+  else if (subcmd == "query")
+    all.add(general).add(query);
+  else {
+    force_help_message = true;
+    all.add(general).add(build).add(query);
+  }
+
+  try {
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc - 1, argv + 1, all), vm);
+    if (force_help_message || vm.count("help") || argc == 1 ||
+        (argc == 2 && !subcmd.empty())) {
+      if (!subcmd.empty() && subcmd != "build" && subcmd != "query")
+        std::println("One of build or query must be specified\n");
+      std::println("{}\n{}", about_msg, usage);
+      all.print(std::cout);
+      std::println("\n{}", description_msg);
+      return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+  }
+  catch (po::error &e) {
+    std::println("{}", e.what());
+    std::println("{}\n{}", about_msg, usage);
+    all.print(std::cout);
+    std::println("\n{}", description_msg);
+    return EXIT_FAILURE;
+  }
+
+  const bool build_mode = (subcmd == "build");
+
+  auto &lgr = logger::instance(shared_from_cout(), command, log_level);
+  if (!lgr) {
+    std::println("Failure initializing logging: {}.", lgr.get_status());
+    return EXIT_FAILURE;
+  }
+
+  vector<std::tuple<string, string>> args_to_log{
+    {"Index", index_file},
+    {"Output", outfile},
+  };
+  vector<std::tuple<string, string>> build_args{
+    {"Binsize", std::format("{}", bin_size)},
+    {"Chunk size", std::format("{}", chunk_size)},
+    {"Methylomes", std::format("{}", std::size(meth_files))},
+  };
+  vector<std::tuple<string, string>> query_args{
+    {"Matrix", matrix_file},
+    {"Regions", std::format("{}", std::size(region_strs))},
+    {"Accessions", std::format("{}", std::size(accessions))},
+  };
+  log_args<xfrase_log_level::info>(args_to_log);
+  log_args<xfrase_log_level::info>(build_mode ? build_args : query_args);
+
+  const auto err =
+    build_mode
+      ? do_build(index_file, outfile, bin_size, chunk_size, meth_files)
+      : do_query(index_file, matrix_file, outfile, region_strs, accessions);
+
+  return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -36,15 +36,25 @@ combined as though they were a single methylome. The input methylomes
 to be merged must all have been analyzed using the same reference
 genome. The output is a methylome: a pair of methylome data (.m16) and
 metadata files (.m16.yaml) files.
+
+With an accumulator file, the sum of the methylomes is kept with
+counts that never need rounding, along with the list of methylomes
+already merged. Inputs are added to the accumulator and methylomes
+given for removal are subtracted, each needing only one pass over that
+methylome. If the accumulator does not exist it is created. The merged
+methylome is only written if an output file is given.
 )";
 
 static constexpr auto examples = R"(
 Examples:
 
 xfrase merge -o merged.m16 -i SRX0123*.m16
+xfrase merge -a cohort.macc -i SRX012399.m16 -r SRX012345.m16
+xfrase merge -a cohort.macc -o merged.m16
 )";
 
 #include "logger.hpp"
+#include "merge_accumulator.hpp"
 #include "methylome.hpp"
 #include "methylome_metadata.hpp"
 #include "utilities.hpp"
@@ -55,6 +65,7 @@ xfrase merge -o merged.m16 -i SRX0123*.m16
 #include <algorithm>
 #include <chrono>
 #include <cstdlib>  // for EXIT_FAILURE, EXIT_SUCCESS
+#include <filesystem>
 #include <format>
 #include <iostream>
 #include <iterator>  // for std::size
@@ -89,6 +100,93 @@ verify_consistent_metadata_files(const std::vector<std::string> &meth_files)
            : methylome_metadata_error::inconsistent;
 }
 
+[[nodiscard]] static auto
+do_accumulator_merge(const std::string &acc_file,
+                     const std::vector<std::string> &to_add,
+                     const std::vector<std::string> &to_remove,
+                     const std::string &output_file,
+                     const std::string &metadata_output) -> std::error_code {
+  logger &lgr = logger::instance();
+  const auto acc_meta_file =
+    get_default_merge_accumulator_metadata_filename(acc_file);
+
+  merge_accumulator acc;
+  if (std::filesystem::exists(acc_file)) {
+    auto [tmp_acc, acc_err] = merge_accumulator::read(acc_file, acc_meta_file);
+    if (acc_err) {
+      lgr.error("Error reading accumulator {}: {}", acc_file, acc_err);
+      return acc_err;
+    }
+    acc = std::move(tmp_acc);
+  }
+  else if (!to_add.empty()) {
+    const auto meta_file = get_default_methylome_metadata_filename(to_add[0]);
+    const auto [meta, meta_err] = methylome_metadata::read(meta_file);
+    if (meta_err) {
+      lgr.error("Error reading metadata {}: {}", meta_file, meta_err);
+      return meta_err;
+    }
+    acc = merge_accumulator::init(meta);
+    lgr.info("Creating accumulator {}", acc_file);
+  }
+  else {
+    lgr.error("Accumulator {} not found and no inputs to add", acc_file);
+    return std::make_error_code(std::errc::no_such_file_or_directory);
+  }
+
+  // ADS: removing and adding only require a pass over the changed
+  // methylomes, not over all those already merged
+  const auto update = [&](const std::string &filename, const bool add) {
+    const auto [meth, meta, meth_err] = read_methylome(filename);
+    if (meth_err) {
+      lgr.error("Error reading methylome {}: {}", filename, meth_err);
+      return meth_err;
+    }
+    const auto err = add ? acc.add(meth, meta) : acc.remove(meth, meta);
+    if (err)
+      lgr.error("Error {} methylome {}: {}", add ? "adding" : "removing",
+                filename, err);
+    return err;
+  };
+
+  const auto update_start = std::chrono::high_resolution_clock::now();
+  for (const auto &filename : to_remove)
+    if (const auto err = update(filename, false))
+      return err;
+  for (const auto &filename : to_add)
+    if (const auto err = update(filename, true))
+      return err;
+  const auto update_stop = std::chrono::high_resolution_clock::now();
+  lgr.debug("Accumulator update time: {:.3}s",
+            duration(update_start, update_stop));
+  lgr.info("Methylomes in accumulator: {}",
+           std::size(acc.meta.methylome_hashes));
+
+  if (!to_add.empty() || !to_remove.empty())
+    if (const auto err = acc.write(acc_file, acc_meta_file)) {
+      lgr.error("Error writing accumulator {}: {}", acc_file, err);
+      return err;
+    }
+
+  if (output_file.empty())
+    return {};
+
+  const auto [meth, meta, meth_err] = acc.get_methylome();
+  if (meth_err) {
+    lgr.error("Error making methylome from accumulator: {}", meth_err);
+    return meth_err;
+  }
+  if (const auto err = meth.write(output_file)) {
+    lgr.error("Error writing methylome {}: {}", output_file, err);
+    return err;
+  }
+  if (const auto err = meta.write(metadata_output)) {
+    lgr.error("Error writing metadata {}: {}", metadata_output, err);
+    return err;
+  }
+  return {};
+}
+
 auto
 command_merge_main(int argc, char *argv[]) -> int {
   static constexpr auto command = "merge";
@@ -102,6 +200,7 @@ command_merge_main(int argc, char *argv[]) -> int {
   xfrase_log_level log_level{};
   std::string output_file{};
   std::string metadata_output{};
+  std::string accumulator_file{};
 
   namespace po = boost::program_options;
 
@@ -109,9 +208,12 @@ command_merge_main(int argc, char *argv[]) -> int {
   desc.add_options()
     // clang-format off
     ("help,h", "print this message and exit")
-    ("output,o", po::value(&output_file)->required(), "methylome output file")
+    ("output,o", po::value(&output_file), "methylome output file")
     ("meta,e", po::value(&metadata_output), "output metadata (default: output.json)")
-    ("input,i", po::value<std::vector<std::string>>()->multitoken()->required(), "input files")
+    ("input,i", po::value<std::vector<std::string>>()->multitoken(), "input files")
+    ("accumulator,a", po::value(&accumulator_file), "merge accumulator file")
+    ("remove,r", po::value<std::vector<std::string>>()->multitoken(),
+     "methylomes to remove from the accumulator")
     ("log-level,v", po::value(&log_level)->default_value(logger::default_level),
      "log level {debug,info,warning,error,critical}")
     // clang-format on
@@ -126,6 +228,10 @@ command_merge_main(int argc, char *argv[]) -> int {
       return EXIT_SUCCESS;
     }
     po::notify(vm);
+    if (accumulator_file.empty() &&
+        (output_file.empty() || !vm.count("input") || vm.count("remove")))
+      throw po::error("without an accumulator both output and input are "
+                      "required and remove is not allowed");
   }
   catch (po::error &e) {
     std::println("{}", e.what());
@@ -135,7 +241,7 @@ command_merge_main(int argc, char *argv[]) -> int {
     return EXIT_FAILURE;
   }
 
-  if (metadata_output.empty())
+  if (metadata_output.empty() && !output_file.empty())
     metadata_output = get_default_methylome_metadata_filename(output_file);
 
   logger &lgr = logger::instance(shared_from_cout(), command, log_level);
@@ -144,9 +250,31 @@ command_merge_main(int argc, char *argv[]) -> int {
     return EXIT_FAILURE;
   }
 
-  const auto input_files = vm["input"].as<std::vector<std::string>>();
+  const auto input_files =
+    vm.count("input") ? vm["input"].as<std::vector<std::string>>()
+                      : std::vector<std::string>{};
   const auto n_inputs = std::size(input_files);
 
+  if (!accumulator_file.empty()) {
+    const auto remove_files =
+      vm.count("remove") ? vm["remove"].as<std::vector<std::string>>()
+                         : std::vector<std::string>{};
+    std::vector<std::tuple<std::string, std::string>> args_to_log{
+      // clang-format off
+      {"Accumulator", accumulator_file},
+      {"Output", output_file},
+      {"Output metadata", metadata_output},
+      {"Number of inputs", std::format("{}", n_inputs)},
+      {"Number to remove", std::format("{}", std::size(remove_files))},
+      // clang-format on
+    };
+    log_args<xfrase_log_level::info>(args_to_log);
+    const auto err = do_accumulator_merge(accumulator_file, input_files,
+                                          remove_files, output_file,
+                                          metadata_output);
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
   std::vector<std::tuple<std::string, std::string>> args_to_log{
     // clang-format off
     {"Output", output_file},
@@ -239,6 +367,8 @@ command_merge_main(int argc, char *argv[]) -> int {
     lgr.error("Error updating metadata: {}", update_err);
     return EXIT_FAILURE;
   }
+  // ADS: sums can exceed 8 bits, so merged counts are always 16 bits
+  last_meta.count_width = methylome::default_count_width;
 
   const auto meta_outfile =
     get_default_methylome_metadata_filename(output_file);
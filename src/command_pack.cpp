@@ -0,0 +1,154 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "command_pack.hpp"
+
+static constexpr auto about = R"(
+put many methylomes into one pack file
+)";
+
+static constexpr auto description = R"(
+The pack command builds a pack file holding many methylomes along with
+their metadata, or appends methylomes to an existing pack. The
+accession for each methylome is its filename without the .m16
+extension. A server finds packs in its methylome directory, opens each
+pack once, and loads methylomes in packs without looking for their
+individual files. Methylomes may be compressed or not, and are stored
+in the pack exactly as in their files.
+)";
+
+static constexpr auto examples = R"(
+Examples:
+
+xfrase pack -o methylomes.mpk -m SRX012345.m16 SRX012346.m16
+)";
+
+#include "logger.hpp"
+#include "methylome.hpp"
+#include "methylome_metadata.hpp"
+#include "methylome_pack.hpp"
+#include "utilities.hpp"  // duration()
+
+#include <boost/program_options.hpp>
+
+#include <chrono>
+#include <cstdlib>  // for EXIT_FAILURE, EXIT_SUCCESS
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <print>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+[[nodiscard]] static inline auto
+get_accession(const std::string &methylome_file) -> std::string {
+  const auto name = std::filesystem::path(methylome_file).filename().string();
+  const std::string_view ext = methylome::filename_extension;
+  return name.ends_with(ext) ? name.substr(0, std::size(name) - std::size(ext))
+                             : name;
+}
+
+auto
+command_pack_main(int argc, char *argv[]) -> int {
+  static constexpr auto command = "pack";
+  static const auto usage =
+    std::format("Usage: xfrase {} [options]\n", strip(command));
+  static const auto about_msg =
+    std::format("xfrase {}: {}", strip(command), strip(about));
+  static const auto description_msg =
+    std::format("{}\n{}", strip(description), strip(examples));
+
+  std::string pack_file{};
+  std::vector<std::string> methylome_files{};
+  xfrase_log_level log_level{};
+
+  namespace po = boost::program_options;
+
+  po::options_description desc("Options");
+  // clang-format off
+  desc.add_options()
+    ("help,h", "print this message and exit")
+    ("output,o", po::value(&pack_file)->required(),
+     "pack file (appended if it exists)")
+    ("methylomes,m", po::value(&methylome_files)->multitoken()->required(),
+     "methylome files")
+    ("log-level,v", po::value(&log_level)->default_value(logger::default_level),
+     "log level {debug,info,warning,error,critical}")
+    ;
+  // clang-format on
+  try {
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("help") || argc == 1) {
+      std::println("{}\n{}", about_msg, usage);
+      desc.print(std::cout);
+      std::println("\n{}", description_msg);
+      return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+  }
+  catch (po::error &e) {
+    std::println("{}", e.what());
+    std::println("{}\n{}", about_msg, usage);
+    desc.print(std::cout);
+    std::println("\n{}", description_msg);
+    return EXIT_FAILURE;
+  }
+
+  auto &lgr = logger::instance(shared_from_cout(), command, log_level);
+  if (!lgr) {
+    std::println("Failure initializing logging: {}.", lgr.get_status());
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::tuple<std::string, std::string>> args_to_log{
+    // clang-format off
+    {"Pack", pack_file},
+    {"Methylomes", std::format("{}", std::size(methylome_files))},
+    // clang-format on
+  };
+  log_args<xfrase_log_level::info>(args_to_log);
+
+  std::vector<methylome_pack::source> sources;
+  for (const auto &methylome_file : methylome_files) {
+    sources.push_back({
+      get_accession(methylome_file),
+      methylome_file,
+      get_default_methylome_metadata_filename(methylome_file),
+    });
+    lgr.debug("Adding {} from {}", sources.back().accession, methylome_file);
+  }
+
+  const auto pack_start = std::chrono::high_resolution_clock::now();
+  if (const auto pack_err = methylome_pack::append(pack_file, sources)) {
+    lgr.error("Error writing pack {}: {}", pack_file, pack_err);
+    return EXIT_FAILURE;
+  }
+  const auto pack_stop = std::chrono::high_resolution_clock::now();
+  lgr.debug("Pack write time: {}s", duration(pack_start, pack_stop));
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,412 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "command_profile.hpp"
+
+static constexpr auto about = R"(
+summarize methylation levels in a profile around a set of features
+)";
+
+static constexpr auto description = R"(
+The profile command accepts a set of anchor intervals, like genes,
+and a methylome, and it generates one profile of methylation levels
+summed over all anchors. Each flank of an anchor is divided into the
+given number of bins. If body bins are requested, each anchor is
+divided into that many equal parts between its flanks; otherwise the
+flanks are around the 5' end of each anchor. Anchors on the reverse
+strand (6th BED column) are oriented 5' to 3' on that strand. Each
+output line has the part of the profile (upstream, body or
+downstream), the start and end of the bin (bp from the anchor for
+flanks, and bin number for the body), and the counts or the level.
+This command runs in two modes, local and remote. In remote mode the
+profile is computed on the server, and the anchors can be a set of
+intervals the server has, given by name.
+)";
+
+static constexpr auto examples = R"(
+Examples:
+
+xfrase profile local -x hg38.cpg_idx -o output.txt -m methylome.m16 -i genes.bed -f 5000 -n 50
+xfrase profile remote -x hg38.cpg_idx -o output.txt -s example.com -a SRX012345 -i genes.bed -f 5000 -n 50 -B 20
+xfrase profile remote -x hg38.cpg_idx -o output.txt -s example.com -a SRX012345 --interval-set promoters -f 5000 -n 50
+)";
+
+#include "client.hpp"
+#include "cpg_index.hpp"
+#include "cpg_index_meta.hpp"
+#include "genomic_interval.hpp"
+#include "logger.hpp"
+#include "methylome.hpp"
+#include "methylome_metadata.hpp"
+#include "methylome_results_types.hpp"
+#include "request.hpp"
+#include "utilities.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>  // for EXIT_FAILURE, EXIT_SUCCESS
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <print>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>  // for std::is_same
+#include <utility>      // for std::move
+#include <vector>
+
+using std::string;
+using std::vector;
+
+template <typename counts_res_type>
+[[nodiscard]] static inline auto
+do_remote_profile(const string &accession, const cpg_index_meta &cim,
+                  const profile_request &req, const string &hostname,
+                  const string &port)
+  -> std::tuple<vector<counts_res_type>, std::error_code> {
+  request_header hdr{accession, cim.n_cpgs, {}};
+
+  if constexpr (std::is_same<counts_res_type, counts_res>::value)
+    hdr.rq_type = request_header::request_type::profile_counts;
+  else
+    hdr.rq_type = request_header::request_type::profile_counts_cov;
+
+  xfrase::client<counts_res_type, profile_request> cl(hostname, port, hdr,
+                                                      req);
+  const auto status = cl.run();
+  if (status) {
+    logger::instance().error("Transaction status: {}", status);
+    return {{}, status};
+  }
+  return {std::move(cl.take_counts()), {}};
+}
+
+template <typename counts_res_type>
+[[nodiscard]] static inline auto
+do_local_profile(const string &meth_file, const string &meta_file,
+                 const cpg_index &index, const cpg_index_meta &cim,
+                 const profile_request &req)
+  -> std::tuple<vector<counts_res_type>, std::error_code> {
+  const auto [meta, meta_err] = methylome_metadata::read(meta_file);
+  if (meta_err) {
+    logger::instance().error("Error: {} ({})", meta_err, meta_file);
+    return {{}, meta_err};
+  }
+
+  const auto [meth, meth_read_err] = methylome::read(meth_file, meta);
+  if (meth_read_err) {
+    logger::instance().error("Error: {} ({})", meth_read_err, meth_file);
+    return {{}, meth_read_err};
+  }
+  if constexpr (std::is_same<counts_res_type, counts_res_cov>::value)
+    return {meth.get_profile_cov(req.flank_size, req.n_flank_bins,
+                                 req.n_body_bins, index, cim, req.anchors),
+            {}};
+  else
+    return {meth.get_profile(req.flank_size, req.n_flank_bins,
+                             req.n_body_bins, index, cim, req.anchors),
+            {}};
+}
+
+[[nodiscard]] static inline auto
+write_output(std::ostream &out, const profile_request &req,
+             const auto &results, const bool write_scores) -> std::error_code {
+  using counts_res_type =
+    typename std::remove_cvref_t<decltype(results)>::value_type;
+  const std::int64_t flank_size = req.flank_size;
+  const std::int64_t flank_bin_size =
+    req.n_flank_bins == 0 ? 0 : req.flank_size / req.n_flank_bins;
+  const std::int64_t n_up = req.n_flank_bins;
+  const std::int64_t n_up_body = req.n_flank_bins + req.n_body_bins;
+  for (std::uint32_t i = 0; i < req.get_n_bins(); ++i) {
+    const auto &x = results[i];
+    // ADS: upstream bins end at the anchor, downstream bins start at
+    // the anchor end, and body bins are numbered
+    const std::int64_t j = i;
+    auto part = "upstream";
+    std::int64_t start = j * flank_bin_size - flank_size;
+    std::int64_t stop = start + flank_bin_size;
+    if (j >= n_up_body) {
+      part = "downstream";
+      start = (j - n_up_body) * flank_bin_size;
+      stop = start + flank_bin_size;
+    }
+    else if (j >= n_up) {
+      part = "body";
+      start = j - n_up;
+      stop = start + 1;
+    }
+    if (write_scores) {
+      const auto score =
+        x.n_meth / std::max(1.0, static_cast<double>(x.n_meth + x.n_unmeth));
+      std::print(out, "{}\t{}\t{}\t{:.6}\n", part, start, stop, score);
+    }
+    else if constexpr (std::is_same<counts_res_type, counts_res_cov>::value)
+      std::print(out, "{}\t{}\t{}\t{}\t{}\t{}\n", part, start, stop, x.n_meth,
+                 x.n_unmeth, x.n_covered);
+    else
+      std::print(out, "{}\t{}\t{}\t{}\t{}\n", part, start, stop, x.n_meth,
+                 x.n_unmeth);
+    if (!out)
+      return std::make_error_code(std::errc(errno));
+  }
+  return {};
+}
+
+template <typename counts_res_type>
+static auto
+do_profile(const string &accession, const cpg_index &index,
+           const cpg_index_meta &cim, const profile_request &req,
+           const string &hostname, const string &port, const string &meth_file,
+           const string &meta_file, std::ostream &out, const bool write_scores,
+           const bool remote_mode) -> std::error_code {
+  logger &lgr = logger::instance();
+  const auto profile_start{std::chrono::high_resolution_clock::now()};
+  const auto [results, profile_err] =
+    remote_mode
+      ? do_remote_profile<counts_res_type>(accession, cim, req, hostname, port)
+      : do_local_profile<counts_res_type>(meth_file, meta_file, index, cim,
+                                          req);
+  const auto profile_stop{std::chrono::high_resolution_clock::now()};
+  lgr.debug("Elapsed time for profile query: {:.3}s",
+            duration(profile_start, profile_stop));
+
+  if (profile_err)  // ADS: error messages already logged
+    return std::make_error_code(std::errc::invalid_argument);
+
+  if (std::size(results) != req.get_n_bins()) {
+    lgr.error("Unexpected number of profile bins: {} (expected {})",
+              std::size(results), req.get_n_bins());
+    return std::make_error_code(std::errc::invalid_argument);
+  }
+  return write_output(out, req, results, write_scores);
+}
+
+auto
+command_profile_main(int argc, char *argv[]) -> int {
+  static constexpr auto command = "profile";
+  static const auto usage =
+    std::format("Usage: xfrase profile [local|remote] [options]\n");
+  static const auto about_msg =
+    std::format("xfrase {}: {}", strip(command), strip(about));
+  static const auto description_msg =
+    std::format("{}\n{}", strip(description), strip(examples));
+
+  static constexpr auto default_port = "5000";
+
+  string accession{};
+  string hostname{};
+  string index_file{};
+  string anchors_file{};
+  string interval_set{};
+  string meta_file{};
+  string meth_file{};
+  string outfile{};
+  string port{};
+  string subcmd;
+  bool count_covered{};
+  bool write_scores{};
+  xfrase_log_level log_level{};
+  std::uint32_t flank_size{};
+  std::uint32_t n_flank_bins{};
+  std::uint32_t n_body_bins{};
+
+  namespace po = boost::program_options;
+
+  po::options_description subcmds;
+  subcmds.add_options()
+    // clang-format off
+    ("subcmd", po::value(&subcmd))
+    ("subargs", po::value<vector<string>>())
+    // clang-format on
+    ;
+  // positional; one for "subcmd" and the rest else parser throws
+  po::positional_options_description p;
+  p.add("subcmd", 1).add("subargs", -1);
+
+  po::options_description general("General");
+  // clang-format off
+  general.add_options()
+    ("help,h", "print this message and exit")
+    ("index,x", po::value(&index_file)->required(), "index file")
+    ("anchors,i", po::value(&anchors_file), "anchor intervals file (BED)")
+    ("flank,f", po::value(&flank_size)->default_value(0), "size of each flank")
+    ("flank-bins,n", po::value(&n_flank_bins)->default_value(0),
+     "number of bins in each flank")
+    ("body-bins,B", po::value(&n_body_bins)->default_value(0),
+     "number of bins in each anchor")
+    ("log-level,v", po::value(&log_level)->default_value(logger::default_level),
+     "log level {debug,info,warning,error,critical}")
+    ;
+  po::options_description output("Output");
+  output.add_options()
+    ("output,o", po::value(&outfile)->required(), "output file")
+    ("covered", po::bool_switch(&count_covered), "count covered sites per bin")
+    ("score", po::bool_switch(&write_scores), "weighted methylation levels")
+    ;
+  po::options_description remote("Remote");
+  remote.add_options()
+    ("hostname,s", po::value(&hostname)->required(), "server hostname")
+    ("port,p", po::value(&port)->default_value(default_port), "port")
+    ("accession,a", po::value(&accession)->required(), "methylome accession")
+    ("interval-set", po::value(&interval_set),
+     "name of anchor intervals held by the server")
+    ;
+  po::options_description local("Local");
+  local.add_options()
+    ("methylome,m", po::value(&meth_file)->required(), "local methylome file")
+    ("meta", po::value(&meta_file), "methylome metadata file")
+    ;
+  // clang-format on
+
+  po::variables_map vm_subcmd;
+  po::store(po::command_line_parser(argc, argv)
+              .options(subcmds)
+              .positional(p)
+              .allow_unregistered()
+              .run(),
+            vm_subcmd);
+  po::notify(vm_subcmd);
+
+  bool force_help_message{};
+  po::options_description all("Options");
+  if (subcmd == "local")
+    all.add(general).add(output).add(local);
+  else if (subcmd == "remote")
+    all.add(general).add(output).add(remote);
+  else {
+    force_help_message = true;
+    all.add(general).add(output).add(local).add(remote);
+  }
+
+  try {
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc - 1, argv + 1, all), vm);
+    if (force_help_message || vm.count("help") || argc == 1 ||
+        (argc == 2 && !subcmd.empty())) {
+      if (!subcmd.empty() && subcmd != "local" && subcmd != "remote")
+        std::println("One of local or remote must be specified\n");
+      std::println("{}\n{}", about_msg, usage);
+      all.print(std::cout);
+      std::println("\n{}", description_msg);
+      return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+  }
+  catch (po::error &e) {
+    std::println("{}", e.what());
+    std::println("{}\n{}", about_msg, usage);
+    all.print(std::cout);
+    std::println("\n{}", description_msg);
+    return EXIT_FAILURE;
+  }
+
+  const bool remote_mode = (subcmd == "remote");
+
+  if (meta_file.empty())
+    meta_file = get_default_methylome_metadata_filename(meth_file);
+
+  logger &lgr = logger::instance(shared_from_cout(), command, log_level);
+  if (!lgr) {
+    std::println("Failure initializing logging: {}.", lgr.get_status());
+    return EXIT_FAILURE;
+  }
+
+  // ADS: log the command line arguments (assuming right log level)
+  vector<std::tuple<string, string>> args_to_log{
+    {"Index", index_file},
+    {"Anchors", anchors_file},
+    {"Flank size", std::format("{}", flank_size)},
+    {"Flank bins", std::format("{}", n_flank_bins)},
+    {"Body bins", std::format("{}", n_body_bins)},
+    {"Output", outfile},
+    {"Covered", std::format("{}", count_covered)},
+    {"Scores", std::format("{}", write_scores)},
+  };
+  vector<std::tuple<string, string>> remote_args{
+    {"Hostname:port", std::format("{}:{}", hostname, port)},
+    {"Accession", accession},
+    {"Interval set", interval_set},
+  };
+  vector<std::tuple<string, string>> local_args{
+    {"Methylome", meth_file},
+    {"Metadata", meta_file},
+  };
+  log_args<xfrase_log_level::info>(args_to_log);
+  log_args<xfrase_log_level::info>(remote_mode ? remote_args : local_args);
+
+  profile_request req{flank_size, n_flank_bins, n_body_bins, 0, interval_set,
+                      {}};
+  if (!req.is_valid()) {
+    lgr.error("Flank size must be a positive multiple of flank bins, and "
+              "there must be some bins");
+    return EXIT_FAILURE;
+  }
+  if (anchors_file.empty() == interval_set.empty()) {
+    lgr.error("Exactly one of anchors or interval set must be given");
+    return EXIT_FAILURE;
+  }
+
+  const auto [index, cim, index_read_err] = read_cpg_index(index_file);
+  if (index_read_err) {
+    lgr.error("Failed to read cpg index: {} ({})", index_file, index_read_err);
+    return EXIT_FAILURE;
+  }
+
+  lgr.debug("Number of CpGs in index: {}", cim.n_cpgs);
+
+  if (!anchors_file.empty()) {
+    auto [anchors, anchors_err] = profile_anchor::load(cim, anchors_file);
+    if (anchors_err) {
+      lgr.error("Error reading anchors file: {} ({})", anchors_file,
+                anchors_err);
+      return EXIT_FAILURE;
+    }
+    lgr.debug("Number of anchors: {}", std::size(anchors));
+    req.n_anchors = std::size(anchors);
+    req.anchors = std::move(anchors);
+  }
+
+  std::ofstream out(outfile);
+  if (!out) {
+    lgr.error("Failed to open output file {}: {}", outfile,
+              std::make_error_code(std::errc(errno)));
+    return EXIT_FAILURE;
+  }
+
+  const auto profile_err =
+    count_covered
+      ? do_profile<counts_res_cov>(accession, index, cim, req, hostname, port,
+                                   meth_file, meta_file, out, write_scores,
+                                   remote_mode)
+      : do_profile<counts_res>(accession, index, cim, req, hostname, port,
+                               meth_file, meta_file, out, write_scores,
+                               remote_mode);
+
+  return profile_err == std::errc() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -40,18 +40,36 @@ analyzed using human reference hg38, then an index for hg38 must be
 available. Note: the hostname or ip address for the server needs to be
 used exactly by the client. If the server is started using 'localhost'
 as the hostname, it will not be reachable by any remote client. The
-server can run in detached mode.
+server can run in detached mode. Requests are computed in two lanes by
+their estimated cost: small interval queries run on the server
+threads, while requests costing at least the bulk cost, like bins over
+the whole genome, run on the bulk threads. A request waiting longer
+than the max wait is taken by any free thread. Within each lane,
+clients share the threads fairly by the cost of their requests. Each
+client, identified by its address, can be limited in requests per
+second and in MB per second of responses; a client over its limit gets
+an error response. To upgrade a running server without refusing
+connections, start the new server with '--takeover' and the same
+handoff socket as the running server. The running server passes its
+listening socket to the new one, stops accepting, and exits once its
+connections finish; the new server loads the methylomes that were
+resident in the running server.
 )";
 
 static constexpr auto examples = R"(
 Examples:
 
 xfrase server -s localhost -m methylomes -x indexes
+xfrase server -d -m methylomes -x indexes --handoff-socket /tmp/xfrase.sock
+xfrase server -d -m methylomes -x indexes --handoff-socket /tmp/xfrase.sock \
+    --takeover
 )";
 
 #include "arguments.hpp"
+#include "client_limits.hpp"
 #include "config_file_utils.hpp"  // write_config_file
 #include "logger.hpp"
+#include "request_lanes.hpp"
 #include "server.hpp"
 #include "utilities.hpp"
 #include "xfrase_error.hpp"  // IWYU pragma: keep
@@ -91,6 +109,13 @@ struct server_argset : argset_base<server_argset> {
   static constexpr auto log_level_default{xfrase_log_level::info};
   static constexpr auto n_threads_default{1};
   static constexpr auto max_resident_default = 32;
+  static constexpr auto hot_mb_default = 0;
+  static constexpr auto warm_mb_default = 0;
+  static constexpr auto bulk_threads_default = 1;
+  static constexpr auto max_queued_default = 64;
+  static constexpr auto max_wait_ms_default = 1000;
+  static constexpr auto bulk_cost_default = 1000000;
+  static constexpr auto client_stats_seconds_default = 0;
   std::string hostname{};
   std::string port{};
   std::string methylome_dir{};
@@ -99,6 +124,20 @@ struct server_argset : argset_base<server_argset> {
   xfrase_log_level log_level{};
   std::uint32_t n_threads{};
   std::uint32_t max_resident{};
+  std::uint32_t hot_mb{};
+  std::uint32_t warm_mb{};
+  bool chrom_granular{};
+  std::uint32_t bulk_threads{};
+  std::uint32_t max_queued{};
+  std::uint32_t max_wait_ms{};
+  std::uint64_t bulk_cost{};
+  std::uint32_t client_requests_per_sec{};
+  std::uint32_t client_request_burst{};
+  std::uint32_t client_mb_per_sec{};
+  std::uint32_t client_mb_burst{};
+  std::uint32_t client_stats_seconds{};
+  std::string handoff_socket{};
+  bool takeover{};
   bool daemonize{};
   std::string config_out{};
 
@@ -115,6 +154,20 @@ struct server_argset : argset_base<server_argset> {
         {"log_level", std::format("{}", log_level)},
         {"n_threads", std::format("{}", n_threads)},
         {"max_resident", std::format("{}", max_resident)},
+        {"hot_mb", std::format("{}", hot_mb)},
+        {"warm_mb", std::format("{}", warm_mb)},
+        {"chrom_granular", std::format("{}", chrom_granular)},
+        {"bulk_threads", std::format("{}", bulk_threads)},
+        {"max_queued", std::format("{}", max_queued)},
+        {"max_wait_ms", std::format("{}", max_wait_ms)},
+        {"bulk_cost", std::format("{}", bulk_cost)},
+        {"client_requests_per_sec", std::format("{}", client_requests_per_sec)},
+        {"client_request_burst", std::format("{}", client_request_burst)},
+        {"client_mb_per_sec", std::format("{}", client_mb_per_sec)},
+        {"client_mb_burst", std::format("{}", client_mb_burst)},
+        {"client_stats_seconds", std::format("{}", client_stats_seconds)},
+        {"handoff_socket", std::format("{}", handoff_socket)},
+        {"takeover", std::format("{}", takeover)},
         {"daemonize", std::format("{}", daemonize)},
         // clang-format on
       });
@@ -136,8 +189,40 @@ struct server_argset : argset_base<server_argset> {
       ("max-resident,r",
        value(&max_resident)->default_value(max_resident_default),
        "max resident methylomes")
+      ("hot-mb", value(&hot_mb)->default_value(hot_mb_default),
+       "MB for resident methylomes (0: no limit)")
+      ("warm-mb", value(&warm_mb)->default_value(warm_mb_default),
+       "MB for evicted methylomes kept compressed (0: none)")
+      ("chrom-granular", po::bool_switch(&chrom_granular),
+       "for intervals, keep each chrom resident on its own (use --hot-mb)")
       ("threads,t", value(&n_threads)->default_value(n_threads_default),
        "number of threads")
+      ("bulk-threads",
+       value(&bulk_threads)->default_value(bulk_threads_default),
+       "number of threads for costly requests")
+      ("max-queued", value(&max_queued)->default_value(max_queued_default),
+       "max requests waiting in each lane")
+      ("max-wait-ms", value(&max_wait_ms)->default_value(max_wait_ms_default),
+       "wait after which any thread takes a request")
+      ("bulk-cost", value(&bulk_cost)->default_value(bulk_cost_default),
+       "estimated cost at which a request is bulk")
+      ("client-requests-per-sec",
+       value(&client_requests_per_sec)->default_value(0),
+       "requests per second for each client (0: no limit)")
+      ("client-request-burst", value(&client_request_burst)->default_value(0),
+       "requests a client can make at once")
+      ("client-mb-per-sec", value(&client_mb_per_sec)->default_value(0),
+       "MB per second of responses for each client (0: no limit)")
+      ("client-mb-burst", value(&client_mb_burst)->default_value(0),
+       "MB of responses a client can receive at once")
+      ("client-stats-seconds",
+       value(&client_stats_seconds)
+       ->default_value(client_stats_seconds_default),
+       "seconds between logging client counters (0: never)")
+      ("handoff-socket", value(&handoff_socket),
+       "unix socket for handing off to a new server")
+      ("takeover", po::bool_switch(&takeover),
+       "take over from the server on the handoff socket")
       ("log-level,v", value(&log_level)->default_value(log_level_default),
        "log level {debug,info,warning,error,critical}")
       ("log-file,l", value(&log_filename)->value_name("console"),
@@ -176,6 +261,20 @@ BOOST_DESCRIBE_STRUCT(server_argset, (), (
   log_level,
   n_threads,
   max_resident,
+  hot_mb,
+  warm_mb,
+  chrom_granular,
+  bulk_threads,
+  max_queued,
+  max_wait_ms,
+  bulk_cost,
+  client_requests_per_sec,
+  client_request_burst,
+  client_mb_per_sec,
+  client_mb_burst,
+  client_stats_seconds,
+  handoff_socket,
+  takeover,
   daemonize
 )
 )
@@ -220,10 +319,37 @@ command_server_main(int argc, char *argv[]) -> int {
     return EXIT_FAILURE;
   }
 
+  if (args.takeover && args.handoff_socket.empty()) {
+    lgr.error("Taking over requires a handoff socket");
+    return EXIT_FAILURE;
+  }
+  // ADS: a daemon changes its working dir
+  if (!args.handoff_socket.empty())
+    args.handoff_socket = std::filesystem::absolute(args.handoff_socket);
+
+  static constexpr std::uint64_t bytes_per_mb = 1024 * 1024;
+  const std::uint64_t max_hot_bytes = args.hot_mb * bytes_per_mb;
+  const std::uint64_t max_warm_bytes = args.warm_mb * bytes_per_mb;
+
+  const request_lanes_config lanes_config{
+    args.n_threads, args.bulk_threads, args.max_queued,
+    args.max_wait_ms, args.bulk_cost,
+  };
+
+  const client_limits_config limits_config{
+    args.client_requests_per_sec,
+    args.client_request_burst,
+    args.client_mb_per_sec * bytes_per_mb,
+    args.client_mb_burst * bytes_per_mb,
+    args.client_stats_seconds,
+  };
+
   if (args.daemonize) {
     auto s =
       server(args.hostname, args.port, args.n_threads, args.methylome_dir,
-             args.index_dir, args.max_resident, lgr, ec, args.daemonize);
+             args.index_dir, args.max_resident, max_hot_bytes, max_warm_bytes,
+             args.chrom_granular, lanes_config, limits_config,
+             args.handoff_socket, args.takeover, lgr, ec, args.daemonize);
     if (ec) {
       lgr.error("Failure daemonizing server: {}.", ec);
       return EXIT_FAILURE;
@@ -233,7 +359,9 @@ command_server_main(int argc, char *argv[]) -> int {
   else {
     auto s =
       server(args.hostname, args.port, args.n_threads, args.methylome_dir,
-             args.index_dir, args.max_resident, lgr, ec);
+             args.index_dir, args.max_resident, max_hot_bytes, max_warm_bytes,
+             args.chrom_granular, lanes_config, limits_config,
+             args.handoff_socket, args.takeover, lgr, ec);
     s.run();
   }
 
@@ -0,0 +1,315 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "command_sites.hpp"
+
+static constexpr auto about = R"(
+get the counts at each CpG site in a set of genomic intervals
+)";
+
+static constexpr auto description = R"(
+The sites command accepts a set of genomic intervals and a methylome,
+and it generates the counts of methylated and unmethylated reads at
+each individual CpG site within each interval. Output is one line per
+site: chrom, position, position + 1, then the counts. In remote mode,
+the server sends the counts directly from the methylome in memory
+together with the positions from its index. This command runs in two
+modes, local and remote, in the same way as the intervals command.
+)";
+
+static constexpr auto examples = R"(
+Examples:
+
+xfrase sites local -x hg38.cpg_idx -o output.bed -m methylome.m16 -i input.bed
+xfrase sites remote -x hg38.cpg_idx -o output.bed -s example.com -a SRX012345 -i input.bed
+)";
+
+#include "client.hpp"
+#include "cpg_index.hpp"
+#include "cpg_index_meta.hpp"
+#include "genomic_interval.hpp"
+#include "genomic_interval_output.hpp"
+#include "logger.hpp"
+#include "methylome.hpp"
+#include "methylome_metadata.hpp"
+#include "request.hpp"
+#include "utilities.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>  // for std::uint32_t
+#include <cstdlib>  // for EXIT_FAILURE, EXIT_SUCCESS
+#include <cstring>  // for std::memcpy
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>  // for std::size
+#include <print>
+#include <ranges>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
+
+[[nodiscard]] static inline auto
+do_remote_sites(const std::string &accession, const cpg_index_meta &cim,
+                std::vector<methylome::offset_pair> offsets,
+                const std::string &hostname, const std::string &port)
+  -> std::tuple<methylome::vec, std::vector<std::uint32_t>, std::error_code> {
+  static_assert(sizeof(methylome::m_elem) == sizeof(cpg_index::cpg_pos_t));
+  request_header hdr{accession, cim.n_cpgs,
+                     request_header::request_type::raw_counts_positions};
+  request req{static_cast<std::uint32_t>(size(offsets)), offsets};
+  xfrase::client<methylome::m_elem, request> cl(hostname, port, hdr, req);
+  const auto status = cl.run();
+  if (status) {
+    logger::instance().error("Transaction status: {}", status);
+    return {{}, {}, status};
+  }
+  // ADS: response has counts for all sites followed by their positions
+  const auto received = cl.take_counts();
+  const auto n_sites = std::size(received) / 2;
+  methylome::vec counts(std::cbegin(received),
+                        std::cbegin(received) + n_sites);
+  std::vector<std::uint32_t> positions(n_sites);
+  std::memcpy(positions.data(), received.data() + n_sites,
+              n_sites * sizeof(std::uint32_t));
+  return {std::move(counts), std::move(positions), {}};
+}
+
+[[nodiscard]] static inline auto
+do_local_sites(const std::string &meth_file, const std::string &meth_meta_file,
+               const cpg_index &index, const cpg_index_meta &cim,
+               const std::vector<genomic_interval> &gis,
+               const std::vector<methylome::offset_pair> &offsets)
+  -> std::tuple<methylome::vec, std::vector<std::uint32_t>, std::error_code> {
+  logger &lgr = logger::instance();
+  const auto [meta, meta_err] = methylome_metadata::read(meth_meta_file);
+  if (meta_err) {
+    lgr.error("Error reading file {}: {}", meth_meta_file, meta_err);
+    return {{}, {}, meta_err};
+  }
+  const auto [meth, meth_err] = methylome::read(meth_file, meta);
+  if (meth_err) {
+    lgr.error("Error reading file {}: {}", meth_file, meth_err);
+    return {{}, {}, meth_err};
+  }
+  methylome::vec counts;
+  std::vector<std::uint32_t> positions;
+  for (const auto &[gi, offset] : std::views::zip(gis, offsets)) {
+    const auto [first, last] = offset;
+    counts.insert(std::cend(counts), std::cbegin(meth.cpgs) + first,
+                  std::cbegin(meth.cpgs) + last);
+    const auto chrom_beg = cim.chrom_offset[gi.ch_id];
+    const auto &chrom_positions = index.positions[gi.ch_id];
+    positions.insert(std::cend(positions),
+                     std::cbegin(chrom_positions) + (first - chrom_beg),
+                     std::cbegin(chrom_positions) + (last - chrom_beg));
+  }
+  return {std::move(counts), std::move(positions), {}};
+}
+
+auto
+command_sites_main(int argc, char *argv[]) -> int {
+  static constexpr auto command = "sites";
+  static const auto usage =
+    std::format("Usage: xfrase sites [local|remote] [options]\n");
+  static const auto about_msg =
+    std::format("xfrase {}: {}", strip(command), strip(about));
+  static const auto description_msg =
+    std::format("{}\n{}", strip(description), strip(examples));
+
+  static constexpr auto default_port = "5000";
+
+  std::string port{};
+  std::string accession{};
+  std::string index_file{};
+  std::string meth_file{};
+  std::string meth_meta_file{};
+  std::string intervals_file{};
+  std::string hostname{};
+  std::string output_file{};
+  xfrase_log_level log_level{};
+
+  std::string subcmd;
+
+  namespace po = boost::program_options;
+
+  po::options_description subcmds;
+  subcmds.add_options()
+    // clang-format off
+    ("subcmd", po::value(&subcmd))
+    ("subargs", po::value<std::vector<std::string>>())
+    // clang-format on
+    ;
+  // positional; one for "subcmd" and the rest else parser throws
+  po::positional_options_description p;
+  p.add("subcmd", 1).add("subargs", -1);
+
+  po::options_description general("General");
+  // clang-format off
+  general.add_options()
+    ("help,h", "print this message and exit")
+    ("index,x", po::value(&index_file)->required(), "index file")
+    ("intervals,i", po::value(&intervals_file)->required(), "intervals file")
+    ("output,o", po::value(&output_file)->required(), "output file")
+    ("log-level,v", po::value(&log_level)->default_value(logger::default_level),
+     "log level {debug,info,warning,error,critical}")
+    ;
+  po::options_description remote("Remote");
+  remote.add_options()
+    ("hostname,s", po::value(&hostname)->required(), "server hostname")
+    ("port,p", po::value(&port)->default_value(default_port), "port")
+    ("accession,a", po::value(&accession)->required(), "methylome accession")
+    ;
+  po::options_description local("Local");
+  local.add_options()
+    ("methylome,m", po::value(&meth_file)->required(), "local methylome file")
+    ("metadata", po::value(&meth_meta_file), "methylome metadata (default: methylome.json)")
+    ;
+  // clang-format on
+
+  po::variables_map vm_subcmd;
+  po::store(po::command_line_parser(argc, argv)
+              .options(subcmds)
+              .positional(p)
+              .allow_unregistered()
+              .run(),
+            vm_subcmd);
+  po::notify(vm_subcmd);
+
+  bool force_help_message{};
+  po::options_description all("Options");
+  if (subcmd == "local")
+    all.add(general).add(local);
+  else if (subcmd == "remote")
+    all.add(general).add(remote);
+  else {
+    force_help_message = true;
+    all.add(general).add(local).add(remote);
+  }
+
+  try {
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc - 1, argv + 1, all), vm);
+    if (force_help_message || vm.count("help") || argc == 1 ||
+        (argc == 2 && !subcmd.empty())) {
+      if (!subcmd.empty() && subcmd != "local" && subcmd != "remote")
+        std::println("One of local or remote must be specified\n");
+      std::println("{}\n{}", about_msg, usage);
+      all.print(std::cout);
+      std::println("\n{}", description_msg);
+      return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+  }
+  catch (po::error &e) {
+    std::println("{}", e.what());
+    std::println("{}\n{}", about_msg, usage);
+    all.print(std::cout);
+    std::println("\n{}", description_msg);
+    return EXIT_FAILURE;
+  }
+
+  const bool remote_mode = (subcmd == "remote");
+
+  if (meth_meta_file.empty())
+    meth_meta_file = get_default_methylome_metadata_filename(meth_file);
+
+  logger &lgr = logger::instance(shared_from_cout(), command, log_level);
+  if (!lgr) {
+    std::println("Failure initializing logging: {}.", lgr.get_status());
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::tuple<std::string, std::string>> args_to_log{
+    {"Index", index_file},
+    {"Intervals", intervals_file},
+    {"Output", output_file},
+  };
+  std::vector<std::tuple<std::string, std::string>> remote_args{
+    {"Hostname:port", std::format("{}:{}", hostname, port)},
+    {"Accession", accession},
+  };
+  std::vector<std::tuple<std::string, std::string>> local_args{
+    {"Methylome", meth_file},
+    {"Metadata", meth_meta_file},
+  };
+  log_args<xfrase_log_level::info>(args_to_log);
+  log_args<xfrase_log_level::info>(remote_mode ? remote_args : local_args);
+
+  const auto [index, cim, index_read_err] = read_cpg_index(index_file);
+  if (index_read_err) {
+    lgr.error("Failed to read cpg index: {} ({})", index_file, index_read_err);
+    return EXIT_FAILURE;
+  }
+
+  const auto [gis, ec] = genomic_interval::load(cim, intervals_file);
+  if (ec) {
+    lgr.error("Error reading intervals file: {} ({})", intervals_file, ec);
+    return EXIT_FAILURE;
+  }
+  if (!intervals_valid(gis)) {
+    lgr.error("Intervals not valid: {} (negative size found)", intervals_file);
+    return EXIT_FAILURE;
+  }
+  lgr.info("Number of intervals: {}", size(gis));
+
+  const auto offsets = index.get_offsets(cim, gis);
+
+  const auto sites_start{std::chrono::high_resolution_clock::now()};
+  const auto [counts, positions, sites_err] =
+    remote_mode
+      ? do_remote_sites(accession, cim, offsets, hostname, port)
+      : do_local_sites(meth_file, meth_meta_file, index, cim, gis, offsets);
+  const auto sites_stop{std::chrono::high_resolution_clock::now()};
+  lgr.debug("Elapsed time for query: {:.3}s",
+            duration(sites_start, sites_stop));
+  if (sites_err)  // ADS: error messages already logged
+    return EXIT_FAILURE;
+  lgr.info("Number of sites: {}", std::size(counts));
+
+  std::ofstream out(output_file);
+  if (!out) {
+    lgr.error("Failed to open output file: {} ({})", output_file,
+              std::make_error_code(std::errc(errno)));
+    return EXIT_FAILURE;
+  }
+
+  const auto output_start{std::chrono::high_resolution_clock::now()};
+  const auto write_err = write_sites(out, cim, gis, offsets, counts, positions);
+  const auto output_stop{std::chrono::high_resolution_clock::now()};
+  lgr.debug("Elapsed time for output: {:.3}s",
+            duration(output_start, output_stop));
+  if (write_err) {
+    lgr.error("Error writing output {}: {}", output_file, write_err);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
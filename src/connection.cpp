@@ -23,17 +23,22 @@
 
 #include "connection.hpp"
 
+#include "client_limits.hpp"
+#include "methylome_metadata.hpp"
 #include "request.hpp"
 #include "request_handler.hpp"
+#include "request_lanes.hpp"
 #include "response.hpp"
 #include "utilities.hpp"
 
 #include <boost/asio.hpp>
 #include <boost/system.hpp>
 
-#include <chrono>
-#include <compare>   // for operator<=
-#include <iterator>  // for cend
+#include <compare>    // for operator<=
+#include <cstdint>
+#include <exception>  // for std::exception
+#include <iterator>   // for cend, size, data
+#include <string>
 #include <system_error>
 #include <vector>
 
@@ -55,6 +60,46 @@ connection::prepare_to_read_offsets() -> void {
   offset_byte = 0;                               // should be init to this
 }
 
+auto
+connection::prepare_to_read_regions() -> void {
+  if (req_hdr.is_windows_request()) {
+    windows_req.regions.resize(windows_req.n_regions);
+    offset_remaining = windows_req.get_regions_n_bytes();
+  }
+  else if (req_hdr.is_profile_request()) {
+    profile_req.anchors.resize(profile_req.n_anchors);
+    offset_remaining = profile_req.get_anchors_n_bytes();
+  }
+  else {
+    bins_req.regions.resize(bins_req.n_regions);
+    offset_remaining = bins_req.get_regions_n_bytes();
+  }
+  offset_byte = 0;
+}
+
+[[nodiscard]] auto
+connection::get_regions_data() -> char * {
+  if (req_hdr.is_profile_request())
+    return profile_req.get_anchors_data();
+  return req_hdr.is_windows_request() ? windows_req.get_regions_data()
+                                      : bins_req.get_regions_data();
+}
+
+auto
+connection::reset_request() -> void {
+  req_hdr = {};
+  req = {};
+  bins_req = {};
+  windows_req = {};
+  named_req = {};
+  profile_req = {};
+  resp_hdr = {};
+  resp = {};  // ADS: also releases memory held by resp.owner
+  ctx = {};   // ADS: so the methylome can leave the methylome_set
+  offset_byte = 0;
+  offset_remaining = 0;
+}
+
 auto
 connection::read_request() -> void {
   // as long as lambda is alive, connection instance is too
@@ -66,20 +111,31 @@ connection::read_request() -> void {
     [this, self](const boost::system::error_code ec,
                  [[maybe_unused]] const std::size_t bytes_transferred) {
       // waiting is done; remove deadline for now
-      deadline.expires_at(boost::asio::steady_timer::time_point::max());
+      wheel.clear(deadline);
       if (!ec) {
         if (const auto req_hdr_parse{parse(req_hdr_buf, req_hdr)};
             !req_hdr_parse.error) {
           lgr.debug("{} Received request header: {}", conn_id,
                     req_hdr.summary());
-          handler.handle_header(req_hdr, resp_hdr);
+          if (!limits.admit(client)) {
+            lgr.warning("{} Rate limit exceeded for client {}", conn_id,
+                        client);
+            resp_hdr = {server_response_code::too_many_requests, 0};
+            respond_with_error();
+            return;
+          }
+          handler.handle_header(req_hdr, resp_hdr, ctx);
           if (!resp_hdr.error()) {
-            if (req_hdr.is_intervals_request()) {
+            // ADS: a hash request has nothing after the header
+            if (req_hdr.is_hash_request())
+              schedule(&connection::compute_hash, 0);
+            else if (req_hdr.is_intervals_request() ||
+                     req_hdr.is_raw_request()) {
               if (const auto req_parse =
                     parse(req_hdr_parse.ptr, cend(req_hdr_buf), req);
                   !req_parse.error) {
                 prepare_to_read_offsets();
-                handler.add_response_size_for_intervals(req_hdr, req, resp_hdr);
+                handler.add_response_size_for_intervals(req, resp_hdr);
                 read_offsets();
               }
               else {
@@ -89,12 +145,66 @@ connection::read_request() -> void {
                 respond_with_error();
               }
             }
+            else if (req_hdr.is_named_request()) {
+              if (const auto req_parse =
+                    parse(req_hdr_parse.ptr, cend(req_hdr_buf), named_req);
+                  !req_parse.error)
+                start_named();
+              else {
+                lgr.warning("{} Named request parse error: {}", conn_id,
+                            req_parse.error);
+                resp_hdr = {req_parse.error, 0};
+                respond_with_error();
+              }
+            }
+            else if (req_hdr.is_profile_request()) {
+              if (const auto req_parse =
+                    parse(req_hdr_parse.ptr, cend(req_hdr_buf), profile_req);
+                  !req_parse.error) {
+                // ADS: anchors of a named set are already on the server
+                if (profile_req.set_name.empty() &&
+                    profile_req.n_anchors > 0) {
+                  prepare_to_read_regions();
+                  read_regions();
+                }
+                else
+                  start_profile();
+              }
+              else {
+                lgr.warning("{} Profile request parse error: {}", conn_id,
+                            req_parse.error);
+                resp_hdr = {req_parse.error, 0};
+                respond_with_error();
+              }
+            }
+            else if (req_hdr.is_windows_request()) {
+              if (const auto req_parse =
+                    parse(req_hdr_parse.ptr, cend(req_hdr_buf), windows_req);
+                  !req_parse.error) {
+                if (windows_req.n_regions > 0) {
+                  prepare_to_read_regions();
+                  read_regions();
+                }
+                else
+                  start_windows();
+              }
+              else {
+                lgr.warning("{} Windows request parse error: {}", conn_id,
+                            req_parse.error);
+                resp_hdr = {req_parse.error, 0};
+                respond_with_error();
+              }
+            }
             else {  // is_bins_request
               if (const auto req_parse =
                     parse(req_hdr_parse.ptr, cend(req_hdr_buf), bins_req);
                   !req_parse.error) {
-                handler.add_response_size_for_bins(req_hdr, bins_req, resp_hdr);
-                compute_bins();
+                if (bins_req.n_regions > 0) {
+                  prepare_to_read_regions();
+                  read_regions();
+                }
+                else
+                  start_bins();
               }
               else {
                 lgr.warning("{} Bins request parse error: {}", conn_id,
@@ -116,15 +226,19 @@ connection::read_request() -> void {
           respond_with_error();
         }
       }
+      else if (ec == boost::asio::error::eof)
+        // ADS: the client is done with this connection; this is how
+        // every kept-alive connection ends
+        lgr.debug("{} Client closed connection after {} requests", conn_id,
+                  n_requests);
       else  // problem reading request
         lgr.warning("{} Failed to read request: {}", conn_id, ec);
       // ADS: on error: no new asyncs start; references to this
       // connection disappear; this connection gets destroyed when
-      // *both* this handler returns and the timer completes; that
-      // destructor destroys the socket
+      // this handler returns; that destructor destroys the socket
     });
   // ADS: put this before or after the call to asio::async?
-  deadline.expires_after(std::chrono::seconds(read_timeout_seconds));
+  set_deadline();
 }
 
 auto
@@ -135,16 +249,14 @@ connection::read_offsets() -> void {
     [this, self](const boost::system::error_code ec,
                  const std::size_t bytes_transferred) {
       // remove deadline while doing computation
-      deadline.expires_at(boost::asio::steady_timer::time_point::max());
+      wheel.clear(deadline);
       if (!ec) {
         offset_remaining -= bytes_transferred;
         offset_byte += bytes_transferred;
         if (offset_remaining == 0) {
           lgr.debug("{} Finished reading offsets ({}B)", conn_id, offset_byte);
-          handler.handle_get_counts(req_hdr, req, resp_hdr, resp);
-          lgr.debug("{} Finished computing levels in intervals", conn_id);
           // exiting the read loop -- no deadline for now
-          respond_with_header();
+          schedule(&connection::compute_counts, req.n_intervals);
         }
         else
           read_offsets();
@@ -156,15 +268,202 @@ connection::read_offsets() -> void {
         respond_with_error();
       }
     });
-  deadline.expires_after(std::chrono::seconds(read_timeout_seconds));
+  set_deadline();
+}
+
+auto
+connection::read_regions() -> void {
+  auto self(shared_from_this());
+  socket.async_read_some(
+    boost::asio::buffer(get_regions_data() + offset_byte, offset_remaining),
+    [this, self](const boost::system::error_code ec,
+                 const std::size_t bytes_transferred) {
+      wheel.clear(deadline);
+      if (!ec) {
+        offset_remaining -= bytes_transferred;
+        offset_byte += bytes_transferred;
+        if (offset_remaining == 0) {
+          lgr.debug("{} Finished reading regions ({}B)", conn_id, offset_byte);
+          if (req_hdr.is_windows_request())
+            start_windows();
+          else if (req_hdr.is_profile_request())
+            start_profile();
+          else
+            start_bins();
+        }
+        else
+          read_regions();
+      }
+      else {
+        lgr.warning("{} Error reading regions: {}", conn_id, ec);
+        resp_hdr = {req_hdr.is_windows_request()
+                      ? request_error::windows_error_reading_regions
+                    : req_hdr.is_profile_request()
+                      ? request_error::profile_error_reading_anchors
+                      : request_error::bins_error_reading_regions,
+                    0};
+        respond_with_error();
+      }
+    });
+  set_deadline();
+}
+
+// ADS: bins and windows over the whole genome scan every site, while
+// with regions only the sites in the regions are scanned
+[[nodiscard]] static inline auto
+get_scan_cost(const request_header &req_hdr,
+              const bool has_regions) -> std::uint64_t {
+  return has_regions ? 0 : req_hdr.methylome_size;
+}
+
+auto
+connection::start_bins() -> void {
+  handler.add_response_size_for_bins(bins_req, ctx, resp_hdr);
+  if (resp_hdr.error())
+    respond_with_error();
+  else
+    schedule(&connection::compute_bins,
+             resp_hdr.response_size +
+               get_scan_cost(req_hdr, !bins_req.regions.empty()));
 }
 
 auto
 connection::compute_bins() -> void {
-  deadline.expires_at(boost::asio::steady_timer::time_point::max());
-  handler.handle_get_bins(req_hdr, bins_req, resp_hdr, resp);
+  handler.handle_get_bins(req_hdr, bins_req, ctx, resp_hdr, resp);
   lgr.debug("{} Finished computing levels in bins", conn_id);
-  respond_with_header();
+}
+
+auto
+connection::start_windows() -> void {
+  handler.add_response_size_for_windows(windows_req, ctx, resp_hdr);
+  if (resp_hdr.error())
+    respond_with_error();
+  else
+    schedule(&connection::compute_windows,
+             resp_hdr.response_size +
+               get_scan_cost(req_hdr, !windows_req.regions.empty()));
+}
+
+auto
+connection::compute_windows() -> void {
+  handler.handle_get_windows(req_hdr, windows_req, ctx, resp_hdr, resp);
+  lgr.debug("{} Finished computing levels in windows", conn_id);
+}
+
+auto
+connection::start_named() -> void {
+  handler.add_response_size_for_named(named_req, ctx, resp_hdr);
+  if (resp_hdr.error())
+    respond_with_error();
+  else
+    schedule(&connection::compute_named, named_req.n_intervals);
+}
+
+auto
+connection::compute_named() -> void {
+  handler.handle_get_named(req_hdr, ctx, resp_hdr, resp);
+  lgr.debug("{} Finished computing levels in named intervals", conn_id);
+}
+
+// ADS: the cost of a profile is the number of anchors; each visits
+// only the sites in its flanks and body
+auto
+connection::start_profile() -> void {
+  handler.add_response_size_for_profile(profile_req, ctx, resp_hdr);
+  if (resp_hdr.error())
+    respond_with_error();
+  else
+    schedule(&connection::compute_profile,
+             ctx.intervals ? std::size(ctx.intervals->anchors)
+                           : std::size(profile_req.anchors));
+}
+
+auto
+connection::compute_profile() -> void {
+  handler.handle_get_profile(req_hdr, profile_req, ctx, resp_hdr, resp);
+  lgr.debug("{} Finished computing profile", conn_id);
+}
+
+auto
+connection::compute_hash() -> void {
+  handler.handle_get_hash(ctx, resp_hdr, resp);
+  lgr.debug("{} Finished getting methylome hash", conn_id);
+}
+
+auto
+connection::compute_counts() -> void {
+  if (req_hdr.is_raw_request()) {
+    handler.handle_get_raw(req_hdr, req, ctx, resp_hdr, resp);
+    lgr.debug("{} Finished collecting raw counts", conn_id);
+  }
+  else {
+    handler.handle_get_counts(req_hdr, req, ctx, resp_hdr, resp);
+    lgr.debug("{} Finished computing levels in intervals", conn_id);
+  }
+}
+
+// ADS: requests are identical if they are for the same methylome,
+// by its hash, and the client sent the same bytes; the header buffer
+// holds the parameters and at most one of the vectors is not empty
+[[nodiscard]] auto
+connection::get_inflight_key() const -> std::string {
+  const auto append = [](std::string &key, const auto &data) {
+    key.append(reinterpret_cast<const char *>(std::data(data)),
+               sizeof(*std::data(data)) * std::size(data));
+  };
+  std::string key;
+  const auto hash = ctx.meta ? ctx.meta->methylome_hash : 0;
+  key.append(reinterpret_cast<const char *>(&hash), sizeof(hash));
+  append(key, req_hdr_buf);
+  append(key, req.offsets);
+  append(key, bins_req.regions);
+  append(key, windows_req.regions);
+  append(key, profile_req.anchors);
+  return key;
+}
+
+auto
+connection::schedule(void (connection::*compute)(),
+                     const std::uint64_t cost) -> void {
+  wheel.clear(deadline);
+  const auto lane = lanes.get_lane(cost);
+  lgr.debug("{} Scheduling computation (cost: {}, bulk: {})", conn_id, cost,
+            lane == request_lanes::lane::bulk);
+  auto self(shared_from_this());
+  const bool queued = lanes.submit(lane, client, cost, [this, self, compute] {
+    // ADS: no async op is pending on this connection until the
+    // response is ready, whichever thread fills it; the response is
+    // sent from this connection's own executor
+    const auto respond = [this, self] {
+      boost::asio::post(socket.get_executor(),
+                        [this, self] { respond_with_header(); });
+    };
+    try {
+      // ADS: getting a hash is too cheap to be worth sharing
+      if (compute == &connection::compute_hash) {
+        (this->*compute)();
+        respond();
+      }
+      else if (handler.inflight.run(
+                 get_inflight_key(), [this, compute] { (this->*compute)(); },
+                 resp_hdr, resp, respond))
+        lgr.debug("{} Sharing response of identical request", conn_id);
+    }
+    catch (const std::exception &e) {
+      // ADS: the deadline was cleared when this was scheduled, so
+      // without a response the client would wait forever
+      lgr.error("{} Computation failed: {}", conn_id, e.what());
+      resp_hdr = {server_response_code::server_failure, 0};
+      resp = {};
+      boost::asio::post(socket.get_executor(),
+                        [this, self] { respond_with_error(); });
+    }
+  });
+  if (!queued) {
+    lgr.warning("{} Lane full; refusing request (cost: {})", conn_id, cost);
+    resp_hdr = {server_response_code::server_busy, 0};
+    respond_with_error();
+  }
 }
 
 auto
@@ -177,12 +476,12 @@ connection::respond_with_error() -> void {
       socket, boost::asio::buffer(resp_hdr_buf),
       [this, self](const boost::system::error_code ec,
                    [[maybe_unused]] const std::size_t bytes_transferred) {
-        deadline.expires_at(boost::asio::steady_timer::time_point::max());
+        wheel.clear(deadline);
         if (ec)
           lgr.error("{} Error responding: {}", conn_id, ec);
         stop();
       });
-    deadline.expires_after(std::chrono::seconds(read_timeout_seconds));
+    set_deadline();
   }
   else {
     lgr.error("{} Error responding: {}", conn_id, resp_hdr_compose.error);
@@ -200,7 +499,7 @@ connection::respond_with_header() -> void {
       socket, boost::asio::buffer(resp_hdr_buf),
       [this, self](const boost::system::error_code ec,
                    [[maybe_unused]] const std::size_t bytes_transferred) {
-        deadline.expires_at(boost::asio::steady_timer::time_point::max());
+        wheel.clear(deadline);
         if (!ec)
           respond_with_counts();
         else {
@@ -208,7 +507,7 @@ connection::respond_with_header() -> void {
           stop();
         }
       });
-    deadline.expires_after(std::chrono::seconds(read_timeout_seconds));
+    set_deadline();
   }
   else {
     lgr.error("{} Error composing response header: {}", conn_id,
@@ -220,13 +519,29 @@ connection::respond_with_header() -> void {
 auto
 connection::respond_with_counts() -> void {
   auto self(shared_from_this());
+  // ADS: slices are written directly from memory owned elsewhere;
+  // resp.owner keeps that memory alive until this write completes
+  std::vector<boost::asio::const_buffer> bufs;
+  bufs.reserve(1 + std::size(resp.slices));
+  bufs.emplace_back(boost::asio::buffer(resp.payload));
+  for (const auto &s : resp.slices)
+    bufs.emplace_back(s.data(), std::size(s));
   boost::asio::async_write(
-    socket, boost::asio::buffer(resp.payload),
+    socket, bufs,
     [this, self](const boost::system::error_code ec,
                  const std::size_t bytes_transferred) {
-      deadline.expires_at(boost::asio::steady_timer::time_point::max());
+      wheel.clear(deadline);
       if (!ec) {
         lgr.info("{} Responded with counts ({}B)", conn_id, bytes_transferred);
+        limits.charge_bytes(client, bytes_transferred);
+        ++n_requests;
+        // ADS: keep the connection alive for another request; the
+        // deadline in read_request closes it if the client goes idle
+        if (!draining) {
+          reset_request();
+          read_request();
+          return;
+        }
         stop();
 
         /* ADS: closing here but not sure it makes sense; RAII? See comment in
@@ -239,7 +554,7 @@ connection::respond_with_counts() -> void {
       else
         lgr.warning("{} Error sending counts: {}", conn_id, ec);
     });
-  deadline.expires_after(std::chrono::seconds(read_timeout_seconds));
+  set_deadline();
 }
 
 auto
@@ -247,28 +562,18 @@ connection::check_deadline() -> void {
   if (!socket.is_open())
     return;
 
-  // ADS: use deadline set in place of socket.close so we don't need
-  // to check if socket is_open?
-
-  if (deadline.expiry() <= boost::asio::steady_timer::clock_type::now()) {
-    // deadline passed: close socket so remaining async ops are
-    // cancelled (see comment below)
-
-    stop();
+  // ADS: the deadline may have been set again or cleared between
+  // expiring in the wheel and this running on the connection's strand
+  if (!wheel.expired(deadline))
+    return;
 
-    deadline.expires_at(boost::asio::steady_timer::time_point::max());
+  // deadline passed: close socket so remaining async ops are cancelled
+  stop();
 
-    /* ADS: closing here but not sure it makes sense; RAII? see comment in
-     * respond_with_counts */
-    boost::system::error_code socket_close_ec;  // for non-throwing
-    socket.close(socket_close_ec);
-    if (socket_close_ec)
-      lgr.warning("{} Socket close error: {}", conn_id, socket_close_ec);
-  }
-  else {
-    // ADS: wait again; any issue if the underlying socket is closed?
-    // What is the reasoning it will not be closed?
-    deadline.async_wait(
-      std::bind(&connection::check_deadline, shared_from_this()));
-  }
+  /* ADS: closing here but not sure it makes sense; RAII? see comment in
+   * respond_with_counts */
+  boost::system::error_code socket_close_ec;  // for non-throwing
+  socket.close(socket_close_ec);
+  if (socket_close_ec)
+    lgr.warning("{} Socket close error: {}", conn_id, socket_close_ec);
 }
@@ -26,19 +26,23 @@
 
 #include "logger.hpp"
 #include "request.hpp"
+#include "request_handler.hpp"  // for request_context
 #include "response.hpp"
+#include "timer_wheel.hpp"
 
-#include <boost/asio.hpp>          // for tcp, steady_timer
+#include <boost/asio.hpp>          // for tcp, post
 #include <boost/lexical_cast.hpp>  // for lexical_cast
 
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
-#include <functional>  // for std::bind
 #include <memory>
 #include <string>
 #include <utility>  // for std::move
 
-struct request_handler;
+struct client_limits;
+struct request_lanes;
 
 struct connection : public std::enable_shared_from_this<connection> {
   connection(const connection &) = delete;
@@ -46,26 +50,40 @@ struct connection : public std::enable_shared_from_this<connection> {
   operator=(const connection &) = delete;
 
   explicit connection(boost::asio::ip::tcp::socket socket_,
-                      request_handler &handler, logger &lgr,
+                      request_handler &handler, request_lanes &lanes,
+                      client_limits &limits, timer_wheel &wheel,
+                      std::atomic_uint32_t &n_active,
+                      const std::atomic_bool &draining, logger &lgr,
                       std::uint32_t conn_id) :
     // socket used below gets confused if arg has exact same name
-    socket{std::move(socket_)}, deadline{socket.get_executor()},
-    handler{handler}, lgr{lgr}, conn_id{conn_id} {
+    socket{std::move(socket_)}, handler{handler}, lanes{lanes},
+    limits{limits}, wheel{wheel}, n_active{n_active}, draining{draining},
+    lgr{lgr}, conn_id{conn_id} {
     lgr.info("Connection id: {}. Request endpoint: {}", conn_id,
              boost::lexical_cast<std::string>(socket.remote_endpoint()));
+    // ADS: clients are identified by address for fairness and limits
+    boost::system::error_code endpoint_ec;
+    const auto endpoint = socket.remote_endpoint(endpoint_ec);
+    if (!endpoint_ec)
+      client = endpoint.address().to_string();
+    ++n_active;  // ADS: last, so the destructor always balances it
+  }
+
+  ~connection() {
+    wheel.clear(deadline);  // ADS: the wheel must not keep this entry
+    --n_active;
   }
 
   auto
   start() -> void {
+    // ADS: the wheel holds no reference to this connection, so an
+    // expired deadline does nothing if the connection is gone
+    deadline.on_expire = [weak = weak_from_this()] {
+      if (const auto self = weak.lock())
+        boost::asio::post(self->socket.get_executor(),
+                          [self] { self->check_deadline(); });
+    };
     read_request();  // start first async op; sets deadline
-
-    // This might best be done at the end of read_request, then
-    // cleared and re-done at the appropriate times in read_offsets
-    // NOTE: deadline already set for this one inside read_request().
-    // Completion handler must be bound to a shared pointer so the
-    // session remains alive for the timer
-    deadline.async_wait(
-      std::bind(&connection::check_deadline, shared_from_this()));
   }
 
   auto
@@ -76,12 +94,56 @@ struct connection : public std::enable_shared_from_this<connection> {
   auto
   prepare_to_read_offsets() -> void;
 
+  // Allocate space for regions of a bins or windows request, or the
+  // anchors of a profile request; the same variables track progress
+  // as for offsets.
+  auto
+  prepare_to_read_regions() -> void;
+
+  // Clear the state of the previous request so the next request on
+  // a kept-alive connection starts fresh.
+  auto
+  reset_request() -> void;
+
   auto
   read_request() -> void;  // read 'request'
   auto
   read_offsets() -> void;  // read the 'offsets' part of request
   auto
+  read_regions() -> void;  // read regions of bins/windows or profile anchors
+  auto
+  start_bins() -> void;  // check the bins request before computing
+  auto
   compute_bins() -> void;  // do the computation for bins
+  auto
+  start_windows() -> void;  // check the windows request before computing
+  auto
+  compute_windows() -> void;  // do the computation for windows
+  auto
+  start_named() -> void;  // find the interval set before computing
+  auto
+  compute_named() -> void;  // do the computation for a named interval set
+  auto
+  start_profile() -> void;  // check the profile request before computing
+  auto
+  compute_profile() -> void;  // do the computation for a profile
+  auto
+  compute_hash() -> void;  // get the methylome hash
+  auto
+  compute_counts() -> void;  // do the computation for intervals or raw
+
+  // identifies this request among those in flight so identical ones
+  // can share a response
+  [[nodiscard]] auto
+  get_inflight_key() const -> std::string;
+
+  // queue a computation in the lane for its cost; the response is
+  // sent from the socket's strand once the computation is done
+  auto
+  schedule(void (connection::*compute)(), const std::uint64_t cost) -> void;
+
+  [[nodiscard]] auto
+  get_regions_data() -> char *;  // where regions are read for this request
 
   auto
   respond_with_header() -> void;  // write good header
@@ -90,22 +152,40 @@ struct connection : public std::enable_shared_from_this<connection> {
   auto
   respond_with_counts() -> void;  // write counts
 
+  // close the connection if the current read or write stalls
+  auto
+  set_deadline() -> void {
+    wheel.set(deadline, timer_wheel::to_ticks(
+                          std::chrono::seconds(read_timeout_seconds)));
+  }
+
   auto
-  check_deadline() -> void;
+  check_deadline() -> void;  // on the strand once the deadline expires
 
   boost::asio::ip::tcp::socket socket;  // this connection's socket
-  boost::asio::steady_timer deadline;
   request_handler &handler;  // handles incoming requests
+  request_lanes &lanes;      // where computations are queued
+  client_limits &limits;     // rate limits for each client
+  timer_wheel &wheel;        // holds the deadline for this connection
+  timer_wheel::entry deadline;
+  std::atomic_uint32_t &n_active;  // connections the server is serving
+  const std::atomic_bool &draining;  // server handed off; don't keep alive
+  std::string client;        // address of the client
   request_header_buffer req_hdr_buf{};
   request_header req_hdr;  // this connection's request header
   request req;             // this connection's request
   bins_request bins_req;   // this connection's bins request
+  windows_request windows_req;  // this connection's windows request
+  named_request named_req;      // this connection's named request
+  profile_request profile_req;  // this connection's profile request
+  request_context ctx;  // methylome and index found for this request
   response_header_buffer resp_hdr_buf{};
   response_header resp_hdr;  // header of the response
   response_payload resp;     // response to send back
   logger &lgr;
   std::uint32_t conn_id{};  // identifer for this connection
   std::uint32_t read_timeout_seconds{10};
+  std::uint32_t n_requests{};  // requests answered on this connection
 
   // These help keep track of where we are in the incoming offsets;
   // they might best be associated with the request.
@@ -23,6 +23,7 @@
 
 #include "cpg_index_meta.hpp"
 
+#include "genomic_interval.hpp"
 #include "utilities.hpp"  // for get_time_as_string
 
 #include <config.h>  // for VERSION
@@ -69,15 +70,61 @@ cpg_index_meta::init_env() -> std::error_code {
 
 [[nodiscard]] auto
 cpg_index_meta::get_n_bins(const std::uint32_t bin_size) const
-  -> std::uint32_t {
-  const auto get_n_bins_for_chrom = [&](const auto chrom_size) {
-    return (chrom_size + bin_size) / bin_size;
+  -> std::uint64_t {
+  // ADS: must match the number of bins starting at 0, bin_size, ...
+  // and below chrom_size that get_bins produces for each chrom
+  const auto get_n_bins_for_chrom = [&](const std::uint64_t chrom_size) {
+    return (chrom_size + bin_size - 1) / bin_size;
   };
   return std::transform_reduce(std::cbegin(chrom_size), std::cend(chrom_size),
-                               static_cast<std::uint32_t>(0), std::plus{},
+                               std::uint64_t{}, std::plus{},
                                get_n_bins_for_chrom);
 }
 
+[[nodiscard]] auto
+cpg_index_meta::get_n_bins(const std::uint32_t bin_size,
+                           const std::vector<genomic_interval> &regions) const
+  -> std::uint64_t {
+  // ADS: regions are clipped to the chrom size, and assumed valid; a
+  // client can repeat regions, so the sum is in 64 bits
+  const auto get_n_bins_for_region = [&](const genomic_interval &r) {
+    const std::uint64_t stop = std::min(r.stop, chrom_size[r.ch_id]);
+    return r.start < stop ? (stop - r.start + bin_size - 1) / bin_size : 0u;
+  };
+  return std::transform_reduce(std::cbegin(regions), std::cend(regions),
+                               std::uint64_t{}, std::plus{},
+                               get_n_bins_for_region);
+}
+
+[[nodiscard]] auto
+cpg_index_meta::get_bins_offsets(const std::vector<std::uint32_t> &bin_sizes)
+  const -> std::vector<std::uint64_t> {
+  std::vector<std::uint64_t> offsets{0};
+  for (const auto bin_size : bin_sizes)
+    offsets.push_back(offsets.back() + get_n_bins(bin_size));
+  return offsets;
+}
+
+[[nodiscard]] auto
+cpg_index_meta::get_bins_offsets(
+  const std::vector<std::uint32_t> &bin_sizes,
+  const std::vector<genomic_interval> &regions) const
+  -> std::vector<std::uint64_t> {
+  std::vector<std::uint64_t> offsets{0};
+  for (const auto bin_size : bin_sizes)
+    offsets.push_back(offsets.back() + get_n_bins(bin_size, regions));
+  return offsets;
+}
+
+[[nodiscard]] auto
+cpg_index_meta::regions_valid(const std::vector<genomic_interval> &regions)
+  const -> bool {
+  const std::int32_t n_chroms = std::size(chrom_size);
+  return std::ranges::all_of(regions, [&](const genomic_interval &r) {
+    return 0 <= r.ch_id && r.ch_id < n_chroms && r.start <= r.stop;
+  });
+}
+
 [[nodiscard]] auto
 cpg_index_meta::tostring() const -> std::string {
   std::ostringstream o;
@@ -37,6 +37,8 @@
 #include <variant>  // IWYU pragma: keep
 #include <vector>
 
+struct genomic_interval;
+
 enum class cpg_index_meta_error : std::uint32_t {
   ok = 0,
   version_not_found = 1,
@@ -121,7 +123,27 @@ struct cpg_index_meta {
   get_n_cpgs_chrom() const -> std::vector<std::uint32_t>;
 
   [[nodiscard]] auto
-  get_n_bins(const std::uint32_t bin_size) const -> std::uint32_t;
+  get_n_bins(const std::uint32_t bin_size) const -> std::uint64_t;
+
+  [[nodiscard]] auto
+  get_n_bins(const std::uint32_t bin_size,
+             const std::vector<genomic_interval> &regions) const
+    -> std::uint64_t;
+
+  // directory for bins of several sizes held together: the bins for
+  // bin_sizes[i] are at [offsets[i], offsets[i + 1]); summed in 64
+  // bits, as the bins of all sizes together may not fit in 32
+  [[nodiscard]] auto
+  get_bins_offsets(const std::vector<std::uint32_t> &bin_sizes) const
+    -> std::vector<std::uint64_t>;
+
+  [[nodiscard]] auto
+  get_bins_offsets(const std::vector<std::uint32_t> &bin_sizes,
+                   const std::vector<genomic_interval> &regions) const
+    -> std::vector<std::uint64_t>;
+
+  [[nodiscard]] auto
+  regions_valid(const std::vector<genomic_interval> &regions) const -> bool;
 };
 
 // clang-format off
@@ -25,12 +25,17 @@
 
 #include "cpg_index.hpp"
 #include "cpg_index_meta.hpp"
+#include "genomic_interval.hpp"
 #include "logger.hpp"
 #include "xfrase_error.hpp"  // IWYU pragma: keep
 
+#include <algorithm>
 #include <filesystem>
 #include <format>
 #include <iterator>  // for std::cend
+#include <memory>
+#include <mutex>
+#include <ranges>
 #include <regex>
 #include <string>
 #include <system_error>
@@ -60,6 +65,112 @@ cpg_index_set::get_cpg_index_with_meta(const std::string &assembly_name)
   return {itr_index->second, itr_meta->second, {}};
 }
 
+[[nodiscard]] auto
+interval_set::get_cached_result(const std::uint64_t methylome_hash,
+                                const std::uint32_t rq_type) const
+  -> std::shared_ptr<const result_type> {
+  std::scoped_lock lock{mtx};
+  const auto itr = std::ranges::find_if(cached_results, [&](const auto &x) {
+    return x.methylome_hash == methylome_hash && x.rq_type == rq_type;
+  });
+  return itr == std::cend(cached_results) ? nullptr : itr->result;
+}
+
+auto
+interval_set::add_cached_result(const std::uint64_t methylome_hash,
+                                const std::uint32_t rq_type,
+                                std::shared_ptr<const result_type> result)
+  -> void {
+  std::scoped_lock lock{mtx};
+  std::erase_if(cached_results, [&](const auto &x) {
+    return x.methylome_hash == methylome_hash && x.rq_type == rq_type;
+  });
+  cached_results.emplace_front(
+    cached_result{methylome_hash, rq_type, std::move(result)});
+  if (std::size(cached_results) > max_cached_results)
+    cached_results.pop_back();
+}
+
+[[nodiscard]] auto
+cpg_index_set::get_interval_set(const std::string &assembly_name,
+                                const std::string &set_name) const
+  -> std::tuple<std::shared_ptr<interval_set>, std::error_code> {
+  const auto itr_assembly = assembly_to_interval_sets.find(assembly_name);
+  if (itr_assembly == std::cend(assembly_to_interval_sets))
+    return {nullptr, cpg_index_code::interval_set_not_found};
+  const auto itr_set = itr_assembly->second.find(set_name);
+  if (itr_set == std::cend(itr_assembly->second))
+    return {nullptr, cpg_index_code::interval_set_not_found};
+  return {itr_set->second, {}};
+}
+
+[[nodiscard]] static auto
+offsets_within_chroms(
+  const cpg_index_meta &cim,
+  const std::vector<std::pair<std::uint32_t, std::uint32_t>> &offsets)
+  -> bool {
+  return std::ranges::all_of(offsets, [&](const auto &q) {
+    if (q.first == q.second)
+      return true;
+    const auto ch_itr = std::ranges::upper_bound(cim.chrom_offset, q.first);
+    return ch_itr == std::cend(cim.chrom_offset) || q.second <= *ch_itr;
+  });
+}
+
+[[nodiscard]] auto
+cpg_index_set::load_interval_sets(const std::string &interval_sets_directory)
+  -> std::error_code {
+  auto &lgr = logger::instance();
+  std::error_code ec;
+  for (const auto &assembly_dir :
+       std::filesystem::directory_iterator{interval_sets_directory, ec}) {
+    const auto assembly = assembly_dir.path().filename().string();
+    const auto itr_index = assembly_to_cpg_index.find(assembly);
+    const auto itr_meta = assembly_to_cpg_index_meta.find(assembly);
+    if (!assembly_dir.is_directory() ||
+        itr_index == std::cend(assembly_to_cpg_index) ||
+        itr_meta == std::cend(assembly_to_cpg_index_meta)) {
+      lgr.warning("Ignoring interval sets without cpg index: {}", assembly);
+      continue;
+    }
+    const auto &index = itr_index->second;
+    const auto &cim = itr_meta->second;
+    for (const auto &set_file :
+         std::filesystem::directory_iterator{assembly_dir.path(), ec}) {
+      if (set_file.path().extension() != interval_set::filename_extension)
+        continue;
+      auto [anchors, load_err] =
+        profile_anchor::load(cim, set_file.path().string());
+      // ADS: one bad file only loses its own set
+      if (load_err) {
+        lgr.warning("Skipping interval set {}: {}", set_file.path().string(),
+                    load_err);
+        continue;
+      }
+      std::vector<genomic_interval> gis;
+      gis.reserve(std::size(anchors));
+      for (const auto &a : anchors)
+        gis.push_back({a.ch_id, a.start, a.stop});
+      // ADS: clients sort their copy of the intervals the same way
+      if (!intervals_sorted(cim, gis))
+        std::ignore = sort_intervals(gis);
+      auto is = std::make_shared<interval_set>();
+      is->name = set_file.path().stem().string();
+      is->assembly = assembly;
+      is->offsets = index.get_offsets(cim, gis);
+      is->intervals_hash = get_intervals_hash(gis);
+      is->within_chroms = offsets_within_chroms(cim, is->offsets);
+      is->anchors = std::move(anchors);
+      lgr.info("Loaded interval set {} for {} ({} intervals)", is->name,
+               assembly, std::size(is->offsets));
+      assembly_to_interval_sets[assembly].emplace(is->name, std::move(is));
+    }
+    if (ec)
+      return ec;
+  }
+  return ec;
+}
+
 cpg_index_set::cpg_index_set(const std::string &cpg_index_directory,
                              std::error_code &ec) {
   static constexpr auto assembly_ptrn = R"(^[_[:alnum:]]+)";
@@ -107,4 +218,9 @@ cpg_index_set::cpg_index_set(const std::string &cpg_index_directory,
 
   assembly_to_cpg_index = std::move(assembly_to_cpg_index_in);
   assembly_to_cpg_index_meta = std::move(assembly_to_cpg_index_meta_in);
+
+  // ADS: interval sets are optional
+  const auto interval_sets_dir = idx_dir / interval_sets_dirname;
+  if (std::filesystem::is_directory(interval_sets_dir))
+    ec = load_interval_sets(interval_sets_dir.string());
 }
@@ -26,12 +26,66 @@
 
 #include "cpg_index.hpp"
 #include "cpg_index_meta.hpp"
+#include "genomic_interval.hpp"  // for profile_anchor
 
+#include <cstddef>  // for std::byte, std::size_t
+#include <cstdint>  // for std::uint32_t, std::uint64_t
+#include <deque>
+#include <memory>  // for std::shared_ptr
+#include <mutex>
 #include <string>
 #include <system_error>
 #include <tuple>
 #include <unordered_map>
+#include <utility>  // for std::pair
 #include <variant>
+#include <vector>
+
+/*
+  interval_set: intervals the server loads for an assembly, kept as
+  offsets so a request can name the set instead of sending offsets.
+  Intervals are sorted as they are loaded, so results are in the order
+  a client gets by sorting the same intervals. The intervals are also
+  kept with their strands as anchors for profiles. Recent responses are
+  kept with the set, since the same annotation is often requested for
+  the same methylome more than once.
+ */
+struct interval_set {
+  static constexpr auto filename_extension{".bed"};
+  static constexpr std::size_t max_cached_results{8};
+
+  typedef std::vector<std::byte> result_type;
+
+  std::string name;
+  std::string assembly;
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> offsets;
+  std::vector<profile_anchor> anchors;
+  // ADS: from get_intervals_hash of the sorted intervals, so a client
+  // naming the set can be checked to have the same intervals
+  std::uint64_t intervals_hash{};
+  // ADS: true if each offset range is inside one chrom, so counts can
+  // be done one chrom at a time
+  bool within_chroms{};
+
+  [[nodiscard]] auto
+  get_cached_result(const std::uint64_t methylome_hash,
+                    const std::uint32_t rq_type) const
+    -> std::shared_ptr<const result_type>;
+
+  auto
+  add_cached_result(const std::uint64_t methylome_hash,
+                    const std::uint32_t rq_type,
+                    std::shared_ptr<const result_type> result) -> void;
+
+private:
+  struct cached_result {
+    std::uint64_t methylome_hash{};
+    std::uint32_t rq_type{};
+    std::shared_ptr<const result_type> result;
+  };
+  mutable std::mutex mtx;
+  std::deque<cached_result> cached_results;  // most recent first
+};
 
 struct cpg_index_set {
   cpg_index_set(const cpg_index_set &) = delete;
@@ -49,8 +103,25 @@ struct cpg_index_set {
   get_cpg_index_with_meta(const std::string &assembly_name)
     -> std::tuple<const cpg_index &, const cpg_index_meta &, std::error_code>;
 
+  [[nodiscard]] auto
+  get_interval_set(const std::string &assembly_name,
+                   const std::string &set_name) const
+    -> std::tuple<std::shared_ptr<interval_set>, std::error_code>;
+
+  // named sets of intervals in interval_sets/<assembly>/<name>.bed
+  // under the cpg index directory, for assemblies with an index
+  static constexpr auto interval_sets_dirname{"interval_sets"};
+
+  [[nodiscard]] auto
+  load_interval_sets(const std::string &interval_sets_directory)
+    -> std::error_code;
+
   std::unordered_map<std::string, cpg_index> assembly_to_cpg_index;
   std::unordered_map<std::string, cpg_index_meta> assembly_to_cpg_index_meta;
+  std::unordered_map<std::string,
+                     std::unordered_map<std::string,
+                                        std::shared_ptr<interval_set>>>
+    assembly_to_interval_sets;
 };
 
 #endif  // SRC_CPG_INDEX_SET_HPP_
@@ -25,14 +25,19 @@
 #include "genomic_interval_impl.hpp"
 
 #include "cpg_index_meta.hpp"  // for cpg_index_meta
+#include "hash.hpp"
 
 #include <algorithm>
+#include <array>
 #include <cerrno>
 #include <charconv>
+#include <cstddef>  // for std::size_t
+#include <cstdint>
 #include <fstream>
 #include <iterator>  // for std::cend
 #include <ranges>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <utility>  // for std::move, std::pair
@@ -99,6 +104,75 @@ genomic_interval::load(const cpg_index_meta &cim, const std::string &filename)
   return {std::move(v), genomic_interval_code::ok};
 }
 
+// ADS: true if the 6th column of a BED line is '-'
+[[nodiscard]] static inline auto
+is_rev_strand(const std::string &line) -> bool {
+  static constexpr auto strand_column{5};
+  std::size_t pos{};
+  for (auto i = 0; i < strand_column && pos != std::string::npos; ++i) {
+    pos = line.find_first_of(" \t", pos);
+    if (pos != std::string::npos)
+      ++pos;
+  }
+  return pos != std::string::npos && pos < std::size(line) && line[pos] == '-';
+}
+
+[[nodiscard]] auto
+profile_anchor::load(const cpg_index_meta &cim, const std::string &filename)
+  -> std::tuple<std::vector<profile_anchor>, std::error_code> {
+  std::ifstream in{filename};
+  if (!in)
+    return {{}, std::make_error_code(std::errc(errno))};
+  std::vector<profile_anchor> v;
+  std::string line;
+  std::error_code ec;
+  while (getline(in, line)) {
+    const auto gi = parse(cim, line, ec);
+    if (ec)
+      return {{}, ec};
+    v.push_back({gi.ch_id, gi.start, gi.stop, is_rev_strand(line)});
+  }
+  return {std::move(v), genomic_interval_code::ok};
+}
+
+[[nodiscard]] auto
+genomic_interval::parse_region(const cpg_index_meta &cim,
+                               const std::string &region)
+  -> std::tuple<genomic_interval, std::error_code> {
+  const auto colon_pos = region.rfind(':');
+  const auto ch_id_itr = cim.chrom_index.find(region.substr(0, colon_pos));
+  if (ch_id_itr == std::cend(cim.chrom_index))
+    return {{}, genomic_interval_code::chrom_name_not_found_in_index};
+  const auto ch_id = ch_id_itr->second;
+  const auto chrom_size = cim.chrom_size[ch_id];
+  if (colon_pos == std::string::npos)
+    return {{ch_id, 0, chrom_size}, genomic_interval_code::ok};
+
+  const auto region_end = region.data() + std::size(region);
+  std::uint32_t start{};
+  auto result =
+    std::from_chars(region.data() + colon_pos + 1, region_end, start);
+  if (static_cast<bool>(result.ec) || result.ptr == region_end ||
+      *result.ptr != '-')
+    return {{}, genomic_interval_code::error_parsing_region};
+  std::uint32_t stop{};
+  result = std::from_chars(result.ptr + 1, region_end, stop);
+  if (static_cast<bool>(result.ec) || result.ptr != region_end || stop < start)
+    return {{}, genomic_interval_code::error_parsing_region};
+  if (stop > chrom_size)
+    return {{}, genomic_interval_code::interval_past_chrom_end_in_index};
+  return {{ch_id, start, stop}, genomic_interval_code::ok};
+}
+
+[[nodiscard]] auto
+get_intervals_hash(const std::vector<genomic_interval> &gis)
+  -> std::uint64_t {
+  // ADS: three 32-bit fields and no padding, so the bytes are the
+  // same on any machine with the same byte order
+  static_assert(sizeof(genomic_interval) == 3 * sizeof(std::uint32_t));
+  return get_adler(gis.data(), std::size(gis) * sizeof(genomic_interval));
+}
+
 [[nodiscard]] auto
 intervals_sorted(const cpg_index_meta &cim,
                  const std::vector<genomic_interval> &gis) -> bool {
@@ -125,3 +199,89 @@ intervals_sorted(const cpg_index_meta &cim,
   }
   return is_sorted;
 }
+
+// ADS: radix sort on 64-bit keys with chrom id in the high bits and
+// start in the low bits; 16-bit digits mean at most 4 passes, and a
+// pass is skipped if every key has the same digit, which for the
+// chrom id part is usual
+static constexpr std::uint32_t radix_bits{16};
+static constexpr std::size_t n_radix_buckets{1ul << radix_bits};
+static constexpr std::size_t min_intervals_per_thread{1ul << 16};
+
+[[nodiscard]] static inline auto
+get_sort_key(const genomic_interval &gi) -> std::uint64_t {
+  return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(gi.ch_id))
+          << 32) |
+         gi.start;
+}
+
+[[nodiscard]] auto
+sort_intervals(std::vector<genomic_interval> &gis,
+               const std::uint32_t n_threads) -> std::vector<std::uint32_t> {
+  const std::size_t n = std::size(gis);
+  std::vector<std::uint64_t> keys(n);
+  std::vector<std::uint32_t> order(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    keys[i] = get_sort_key(gis[i]);
+    order[i] = i;
+  }
+
+  // ADS: each chunk is counted and scattered by its own thread; chunk
+  // c gets the positions in each bucket after those of chunks before
+  // c, which keeps the sort stable
+  const std::size_t n_chunks = std::clamp<std::size_t>(
+    n / min_intervals_per_thread, 1, std::max(n_threads, 1u));
+  const std::size_t chunk_size = (n + n_chunks - 1) / n_chunks;
+  const auto run_chunks = [&](const auto &f) {
+    std::vector<std::jthread> threads;
+    for (std::size_t c = 1; c < n_chunks; ++c)
+      threads.emplace_back(f, c);
+    f(0);
+  };  // ADS: threads join here
+
+  std::vector<std::uint64_t> keys_out(n);
+  std::vector<std::uint32_t> order_out(n);
+  std::vector<std::vector<std::size_t>> counts(
+    n_chunks, std::vector<std::size_t>(n_radix_buckets));
+  for (std::uint32_t shift = 0; shift < 64; shift += radix_bits) {
+    const auto digit = [shift](const std::uint64_t k) {
+      return (k >> shift) & (n_radix_buckets - 1);
+    };
+    run_chunks([&](const std::size_t c) {
+      auto &chunk_counts = counts[c];
+      std::ranges::fill(chunk_counts, 0);
+      const auto last = std::min(n, (c + 1) * chunk_size);
+      for (auto i = c * chunk_size; i < last; ++i)
+        ++chunk_counts[digit(keys[i])];
+    });
+
+    std::size_t n_in_first_bucket{};
+    for (const auto &chunk_counts : counts)
+      n_in_first_bucket += chunk_counts[n == 0 ? 0 : digit(keys[0])];
+    if (n_in_first_bucket == n)
+      continue;  // every key has the same digit
+
+    // counts become the first position for each chunk in each bucket
+    for (std::size_t pos = 0, b = 0; b < n_radix_buckets; ++b)
+      for (auto &chunk_counts : counts)
+        pos += std::exchange(chunk_counts[b], pos);
+
+    run_chunks([&](const std::size_t c) {
+      auto &chunk_pos = counts[c];
+      const auto last = std::min(n, (c + 1) * chunk_size);
+      for (auto i = c * chunk_size; i < last; ++i) {
+        const auto p = chunk_pos[digit(keys[i])]++;
+        keys_out[p] = keys[i];
+        order_out[p] = order[i];
+      }
+    });
+    std::swap(keys, keys_out);
+    std::swap(order, order_out);
+  }
+
+  std::vector<genomic_interval> sorted(n);
+  for (std::size_t i = 0; i < n; ++i)
+    sorted[i] = gis[order[i]];
+  gis = std::move(sorted);
+  return order;
+}
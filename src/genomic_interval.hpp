@@ -25,7 +25,9 @@
 #define SRC_GENOMIC_INTERVAL_HPP_
 
 #include <algorithm>
+#include <cstddef>  // for std::size_t
 #include <cstdint>
+#include <iterator>  // for std::size
 #include <format>
 #include <ranges>  // IWYU pragma: keep
 #include <string>
@@ -50,6 +52,31 @@ struct genomic_interval {
   [[nodiscard]] static auto
   load(const cpg_index_meta &index, const std::string &filename)
     -> std::tuple<std::vector<genomic_interval>, std::error_code>;
+
+  // region is either a chrom name for the whole chrom, or
+  // chrom:start-stop
+  [[nodiscard]] static auto
+  parse_region(const cpg_index_meta &index, const std::string &region)
+    -> std::tuple<genomic_interval, std::error_code>;
+};
+
+// profile_anchor: an interval with a strand, for a profile of levels
+// around features like genes; a profile is oriented 5' to 3' on the
+// strand of each anchor
+struct profile_anchor {
+  std::int32_t ch_id{genomic_interval::not_a_chrom};
+  std::uint32_t start{};
+  std::uint32_t stop{};
+  std::uint32_t is_rev{};  // ADS: 32 bits so the struct has no padding
+
+  auto
+  operator<=>(const profile_anchor &) const = default;
+
+  // BED lines; the strand is the 6th column if there is one, and
+  // without it the anchor is on the forward strand
+  [[nodiscard]] static auto
+  load(const cpg_index_meta &index, const std::string &filename)
+    -> std::tuple<std::vector<profile_anchor>, std::error_code>;
 };
 
 // ADS: Sorted intervals have chromosomes together but the order on
@@ -59,6 +86,32 @@ struct genomic_interval {
 intervals_sorted(const cpg_index_meta &cim,
                  const std::vector<genomic_interval> &gis) -> bool;
 
+// ADS: sorts intervals by chrom id and then start, with a stable
+// radix sort using up to n_threads threads. Returns the order of the
+// input, so that element i of the sorted intervals was element
+// order[i] of the input.
+[[nodiscard]] auto
+sort_intervals(std::vector<genomic_interval> &gis,
+               const std::uint32_t n_threads = 1) -> std::vector<std::uint32_t>;
+
+// ADS: checksum of the intervals in their order; a client and the
+// server sort the same intervals the same way, so a client can check
+// that a set of intervals named on the server is the one it has
+[[nodiscard]] auto
+get_intervals_hash(const std::vector<genomic_interval> &gis) -> std::uint64_t;
+
+// Put values computed for sorted intervals back in the order of the
+// input, using the order returned by sort_intervals.
+template <typename T>
+[[nodiscard]] auto
+restore_input_order(const std::vector<T> &sorted,
+                    const std::vector<std::uint32_t> &order) -> std::vector<T> {
+  std::vector<T> restored(std::size(sorted));
+  for (std::size_t i = 0; i < std::size(sorted); ++i)
+    restored[order[i]] = sorted[i];
+  return restored;
+}
+
 [[nodiscard]] inline auto
 intervals_valid(const auto &g) -> bool {
   return std::ranges::all_of(g, [](const auto x) { return x.start <= x.stop; });
@@ -79,6 +132,7 @@ enum class genomic_interval_code : std::uint32_t {
   error_parsing_bed_line = 1,
   chrom_name_not_found_in_index = 2,
   interval_past_chrom_end_in_index = 3,
+  error_parsing_region = 4,
 };
 
 // register genomic_interval_code as error code enum
@@ -101,6 +155,7 @@ struct genomic_interval_category : std::error_category {
     case 1: return "error parsing BED line"s;
     case 2: return "chrom name not found in index"s;
     case 3: return "interval past chrom end in index"s;
+    case 4: return "error parsing region"s;
     }
     // clang-format on
     std::unreachable();  // hopefully
@@ -44,6 +44,7 @@
 #include <vector>
 
 struct counts_res_cov;
+struct counts_res_ext;
 
 [[nodiscard]] auto
 write_intervals(std::ostream &out, const cpg_index_meta &cim,
@@ -85,6 +86,20 @@ write_intervals(std::ostream &out, const cpg_index_meta &cim,
         *tcr.ptr++ = delim;
         tcr = std::to_chars(tcr.ptr, buf_end, single_result.n_covered);
       }
+      if constexpr (std::is_same<counts_res_type, counts_res_ext>::value) {
+        static constexpr auto level_precision{6};
+        *tcr.ptr++ = delim;
+        tcr = std::to_chars(tcr.ptr, buf_end, single_result.n_covered);
+        *tcr.ptr++ = delim;
+        tcr = std::to_chars(tcr.ptr, buf_end, single_result.n_sites);
+        *tcr.ptr++ = delim;
+        tcr = std::to_chars(tcr.ptr, buf_end, get_mean_level(single_result),
+                            std::chars_format::general, level_precision);
+        *tcr.ptr++ = delim;
+        tcr =
+          std::to_chars(tcr.ptr, buf_end, get_level_variance(single_result),
+                        std::chars_format::general, level_precision);
+      }
       *tcr.ptr++ = '\n';
 #if defined(__GNUG__) and not defined(__clang__)
 #pragma GCC diagnostic pop
@@ -164,8 +179,9 @@ write_bins(std::ostream &out, const cpg_index_meta &cim,
   for (const auto [chrom_size, chrom_name] : zipped) {
     std::ranges::copy(chrom_name, buf.data());
     buf[size(chrom_name)] = delim;
-    for (std::uint32_t bin_beg = 0; bin_beg < chrom_size; bin_beg += bin_size) {
-      const auto bin_end = std::min(bin_beg + bin_size, chrom_size);
+    for (std::uint64_t bin_beg = 0; bin_beg < chrom_size; bin_beg += bin_size) {
+      const auto bin_end = std::min<std::uint64_t>(bin_beg + bin_size,
+                                                   chrom_size);
       std::to_chars_result tcr{buf.data() + std::size(chrom_name) + 1,
                                std::errc()};
 #if defined(__GNUG__) and not defined(__clang__)
@@ -214,8 +230,9 @@ write_bins_bedgraph(std::ostream &out, const cpg_index_meta &cim,
   for (const auto [chrom_size, chrom_name] : zipped) {
     std::ranges::copy(chrom_name, buf.data());
     buf[size(chrom_name)] = delim;
-    for (std::uint32_t bin_beg = 0; bin_beg < chrom_size; bin_beg += bin_size) {
-      const auto bin_end = std::min(bin_beg + bin_size, chrom_size);
+    for (std::uint64_t bin_beg = 0; bin_beg < chrom_size; bin_beg += bin_size) {
+      const auto bin_end = std::min<std::uint64_t>(bin_beg + bin_size,
+                                                   chrom_size);
       std::to_chars_result tcr{buf.data() + std::size(chrom_name) + 1,
                                std::errc()};
 #if defined(__GNUG__) and not defined(__clang__)
@@ -243,4 +260,178 @@ write_bins_bedgraph(std::ostream &out, const cpg_index_meta &cim,
   return {};
 }
 
+// ADS: bins within regions are written as intervals; these must be
+// generated in the same order as get_bins produces them for regions
+[[nodiscard]] inline auto
+get_bins_in_regions(const cpg_index_meta &cim, const std::uint32_t bin_size,
+                    const std::vector<genomic_interval> &regions)
+  -> std::vector<genomic_interval> {
+  std::vector<genomic_interval> bins;
+  bins.reserve(cim.get_n_bins(bin_size, regions));
+  for (const auto &r : regions) {
+    const auto stop = std::min(r.stop, cim.chrom_size[r.ch_id]);
+    for (std::uint64_t bin_beg = r.start; bin_beg < stop; bin_beg += bin_size)
+      bins.push_back({r.ch_id, static_cast<std::uint32_t>(bin_beg),
+                      static_cast<std::uint32_t>(
+                        std::min<std::uint64_t>(bin_beg + bin_size, stop))});
+  }
+  return bins;
+}
+
+// ADS: windows are written in the order get_windows produces them,
+// so for whole chroms each region must be a full chrom
+[[nodiscard]] auto
+write_windows(std::ostream &out, const cpg_index_meta &cim,
+              const std::uint32_t window_size, const std::uint32_t window_step,
+              const std::vector<genomic_interval> &regions,
+              const auto &results) -> std::error_code {
+  static constexpr auto buf_size{512};
+  static constexpr auto delim{'\t'};
+
+  using counts_res_type =
+    typename std::remove_cvref_t<decltype(results)>::value_type;
+
+  std::array<char, buf_size> buf{};
+  const auto buf_end = buf.data() + buf_size;
+
+  auto results_itr = std::cbegin(results);
+
+  for (const auto &r : regions) {
+    const auto &chrom_name = cim.chrom_order[r.ch_id];
+    const auto stop = std::min(r.stop, cim.chrom_size[r.ch_id]);
+    std::ranges::copy(chrom_name, buf.data());
+    buf[size(chrom_name)] = delim;
+    for (std::uint64_t win_beg = r.start; win_beg < stop;
+         win_beg += window_step) {
+      const auto win_end = std::min<std::uint64_t>(win_beg + window_size, stop);
+      std::to_chars_result tcr{buf.data() + std::size(chrom_name) + 1,
+                               std::errc()};
+#if defined(__GNUG__) and not defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic error "-Wstringop-overflow=0"
+#endif
+      tcr = std::to_chars(tcr.ptr, buf_end, win_beg);
+      *tcr.ptr++ = delim;
+      tcr = std::to_chars(tcr.ptr, buf_end, win_end);
+      *tcr.ptr++ = delim;
+      tcr = std::to_chars(tcr.ptr, buf_end, results_itr->n_meth);
+      *tcr.ptr++ = delim;
+      tcr = std::to_chars(tcr.ptr, buf_end, results_itr->n_unmeth);
+      if constexpr (std::is_same<counts_res_type, counts_res_cov>::value) {
+        *tcr.ptr++ = delim;
+        tcr = std::to_chars(tcr.ptr, buf_end, results_itr->n_covered);
+      }
+      *tcr.ptr++ = '\n';
+#if defined(__GNUG__) and not defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+      out.write(buf.data(), std::ranges::distance(buf.data(), tcr.ptr));
+      if (!out)
+        return std::make_error_code(std::errc(errno));
+      ++results_itr;
+    }
+  }
+  assert(results_itr == std::cend(results));
+  return {};
+}
+
+[[nodiscard]] auto
+write_windows_bedgraph(std::ostream &out, const cpg_index_meta &cim,
+                       const std::uint32_t window_size,
+                       const std::uint32_t window_step,
+                       const std::vector<genomic_interval> &regions,
+                       std::ranges::input_range auto &&scores)
+  -> std::error_code {
+  static constexpr auto score_precision{6};
+  static constexpr auto buf_size{512};
+  static constexpr auto delim{'\t'};
+
+  std::array<char, buf_size> buf{};
+  const auto buf_end = buf.data() + buf_size;
+
+  auto scores_itr = std::cbegin(scores);
+
+  for (const auto &r : regions) {
+    const auto &chrom_name = cim.chrom_order[r.ch_id];
+    const auto stop = std::min(r.stop, cim.chrom_size[r.ch_id]);
+    std::ranges::copy(chrom_name, buf.data());
+    buf[size(chrom_name)] = delim;
+    for (std::uint64_t win_beg = r.start; win_beg < stop;
+         win_beg += window_step) {
+      const auto win_end = std::min<std::uint64_t>(win_beg + window_size, stop);
+      std::to_chars_result tcr{buf.data() + std::size(chrom_name) + 1,
+                               std::errc()};
+#if defined(__GNUG__) and not defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic error "-Wstringop-overflow=0"
+#endif
+      tcr = std::to_chars(tcr.ptr, buf_end, win_beg);
+      *tcr.ptr++ = delim;
+      tcr = std::to_chars(tcr.ptr, buf_end, win_end);
+      *tcr.ptr++ = delim;
+      tcr = std::to_chars(tcr.ptr, buf_end, *scores_itr,
+                          std::chars_format::general, score_precision);
+      *tcr.ptr++ = '\n';
+#if defined(__GNUG__) and not defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+      out.write(buf.data(), std::ranges::distance(buf.data(), tcr.ptr));
+      if (!out)
+        return std::make_error_code(std::errc(errno));
+      ++scores_itr;
+    }
+  }
+  assert(scores_itr == std::cend(scores));
+  return {};
+}
+
+// ADS: counts and positions are concatenated over intervals, with the
+// number for each interval given by the corresponding offsets
+[[nodiscard]] auto
+write_sites(std::ostream &out, const cpg_index_meta &cim,
+            const std::vector<genomic_interval> &gis,
+            const std::vector<std::pair<std::uint32_t, std::uint32_t>> &offsets,
+            const auto &counts, const auto &positions) -> std::error_code {
+  static constexpr auto buf_size{512};
+  static constexpr auto delim{'\t'};
+
+  std::array<char, buf_size> buf{};
+  const auto buf_end = buf.data() + buf_size;
+
+  assert(std::size(counts) == std::size(positions));
+  auto counts_itr = std::cbegin(counts);
+  auto positions_itr = std::cbegin(positions);
+
+  for (const auto &[gi, offset] : std::views::zip(gis, offsets)) {
+    const auto &chrom = cim.chrom_order[gi.ch_id];
+    std::ranges::copy(chrom, buf.data());
+    buf[size(chrom)] = delim;
+    for (auto i = offset.first; i < offset.second; ++i) {
+      std::to_chars_result tcr{buf.data() + size(chrom) + 1, std::errc()};
+#if defined(__GNUG__) and not defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic error "-Wstringop-overflow=0"
+#endif
+      tcr = std::to_chars(tcr.ptr, buf_end, *positions_itr);
+      *tcr.ptr++ = delim;
+      tcr = std::to_chars(tcr.ptr, buf_end, *positions_itr + 1);
+      *tcr.ptr++ = delim;
+      tcr = std::to_chars(tcr.ptr, buf_end, counts_itr->first);
+      *tcr.ptr++ = delim;
+      tcr = std::to_chars(tcr.ptr, buf_end, counts_itr->second);
+      *tcr.ptr++ = '\n';
+#if defined(__GNUG__) and not defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+      out.write(buf.data(), std::ranges::distance(buf.data(), tcr.ptr));
+      if (!out)
+        return std::make_error_code(std::errc(errno));
+      ++counts_itr;
+      ++positions_itr;
+    }
+  }
+  assert(counts_itr == std::cend(counts));
+  return {};
+}
+
 #endif  // SRC_GENOMIC_INTERVAL_OUTPUT_HPP_
@@ -126,6 +126,11 @@ shared_from_cout() -> std::shared_ptr<std::ostream> {
   return std::make_shared<std::ostream>(std::cout.rdbuf());
 }
 
+[[nodiscard]] inline auto
+shared_from_cerr() -> std::shared_ptr<std::ostream> {
+  return std::make_shared<std::ostream>(std::cerr.rdbuf());
+}
+
 class logger {
 private:
   static constexpr std::string_view date_time_fmt_expanded =
@@ -0,0 +1,262 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "merge_accumulator.hpp"
+
+#include "automatic_json.hpp"  // for tag_invoke
+#include "methylome.hpp"
+#include "methylome_metadata.hpp"
+#include "utilities.hpp"  // for get_time_as_string
+
+#include <config.h>  // for VERSION
+
+#include <boost/json.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>  // for std::size, std::cbegin, std::cend
+#include <limits>
+#include <ranges>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <utility>  // std::move
+#include <vector>
+
+#include <unistd.h>  // for getpid
+
+[[nodiscard]] auto
+merge_accumulator_metadata::read(const std::string &json_filename)
+  -> std::tuple<merge_accumulator_metadata, std::error_code> {
+  std::ifstream in(json_filename);
+  if (!in)
+    return {{}, std::make_error_code(std::errc(errno))};
+
+  std::error_code ec;
+  const auto filesize = std::filesystem::file_size(json_filename, ec);
+  if (ec)
+    return {{}, ec};
+
+  std::string payload(filesize, '\0');
+  if (!in.read(payload.data(), filesize))
+    return {{}, std::make_error_code(std::errc(errno))};
+
+  merge_accumulator_metadata mam;
+  boost::json::parse_into(mam, payload, ec);
+  if (ec)
+    return {{}, merge_accumulator_error::failure_parsing_json};
+
+  return {std::move(mam), merge_accumulator_error::ok};
+}
+
+[[nodiscard]] auto
+merge_accumulator_metadata::write(const std::string &json_filename) const
+  -> std::error_code {
+  std::ofstream out(json_filename);
+  if (!out)
+    return std::make_error_code(std::errc(errno));
+  if (!(out << boost::json::value_from(*this)))
+    return std::make_error_code(std::errc(errno));
+  return {};
+}
+
+[[nodiscard]] auto
+merge_accumulator_metadata::tostring() const -> std::string {
+  std::ostringstream o;
+  if (!(o << boost::json::value_from(*this)))
+    o.clear();
+  return o.str();
+}
+
+[[nodiscard]] auto
+merge_accumulator::init(const methylome_metadata &mm) -> merge_accumulator {
+  merge_accumulator acc;
+  acc.meta.version = VERSION;
+  acc.meta.creation_time = get_time_as_string();
+  acc.meta.index_hash = mm.index_hash;
+  acc.meta.assembly = mm.assembly;
+  acc.meta.n_cpgs = mm.n_cpgs;
+  acc.cpgs.resize(mm.n_cpgs);
+  return acc;
+}
+
+[[nodiscard]] auto
+merge_accumulator::read(const std::string &filename,
+                        const std::string &meta_filename)
+  -> std::tuple<merge_accumulator, std::error_code> {
+  auto [mam, meta_err] = merge_accumulator_metadata::read(meta_filename);
+  if (meta_err)
+    return {{}, meta_err};
+
+  std::error_code ec;
+  const auto filesize = std::filesystem::file_size(filename, ec);
+  if (ec)
+    return {{}, ec};
+  if (filesize != mam.n_cpgs * record_size)
+    return {{}, merge_accumulator_error::error_reading_accumulator};
+
+  std::ifstream in(filename, std::ios::binary);
+  if (!in)
+    return {{}, std::make_error_code(std::errc(errno))};
+
+  merge_accumulator acc;
+  acc.meta = std::move(mam);
+  acc.cpgs.resize(acc.meta.n_cpgs);
+  if (!in.read(reinterpret_cast<char *>(acc.cpgs.data()), filesize))
+    return {{}, merge_accumulator_error::error_reading_accumulator};
+
+  return {std::move(acc), merge_accumulator_error::ok};
+}
+
+[[nodiscard]] auto
+merge_accumulator::write(const std::string &filename,
+                         const std::string &meta_filename) const
+  -> std::error_code {
+  // ADS: counts and metadata are both written to temporary files and
+  // renamed over the old ones only once both are complete, so a failed
+  // write never leaves counts that disagree with methylome_hashes
+  const auto tmp_filename = std::format("{}.{}.tmp", filename, ::getpid());
+  const auto tmp_meta_filename =
+    std::format("{}.{}.tmp", meta_filename, ::getpid());
+  std::error_code write_err;
+  {
+    std::ofstream out(tmp_filename, std::ios::binary);
+    if (!out)
+      write_err = std::make_error_code(std::errc(errno));
+    else if (!out.write(reinterpret_cast<const char *>(cpgs.data()),
+                        std::size(cpgs) * record_size) ||
+             !out.flush())
+      write_err = merge_accumulator_error::error_writing_accumulator;
+  }
+  if (!write_err)
+    write_err = meta.write(tmp_meta_filename);
+  if (!write_err)
+    std::filesystem::rename(tmp_filename, filename, write_err);
+  if (!write_err)
+    std::filesystem::rename(tmp_meta_filename, meta_filename, write_err);
+  if (write_err) {
+    std::error_code ec;
+    std::filesystem::remove(tmp_filename, ec);
+    std::filesystem::remove(tmp_meta_filename, ec);
+    return write_err;
+  }
+  return {};
+}
+
+[[nodiscard]] auto
+merge_accumulator::contains(const std::uint64_t methylome_hash) const -> bool {
+  return std::ranges::find(meta.methylome_hashes, methylome_hash) !=
+         std::cend(meta.methylome_hashes);
+}
+
+[[nodiscard]] static inline auto
+consistent(const merge_accumulator &acc, const methylome &meth,
+           const methylome_metadata &mm) -> bool {
+  return acc.meta.index_hash == mm.index_hash &&
+         acc.meta.assembly == mm.assembly && acc.meta.n_cpgs == mm.n_cpgs &&
+         std::size(acc.cpgs) == std::size(meth.cpgs);
+}
+
+[[nodiscard]] auto
+merge_accumulator::add(const methylome &meth,
+                       const methylome_metadata &mm) -> std::error_code {
+  if (!consistent(*this, meth, mm))
+    return merge_accumulator_error::inconsistent_methylome;
+  if (contains(mm.methylome_hash))
+    return merge_accumulator_error::methylome_already_merged;
+  // ADS: as with remove, counts are unchanged if any sum would not fit
+  static constexpr auto max_count = std::numeric_limits<a_count_t>::max();
+  const auto above_max = [](const auto &l, const auto &r) {
+    return r.first > max_count - l.first || r.second > max_count - l.second;
+  };
+  if (std::ranges::any_of(std::views::zip(cpgs, meth.cpgs), [&](const auto &x) {
+        return above_max(std::get<0>(x), std::get<1>(x));
+      }))
+    return merge_accumulator_error::counts_above_maximum;
+  std::ranges::transform(cpgs, meth.cpgs, std::begin(cpgs),
+                         [](const auto &l, const auto &r) -> a_elem {
+                           return {l.first + r.first, l.second + r.second};
+                         });
+  meta.methylome_hashes.push_back(mm.methylome_hash);
+  return {};
+}
+
+[[nodiscard]] auto
+merge_accumulator::remove(const methylome &meth,
+                          const methylome_metadata &mm) -> std::error_code {
+  if (!consistent(*this, meth, mm))
+    return merge_accumulator_error::inconsistent_methylome;
+  const auto hash_itr = std::ranges::find(meta.methylome_hashes,
+                                          mm.methylome_hash);
+  if (hash_itr == std::cend(meta.methylome_hashes))
+    return merge_accumulator_error::methylome_not_merged;
+  // ADS: the hash says this methylome was added, but if counts would
+  // go below zero it was not the same data, so leave counts unchanged
+  const auto below_zero = [](const auto &l, const auto &r) {
+    return l.first < r.first || l.second < r.second;
+  };
+  if (std::ranges::any_of(std::views::zip(cpgs, meth.cpgs), [&](const auto &x) {
+        return below_zero(std::get<0>(x), std::get<1>(x));
+      }))
+    return merge_accumulator_error::counts_below_zero;
+  std::ranges::transform(cpgs, meth.cpgs, std::begin(cpgs),
+                         [](const auto &l, const auto &r) -> a_elem {
+                           return {l.first - r.first, l.second - r.second};
+                         });
+  meta.methylome_hashes.erase(hash_itr);
+  return {};
+}
+
+[[nodiscard]] auto
+merge_accumulator::get_methylome() const
+  -> std::tuple<methylome, methylome_metadata, std::error_code> {
+  methylome meth;
+  meth.cpgs.resize(std::size(cpgs));
+  std::ranges::transform(cpgs, std::begin(meth.cpgs),
+                         [](auto x) -> methylome::m_elem {
+                           conditional_round_to_fit<methylome::m_count_t>(
+                             x.first, x.second);
+                           return {x.first, x.second};
+                         });
+  methylome_metadata mm;
+  if (const auto err = mm.init_env())
+    return {{}, {}, err};
+  mm.methylome_hash = meth.hash();
+  mm.index_hash = meta.index_hash;
+  mm.assembly = meta.assembly;
+  mm.n_cpgs = meta.n_cpgs;
+  mm.is_compressed = false;
+  mm.block_size = methylome::default_block_size;
+  mm.block_hashes = meth.get_block_hashes(mm.block_size);
+  return {std::move(meth), std::move(mm), {}};
+}
+
+[[nodiscard]] auto
+get_default_merge_accumulator_metadata_filename(const std::string &accfile)
+  -> std::string {
+  return std::format("{}.json", accfile);
+}
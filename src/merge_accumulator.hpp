@@ -0,0 +1,190 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_MERGE_ACCUMULATOR_HPP_
+#define SRC_MERGE_ACCUMULATOR_HPP_
+
+#include <boost/describe.hpp>  // for BOOST_DESCRIBE_STRUCT
+
+#include <cstddef>  // for std::size_t
+#include <cstdint>  // for std::uint32_t, std::uint64_t
+#include <format>
+#include <iterator>  // for std::size
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>  // for std::true_type
+#include <utility>      // for std::pair, std::to_underlying, std::unreachable
+#include <variant>      // for std::tuple
+#include <vector>
+
+enum class merge_accumulator_error : std::uint32_t {
+  ok = 0,
+  error_reading_accumulator = 1,
+  error_writing_accumulator = 2,
+  failure_parsing_json = 3,
+  inconsistent_methylome = 4,
+  methylome_already_merged = 5,
+  methylome_not_merged = 6,
+  counts_below_zero = 7,
+  counts_above_maximum = 8,
+};
+
+// register merge_accumulator_error as error code enum
+template <>
+struct std::is_error_code_enum<merge_accumulator_error>
+  : public std::true_type {};
+
+// category to provide text descriptions
+struct merge_accumulator_error_category : std::error_category {
+  const char *
+  name() const noexcept override {
+    return "merge_accumulator_error";
+  }
+  std::string
+  message(int code) const override {
+    using std::string_literals::operator""s;
+    // clang-format off
+    switch (code) {
+    case 0: return "ok"s;
+    case 1: return "error reading accumulator"s;
+    case 2: return "error writing accumulator"s;
+    case 3: return "failure parsing accumulator metadata json"s;
+    case 4: return "methylome inconsistent with accumulator"s;
+    case 5: return "methylome already merged in accumulator"s;
+    case 6: return "methylome not merged in accumulator"s;
+    case 7: return "removing methylome gives counts below zero"s;
+    case 8: return "adding methylome gives counts above maximum"s;
+    }
+    // clang-format on
+    std::unreachable();  // hopefully this is unreacheable
+  }
+};
+
+inline std::error_code
+make_error_code(merge_accumulator_error e) {
+  static auto category = merge_accumulator_error_category{};
+  return std::error_code(std::to_underlying(e), category);
+}
+
+struct methylome;
+struct methylome_metadata;
+
+struct merge_accumulator_metadata {
+  std::string version;
+  std::string creation_time;
+  std::uint64_t index_hash{};
+  std::string assembly;
+  std::uint32_t n_cpgs{};
+  // ADS: methylome_hash for each methylome merged so far, in the
+  // order they were added
+  std::vector<std::uint64_t> methylome_hashes;
+
+  [[nodiscard]] static auto
+  read(const std::string &json_filename)
+    -> std::tuple<merge_accumulator_metadata, std::error_code>;
+
+  [[nodiscard]] auto
+  write(const std::string &json_filename) const -> std::error_code;
+
+  [[nodiscard]] auto
+  tostring() const -> std::string;
+};
+
+// clang-format off
+BOOST_DESCRIBE_STRUCT(merge_accumulator_metadata, (),
+(
+ version,
+ creation_time,
+ index_hash,
+ assembly,
+ n_cpgs,
+ methylome_hashes
+))
+// clang-format on
+
+/*
+  merge_accumulator: a persistent sum of methylomes with counts wide
+  enough that they never need rounding, along with the hashes of the
+  methylomes that have been summed. Adding or removing a methylome
+  requires one pass over that methylome only, and the merged methylome
+  is rounded to fit the methylome counts only when it is requested.
+ */
+struct merge_accumulator {
+  static constexpr auto filename_extension{".macc"};
+
+  typedef std::uint32_t a_count_t;
+  typedef std::pair<a_count_t, a_count_t> a_elem;
+
+  [[nodiscard]] static auto
+  init(const methylome_metadata &meta) -> merge_accumulator;
+
+  [[nodiscard]] static auto
+  read(const std::string &filename, const std::string &meta_filename)
+    -> std::tuple<merge_accumulator, std::error_code>;
+
+  [[nodiscard]] auto
+  write(const std::string &filename,
+        const std::string &meta_filename) const -> std::error_code;
+
+  [[nodiscard]] auto
+  add(const methylome &meth, const methylome_metadata &meta) -> std::error_code;
+
+  [[nodiscard]] auto
+  remove(const methylome &meth,
+         const methylome_metadata &meta) -> std::error_code;
+
+  [[nodiscard]] auto
+  contains(const std::uint64_t methylome_hash) const -> bool;
+
+  // round the accumulated counts to fit a methylome and make metadata
+  // for that methylome
+  [[nodiscard]] auto
+  get_methylome() const
+    -> std::tuple<methylome, methylome_metadata, std::error_code>;
+
+  std::vector<a_elem> cpgs{};
+  merge_accumulator_metadata meta{};
+  static constexpr auto record_size = sizeof(a_elem);
+};
+
+[[nodiscard]] inline auto
+size(const merge_accumulator &acc) -> std::size_t {
+  return std::size(acc.cpgs);
+}
+
+template <>
+struct std::formatter<merge_accumulator_metadata>
+  : std::formatter<std::string> {
+  auto
+  format(const merge_accumulator_metadata &mam,
+         std::format_context &ctx) const {
+    return std::format_to(ctx.out(), "{}", mam.tostring());
+  }
+};
+
+auto
+get_default_merge_accumulator_metadata_filename(const std::string &accfile)
+  -> std::string;
+
+#endif  // SRC_MERGE_ACCUMULATOR_HPP_
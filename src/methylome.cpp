@@ -24,6 +24,7 @@
 #include "methylome.hpp"
 
 #include "cpg_index_meta.hpp"
+#include "genomic_interval.hpp"
 #include "hash.hpp"
 #include "methylome_metadata.hpp"
 #include "methylome_results_types.hpp"
@@ -31,14 +32,24 @@
 #include "zlib_adapter.hpp"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cerrno>
 #include <cstdint>  // for uint32_t, uint16_t, uint8_t, uint64_t
+#include <cstring>  // for std::memcpy
 #include <filesystem>
 #include <fstream>
+#include <functional>  // for std::function
+#include <istream>
+#include <iterator>    // for std::distance, std::iterator_traits
+#include <memory>  // for std::make_shared
+#include <numeric>  // for std::iota
+#include <ostream>
 #include <ranges>
 #include <string>
 #include <system_error>
+#include <thread>
 #include <tuple>
 #include <type_traits>  // for is_same
 #include <utility>      // for pair, move
@@ -66,54 +77,434 @@ methylome::get_n_cpgs_from_file(const std::string &filename) -> std::uint32_t {
 }
 
 [[nodiscard]] auto
-methylome::read(const std::string &filename, const methylome_metadata &metadata)
+methylome::read_counts(
+  const std::uint32_t count_width, vec &cpgs,
+  const std::function<bool(char *, std::uint64_t)> &read_bytes) -> bool {
+  if (count_width != 8)
+    return read_bytes(reinterpret_cast<char *>(cpgs.data()),
+                      std::size(cpgs) * record_size);
+  std::vector<m8_elem> narrow(std::size(cpgs));
+  if (!read_bytes(reinterpret_cast<char *>(narrow.data()),
+                  std::size(narrow) * sizeof(m8_elem)))
+    return false;
+  from_count_width(narrow, cpgs);
+  return true;
+}
+
+[[nodiscard]] auto
+methylome::compress_counts(const std::uint32_t count_width, const vec &cpgs,
+                           std::vector<std::uint8_t> &buf) -> std::error_code {
+  if (count_width != 8)
+    return compress(cpgs, buf);
+  return compress(to_count_width<m8_count_t>(cpgs), buf);
+}
+
+[[nodiscard]] auto
+methylome::decompress_counts(const std::uint32_t count_width,
+                             std::vector<std::uint8_t> &buf,
+                             vec &cpgs) -> std::error_code {
+  if (count_width != 8)
+    return decompress(buf, cpgs);
+  std::vector<m8_elem> narrow(std::size(cpgs));
+  if (const auto err = decompress(buf, narrow))
+    return err;
+  from_count_width(narrow, cpgs);
+  return {};
+}
+
+[[nodiscard]] auto
+methylome::decompress_counts(std::vector<std::uint8_t> &buf,
+                             vec8 &cpgs8) -> std::error_code {
+  return decompress(buf, cpgs8);
+}
+
+auto
+methylome::narrow(const std::uint32_t count_width) -> void {
+  if (count_width != 8 || is_narrow())
+    return;
+  cpgs8.resize(std::size(cpgs));
+  std::ranges::transform(cpgs, std::begin(cpgs8), [](const auto &x) {
+    return m8_elem(x.first, x.second);
+  });
+  vec{}.swap(cpgs);
+}
+
+auto
+methylome::widen() -> void {
+  if (!is_narrow())
+    return;
+  cpgs.resize(std::size(cpgs8));
+  std::ranges::transform(cpgs8, std::begin(cpgs), [](const auto &x) {
+    return m_elem(x.first, x.second);
+  });
+  vec8{}.swap(cpgs8);
+}
+
+[[nodiscard]] auto
+methylome::get_n_bytes() const -> std::uint64_t {
+  return is_narrow() ? std::size(cpgs8) * sizeof(m8_elem)
+                     : std::size(cpgs) * record_size;
+}
+
+[[nodiscard]] auto
+methylome::get_compressed(const std::uint32_t count_width,
+                          std::vector<std::uint8_t> &buf) const
+  -> std::error_code {
+  if (!is_narrow())
+    return compress_counts(count_width, cpgs, buf);
+  if (count_width != 8)
+    return methylome_code::error_writing_methylome;
+  return compress(cpgs8, buf);
+}
+
+auto
+methylome::round_to_width(const std::uint32_t count_width) -> void {
+  if (count_width != 8)
+    return;
+  for (auto &cpg : cpgs) {
+    std::uint32_t n_meth = cpg.first;
+    std::uint32_t n_unmeth = cpg.second;
+    conditional_round_to_fit<m8_count_t>(n_meth, n_unmeth);
+    cpg = {n_meth, n_unmeth};
+  }
+  blocks.reset();
+}
+
+static_assert(sizeof(methylome_file_header) == 128);
+static_assert(std::is_trivially_copyable_v<methylome_file_header>);
+
+[[nodiscard]] static inline auto
+get_codec(const methylome_metadata &meta)
+  -> methylome_file_header::codec_type {
+  using codec = methylome_file_header::codec_type;
+  if (meta.count_width == 8)
+    return meta.is_compressed ? codec::zlib8 : codec::raw8;
+  return meta.is_compressed ? codec::zlib16 : codec::raw16;
+}
+
+[[nodiscard]] auto
+methylome_file_header::init(const methylome_metadata &meta,
+                            const std::uint64_t data_size)
+  -> std::tuple<methylome_file_header, std::error_code> {
+  if (std::size(meta.assembly) > max_assembly_size ||
+      !methylome::is_valid_count_width(meta.count_width))
+    return {{}, methylome_code::error_writing_methylome_header};
+  methylome_file_header hdr;
+  hdr.file_magic = magic;
+  hdr.version = current_version;
+  hdr.n_cpgs = meta.n_cpgs;
+  hdr.codec = get_codec(meta);
+  hdr.block_size = meta.block_size;
+  hdr.index_hash = meta.index_hash;
+  hdr.methylome_hash = meta.methylome_hash;
+  hdr.data_offset = n_bytes;
+  hdr.data_size = data_size;
+  hdr.block_table_offset = hdr.data_offset + data_size;
+  hdr.n_blocks = std::size(meta.block_hashes);
+  hdr.assembly_size = std::size(meta.assembly);
+  std::ranges::copy(meta.assembly, std::begin(hdr.assembly));
+  return {hdr, {}};
+}
+
+[[nodiscard]] auto
+methylome_file_header::read(std::istream &in, const std::uint64_t filesize)
+  -> std::tuple<methylome_file_header, std::error_code> {
+  methylome_file_header hdr;
+  // ADS: a v1 file smaller than a header has no header
+  if (filesize < sizeof(methylome_file_header))
+    return {hdr, {}};
+  std::array<char, n_bytes> page{};
+  const auto page_size = std::min<std::uint64_t>(filesize, n_bytes);
+  if (!in.read(page.data(), static_cast<std::streamsize>(page_size)))
+    return {{}, methylome_code::error_reading_methylome_header};
+  if (!std::ranges::equal(magic, page | std::views::take(std::size(magic)))) {
+    in.seekg(0);
+    return {hdr, {}};
+  }
+  std::memcpy(&hdr, page.data(), sizeof(methylome_file_header));
+
+  const auto uncompressed_size = [&] {
+    const auto width = (hdr.codec == codec_type::raw8) ? 8u : 16u;
+    return static_cast<std::uint64_t>(hdr.n_cpgs) *
+           methylome::get_record_size(width);
+  };
+  // ADS: offsets and sizes are compared with what remains of the file
+  // so a corrupt header cannot overflow their sums
+  const bool valid =
+    hdr.version == current_version && hdr.codec <= codec_type::zlib8 &&
+    hdr.assembly_size <= max_assembly_size && hdr.data_offset >= n_bytes &&
+    hdr.data_offset <= filesize &&
+    hdr.data_size <= filesize - hdr.data_offset &&
+    hdr.block_table_offset <= filesize &&
+    hdr.n_blocks <=
+      (filesize - hdr.block_table_offset) / sizeof(std::uint64_t) &&
+    (hdr.codec == codec_type::zlib16 || hdr.codec == codec_type::zlib8 ||
+     hdr.data_size == uncompressed_size());
+  if (!valid)
+    return {{}, methylome_code::invalid_methylome_header};
+
+  in.seekg(static_cast<std::streamoff>(hdr.data_offset));
+  return {hdr, {}};
+}
+
+[[nodiscard]] auto
+methylome_file_header::write(std::ostream &out) const -> std::error_code {
+  std::array<char, n_bytes> page{};
+  std::memcpy(page.data(), this, sizeof(methylome_file_header));
+  if (!out.write(page.data(), n_bytes))
+    return methylome_code::error_writing_methylome_header;
+  return {};
+}
+
+[[nodiscard]] auto
+methylome_file_header::get_metadata() const -> methylome_metadata {
+  methylome_metadata meta;
+  meta.methylome_hash = methylome_hash;
+  meta.index_hash = index_hash;
+  meta.assembly = std::string(std::cbegin(assembly),
+                              std::cbegin(assembly) + assembly_size);
+  meta.n_cpgs = n_cpgs;
+  meta.is_compressed =
+    codec == codec_type::zlib16 || codec == codec_type::zlib8;
+  meta.block_size = block_size;
+  meta.count_width =
+    (codec == codec_type::raw8 || codec == codec_type::zlib8) ? 8 : 16;
+  return meta;
+}
+
+// ADS: 'in' must be at the first byte of counts, which take data_size
+// bytes in the file
+[[nodiscard]] static auto
+read_counts_at(std::istream &in, const methylome_metadata &meta,
+               const std::uint64_t data_size)
   -> std::tuple<methylome, std::error_code> {
-  std::error_code ec;
-  const auto filesize = std::filesystem::file_size(filename, ec);
-  if (ec)
-    return {{}, ec};
-  std::ifstream in(filename);
-  if (!in)
-    return {{}, std::make_error_code(std::errc(errno))};
+  if (!methylome::is_valid_count_width(meta.count_width))
+    return {{}, std::error_code{methylome_code::error_reading_methylome}};
   methylome meth;
-  if (metadata.is_compressed) {
-    std::vector<std::uint8_t> buf(filesize);
+  if (meta.is_compressed) {
+    std::vector<std::uint8_t> buf(data_size);
     const bool read_ok = static_cast<bool>(
-      in.read(reinterpret_cast<char *>(buf.data()), filesize));
+      in.read(reinterpret_cast<char *>(buf.data()), data_size));
     const auto n_bytes = in.gcount();
-    if (!read_ok || n_bytes != static_cast<std::streamsize>(filesize))
+    if (!read_ok || n_bytes != static_cast<std::streamsize>(data_size))
       return {{}, std::error_code{methylome_code::error_reading_methylome}};
-    meth.cpgs.resize(metadata.n_cpgs);
+    meth.cpgs.resize(meta.n_cpgs);
 #ifdef BENCHMARK
     const auto decompress_start{std::chrono::high_resolution_clock::now()};
 #endif
-    const auto decompress_err = decompress(buf, meth.cpgs);
+    const auto decompress_err =
+      methylome::decompress_counts(meta.count_width, buf, meth.cpgs);
 #ifdef BENCHMARK
     const auto decompress_stop{std::chrono::high_resolution_clock::now()};
     std::println("decompress(buf, cpgs) time: {}s",
                  duration(decompress_start, decompress_stop));
 #endif
-    return {std::move(meth), decompress_err};
+    if (decompress_err)
+      return {{}, decompress_err};
+    const auto block_err = meth.init_block_status(meta);
+    return {std::move(meth), block_err};
   }
-  meth.cpgs.resize(metadata.n_cpgs);
-  const bool read_ok = static_cast<bool>(
-    in.read(reinterpret_cast<char *>(meth.cpgs.data()), filesize));
-  const auto n_bytes = in.gcount();
-  if (!read_ok || n_bytes != static_cast<std::streamsize>(filesize))
+  if (data_size != static_cast<std::uint64_t>(meta.n_cpgs) *
+                     methylome::get_record_size(meta.count_width))
+    return {{}, std::error_code{methylome_code::error_reading_methylome}};
+  meth.cpgs.resize(meta.n_cpgs);
+  const bool read_ok = methylome::read_counts(
+    meta.count_width, meth.cpgs,
+    [&in](char *dst, const std::uint64_t n_bytes) {
+      return static_cast<bool>(
+        in.read(dst, static_cast<std::streamsize>(n_bytes)));
+    });
+  if (!read_ok)
+    return {{}, std::error_code{methylome_code::error_reading_methylome}};
+
+  // ADS: blocks are not verified here, only when first used
+  const auto block_err = meth.init_block_status(meta);
+  return {std::move(meth), block_err};
+}
+
+[[nodiscard]] auto
+methylome::read(const std::string &filename, const methylome_metadata &metadata)
+  -> std::tuple<methylome, std::error_code> {
+  std::error_code ec;
+  const auto filesize = std::filesystem::file_size(filename, ec);
+  if (ec)
+    return {{}, ec};
+  std::ifstream in(filename, std::ios::binary);
+  if (!in)
+    return {{}, std::make_error_code(std::errc(errno))};
+  // ADS: the counts of a v2 file follow its header, which must agree
+  // with the metadata
+  const auto [hdr, hdr_err] = methylome_file_header::read(in, filesize);
+  if (hdr_err)
+    return {{}, hdr_err};
+  if (hdr.version != 0 && hdr.n_cpgs != metadata.n_cpgs)
+    return {{}, std::error_code{methylome_code::incorrect_methylome_size}};
+  return read_counts_at(in, metadata,
+                        hdr.version == 0 ? filesize : hdr.data_size);
+}
+
+// ADS: the header and block checksums of a v2 file, with 'in' left
+// at the first byte of counts
+[[nodiscard]] static auto
+read_v2_header(std::istream &in, const std::uint64_t filesize)
+  -> std::tuple<methylome_metadata, std::uint64_t, std::error_code> {
+  const auto [hdr, hdr_err] = methylome_file_header::read(in, filesize);
+  if (hdr_err)
+    return {{}, 0, hdr_err};
+  if (hdr.version == 0)
+    return {{}, 0, methylome_code::methylome_file_without_header};
+  auto meta = hdr.get_metadata();
+  meta.block_hashes.resize(hdr.n_blocks);
+  in.seekg(static_cast<std::streamoff>(hdr.block_table_offset));
+  if (!in.read(reinterpret_cast<char *>(meta.block_hashes.data()),
+               hdr.n_blocks * sizeof(std::uint64_t)))
+    return {{}, 0, methylome_code::error_reading_methylome_header};
+  in.seekg(static_cast<std::streamoff>(hdr.data_offset));
+  return {std::move(meta), hdr.data_size, {}};
+}
+
+[[nodiscard]] auto
+methylome::read_v2(const std::string &filename)
+  -> std::tuple<methylome, methylome_metadata, std::error_code> {
+  std::error_code ec;
+  const auto filesize = std::filesystem::file_size(filename, ec);
+  if (ec)
+    return {{}, {}, ec};
+  std::ifstream in(filename, std::ios::binary);
+  if (!in)
+    return {{}, {}, std::make_error_code(std::errc(errno))};
+  auto [meta, data_size, hdr_err] = read_v2_header(in, filesize);
+  if (hdr_err)
+    return {{}, {}, hdr_err};
+  auto [meth, meth_err] = read_counts_at(in, meta, data_size);
+  if (meth_err)
+    return {{}, {}, meth_err};
+  return {std::move(meth), std::move(meta), {}};
+}
+
+[[nodiscard]] auto
+methylome::read_v2_metadata(const std::string &filename)
+  -> std::tuple<methylome_metadata, std::error_code> {
+  std::error_code ec;
+  const auto filesize = std::filesystem::file_size(filename, ec);
+  if (ec)
+    return {{}, ec};
+  std::ifstream in(filename, std::ios::binary);
+  if (!in)
+    return {{}, std::make_error_code(std::errc(errno))};
+  auto [meta, data_size, hdr_err] = read_v2_header(in, filesize);
+  return {std::move(meta), hdr_err};
+}
+
+[[nodiscard]] auto
+methylome::read_slice(
+  const methylome_metadata &meta, const std::uint32_t first,
+  const std::uint32_t n,
+  const std::function<bool(char *, std::uint64_t, std::uint64_t)> &read_at)
+  -> std::tuple<methylome, std::error_code> {
+  if (static_cast<std::uint64_t>(first) + n > meta.n_cpgs)
+    return {{}, std::error_code{methylome_code::error_reading_methylome}};
+  // ADS: without block checksums the slice is read exactly
+  const std::uint32_t bs = meta.block_size;
+  const auto range_first = bs == 0 ? first : first / bs * bs;
+  const auto range_last =
+    bs == 0 ? first + n
+            : std::min(meta.n_cpgs, (first + n + bs - 1) / bs * bs);
+  if (!is_valid_count_width(meta.count_width))
+    return {{}, std::error_code{methylome_code::error_reading_methylome}};
+  const auto range_offset = static_cast<std::uint64_t>(range_first) *
+                            get_record_size(meta.count_width);
+  vec range(range_last - range_first);
+  const auto read_ok = read_counts(
+    meta.count_width, range,
+    [&read_at, range_offset](char *dst, const std::uint64_t n_bytes) {
+      return read_at(dst, n_bytes, range_offset);
+    });
+  if (!read_ok)
     return {{}, std::error_code{methylome_code::error_reading_methylome}};
+  if (bs > 0) {
+    if (std::size(meta.block_hashes) != (meta.n_cpgs + bs - 1) / bs)
+      return {{}, std::error_code{methylome_code::block_checksum_mismatch}};
+    for (auto beg = range_first; beg < range_last; beg += bs) {
+      const auto block_n = std::min(bs, range_last - beg);
+      const auto block_data = range.data() + (beg - range_first);
+      if (get_adler(block_data, block_n * record_size) !=
+          meta.block_hashes[beg / bs])
+        return {{}, std::error_code{methylome_code::block_checksum_mismatch}};
+    }
+  }
+  methylome meth;
+  const auto slice_beg = std::cbegin(range) + (first - range_first);
+  meth.cpgs.assign(slice_beg, slice_beg + n);
+  return {std::move(meth), {}};
+}
 
-  return {std::move(meth), std::error_code{}};
+[[nodiscard]] auto
+methylome::read_slice(const std::string &filename,
+                      const methylome_metadata &meta, const std::uint32_t first,
+                      const std::uint32_t n)
+  -> std::tuple<methylome, std::error_code> {
+  if (meta.is_compressed) {
+    const auto [meth, meth_err] = read(filename, meta);
+    if (meth_err)
+      return {{}, meth_err};
+    return meth.get_slice(first, n);
+  }
+  std::error_code ec;
+  const auto filesize = std::filesystem::file_size(filename, ec);
+  if (ec)
+    return {{}, ec};
+  std::ifstream in(filename, std::ios::binary);
+  if (!in)
+    return {{}, std::make_error_code(std::errc(errno))};
+  // ADS: offsets are from the start of counts, which follow the header
+  // in a v2 file
+  const auto [hdr, hdr_err] = methylome_file_header::read(in, filesize);
+  if (hdr_err)
+    return {{}, hdr_err};
+  const auto data_offset = hdr.data_offset;
+  return read_slice(meta, first, n,
+                    [&in, data_offset](char *dst, const std::uint64_t n_bytes,
+                                       const std::uint64_t offset) {
+                      in.seekg(static_cast<std::streamoff>(data_offset +
+                                                           offset));
+                      return static_cast<bool>(
+                        in.read(dst, static_cast<std::streamsize>(n_bytes)));
+                    });
 }
 
 [[nodiscard]] auto
-methylome::write(const std::string &filename,
-                 const bool zip) const -> std::error_code {
+methylome::get_slice(const std::uint32_t first, const std::uint32_t n) const
+  -> std::tuple<methylome, std::error_code> {
+  if (static_cast<std::uint64_t>(first) + n > get_n_cpgs())
+    return {{}, std::error_code{methylome_code::error_reading_methylome}};
+  if (const auto block_err = verify_blocks(first, first + n))
+    return {{}, block_err};
+  methylome meth;
+  if (is_narrow())
+    meth.cpgs8.assign(std::cbegin(cpgs8) + first,
+                      std::cbegin(cpgs8) + first + n);
+  else
+    meth.cpgs.assign(std::cbegin(cpgs) + first, std::cbegin(cpgs) + first + n);
+  return {std::move(meth), {}};
+}
+
+[[nodiscard]] auto
+methylome::write(const std::string &filename, const bool zip,
+                 const std::uint32_t count_width) const -> std::error_code {
+  if (!is_valid_count_width(count_width))
+    return methylome_code::error_writing_methylome;
+  if (is_narrow()) {
+    auto wide = *this;
+    wide.widen();
+    return wide.write(filename, zip, count_width);
+  }
   std::vector<std::uint8_t> buf;
   if (zip) {
 #ifdef BENCHMARK
     const auto compress_start{std::chrono::high_resolution_clock::now()};
 #endif
-    const auto compress_err = compress(cpgs, buf);
+    const auto compress_err = compress_counts(count_width, cpgs, buf);
 #ifdef BENCHMARK
     const auto compress_stop{std::chrono::high_resolution_clock::now()};
     std::println(std::cerr, "compress(cpgs, buf) time: {}s",
@@ -131,6 +522,12 @@ methylome::write(const std::string &filename,
     if (!out.write(reinterpret_cast<const char *>(buf.data()), std::size(buf)))
       return methylome_code::error_writing_methylome;
   }
+  else if (count_width == 8) {
+    const auto narrow = to_count_width<m8_count_t>(cpgs);
+    if (!out.write(reinterpret_cast<const char *>(narrow.data()),
+                   std::size(narrow) * sizeof(m8_elem)))
+      return methylome_code::error_writing_methylome;
+  }
   else {
     if (!out.write(reinterpret_cast<const char *>(cpgs.data()),
                    std::size(cpgs) * record_size))
@@ -139,33 +536,81 @@ methylome::write(const std::string &filename,
   return std::error_code{};
 }
 
+[[nodiscard]] auto
+methylome::write_v2(const std::string &filename,
+                    const methylome_metadata &meta) const -> std::error_code {
+  if (!is_valid_count_width(meta.count_width) || meta.n_cpgs != get_n_cpgs())
+    return methylome_code::error_writing_methylome;
+  if (is_narrow()) {
+    auto wide = *this;
+    wide.widen();
+    return wide.write_v2(filename, meta);
+  }
+  std::vector<std::uint8_t> buf;
+  if (meta.is_compressed) {
+    if (const auto compress_err =
+          compress_counts(meta.count_width, cpgs, buf))
+      return compress_err;
+  }
+  else if (meta.count_width == 8) {
+    const auto narrow = to_count_width<m8_count_t>(cpgs);
+    const auto first = reinterpret_cast<const std::uint8_t *>(narrow.data());
+    buf.assign(first, first + std::size(narrow) * sizeof(m8_elem));
+  }
+  const auto data_size =
+    buf.empty() ? std::size(cpgs) * record_size : std::size(buf);
+
+  const auto [hdr, hdr_err] = methylome_file_header::init(meta, data_size);
+  if (hdr_err)
+    return hdr_err;
+
+  std::ofstream out(filename, std::ios::binary);
+  if (!out)
+    return std::make_error_code(std::errc(errno));
+  if (const auto write_err = hdr.write(out))
+    return write_err;
+  const auto data = buf.empty() ? reinterpret_cast<const char *>(cpgs.data())
+                                : reinterpret_cast<const char *>(buf.data());
+  if (!out.write(data, static_cast<std::streamsize>(data_size)))
+    return methylome_code::error_writing_methylome;
+  if (!out.write(reinterpret_cast<const char *>(meta.block_hashes.data()),
+                 std::size(meta.block_hashes) * sizeof(std::uint64_t)))
+    return methylome_code::error_writing_methylome;
+  return std::error_code{};
+}
+
 auto
 methylome::add(const methylome &rhs) -> methylome & {
   // this follows the operator+= pattern
+  assert(!is_narrow() && !rhs.is_narrow());
   assert(std::size(cpgs) == std::size(rhs.cpgs));
   std::ranges::transform(cpgs, rhs.cpgs, std::begin(cpgs),
                          [](const auto &l, const auto &r) -> m_elem {
                            return {l.first + r.first, l.second + r.second};
                          });
+  // ADS: the sums no longer match any stored block checksums
+  blocks.reset();
   return *this;
 }
 
+// ADS: the kernels take iterators to pairs of counts of any width
 template <typename U, typename T>
 [[nodiscard]] static inline auto
 get_counts_impl(const T b, const T e) -> U {
+  using elem_type = typename std::iterator_traits<T>::value_type;
   U u;
   for (auto cursor = b; cursor != e; ++cursor) {
     u.n_meth += cursor->first;
     u.n_unmeth += cursor->second;
     if constexpr (std::is_same<U, counts_res_cov>::value)
-      u.n_covered += *cursor != std::pair<std::uint16_t, std::uint16_t>{};
+      u.n_covered += *cursor != elem_type{};
   }
   return u;
 }
 
 template <typename U>
 [[nodiscard]] static inline auto
-get_counts_impl(const methylome::vec &cpgs, const cpg_index::vec &positions,
+get_counts_impl(const auto &cpgs, const cpg_index::vec &positions,
                 const std::uint32_t offset, const std::uint32_t start,
                 const std::uint32_t stop) -> U {
   // ADS: it is possible that the intervals requested are past the cpg
@@ -187,28 +632,36 @@ get_counts_impl(const methylome::vec &cpgs, const cpg_index::vec &positions,
 methylome::get_counts_cov(const cpg_index::vec &positions,
                           const std::uint32_t offset, const std::uint32_t start,
                           const std::uint32_t stop) const -> counts_res_cov {
-  return get_counts_impl<counts_res_cov>(cpgs, positions, offset, start, stop);
+  return visit_counts([&](const auto &c) {
+    return get_counts_impl<counts_res_cov>(c, positions, offset, start, stop);
+  });
 }
 
 [[nodiscard]] auto
 methylome::get_counts(const cpg_index::vec &positions,
                       const std::uint32_t offset, const std::uint32_t start,
                       const std::uint32_t stop) const -> counts_res {
-  return get_counts_impl<counts_res>(cpgs, positions, offset, start, stop);
+  return visit_counts([&](const auto &c) {
+    return get_counts_impl<counts_res>(c, positions, offset, start, stop);
+  });
 }
 
 [[nodiscard]] auto
 methylome::get_counts_cov(const std::uint32_t start,
                           const std::uint32_t stop) const -> counts_res_cov {
-  return get_counts_impl<counts_res_cov>(std::cbegin(cpgs) + start,
-                                         std::cbegin(cpgs) + stop);
+  return visit_counts([&](const auto &c) {
+    return get_counts_impl<counts_res_cov>(std::cbegin(c) + start,
+                                           std::cbegin(c) + stop);
+  });
 }
 
 [[nodiscard]] auto
 methylome::get_counts(const std::uint32_t start,
                       const std::uint32_t stop) const -> counts_res {
-  return get_counts_impl<counts_res>(std::cbegin(cpgs) + start,
-                                     std::cbegin(cpgs) + stop);
+  return visit_counts([&](const auto &c) {
+    return get_counts_impl<counts_res>(std::cbegin(c) + start,
+                                       std::cbegin(c) + stop);
+  });
 }
 
 [[nodiscard]] auto
@@ -216,9 +669,11 @@ methylome::get_counts_cov(
   const std::vector<std::pair<std::uint32_t, std::uint32_t>> &queries) const
   -> std::vector<counts_res_cov> {
   std::vector<counts_res_cov> res(std::size(queries));
-  const auto beg = std::cbegin(cpgs);
-  for (const auto [i, q] : std::views::enumerate(queries))
-    res[i] = get_counts_impl<counts_res_cov>(beg + q.first, beg + q.second);
+  visit_counts([&](const auto &c) {
+    const auto beg = std::cbegin(c);
+    for (const auto [i, q] : std::views::enumerate(queries))
+      res[i] = get_counts_impl<counts_res_cov>(beg + q.first, beg + q.second);
+  });
   return res;
 }
 
@@ -226,42 +681,98 @@ methylome::get_counts_cov(
 methylome::get_counts(const std::vector<std::pair<std::uint32_t, std::uint32_t>>
                         &queries) const -> std::vector<counts_res> {
   std::vector<counts_res> res(std::size(queries));
-  const auto beg = std::cbegin(cpgs);
-  for (const auto [i, q] : std::views::enumerate(queries))
-    res[i] = get_counts_impl<counts_res>(beg + q.first, beg + q.second);
+  visit_counts([&](const auto &c) {
+    const auto beg = std::cbegin(c);
+    for (const auto [i, q] : std::views::enumerate(queries))
+      res[i] = get_counts_impl<counts_res>(beg + q.first, beg + q.second);
+  });
   return res;
 }
 
-[[nodiscard]] auto
-methylome::total_counts_cov() const -> counts_res_cov {
+// ADS: independent accumulators for the level sums, so the loop
+// vectorizes without needing -ffast-math to reorder the floating point
+// sums; the lane sums are added once at the end
+static constexpr std::uint32_t counts_ext_n_lanes{8};
+
+// ADS: the loop body has no branches; a site that is not covered adds
+// a level of zero, and the division is by at least one
+template <typename T>
+[[nodiscard]] static inline auto
+get_counts_ext_impl(const T b, const T e) -> counts_res_ext {
   std::uint32_t n_meth{};
   std::uint32_t n_unmeth{};
   std::uint32_t n_covered{};
-  for (const auto &cpg : cpgs) {
-    n_meth += cpg.first;
-    n_unmeth += cpg.second;
-    n_covered += cpg != std::pair<std::uint16_t, std::uint16_t>{};
+  std::array<double, counts_ext_n_lanes> sum_levels{};
+  std::array<double, counts_ext_n_lanes> sum_sq_levels{};
+  const auto add_site = [&](const auto &site, const std::uint32_t j) {
+    const std::uint32_t m = site.first;
+    const std::uint32_t u = site.second;
+    const std::uint32_t n = m + u;
+    n_meth += m;
+    n_unmeth += u;
+    n_covered += (n != 0);
+    const double level =
+      static_cast<double>(m) / static_cast<double>(std::max(n, 1u));
+    sum_levels[j] += level;
+    sum_sq_levels[j] += level * level;
+  };
+  const auto n_sites = static_cast<std::uint32_t>(std::distance(b, e));
+  auto cursor = b;
+  for (std::uint32_t i = 0; i + counts_ext_n_lanes <= n_sites;
+       i += counts_ext_n_lanes, cursor += counts_ext_n_lanes)
+    for (std::uint32_t j = 0; j < counts_ext_n_lanes; ++j)
+      add_site(cursor[j], j);
+  for (std::uint32_t j = 0; cursor != e; ++cursor, ++j)
+    add_site(*cursor, j);
+  double levels{};
+  double sq_levels{};
+  for (std::uint32_t j = 0; j < counts_ext_n_lanes; ++j) {
+    levels += sum_levels[j];
+    sq_levels += sum_sq_levels[j];
   }
-  return {n_meth, n_unmeth, n_covered};
+  return {n_meth, n_unmeth, n_covered, n_sites, levels, sq_levels};
+}
+
+[[nodiscard]] auto
+methylome::get_counts_ext(const std::uint32_t start,
+                          const std::uint32_t stop) const -> counts_res_ext {
+  return visit_counts([&](const auto &c) {
+    return get_counts_ext_impl(std::cbegin(c) + start, std::cbegin(c) + stop);
+  });
+}
+
+[[nodiscard]] auto
+methylome::get_counts_ext(
+  const std::vector<std::pair<std::uint32_t, std::uint32_t>> &queries) const
+  -> std::vector<counts_res_ext> {
+  std::vector<counts_res_ext> res(std::size(queries));
+  visit_counts([&](const auto &c) {
+    const auto beg = std::cbegin(c);
+    for (const auto [i, q] : std::views::enumerate(queries))
+      res[i] = get_counts_ext_impl(beg + q.first, beg + q.second);
+  });
+  return res;
+}
+
+[[nodiscard]] auto
+methylome::total_counts_cov() const -> counts_res_cov {
+  return visit_counts([](const auto &c) {
+    return get_counts_impl<counts_res_cov>(std::cbegin(c), std::cend(c));
+  });
 }
 
 [[nodiscard]] auto
 methylome::total_counts() const -> counts_res {
-  std::uint32_t n_meth{};
-  std::uint32_t n_unmeth{};
-  for (const auto &cpg : cpgs) {
-    n_meth += cpg.first;
-    n_unmeth += cpg.second;
-  }
-  return {n_meth, n_unmeth};
+  return visit_counts([](const auto &c) {
+    return get_counts_impl<counts_res>(std::cbegin(c), std::cend(c));
+  });
 }
 
 template <typename T>
 static auto
 bin_counts_impl(cpg_index::vec::const_iterator &posn_itr,
                 const cpg_index::vec::const_iterator posn_end,
-                const std::uint32_t bin_end,
-                methylome::vec::const_iterator &cpg_itr) -> T {
+                const std::uint32_t bin_end, auto &cpg_itr) -> T {
   T t{};
   while (posn_itr != posn_end && *posn_itr < bin_end) {
     t.n_meth += cpg_itr->first;
@@ -278,7 +789,7 @@ template <typename T>
 [[nodiscard]] static auto
 get_bins_impl(const std::uint32_t bin_size, const cpg_index &index,
               const cpg_index_meta &meta,
-              const methylome::vec &cpgs) -> std::vector<T> {
+              const auto &cpgs) -> std::vector<T> {
   std::vector<T> results;  // ADS TODO: reserve n_bins
 
   const auto zipped =
@@ -287,8 +798,10 @@ get_bins_impl(const std::uint32_t bin_size, const cpg_index &index,
     auto posn_itr = std::cbegin(positions);
     const auto posn_end = std::cend(positions);
     auto cpg_itr = std::cbegin(cpgs) + offset;
-    for (std::uint32_t i = 0; i < chrom_size; i += bin_size) {
-      const auto bin_end = std::min(i + bin_size, chrom_size);
+    // ADS: in 64 bits so the last bin of a chrom cannot wrap around
+    for (std::uint64_t i = 0; i < chrom_size; i += bin_size) {
+      const std::uint32_t bin_end = std::min<std::uint64_t>(i + bin_size,
+                                                            chrom_size);
       results.emplace_back(
         bin_counts_impl<T>(posn_itr, posn_end, bin_end, cpg_itr));
     }
@@ -300,30 +813,563 @@ get_bins_impl(const std::uint32_t bin_size, const cpg_index &index,
 methylome::get_bins(const std::uint32_t bin_size, const cpg_index &index,
                     const cpg_index_meta &meta) const
   -> std::vector<counts_res> {
-  return get_bins_impl<counts_res>(bin_size, index, meta, cpgs);
+  return visit_counts([&](const auto &c) {
+    return get_bins_impl<counts_res>(bin_size, index, meta, c);
+  });
 }
 
 [[nodiscard]] auto
 methylome::get_bins_cov(const std::uint32_t bin_size, const cpg_index &index,
                         const cpg_index_meta &meta) const
   -> std::vector<counts_res_cov> {
-  return get_bins_impl<counts_res_cov>(bin_size, index, meta, cpgs);
+  return visit_counts([&](const auto &c) {
+    return get_bins_impl<counts_res_cov>(bin_size, index, meta, c);
+  });
+}
+
+template <typename T>
+[[nodiscard]] static auto
+get_bins_impl(const std::uint32_t bin_size, const cpg_index &index,
+              const cpg_index_meta &meta,
+              const std::vector<genomic_interval> &regions,
+              const auto &cpgs) -> std::vector<T> {
+  std::vector<T> results;
+  for (const auto &region : regions) {
+    const auto &positions = index.positions[region.ch_id];
+    const auto stop = std::min(region.stop, meta.chrom_size[region.ch_id]);
+    auto posn_itr = std::ranges::lower_bound(positions, region.start);
+    const auto posn_end = std::cend(positions);
+    auto cpg_itr = std::cbegin(cpgs) + meta.chrom_offset[region.ch_id] +
+                   std::distance(std::cbegin(positions), posn_itr);
+    for (std::uint64_t i = region.start; i < stop; i += bin_size) {
+      const std::uint32_t bin_end = std::min<std::uint64_t>(i + bin_size, stop);
+      results.emplace_back(
+        bin_counts_impl<T>(posn_itr, posn_end, bin_end, cpg_itr));
+    }
+  }
+  return results;
+}
+
+[[nodiscard]] auto
+methylome::get_bins(const std::uint32_t bin_size, const cpg_index &index,
+                    const cpg_index_meta &meta,
+                    const std::vector<genomic_interval> &regions) const
+  -> std::vector<counts_res> {
+  return visit_counts([&](const auto &c) {
+    return get_bins_impl<counts_res>(bin_size, index, meta, regions, c);
+  });
+}
+
+[[nodiscard]] auto
+methylome::get_bins_cov(const std::uint32_t bin_size, const cpg_index &index,
+                        const cpg_index_meta &meta,
+                        const std::vector<genomic_interval> &regions) const
+  -> std::vector<counts_res_cov> {
+  return visit_counts([&](const auto &c) {
+    return get_bins_impl<counts_res_cov>(bin_size, index, meta, regions, c);
+  });
+}
+
+template <typename T>
+static inline auto
+add_counts(T &t, const T &u) -> void {
+  t.n_meth += u.n_meth;
+  t.n_unmeth += u.n_unmeth;
+  if constexpr (std::is_same<T, counts_res_cov>::value)
+    t.n_covered += u.n_covered;
+}
+
+// ADS: how bins of several sizes are computed together; 'order' has
+// the indexes of bin_sizes from smallest to largest size, and 'nested'
+// means each of those sizes divides the next
+struct multi_bins_plan {
+  std::vector<std::size_t> order;
+  bool nested{};
+
+  explicit multi_bins_plan(const std::vector<std::uint32_t> &bin_sizes) :
+    order(std::size(bin_sizes)) {
+    std::iota(std::begin(order), std::end(order), 0);
+    std::ranges::stable_sort(
+      order, [&](const auto a, const auto b) {
+        return bin_sizes[a] < bin_sizes[b];
+      });
+    nested = std::ranges::all_of(
+      std::views::iota(std::size_t{1}, std::size(order)), [&](const auto j) {
+        return bin_sizes[order[j]] % bin_sizes[order[j - 1]] == 0;
+      });
+  }
+};
+
+// ADS: bins of each size over [start, stop) of one chrom, written
+// through the iterator for that size in 'outs'
+template <typename T>
+static auto
+multi_bins_impl(const std::vector<std::uint32_t> &bin_sizes,
+                const multi_bins_plan &plan, const std::uint32_t start,
+                const std::uint32_t stop,
+                cpg_index::vec::const_iterator posn_itr,
+                const cpg_index::vec::const_iterator posn_end, auto cpg_itr,
+                std::vector<typename std::vector<T>::iterator> &outs) -> void {
+  if (start >= stop)
+    return;
+  if (plan.nested) {
+    // smallest bins from the sites, then each size from the one below
+    const auto first = plan.order.front();
+    auto prev_begin = outs[first];
+    for (std::uint32_t i = start; i < stop; i += bin_sizes[first]) {
+      const auto bin_end = std::min(i + bin_sizes[first], stop);
+      *outs[first]++ = bin_counts_impl<T>(posn_itr, posn_end, bin_end, cpg_itr);
+    }
+    auto prev = first;
+    for (const auto curr : plan.order | std::views::drop(1)) {
+      const std::ptrdiff_t ratio = bin_sizes[curr] / bin_sizes[prev];
+      const auto curr_begin = outs[curr];
+      for (auto itr = prev_begin; itr != outs[prev];) {
+        const auto group_end = itr + std::min(ratio, outs[prev] - itr);
+        T t{};
+        for (; itr != group_end; ++itr)
+          add_counts(t, *itr);
+        *outs[curr]++ = t;
+      }
+      prev_begin = curr_begin;
+      prev = curr;
+    }
+    return;
+  }
+  // ADS: sizes do not nest, so one scan over the sites with a running
+  // sum and current bin end for each size
+  const auto n_sizes = std::size(bin_sizes);
+  std::vector<T> sums(n_sizes);
+  std::vector<std::uint32_t> bin_ends(n_sizes);
+  std::vector<std::uint32_t> n_bins(n_sizes);
+  for (std::size_t k = 0; k < n_sizes; ++k)
+    bin_ends[k] = std::min(start + bin_sizes[k], stop);
+  for (; posn_itr != posn_end && *posn_itr < stop; ++posn_itr, ++cpg_itr) {
+    T site{cpg_itr->first, cpg_itr->second};
+    if constexpr (std::is_same<T, counts_res_cov>::value)
+      site.n_covered = (cpg_itr->first + cpg_itr->second > 0);
+    for (std::size_t k = 0; k < n_sizes; ++k) {
+      while (*posn_itr >= bin_ends[k]) {
+        *outs[k]++ = std::exchange(sums[k], T{});
+        ++n_bins[k];
+        bin_ends[k] = std::min(bin_ends[k] + bin_sizes[k], stop);
+      }
+      add_counts(sums[k], site);
+    }
+  }
+  // ADS: the bin holding the last site and any empty bins after it
+  for (std::size_t k = 0; k < n_sizes; ++k) {
+    const auto total = (stop - start + bin_sizes[k] - 1) / bin_sizes[k];
+    *outs[k]++ = sums[k];
+    for (++n_bins[k]; n_bins[k] < total; ++n_bins[k])
+      *outs[k]++ = T{};
+  }
+}
+
+template <typename T>
+[[nodiscard]] static auto
+get_multi_bins_impl(const std::vector<std::uint32_t> &bin_sizes,
+                    const cpg_index &index, const cpg_index_meta &meta,
+                    const auto &cpgs) -> std::vector<T> {
+  const auto offsets = meta.get_bins_offsets(bin_sizes);
+  std::vector<T> results(offsets.back());
+  std::vector<typename std::vector<T>::iterator> outs;
+  for (const auto offset : offsets | std::views::take(std::size(bin_sizes)))
+    outs.push_back(std::begin(results) + offset);
+
+  const multi_bins_plan plan(bin_sizes);
+  const auto zipped =
+    std::views::zip(index.positions, meta.chrom_size, meta.chrom_offset);
+  for (const auto [positions, chrom_size, offset] : zipped)
+    multi_bins_impl<T>(bin_sizes, plan, 0, chrom_size, std::cbegin(positions),
+                       std::cend(positions), std::cbegin(cpgs) + offset, outs);
+  return results;
+}
+
+template <typename T>
+[[nodiscard]] static auto
+get_multi_bins_impl(const std::vector<std::uint32_t> &bin_sizes,
+                    const cpg_index &index, const cpg_index_meta &meta,
+                    const std::vector<genomic_interval> &regions,
+                    const auto &cpgs) -> std::vector<T> {
+  const auto offsets = meta.get_bins_offsets(bin_sizes, regions);
+  std::vector<T> results(offsets.back());
+  std::vector<typename std::vector<T>::iterator> outs;
+  for (const auto offset : offsets | std::views::take(std::size(bin_sizes)))
+    outs.push_back(std::begin(results) + offset);
+
+  const multi_bins_plan plan(bin_sizes);
+  for (const auto &region : regions) {
+    const auto &positions = index.positions[region.ch_id];
+    const auto stop = std::min(region.stop, meta.chrom_size[region.ch_id]);
+    const auto posn_itr = std::ranges::lower_bound(positions, region.start);
+    const auto cpg_itr = std::cbegin(cpgs) + meta.chrom_offset[region.ch_id] +
+                         std::distance(std::cbegin(positions), posn_itr);
+    multi_bins_impl<T>(bin_sizes, plan, region.start, stop, posn_itr,
+                       std::cend(positions), cpg_itr, outs);
+  }
+  return results;
+}
+
+[[nodiscard]] auto
+methylome::get_multi_bins(const std::vector<std::uint32_t> &bin_sizes,
+                          const cpg_index &index,
+                          const cpg_index_meta &meta) const
+  -> std::vector<counts_res> {
+  return visit_counts([&](const auto &c) {
+    return get_multi_bins_impl<counts_res>(bin_sizes, index, meta, c);
+  });
+}
+
+[[nodiscard]] auto
+methylome::get_multi_bins_cov(const std::vector<std::uint32_t> &bin_sizes,
+                              const cpg_index &index,
+                              const cpg_index_meta &meta) const
+  -> std::vector<counts_res_cov> {
+  return visit_counts([&](const auto &c) {
+    return get_multi_bins_impl<counts_res_cov>(bin_sizes, index, meta, c);
+  });
+}
+
+[[nodiscard]] auto
+methylome::get_multi_bins(const std::vector<std::uint32_t> &bin_sizes,
+                          const cpg_index &index, const cpg_index_meta &meta,
+                          const std::vector<genomic_interval> &regions) const
+  -> std::vector<counts_res> {
+  return visit_counts([&](const auto &c) {
+    return get_multi_bins_impl<counts_res>(bin_sizes, index, meta, regions, c);
+  });
+}
+
+[[nodiscard]] auto
+methylome::get_multi_bins_cov(const std::vector<std::uint32_t> &bin_sizes,
+                              const cpg_index &index,
+                              const cpg_index_meta &meta,
+                              const std::vector<genomic_interval> &regions)
+  const -> std::vector<counts_res_cov> {
+  return visit_counts([&](const auto &c) {
+    return get_multi_bins_impl<counts_res_cov>(bin_sizes, index, meta,
+                                               regions, c);
+  });
+}
+
+// ADS: each site near an anchor goes to one bin, found from where it
+// is relative to the body of the anchor; flank bins have the same
+// size, and body bins scale with the size of the body
+template <typename T>
+[[nodiscard]] static auto
+get_profile_impl(const std::uint32_t flank_size,
+                 const std::uint32_t n_flank_bins,
+                 const std::uint32_t n_body_bins, const cpg_index &index,
+                 const cpg_index_meta &meta,
+                 const std::vector<profile_anchor> &anchors,
+                 const auto &cpgs) -> std::vector<T> {
+  const std::uint32_t n_bins = 2 * n_flank_bins + n_body_bins;
+  const std::uint32_t flank_bin_size =
+    n_flank_bins == 0 ? 0 : flank_size / n_flank_bins;
+  std::vector<T> results(n_bins);
+  for (const auto &anchor : anchors) {
+    const auto &positions = index.positions[anchor.ch_id];
+    const auto chrom_size = meta.chrom_size[anchor.ch_id];
+    // ADS: without body bins, the body is empty and at the 5' end
+    const auto body_start =
+      (n_body_bins == 0 && anchor.is_rev) ? anchor.stop : anchor.start;
+    const auto body_stop =
+      (n_body_bins == 0 && !anchor.is_rev) ? anchor.start : anchor.stop;
+    const std::uint64_t body_size = body_stop - body_start;
+    const auto lo = body_start - std::min(body_start, flank_size);
+    const auto hi = std::min(body_stop + flank_size, chrom_size);
+
+    auto posn_itr = std::ranges::lower_bound(positions, lo);
+    const auto posn_end = std::cend(positions);
+    auto cpg_itr = std::cbegin(cpgs) + meta.chrom_offset[anchor.ch_id] +
+                   std::distance(std::cbegin(positions), posn_itr);
+    for (; posn_itr != posn_end && *posn_itr < hi; ++posn_itr, ++cpg_itr) {
+      const auto posn = *posn_itr;
+      std::uint32_t bin{};
+      if (posn < body_start)
+        bin = n_flank_bins - 1 - (body_start - 1 - posn) / flank_bin_size;
+      else if (posn >= body_stop)
+        bin = n_flank_bins + n_body_bins + (posn - body_stop) / flank_bin_size;
+      else
+        bin = n_flank_bins + (posn - body_start) * n_body_bins / body_size;
+      if (anchor.is_rev)
+        bin = n_bins - 1 - bin;
+      auto &t = results[bin];
+      t.n_meth += cpg_itr->first;
+      t.n_unmeth += cpg_itr->second;
+      if constexpr (std::is_same<T, counts_res_cov>::value)
+        t.n_covered += (cpg_itr->first + cpg_itr->second > 0);
+    }
+  }
+  return results;
+}
+
+[[nodiscard]] auto
+methylome::get_profile(const std::uint32_t flank_size,
+                       const std::uint32_t n_flank_bins,
+                       const std::uint32_t n_body_bins, const cpg_index &index,
+                       const cpg_index_meta &meta,
+                       const std::vector<profile_anchor> &anchors) const
+  -> std::vector<counts_res> {
+  return visit_counts([&](const auto &c) {
+    return get_profile_impl<counts_res>(flank_size, n_flank_bins, n_body_bins,
+                                        index, meta, anchors, c);
+  });
+}
+
+[[nodiscard]] auto
+methylome::get_profile_cov(const std::uint32_t flank_size,
+                           const std::uint32_t n_flank_bins,
+                           const std::uint32_t n_body_bins,
+                           const cpg_index &index, const cpg_index_meta &meta,
+                           const std::vector<profile_anchor> &anchors) const
+  -> std::vector<counts_res_cov> {
+  return visit_counts([&](const auto &c) {
+    return get_profile_impl<counts_res_cov>(flank_size, n_flank_bins,
+                                            n_body_bins, index, meta, anchors,
+                                            c);
+  });
+}
+
+// ADS: windows in [start, stop) of one chrom; the running sums gain
+// each CpG when the window end passes it and lose it when the window
+// start passes it, so each CpG is visited at most twice
+template <typename T>
+static auto
+window_counts_impl(const std::uint32_t window_size,
+                   const std::uint32_t window_step,
+                   const cpg_index::vec &positions, const std::uint32_t start,
+                   const std::uint32_t stop, const auto chrom_cpgs,
+                   std::vector<T> &results) -> void {
+  const auto posn_end = std::cend(positions);
+  auto lo_posn = std::ranges::lower_bound(positions, start);
+  auto lo_cpg =
+    chrom_cpgs + std::distance(std::cbegin(positions), lo_posn);
+  auto hi_posn = lo_posn;
+  auto hi_cpg = lo_cpg;
+  T t{};
+  // ADS: in 64 bits so a window near the end of a chrom cannot wrap
+  for (std::uint64_t i = start; i < stop; i += window_step) {
+    const auto window_end = std::min<std::uint64_t>(i + window_size, stop);
+    for (; hi_posn != posn_end && *hi_posn < window_end; ++hi_posn, ++hi_cpg) {
+      t.n_meth += hi_cpg->first;
+      t.n_unmeth += hi_cpg->second;
+      if constexpr (std::is_same<T, counts_res_cov>::value)
+        t.n_covered += (hi_cpg->first + hi_cpg->second > 0);
+    }
+    for (; lo_posn != hi_posn && *lo_posn < i; ++lo_posn, ++lo_cpg) {
+      t.n_meth -= lo_cpg->first;
+      t.n_unmeth -= lo_cpg->second;
+      if constexpr (std::is_same<T, counts_res_cov>::value)
+        t.n_covered -= (lo_cpg->first + lo_cpg->second > 0);
+    }
+    results.push_back(t);
+  }
+}
+
+template <typename T>
+[[nodiscard]] static auto
+get_windows_impl(const std::uint32_t window_size,
+                 const std::uint32_t window_step, const cpg_index &index,
+                 const cpg_index_meta &meta,
+                 const auto &cpgs) -> std::vector<T> {
+  std::vector<T> results;
+  const auto zipped =
+    std::views::zip(index.positions, meta.chrom_size, meta.chrom_offset);
+  for (const auto [positions, chrom_size, offset] : zipped)
+    window_counts_impl<T>(window_size, window_step, positions, 0, chrom_size,
+                          std::cbegin(cpgs) + offset, results);
+  return results;
+}
+
+template <typename T>
+[[nodiscard]] static auto
+get_windows_impl(const std::uint32_t window_size,
+                 const std::uint32_t window_step, const cpg_index &index,
+                 const cpg_index_meta &meta,
+                 const std::vector<genomic_interval> &regions,
+                 const auto &cpgs) -> std::vector<T> {
+  std::vector<T> results;
+  for (const auto &region : regions) {
+    const auto stop = std::min(region.stop, meta.chrom_size[region.ch_id]);
+    window_counts_impl<T>(window_size, window_step,
+                          index.positions[region.ch_id], region.start, stop,
+                          std::cbegin(cpgs) + meta.chrom_offset[region.ch_id],
+                          results);
+  }
+  return results;
+}
+
+[[nodiscard]] auto
+methylome::get_windows(const std::uint32_t window_size,
+                       const std::uint32_t window_step, const cpg_index &index,
+                       const cpg_index_meta &meta) const
+  -> std::vector<counts_res> {
+  return visit_counts([&](const auto &c) {
+    return get_windows_impl<counts_res>(window_size, window_step, index, meta,
+                                        c);
+  });
+}
+
+[[nodiscard]] auto
+methylome::get_windows_cov(const std::uint32_t window_size,
+                           const std::uint32_t window_step,
+                           const cpg_index &index,
+                           const cpg_index_meta &meta) const
+  -> std::vector<counts_res_cov> {
+  return visit_counts([&](const auto &c) {
+    return get_windows_impl<counts_res_cov>(window_size, window_step, index,
+                                            meta, c);
+  });
+}
+
+[[nodiscard]] auto
+methylome::get_windows(const std::uint32_t window_size,
+                       const std::uint32_t window_step, const cpg_index &index,
+                       const cpg_index_meta &meta,
+                       const std::vector<genomic_interval> &regions) const
+  -> std::vector<counts_res> {
+  return visit_counts([&](const auto &c) {
+    return get_windows_impl<counts_res>(window_size, window_step, index, meta,
+                                        regions, c);
+  });
+}
+
+[[nodiscard]] auto
+methylome::get_windows_cov(const std::uint32_t window_size,
+                           const std::uint32_t window_step,
+                           const cpg_index &index, const cpg_index_meta &meta,
+                           const std::vector<genomic_interval> &regions) const
+  -> std::vector<counts_res_cov> {
+  return visit_counts([&](const auto &c) {
+    return get_windows_impl<counts_res_cov>(window_size, window_step, index,
+                                            meta, regions, c);
+  });
+}
+
+// ADS: checksums are of counts as m_count_t, so 8-bit counts are
+// widened before they are hashed
+[[nodiscard]] static auto
+get_counts_adler(const methylome &meth, const std::uint32_t first,
+                 const std::uint32_t n) -> std::uint64_t {
+  if (!meth.is_narrow())
+    return get_adler(meth.cpgs.data() + first, n * methylome::record_size);
+  methylome::vec wide(n);
+  const auto narrow_beg = std::cbegin(meth.cpgs8) + first;
+  std::transform(narrow_beg, narrow_beg + n, std::begin(wide),
+                 [](const auto &x) {
+                   return methylome::m_elem(x.first, x.second);
+                 });
+  return get_adler(wide.data(), n * methylome::record_size);
 }
 
 [[nodiscard]] auto
 methylome::hash() const -> std::uint64_t {
-  return get_adler(cpgs.data(), std::size(cpgs) * record_size);
+  return get_counts_adler(*this, 0, get_n_cpgs());
 }
 
 [[nodiscard]] auto
 methylome::get_n_cpgs() const -> std::uint32_t {
-  return std::size(cpgs);
+  return is_narrow() ? std::size(cpgs8) : std::size(cpgs);
+}
+
+[[nodiscard]] auto
+methylome::get_block_hashes(const std::uint32_t block_size) const
+  -> std::vector<std::uint64_t> {
+  std::vector<std::uint64_t> hashes;
+  const std::uint32_t n_cpgs = get_n_cpgs();
+  for (std::uint32_t beg = 0; beg < n_cpgs; beg += block_size) {
+    const auto n = std::min(block_size, n_cpgs - beg);
+    hashes.push_back(get_counts_adler(*this, beg, n));
+  }
+  return hashes;
+}
+
+[[nodiscard]] auto
+methylome::init_block_status(const methylome_metadata &meta)
+  -> std::error_code {
+  blocks.reset();
+  if (meta.block_size == 0)
+    return {};
+  const std::uint64_t n_cpgs = get_n_cpgs();
+  const auto n_blocks = (n_cpgs + meta.block_size - 1) / meta.block_size;
+  if (std::size(meta.block_hashes) != n_blocks)
+    return methylome_code::block_checksum_mismatch;
+  auto b = std::make_shared<block_checks>();
+  b->block_size = meta.block_size;
+  b->hashes = meta.block_hashes;
+  b->status = std::vector<std::atomic_uint8_t>(n_blocks);
+  blocks = std::move(b);
+  return {};
+}
+
+[[nodiscard]] static auto
+verify_block(const methylome &meth, methylome::block_checks &b,
+             const std::uint32_t block_id) -> bool {
+  auto &status = b.status[block_id];
+  const auto s = status.load(std::memory_order_acquire);
+  if (s != methylome::block_checks::unchecked)
+    return s == methylome::block_checks::good;
+  // ADS: two requests may hash the same block at once; both get the
+  // same answer so the race is harmless
+  const auto n_cpgs = meth.get_n_cpgs();
+  const auto beg = block_id * b.block_size;
+  const auto n = std::min(b.block_size, n_cpgs - beg);
+  const bool good = get_counts_adler(meth, beg, n) == b.hashes[block_id];
+  status.store(good ? methylome::block_checks::good
+                    : methylome::block_checks::bad,
+               std::memory_order_release);
+  return good;
+}
+
+[[nodiscard]] auto
+methylome::verify_blocks(const std::uint32_t first,
+                         std::uint32_t last) const -> std::error_code {
+  last = std::min(last, get_n_cpgs());
+  if (blocks == nullptr || first >= last)
+    return {};
+  const auto last_block = (last - 1) / blocks->block_size;
+  for (auto i = first / blocks->block_size; i <= last_block; ++i)
+    if (!verify_block(*this, *blocks, i))
+      return methylome_code::block_checksum_mismatch;
+  return {};
+}
+
+[[nodiscard]] auto
+methylome::verify_all_blocks(const std::uint32_t n_threads) const
+  -> std::error_code {
+  if (blocks == nullptr)
+    return {};
+  const std::uint32_t n_blocks = std::size(blocks->status);
+  const auto stride = std::max(n_threads, 1u);
+  std::atomic_bool all_good{true};
+  const auto verify_stripe = [&](const std::uint32_t thread_id) {
+    for (auto i = thread_id; i < n_blocks; i += stride)
+      if (!verify_block(*this, *blocks, i))
+        all_good.store(false, std::memory_order_relaxed);
+  };
+  if (stride == 1) {
+    verify_stripe(0);
+  }
+  else {
+    std::vector<std::jthread> threads;
+    for (std::uint32_t i = 0; i < stride; ++i)
+      threads.emplace_back(verify_stripe, i);
+  }
+  return all_good ? std::error_code{}
+                  : std::error_code{methylome_code::block_checksum_mismatch};
 }
 
 [[nodiscard]] auto
 read_methylome(const std::string &methylome_file,
                const std::string &methylome_meta_file)
   -> std::tuple<methylome, methylome_metadata, std::error_code> {
+  // ADS: a v2 file needs no JSON metadata, and a v1 file needs it
+  auto [meth_v2, meta_v2, v2_err] = methylome::read_v2(methylome_file);
+  if (v2_err != methylome_code::methylome_file_without_header)
+    return {std::move(meth_v2), std::move(meta_v2), v2_err};
+
   // read the methylome metadata first
   const auto [meta, meta_err] = methylome_metadata::read(methylome_meta_file);
   if (meta_err)
@@ -332,7 +1378,7 @@ read_methylome(const std::string &methylome_file,
   // read the methylome using its metadata
   const auto [meth, meth_err] = methylome::read(methylome_file, meta);
   if (meth_err)
-    return {methylome{}, methylome_metadata{}, meta_err};
+    return {methylome{}, methylome_metadata{}, meth_err};
 
   return {std::move(meth), std::move(meta), {}};
 }
@@ -30,12 +30,17 @@
 #endif
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>    // for std::round
 #include <cstddef>  // for std::size_t
 #include <cstdint>  // for std::uint32_t
 #include <format>
+#include <functional>  // for std::function
+#include <iosfwd>      // for std::istream, std::ostream
 #include <iterator>  // for std::pair, std::size
 #include <limits>    // for std::numeric_limits
+#include <memory>    // for std::shared_ptr
 #include <string>
 #include <system_error>
 #include <tuple>
@@ -45,8 +50,68 @@
 
 struct counts_res;
 struct counts_res_cov;
+struct counts_res_ext;
 struct cpg_index_meta;
+struct genomic_interval;
 struct methylome_metadata;
+struct profile_anchor;
+
+/*
+  methylome_file_header: a v2 methylome file starts with this header,
+  padded to fill the first page, so the methylome can be opened and
+  checked with one read and without its JSON metadata. The counts are
+  at data_offset and the block checksums at block_table_offset. A v1
+  file has only the counts and needs the JSON metadata.
+ */
+struct methylome_file_header {
+  static constexpr std::array<char, 8> magic{'X', 'F', 'R', 'M', 'E',
+                                             'T', 'H', '\n'};
+  static constexpr std::uint32_t current_version{2};
+  static constexpr std::uint32_t n_bytes{4096};
+  static constexpr std::uint32_t max_assembly_size{56};
+
+  enum class codec_type : std::uint32_t {
+    raw16 = 0,
+    zlib16 = 1,
+    raw8 = 2,
+    zlib8 = 3,
+  };
+
+  std::array<char, 8> file_magic{};
+  std::uint32_t version{};  // zero for a v1 file
+  std::uint32_t n_cpgs{};
+  codec_type codec{};
+  std::uint32_t block_size{};
+  std::uint64_t index_hash{};
+  std::uint64_t methylome_hash{};
+  std::uint64_t data_offset{};
+  std::uint64_t data_size{};
+  std::uint64_t block_table_offset{};
+  std::uint32_t n_blocks{};
+  std::uint32_t assembly_size{};
+  std::array<char, max_assembly_size> assembly{};
+
+  // header for counts taking data_size bytes as described in meta;
+  // the counts follow the header and the block checksums follow them
+  [[nodiscard]] static auto
+  init(const methylome_metadata &meta, const std::uint64_t data_size)
+    -> std::tuple<methylome_file_header, std::error_code>;
+
+  // read the header from the start of 'in' and leave 'in' at the
+  // first byte of counts; a v1 file gives version zero and no error
+  [[nodiscard]] static auto
+  read(std::istream &in, const std::uint64_t filesize)
+    -> std::tuple<methylome_file_header, std::error_code>;
+
+  // write the header padded to n_bytes
+  [[nodiscard]] auto
+  write(std::ostream &out) const -> std::error_code;
+
+  // metadata with the fields kept in the header, and without the
+  // block checksums, which are read separately
+  [[nodiscard]] auto
+  get_metadata() const -> methylome_metadata;
+};
 
 struct methylome {
   static constexpr auto filename_extension{".m16"};
@@ -59,15 +124,145 @@ struct methylome {
   typedef std::vector<m_elem> vec;
 #endif
 
+  // ADS: number of cpgs covered by each block checksum; 64K sites is
+  // 256KB of counts, small enough that verifying a block on first use
+  // does not show up in request latency
+  static constexpr std::uint32_t default_block_size{65536};
+
+  // ADS: counts are stored with count_width bits each, and 8 bits
+  // halves the size of a shallow methylome on disk and in memory.
+  // Files are read into cpgs as m_count_t, and narrow() moves counts
+  // stored with 8 bits into cpgs8; the kernels take either, and the
+  // checksums are always of the counts as m_count_t
+  typedef std::uint8_t m8_count_t;
+  typedef std::pair<m8_count_t, m8_count_t> m8_elem;
+#if not defined(__APPLE__) && not defined(__MACH__)
+  typedef std::vector<m8_elem, aligned_allocator<m8_elem>> vec8;
+#else
+  typedef std::vector<m8_elem> vec8;
+#endif
+  static constexpr std::uint32_t default_count_width{16};
+
+  [[nodiscard]] static auto
+  is_valid_count_width(const std::uint32_t count_width) -> bool {
+    return count_width == 8 || count_width == 16;
+  }
+
+  // bytes for each cpg as stored with count_width bits
+  [[nodiscard]] static auto
+  get_record_size(const std::uint32_t count_width) -> std::uint32_t {
+    return count_width == 8 ? sizeof(m8_elem) : sizeof(m_elem);
+  }
+
+  // fill cpgs, which must already have the right size, using
+  // 'read_bytes' to read counts stored with count_width bits
+  [[nodiscard]] static auto
+  read_counts(const std::uint32_t count_width, vec &cpgs,
+              const std::function<bool(char *, std::uint64_t)> &read_bytes)
+    -> bool;
+
+  // compress or decompress counts stored with count_width bits; for
+  // decompress cpgs must already have the right size
+  [[nodiscard]] static auto
+  compress_counts(const std::uint32_t count_width, const vec &cpgs,
+                  std::vector<std::uint8_t> &buf) -> std::error_code;
+  [[nodiscard]] static auto
+  decompress_counts(const std::uint32_t count_width,
+                    std::vector<std::uint8_t> &buf,
+                    vec &cpgs) -> std::error_code;
+  // counts stored with 8 bits can be decompressed to 8 bits
+  [[nodiscard]] static auto
+  decompress_counts(std::vector<std::uint8_t> &buf,
+                    vec8 &cpgs8) -> std::error_code;
+
+  // keep counts stored with count_width bits in that width: for 8 bits
+  // the counts move from cpgs to cpgs8, and each must fit in 8 bits
+  auto
+  narrow(const std::uint32_t count_width) -> void;
+
+  // move counts from cpgs8 back to cpgs
+  auto
+  widen() -> void;
+
+  [[nodiscard]] auto
+  is_narrow() const -> bool {
+    return !std::empty(cpgs8);
+  }
+
+  // bytes the counts take in memory
+  [[nodiscard]] auto
+  get_n_bytes() const -> std::uint64_t;
+
+  // compress the counts, whether in cpgs or cpgs8, as stored with
+  // count_width bits
+  [[nodiscard]] auto
+  get_compressed(const std::uint32_t count_width,
+                 std::vector<std::uint8_t> &buf) const -> std::error_code;
+
+  // call 'f' with whichever of cpgs and cpgs8 has the counts
+  template <typename F>
+  auto
+  visit_counts(F &&f) const -> decltype(auto) {
+    if (is_narrow())
+      return f(cpgs8);
+    return f(cpgs);
+  }
+
+  // round counts that do not fit in count_width bits; checksums taken
+  // before rounding no longer apply
+  auto
+  round_to_width(const std::uint32_t count_width) -> void;
+
   // ADS: use of n_cpgs to validate might be confusing and at least
   // need to be documented
   [[nodiscard]] static auto
   read(const std::string &filename, const methylome_metadata &meta)
     -> std::tuple<methylome, std::error_code>;
 
+  // a v2 file gives the methylome and its metadata with one open; a
+  // v1 file gives methylome_file_without_header
+  [[nodiscard]] static auto
+  read_v2(const std::string &filename)
+    -> std::tuple<methylome, methylome_metadata, std::error_code>;
+
+  // metadata from the header and block checksums of a v2 file
+  [[nodiscard]] static auto
+  read_v2_metadata(const std::string &filename)
+    -> std::tuple<methylome_metadata, std::error_code>;
+
+  // read only cpgs [first, first + n); for an uncompressed file the
+  // blocks overlapping the range are read and verified right away, so
+  // the slice needs no lazy verification; a compressed file must be
+  // decompressed whole
+  [[nodiscard]] static auto
+  read_slice(const std::string &filename, const methylome_metadata &meta,
+             const std::uint32_t first,
+             const std::uint32_t n) -> std::tuple<methylome, std::error_code>;
+
+  // same as above, but reading with 'read_at', which reads a number
+  // of bytes at a byte offset into the uncompressed methylome
+  [[nodiscard]] static auto
+  read_slice(const methylome_metadata &meta, const std::uint32_t first,
+             const std::uint32_t n,
+             const std::function<bool(char *, std::uint64_t, std::uint64_t)>
+               &read_at) -> std::tuple<methylome, std::error_code>;
+
+  // copy of cpgs [first, first + n), as narrow as these are, after
+  // verifying the blocks they overlap
+  [[nodiscard]] auto
+  get_slice(const std::uint32_t first, const std::uint32_t n) const
+    -> std::tuple<methylome, std::error_code>;
+
+  // counts must fit in count_width bits, e.g., after round_to_width
+  [[nodiscard]] auto
+  write(const std::string &filename, const bool zip = false,
+        const std::uint32_t count_width = default_count_width) const
+    -> std::error_code;
+
+  // write a v2 file, with the header and block checksums from meta
   [[nodiscard]] auto
-  write(const std::string &filename,
-        const bool zip = false) const -> std::error_code;
+  write_v2(const std::string &filename,
+           const methylome_metadata &meta) const -> std::error_code;
 
   [[nodiscard]] static auto
   get_n_cpgs_from_file(const std::string &filename) -> std::uint32_t;
@@ -84,6 +279,27 @@ struct methylome {
   [[nodiscard]] auto
   hash() const -> std::uint64_t;
 
+  // checksum of each consecutive block of block_size cpgs; the last
+  // block may be short
+  [[nodiscard]] auto
+  get_block_hashes(const std::uint32_t block_size) const
+    -> std::vector<std::uint64_t>;
+
+  // take block checksums from the metadata so blocks can be verified
+  // lazily; metadata without block checksums disables verification
+  [[nodiscard]] auto
+  init_block_status(const methylome_metadata &meta) -> std::error_code;
+
+  // verify each block overlapping cpgs [first, last) that has not yet
+  // been verified; a block is hashed at most once
+  [[nodiscard]] auto
+  verify_blocks(const std::uint32_t first,
+                const std::uint32_t last) const -> std::error_code;
+
+  // verify every block, dividing blocks among n_threads threads
+  [[nodiscard]] auto
+  verify_all_blocks(const std::uint32_t n_threads) const -> std::error_code;
+
   typedef std::pair<std::uint32_t, std::uint32_t> offset_pair;
 
   [[nodiscard]] auto
@@ -114,6 +330,15 @@ struct methylome {
   get_counts(const std::vector<offset_pair> &eps) const
     -> std::vector<counts_res>;
 
+  // counts, covered sites, and sums of levels and squared levels over
+  // covered sites, all in one pass over each range of endpoints
+  [[nodiscard]] auto
+  get_counts_ext(const std::uint32_t start,
+                 const std::uint32_t stop) const -> counts_res_ext;
+  [[nodiscard]] auto
+  get_counts_ext(const std::vector<offset_pair> &eps) const
+    -> std::vector<counts_res_ext>;
+
   [[nodiscard]] auto
   total_counts() const -> counts_res;
   [[nodiscard]] auto
@@ -128,13 +353,108 @@ struct methylome {
   get_bins_cov(const std::uint32_t bin_size, const cpg_index &index,
                const cpg_index_meta &meta) const -> std::vector<counts_res_cov>;
 
+  // same as above, but bins are only within the given regions, with
+  // the first bin in each region starting at the region start
+  [[nodiscard]] auto
+  get_bins(const std::uint32_t bin_size, const cpg_index &index,
+           const cpg_index_meta &meta,
+           const std::vector<genomic_interval> &regions) const
+    -> std::vector<counts_res>;
+  [[nodiscard]] auto
+  get_bins_cov(const std::uint32_t bin_size, const cpg_index &index,
+               const cpg_index_meta &meta,
+               const std::vector<genomic_interval> &regions) const
+    -> std::vector<counts_res_cov>;
+
+  // bins of each size in bin_sizes computed in one pass, concatenated
+  // in the order of bin_sizes as given by get_bins_offsets; when each
+  // size divides the next larger one, only the smallest are counted
+  // from the sites and the rest are sums of those
+  [[nodiscard]] auto
+  get_multi_bins(const std::vector<std::uint32_t> &bin_sizes,
+                 const cpg_index &index, const cpg_index_meta &meta) const
+    -> std::vector<counts_res>;
+  [[nodiscard]] auto
+  get_multi_bins_cov(const std::vector<std::uint32_t> &bin_sizes,
+                     const cpg_index &index, const cpg_index_meta &meta) const
+    -> std::vector<counts_res_cov>;
+
+  [[nodiscard]] auto
+  get_multi_bins(const std::vector<std::uint32_t> &bin_sizes,
+                 const cpg_index &index, const cpg_index_meta &meta,
+                 const std::vector<genomic_interval> &regions) const
+    -> std::vector<counts_res>;
+  [[nodiscard]] auto
+  get_multi_bins_cov(const std::vector<std::uint32_t> &bin_sizes,
+                     const cpg_index &index, const cpg_index_meta &meta,
+                     const std::vector<genomic_interval> &regions) const
+    -> std::vector<counts_res_cov>;
+
+  // counts summed over all anchors in bins along each anchor: first
+  // n_flank_bins bins over flank_size upstream, then n_body_bins that
+  // divide the anchor into equal parts, then n_flank_bins downstream;
+  // without body bins the flanks are around the 5' end. Each anchor
+  // only visits the sites in its flanks and body
+  [[nodiscard]] auto
+  get_profile(const std::uint32_t flank_size, const std::uint32_t n_flank_bins,
+              const std::uint32_t n_body_bins, const cpg_index &index,
+              const cpg_index_meta &meta,
+              const std::vector<profile_anchor> &anchors) const
+    -> std::vector<counts_res>;
+  [[nodiscard]] auto
+  get_profile_cov(const std::uint32_t flank_size,
+                  const std::uint32_t n_flank_bins,
+                  const std::uint32_t n_body_bins, const cpg_index &index,
+                  const cpg_index_meta &meta,
+                  const std::vector<profile_anchor> &anchors) const
+    -> std::vector<counts_res_cov>;
+
+  // windows of window_size starting at each multiple of window_step
+  // along all chromosomes; computed in one sliding pass, so the
+  // overlap between windows does not add work
+  [[nodiscard]] auto
+  get_windows(const std::uint32_t window_size, const std::uint32_t window_step,
+              const cpg_index &index,
+              const cpg_index_meta &meta) const -> std::vector<counts_res>;
+  [[nodiscard]] auto
+  get_windows_cov(const std::uint32_t window_size,
+                  const std::uint32_t window_step, const cpg_index &index,
+                  const cpg_index_meta &meta) const
+    -> std::vector<counts_res_cov>;
+
+  // same as above, but windows are only within the given regions
+  [[nodiscard]] auto
+  get_windows(const std::uint32_t window_size, const std::uint32_t window_step,
+              const cpg_index &index, const cpg_index_meta &meta,
+              const std::vector<genomic_interval> &regions) const
+    -> std::vector<counts_res>;
+  [[nodiscard]] auto
+  get_windows_cov(const std::uint32_t window_size,
+                  const std::uint32_t window_step, const cpg_index &index,
+                  const cpg_index_meta &meta,
+                  const std::vector<genomic_interval> &regions) const
+    -> std::vector<counts_res_cov>;
+
+  // ADS: status of each block is shared among copies of a methylome
+  // and updated by concurrent requests, so it must be atomic
+  struct block_checks {
+    static constexpr std::uint8_t unchecked{0};
+    static constexpr std::uint8_t good{1};
+    static constexpr std::uint8_t bad{2};
+    std::uint32_t block_size{};
+    std::vector<std::uint64_t> hashes;
+    std::vector<std::atomic_uint8_t> status;
+  };
+
   methylome::vec cpgs{};
+  methylome::vec8 cpgs8{};  // only after narrow(); cpgs is then empty
+  std::shared_ptr<block_checks> blocks{};
   static constexpr auto record_size = sizeof(m_elem);
 };
 
 [[nodiscard]] inline auto
 size(const methylome &m) -> std::size_t {
-  return std::size(m.cpgs);
+  return m.get_n_cpgs();
 }
 
 [[nodiscard]] auto
@@ -168,4 +488,26 @@ conditional_round_to_fit(U &a, U &b) -> void {
     round_to_fit<T>(a, b);
 }
 
+// ADS: counts with a narrower type than m_count_t; each count must
+// already fit in count_t
+template <typename count_t>
+[[nodiscard]] inline auto
+to_count_width(const methylome::vec &cpgs)
+  -> std::vector<std::pair<count_t, count_t>> {
+  std::vector<std::pair<count_t, count_t>> narrow(std::size(cpgs));
+  std::ranges::transform(cpgs, std::begin(narrow), [](const auto &x) {
+    return std::pair<count_t, count_t>(x.first, x.second);
+  });
+  return narrow;
+}
+
+template <typename count_t>
+inline auto
+from_count_width(const std::vector<std::pair<count_t, count_t>> &narrow,
+                 methylome::vec &cpgs) -> void {
+  std::ranges::transform(narrow, std::begin(cpgs), [](const auto &x) {
+    return methylome::m_elem(x.first, x.second);
+  });
+}
+
 #endif  // SRC_METHYLOME_HPP_
@@ -85,9 +85,13 @@ methylome_metadata::init(const cpg_index_meta &cim, const methylome &meth,
   if (err)
     return {{}, err};
 
+  const auto block_size = methylome::default_block_size;
+  auto block_hashes = meth.get_block_hashes(block_size);
+
   return {methylome_metadata{VERSION, host, username, get_time_as_string(),
                              methylome_hash, index_hash, assembly, n_cpgs,
-                             is_compressed},
+                             is_compressed, block_size,
+                             std::move(block_hashes)},
           std::error_code{}};
 }
 
@@ -97,6 +101,8 @@ methylome_metadata::update(const methylome &meth) -> std::error_code {
   if (err)
     return err;
   methylome_hash = meth.hash();
+  block_size = methylome::default_block_size;
+  block_hashes = meth.get_block_hashes(block_size);
   return {};
 }
 
@@ -116,8 +122,32 @@ methylome_metadata::read(const std::string &json_filename)
   if (!in.read(payload.data(), filesize))
     return {{}, std::make_error_code(std::errc(errno))};
 
+  return parse(payload);
+}
+
+[[nodiscard]] auto
+methylome_metadata::parse(const std::string &payload)
+  -> std::tuple<methylome_metadata, std::error_code> {
+  std::error_code ec;
+  auto value = boost::json::parse(payload, ec);
+  if (ec || !value.is_object())
+    return {methylome_metadata{},
+            methylome_metadata_error::failure_parsing_json};
+
+  // ADS: metadata written before block checksums existed lacks those
+  // fields; parsing would fail on the missing members
+  auto &obj = value.get_object();
+  if (!obj.contains("block_size"))
+    obj["block_size"] = 0;
+  if (!obj.contains("block_hashes"))
+    obj["block_hashes"] = boost::json::array{};
+  // ADS: metadata written before count widths were recorded is for
+  // 16-bit counts
+  if (!obj.contains("count_width"))
+    obj["count_width"] = methylome::default_count_width;
+
   methylome_metadata mm;
-  boost::json::parse_into(mm, payload, ec);
+  boost::json::parse_into(mm, boost::json::serialize(value), ec);
   if (ec)
     return {methylome_metadata{},
             methylome_metadata_error::failure_parsing_json};
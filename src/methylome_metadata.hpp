@@ -34,6 +34,7 @@
 #include <type_traits>  // for std::true_type
 #include <utility>      // for std::to_underlying, std::unreachable
 #include <variant>      // for std::tuple
+#include <vector>
 
 enum class methylome_metadata_error : std::uint32_t {
   ok = 0,
@@ -102,11 +103,23 @@ struct methylome_metadata {
   std::string assembly;
   std::uint32_t n_cpgs{};
   bool is_compressed{};
+  // ADS: checksum of each block of block_size uncompressed cpgs; a
+  // block_size of 0 means the methylome predates block checksums
+  std::uint32_t block_size{};
+  std::vector<std::uint64_t> block_hashes;
+  // ADS: bits for each stored count, 16 or 8; in memory counts are
+  // always 16 bits, and checksums are of those
+  std::uint32_t count_width{16};
 
   [[nodiscard]] static auto
   read(const std::string &json_filename)
     -> std::tuple<methylome_metadata, std::error_code>;
 
+  // parse metadata from json text, e.g., as stored in a pack file
+  [[nodiscard]] static auto
+  parse(const std::string &payload)
+    -> std::tuple<methylome_metadata, std::error_code>;
+
   [[nodiscard]] auto
   write(const std::string &json_filename) const -> std::error_code;
 
@@ -137,7 +150,10 @@ BOOST_DESCRIBE_STRUCT(methylome_metadata, (),
  index_hash,
  assembly,
  n_cpgs,
- is_compressed
+ is_compressed,
+ block_size,
+ block_hashes,
+ count_width
 ))
 // clang-format on
 
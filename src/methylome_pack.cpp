@@ -0,0 +1,443 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "methylome_pack.hpp"
+
+#include "methylome.hpp"
+#include "methylome_metadata.hpp"
+#include "utilities.hpp"  // for pread_all
+
+#include <fcntl.h>     // for open, O_RDONLY, O_WRONLY
+#include <sys/file.h>  // for flock, LOCK_EX
+#include <unistd.h>    // for close, fsync, getpid, pwrite
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>  // for std::size_t
+#include <cstdint>
+#include <cstring>  // for std::memcpy
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>  // for std::size, std::distance
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <unordered_map>
+#include <utility>  // for std::move, std::exchange
+#include <vector>
+
+struct pack_header {
+  char magic[8]{};
+  std::uint64_t directory_offset{};
+  std::uint64_t n_entries{};
+};
+
+static constexpr std::uint64_t pack_header_size = sizeof(pack_header);
+
+[[nodiscard]] static auto
+copy_bytes(std::istream &in, std::ostream &out,
+           std::uint64_t n_bytes) -> bool {
+  static constexpr std::uint64_t buf_size{1u << 20};
+  std::vector<char> buf(std::min(n_bytes, buf_size));
+  while (n_bytes > 0) {
+    const auto n = static_cast<std::streamsize>(std::min(n_bytes, buf_size));
+    if (!in.read(buf.data(), n) || !out.write(buf.data(), n))
+      return false;
+    n_bytes -= n;
+  }
+  return true;
+}
+
+// ADS: bytes of an uncompressed methylome with the stored count width
+[[nodiscard]] static inline auto
+get_data_size(const methylome_metadata &meta) -> std::uint64_t {
+  return static_cast<std::uint64_t>(meta.n_cpgs) *
+         methylome::get_record_size(meta.count_width);
+}
+
+[[nodiscard]] static auto
+read_directory(const int fd, const pack_header &hdr,
+               const std::uint64_t filesize,
+               std::unordered_map<std::string, methylome_pack::entry> &dir)
+  -> std::error_code {
+  if (hdr.directory_offset < pack_header_size ||
+      hdr.directory_offset > filesize)
+    return methylome_pack_error::invalid_pack_header;
+
+  std::vector<char> buf(filesize - hdr.directory_offset);
+  if (!pread_all(fd, buf.data(), std::size(buf), hdr.directory_offset))
+    return methylome_pack_error::error_reading_pack;
+
+  auto cursor = buf.data();
+  const auto buf_end = buf.data() + std::size(buf);
+  const auto remaining = [&] {
+    return static_cast<std::size_t>(std::distance(cursor, buf_end));
+  };
+  const auto get = [&](auto &x) {
+    if (remaining() < sizeof(x))
+      return false;
+    std::memcpy(&x, cursor, sizeof(x));
+    cursor += sizeof(x);
+    return true;
+  };
+
+  for (std::uint64_t i = 0; i < hdr.n_entries; ++i) {
+    std::uint32_t accession_size{};
+    if (!get(accession_size) || remaining() < accession_size)
+      return methylome_pack_error::invalid_pack_directory;
+    std::string accession(cursor, accession_size);
+    cursor += accession_size;
+    methylome_pack::entry e;
+    if (!get(e.meta_offset) || !get(e.meta_size) || !get(e.data_offset) ||
+        !get(e.data_size))
+      return methylome_pack_error::invalid_pack_directory;
+    // ADS: sizes are compared with the room left before the directory
+    // so a corrupt entry cannot wrap the sum
+    if (e.meta_offset > hdr.directory_offset ||
+        e.meta_size > hdr.directory_offset - e.meta_offset ||
+        e.data_offset > hdr.directory_offset ||
+        e.data_size > hdr.directory_offset - e.data_offset)
+      return methylome_pack_error::invalid_pack_directory;
+    if (!dir.emplace(std::move(accession), e).second)
+      return methylome_pack_error::invalid_pack_directory;
+  }
+  return {};
+}
+
+[[nodiscard]] static auto
+write_directory(std::ostream &out,
+                const std::unordered_map<std::string, methylome_pack::entry>
+                  &dir) -> bool {
+  const auto put = [&](const auto &x) {
+    return static_cast<bool>(
+      out.write(reinterpret_cast<const char *>(&x), sizeof(x)));
+  };
+  for (const auto &[accession, e] : dir) {
+    const std::uint32_t accession_size = std::size(accession);
+    if (!put(accession_size) ||
+        !out.write(accession.data(), accession_size) || !put(e.meta_offset) ||
+        !put(e.meta_size) || !put(e.data_offset) || !put(e.data_size))
+      return false;
+  }
+  return true;
+}
+
+methylome_pack::methylome_pack(methylome_pack &&other) noexcept :
+  filename{std::move(other.filename)}, fd{std::exchange(other.fd, -1)},
+  directory_offset{other.directory_offset},
+  directory{std::move(other.directory)} {}
+
+methylome_pack &
+methylome_pack::operator=(methylome_pack &&other) noexcept {
+  if (this != &other) {
+    if (fd >= 0)
+      ::close(fd);
+    filename = std::move(other.filename);
+    fd = std::exchange(other.fd, -1);
+    directory_offset = other.directory_offset;
+    directory = std::move(other.directory);
+  }
+  return *this;
+}
+
+methylome_pack::~methylome_pack() {
+  if (fd >= 0)
+    ::close(fd);
+}
+
+[[nodiscard]] auto
+methylome_pack::open(const std::string &filename)
+  -> std::tuple<methylome_pack, std::error_code> {
+  std::error_code ec;
+  const auto filesize = std::filesystem::file_size(filename, ec);
+  if (ec)
+    return {methylome_pack{}, ec};
+  if (filesize < pack_header_size)
+    return {methylome_pack{}, methylome_pack_error::invalid_pack_header};
+
+  methylome_pack pack;
+  pack.filename = filename;
+  pack.fd = ::open(filename.data(), O_RDONLY, 0);
+  if (pack.fd < 0)
+    return {methylome_pack{}, std::make_error_code(std::errc(errno))};
+
+  pack_header hdr;
+  if (!pread_all(pack.fd, &hdr, pack_header_size, 0))
+    return {methylome_pack{}, methylome_pack_error::error_reading_pack};
+  if (!std::ranges::equal(hdr.magic, magic))
+    return {methylome_pack{}, methylome_pack_error::invalid_pack_header};
+
+  if (const auto dir_err = read_directory(pack.fd, hdr, filesize, pack.directory))
+    return {methylome_pack{}, dir_err};
+  pack.directory_offset = hdr.directory_offset;
+
+  return {std::move(pack), methylome_pack_error::ok};
+}
+
+[[nodiscard]] auto
+methylome_pack::read(const std::string &accession) const
+  -> std::tuple<methylome, methylome_metadata, std::error_code> {
+  const auto itr = directory.find(accession);
+  if (itr == std::cend(directory))
+    return {{}, {}, methylome_pack_error::accession_not_in_pack};
+  const auto &e = itr->second;
+
+  auto [meta, meta_err] = read_metadata(accession);
+  if (meta_err)
+    return {{}, {}, meta_err};
+
+  methylome meth;
+  if (meta.is_compressed) {
+    std::vector<std::uint8_t> buf(e.data_size);
+    if (!pread_all(fd, buf.data(), e.data_size, e.data_offset))
+      return {{}, {}, methylome_pack_error::error_reading_pack};
+    meth.cpgs.resize(meta.n_cpgs);
+    if (const auto decompress_err =
+          methylome::decompress_counts(meta.count_width, buf, meth.cpgs))
+      return {{}, {}, decompress_err};
+  }
+  else {
+    if (e.data_size != get_data_size(meta))
+      return {{}, {}, methylome_pack_error::inconsistent_methylome_size};
+    meth.cpgs.resize(meta.n_cpgs);
+    const auto read_ok = methylome::read_counts(
+      meta.count_width, meth.cpgs,
+      [this, &e](char *dst, const std::uint64_t n_bytes) {
+        return pread_all(fd, dst, n_bytes, e.data_offset);
+      });
+    if (!read_ok)
+      return {{}, {}, methylome_pack_error::error_reading_pack};
+  }
+  if (const auto block_err = meth.init_block_status(meta))
+    return {{}, {}, block_err};
+  return {std::move(meth), std::move(meta), methylome_pack_error::ok};
+}
+
+[[nodiscard]] auto
+methylome_pack::read_metadata(const std::string &accession) const
+  -> std::tuple<methylome_metadata, std::error_code> {
+  const auto itr = directory.find(accession);
+  if (itr == std::cend(directory))
+    return {{}, methylome_pack_error::accession_not_in_pack};
+  const auto &e = itr->second;
+  std::string payload(e.meta_size, '\0');
+  if (!pread_all(fd, payload.data(), e.meta_size, e.meta_offset))
+    return {{}, methylome_pack_error::error_reading_pack};
+  return methylome_metadata::parse(payload);
+}
+
+[[nodiscard]] auto
+methylome_pack::read_slice(const std::string &accession,
+                           const methylome_metadata &meta,
+                           const std::uint32_t first,
+                           const std::uint32_t n) const
+  -> std::tuple<methylome, std::error_code> {
+  const auto itr = directory.find(accession);
+  if (itr == std::cend(directory))
+    return {{}, methylome_pack_error::accession_not_in_pack};
+  const auto &e = itr->second;
+  if (meta.is_compressed) {
+    const auto [meth, meta_read, read_err] = read(accession);
+    if (read_err)
+      return {{}, read_err};
+    return meth.get_slice(first, n);
+  }
+  if (e.data_size != get_data_size(meta))
+    return {{}, methylome_pack_error::inconsistent_methylome_size};
+  return methylome::read_slice(
+    meta, first, n,
+    [this, &e](char *dst, const std::uint64_t n_bytes,
+               const std::uint64_t offset) {
+      return pread_all(fd, dst, n_bytes, e.data_offset + offset);
+    });
+}
+
+// ADS: write the new methylomes and then the directory of all entries;
+// out must be positioned where the first new methylome goes. The
+// header for the result is returned and not written
+[[nodiscard]] static auto
+write_pack(std::ostream &out, std::unordered_map<std::string,
+                                                 methylome_pack::entry> &dir,
+           const std::vector<methylome_pack::source> &sources)
+  -> std::tuple<pack_header, std::error_code> {
+  std::uint64_t offset = static_cast<std::streamoff>(out.tellp());
+  for (const auto &src : sources) {
+    const auto [meta, meta_err] = methylome_metadata::read(src.metadata_file);
+    if (meta_err)
+      return {{}, meta_err};
+    std::error_code ec;
+    const auto filesize = std::filesystem::file_size(src.methylome_file, ec);
+    if (ec)
+      return {{}, ec};
+    std::ifstream in(src.methylome_file, std::ios::binary);
+    if (!in)
+      return {{}, std::make_error_code(std::errc(errno))};
+    // ADS: only the counts of a v2 file go in the pack; its header and
+    // block checksums are also in the metadata
+    const auto [file_hdr, file_hdr_err] =
+      methylome_file_header::read(in, filesize);
+    if (file_hdr_err)
+      return {{}, file_hdr_err};
+    const auto data_size =
+      file_hdr.version == 0 ? filesize : file_hdr.data_size;
+    if (!meta.is_compressed && data_size != get_data_size(meta))
+      return {{}, methylome_pack_error::inconsistent_methylome_size};
+
+    const auto meta_json = meta.tostring();
+    methylome_pack::entry e;
+    e.meta_offset = offset;
+    e.meta_size = std::size(meta_json);
+    if (!out.write(meta_json.data(), e.meta_size))
+      return {{}, methylome_pack_error::error_writing_pack};
+    offset += e.meta_size;
+
+    e.data_offset = offset;
+    e.data_size = data_size;
+    if (!copy_bytes(in, out, data_size))
+      return {{}, methylome_pack_error::error_writing_pack};
+    offset += data_size;
+
+    if (!dir.emplace(src.accession, e).second)
+      return {{}, methylome_pack_error::accession_already_in_pack};
+  }
+
+  pack_header hdr;
+  std::ranges::copy(methylome_pack::magic, hdr.magic);
+  hdr.directory_offset = offset;
+  hdr.n_entries = std::size(dir);
+  if (!write_directory(out, dir) || !out.flush())
+    return {{}, methylome_pack_error::error_writing_pack};
+  return {hdr, methylome_pack_error::ok};
+}
+
+// ADS: everything the header points to is made durable before the
+// header itself is written, so the pack is only ever seen with the old
+// header and directory or with the new ones
+[[nodiscard]] static auto
+commit_header(const int fd, const pack_header &hdr) -> std::error_code {
+  if (::fsync(fd) != 0)
+    return std::make_error_code(std::errc(errno));
+  if (::pwrite(fd, &hdr, pack_header_size, 0) !=
+      static_cast<ssize_t>(pack_header_size))
+    return methylome_pack_error::error_writing_pack;
+  if (::fsync(fd) != 0)
+    return std::make_error_code(std::errc(errno));
+  return methylome_pack_error::ok;
+}
+
+[[nodiscard]] static auto
+create_pack(const std::string &filename,
+            const std::vector<methylome_pack::source> &sources)
+  -> std::error_code {
+  // ADS: a new pack is written to a temporary file and renamed, so
+  // readers and any failure only ever see a complete pack
+  const auto tmp_filename = std::format("{}.{}.tmp", filename, ::getpid());
+  auto [hdr, write_err] = [&] {
+    std::ofstream out(tmp_filename, std::ios::binary);
+    if (!out)
+      return std::tuple{pack_header{}, std::make_error_code(std::errc(errno))};
+    // ADS: placeholder header until the directory has been written
+    const pack_header placeholder{};
+    if (!out.write(reinterpret_cast<const char *>(&placeholder),
+                   pack_header_size))
+      return std::tuple{pack_header{},
+                        make_error_code(
+                          methylome_pack_error::error_writing_pack)};
+    std::unordered_map<std::string, methylome_pack::entry> dir;
+    return write_pack(out, dir, sources);
+  }();
+  if (!write_err) {
+    const auto fd = ::open(tmp_filename.data(), O_WRONLY, 0);
+    if (fd < 0)
+      write_err = std::make_error_code(std::errc(errno));
+    else {
+      write_err = commit_header(fd, hdr);
+      ::close(fd);
+    }
+  }
+  if (!write_err)
+    std::filesystem::rename(tmp_filename, filename, write_err);
+  if (write_err) {
+    std::error_code ec;
+    std::filesystem::remove(tmp_filename, ec);
+    return write_err;
+  }
+  return methylome_pack_error::ok;
+}
+
+[[nodiscard]] auto
+methylome_pack::append(const std::string &filename,
+                       const std::vector<source> &sources) -> std::error_code {
+  std::error_code ec;
+  if (!std::filesystem::exists(filename, ec))
+    return ec ? ec : create_pack(filename, sources);
+
+  // ADS: appends to one pack are one at a time; readers need no lock
+  const auto fd = ::open(filename.data(), O_WRONLY, 0);
+  if (fd < 0)
+    return std::make_error_code(std::errc(errno));
+  const auto append_err = [&]() -> std::error_code {
+    if (::flock(fd, LOCK_EX) != 0)
+      return std::make_error_code(std::errc(errno));
+    auto [pack, open_err] = methylome_pack::open(filename);
+    if (open_err)
+      return open_err;
+    for (const auto &src : sources)
+      if (pack.contains(src.accession))
+        return methylome_pack_error::accession_already_in_pack;
+
+    // ADS: new methylomes and the new directory go after the end of
+    // the file, so the old header and directory stay valid until the
+    // header is replaced; only the new data is written, and the old
+    // directory is left as a few unused bytes
+    const auto old_size = std::filesystem::file_size(filename, ec);
+    if (ec)
+      return ec;
+    auto [hdr, write_err] = [&] {
+      std::fstream out(filename,
+                       std::ios::in | std::ios::out | std::ios::binary);
+      if (!out || !out.seekp(0, std::ios::end))
+        return std::tuple{pack_header{},
+                          std::make_error_code(std::errc(errno))};
+      return write_pack(out, pack.directory, sources);
+    }();
+    if (!write_err)
+      write_err = commit_header(fd, hdr);
+    if (write_err)
+      std::filesystem::resize_file(filename, old_size, ec);
+    return write_err;
+  }();
+  ::close(fd);  // releases the lock
+  return append_err;
+}
+
+[[nodiscard]] auto
+methylome_pack::get_accessions() const -> std::vector<std::string> {
+  std::vector<std::string> accessions;
+  accessions.reserve(std::size(directory));
+  for (const auto &acc_entry : directory)
+    accessions.push_back(acc_entry.first);
+  std::ranges::sort(accessions);
+  return accessions;
+}
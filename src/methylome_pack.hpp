@@ -0,0 +1,163 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_METHYLOME_PACK_HPP_
+#define SRC_METHYLOME_PACK_HPP_
+
+#include <cstdint>  // for std::uint32_t, std::uint64_t
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>  // for std::true_type
+#include <unordered_map>
+#include <utility>  // for std::to_underlying, std::unreachable
+#include <variant>  // for std::tuple
+#include <vector>
+
+enum class methylome_pack_error : std::uint32_t {
+  ok = 0,
+  error_reading_pack = 1,
+  error_writing_pack = 2,
+  invalid_pack_header = 3,
+  invalid_pack_directory = 4,
+  accession_not_in_pack = 5,
+  accession_already_in_pack = 6,
+  inconsistent_methylome_size = 7,
+};
+
+// register methylome_pack_error as error code enum
+template <>
+struct std::is_error_code_enum<methylome_pack_error> : public std::true_type {};
+
+// category to provide text descriptions
+struct methylome_pack_error_category : std::error_category {
+  auto
+  name() const noexcept -> const char * override {
+    return "methylome_pack_error";
+  }
+  auto
+  message(int code) const -> std::string override {
+    using std::string_literals::operator""s;
+    // clang-format off
+    switch (code) {
+    case 0: return "ok"s;
+    case 1: return "error reading pack"s;
+    case 2: return "error writing pack"s;
+    case 3: return "invalid pack header"s;
+    case 4: return "invalid pack directory"s;
+    case 5: return "accession not in pack"s;
+    case 6: return "accession already in pack"s;
+    case 7: return "methylome size inconsistent with metadata"s;
+    }
+    // clang-format on
+    std::unreachable();  // hopefully this is unreacheable
+  }
+};
+
+inline auto
+make_error_code(methylome_pack_error e) -> std::error_code {
+  static auto category = methylome_pack_error_category{};
+  return std::error_code(std::to_underlying(e), category);
+}
+
+struct methylome;
+struct methylome_metadata;
+
+/*
+  methylome_pack: many methylomes with their metadata in one file. The
+  file starts with a fixed size header giving the location of a
+  directory, which is at the end of the file so more methylomes can be
+  appended. Each directory entry has an accession and the location of
+  the metadata json and the methylome data, stored exactly as they
+  would be in separate files. A pack is opened once and methylomes are
+  read with positioned reads, so no directory lookups or extra opens
+  are needed to load a methylome.
+ */
+struct methylome_pack {
+  static constexpr auto filename_extension{".mpk"};
+  static constexpr char magic[8] = {'x', 'f', 'r', 'p', 'a', 'c', 'k', '1'};
+
+  struct entry {
+    std::uint64_t meta_offset{};
+    std::uint64_t meta_size{};
+    std::uint64_t data_offset{};
+    std::uint64_t data_size{};
+  };
+
+  // one input to append to a pack
+  struct source {
+    std::string accession;
+    std::string methylome_file;
+    std::string metadata_file;
+  };
+
+  methylome_pack() = default;
+  methylome_pack(const methylome_pack &) = delete;
+  methylome_pack &
+  operator=(const methylome_pack &) = delete;
+  methylome_pack(methylome_pack &&other) noexcept;
+  methylome_pack &
+  operator=(methylome_pack &&other) noexcept;
+  ~methylome_pack();
+
+  // open a pack and read its directory; the pack stays open
+  [[nodiscard]] static auto
+  open(const std::string &filename)
+    -> std::tuple<methylome_pack, std::error_code>;
+
+  // create the pack if it does not exist, otherwise append to it; new
+  // methylomes and the directory are written at the end and the header
+  // is replaced last, so a failed append leaves the pack as it was
+  [[nodiscard]] static auto
+  append(const std::string &filename,
+         const std::vector<source> &sources) -> std::error_code;
+
+  [[nodiscard]] auto
+  contains(const std::string &accession) const -> bool {
+    return directory.contains(accession);
+  }
+
+  [[nodiscard]] auto
+  read(const std::string &accession) const
+    -> std::tuple<methylome, methylome_metadata, std::error_code>;
+
+  [[nodiscard]] auto
+  read_metadata(const std::string &accession) const
+    -> std::tuple<methylome_metadata, std::error_code>;
+
+  // cpgs [first, first + n) of one methylome; see methylome::read_slice
+  [[nodiscard]] auto
+  read_slice(const std::string &accession, const methylome_metadata &meta,
+             const std::uint32_t first, const std::uint32_t n) const
+    -> std::tuple<methylome, std::error_code>;
+
+  [[nodiscard]] auto
+  get_accessions() const -> std::vector<std::string>;
+
+  std::string filename;
+  int fd{-1};
+  std::uint64_t directory_offset{};
+  std::unordered_map<std::string, entry> directory;
+};
+
+#endif  // SRC_METHYLOME_PACK_HPP_
@@ -24,6 +24,7 @@
 #ifndef SRC_METHYLOME_RESULTS_TYPES_HPP_
 #define SRC_METHYLOME_RESULTS_TYPES_HPP_
 
+#include <algorithm>  // for std::max
 #include <cstdint>
 #include <format>
 #include <string>
@@ -39,6 +40,39 @@ struct counts_res_cov {
   std::uint32_t n_covered{};
 };
 
+// ADS: the level at a site is n_meth / (n_meth + n_unmeth) for covered
+// sites only; the sums of levels and squared levels give the mean and
+// variance of levels over covered sites, which cannot be recovered
+// from the summed counts
+struct counts_res_ext {
+  std::uint32_t n_meth{};
+  std::uint32_t n_unmeth{};
+  std::uint32_t n_covered{};
+  std::uint32_t n_sites{};
+  double sum_levels{};
+  double sum_sq_levels{};
+};
+
+[[nodiscard]] inline auto
+get_mean_level(const counts_res_ext &cr) -> double {
+  return cr.n_covered == 0 ? 0.0 : cr.sum_levels / cr.n_covered;
+}
+
+[[nodiscard]] inline auto
+get_level_variance(const counts_res_ext &cr) -> double {
+  if (cr.n_covered == 0)
+    return 0.0;
+  const auto mean = cr.sum_levels / cr.n_covered;
+  // ADS: rounding can make this slightly negative when all levels agree
+  return std::max(0.0, cr.sum_sq_levels / cr.n_covered - mean * mean);
+}
+
+[[nodiscard]] inline auto
+get_covered_fraction(const counts_res_ext &cr) -> double {
+  return cr.n_sites == 0 ? 0.0
+                         : static_cast<double>(cr.n_covered) / cr.n_sites;
+}
+
 template <> struct std::formatter<counts_res> : std::formatter<std::string> {
   auto
   format(const counts_res &cr, std::format_context &ctx) const {
@@ -57,4 +91,17 @@ struct std::formatter<counts_res_cov> : std::formatter<std::string> {
   }
 };
 
+template <>
+struct std::formatter<counts_res_ext> : std::formatter<std::string> {
+  auto
+  format(const counts_res_ext &cr, std::format_context &ctx) const {
+    return std::format_to(ctx.out(),
+                          R"({{"n_meth": {}, "n_unmeth": {}, "n_covered": {}, )"
+                          R"("n_sites": {}, "sum_levels": {}, )"
+                          R"("sum_sq_levels": {}}})",
+                          cr.n_meth, cr.n_unmeth, cr.n_covered, cr.n_sites,
+                          cr.sum_levels, cr.sum_sq_levels);
+  }
+};
+
 #endif  // SRC_METHYLOME_RESULTS_TYPES_HPP_
@@ -23,106 +23,460 @@
 
 #include "methylome_set.hpp"
 
+#include "logger.hpp"
 #include "methylome.hpp"
 #include "methylome_metadata.hpp"
 #include "xfrase_error.hpp"  // for make_error_code, methylome_set_code
 
+#include <algorithm>  // for std::ranges::sort
+#include <cstdint>
 #include <filesystem>
 #include <format>
+#include <iterator>  // for std::size
 #include <memory>  // for std::shared_ptr, std::make_shared
 #include <mutex>   // for std::scoped_lock
 #include <regex>
 #include <string>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>  // for std::move, std::pair
+#include <vector>
 
 [[nodiscard]] static auto
 is_valid_accession(const std::string &accession) -> bool {
   static constexpr auto experiment_ptrn = R"(^(D|E|S)RX\d+$)";
-  std::regex experiment_re(experiment_ptrn);
+  // ADS: compiled once; matching with a const regex is thread safe
+  static const std::regex experiment_re(experiment_ptrn);
   return std::regex_search(accession, experiment_re);
 }
 
+[[nodiscard]] static inline auto
+get_methylome_filename(const std::string &directory,
+                       const std::string &accession) -> std::string {
+  return std::format("{}/{}{}", directory, accession,
+                     methylome::filename_extension);
+}
+
+[[nodiscard]] static inline auto
+get_metadata_filename(const std::string &directory,
+                      const std::string &accession) -> std::string {
+  return std::format("{}/{}{}", directory, accession,
+                     methylome_metadata::filename_extension);
+}
+
+// ADS: after a read fails with read_err, find whether a file was
+// missing; only a file without a v2 header needs its JSON metadata,
+// and for a v2 file the error from its header or counts is kept
+[[nodiscard]] static auto
+get_read_error(const bool in_pack, const std::error_code read_err,
+               const std::string &methylome_filename,
+               const std::string &metadata_filename) -> std::error_code {
+  if (in_pack)
+    return methylome_set_code::error_reading_methylome_file;
+  if (!std::filesystem::exists(methylome_filename))
+    return methylome_set_code::methylome_file_not_found;
+  const auto [hdr_meta, hdr_err] =
+    methylome::read_v2_metadata(methylome_filename);
+  if (hdr_err != methylome_code::methylome_file_without_header)
+    return hdr_err ? hdr_err : read_err;
+  if (!std::filesystem::exists(metadata_filename))
+    return methylome_set_code::methylome_metadata_file_not_found;
+  return methylome_set_code::error_reading_methylome_file;
+}
+
+// ADS: a chrom of a methylome is cached under a key that cannot be an
+// accession, so both share the same tiers
+[[nodiscard]] static inline auto
+get_chrom_key(const std::string &accession,
+              const std::int32_t ch_id) -> std::string {
+  return std::format("{}:{}", accession, ch_id);
+}
+
+auto
+methylome_set::evict_hot(const std::string &key,
+                         std::vector<evicted_methylome> &evicted) -> void {
+  const auto meth_itr = accession_to_methylome.find(key);
+  const auto meta_itr = accession_to_methylome_metadata.find(key);
+  hot_order.erase(key);
+  if (meth_itr == std::cend(accession_to_methylome) ||
+      meta_itr == std::cend(accession_to_methylome_metadata))
+    return;
+  // ADS: requests in progress keep their own shared_ptr
+  auto meth = std::move(meth_itr->second);
+  auto meta = std::move(meta_itr->second);
+  accession_to_methylome.erase(meth_itr);
+  accession_to_methylome_metadata.erase(meta_itr);
+  hot_bytes -= meth->get_n_bytes();
+  if (max_warm_bytes > 0)
+    evicted.emplace_back(key, std::move(meth), std::move(meta));
+}
+
+auto
+methylome_set::make_warm(std::vector<evicted_methylome> evicted) -> void {
+  // ADS: compressing takes the most time, so it is done before taking
+  // the mutex, and the mutex is only held to update the warm tier
+  std::vector<std::tuple<std::string, warm_methylome>> to_insert;
+  for (auto &e : evicted) {
+    const std::uint32_t n_cpgs = e.meth->get_n_cpgs();
+    warm_methylome w{{}, std::move(e.meta), n_cpgs};
+    // ADS: counts that are stored with 8 bits are also 8 bits in the
+    // hot tier, which halves the warm bytes before compression
+    if (e.meth->get_compressed(w.meta->count_width, w.data))
+      continue;  // ADS: not keeping it warm is not an error
+    if (std::size(w.data) > max_warm_bytes)
+      continue;
+    to_insert.emplace_back(std::move(e.key), std::move(w));
+  }
+  if (std::empty(to_insert))
+    return;
+
+  std::scoped_lock lock{mtx};
+  for (auto &[key, w] : to_insert) {
+    // ADS: while the mutex was released the methylome might have been
+    // loaded again, and then the hot copy is the one to keep
+    if (accession_to_methylome.contains(key) ||
+        accession_to_warm.contains(key))
+      continue;
+    const std::uint64_t n_bytes = std::size(w.data);
+    while (warm_bytes + n_bytes > max_warm_bytes && !warm_order.empty()) {
+      const auto oldest = warm_order.oldest();
+      const auto warm_itr = accession_to_warm.find(oldest);
+      if (warm_itr != std::cend(accession_to_warm)) {
+        warm_bytes -= std::size(warm_itr->second.data);
+        accession_to_warm.erase(warm_itr);
+      }
+      warm_order.erase(oldest);
+    }
+    warm_bytes += n_bytes;
+    accession_to_warm.emplace(key, std::move(w));
+    warm_order.touch(key);
+  }
+}
+
 [[nodiscard]] auto
-methylome_set::get_methylome(const std::string &accession)
+methylome_set::take_warm(const std::string &key) -> warm_methylome {
+  const auto warm_itr = accession_to_warm.find(key);
+  if (warm_itr == std::cend(accession_to_warm))
+    return {};
+  auto w = std::move(warm_itr->second);
+  accession_to_warm.erase(warm_itr);
+  warm_order.erase(key);
+  warm_bytes -= std::size(w.data);
+  return w;
+}
+
+[[nodiscard]] auto
+methylome_set::from_warm(warm_methylome w)
+  -> std::tuple<std::shared_ptr<methylome>, std::shared_ptr<methylome_metadata>,
+                std::error_code> {
+  auto meth = std::make_shared<methylome>();
+  // ADS: 8-bit counts go straight back to 8 bits in the hot tier
+  const auto decompress_err = [&] {
+    if (w.meta->count_width != 8) {
+      meth->cpgs.resize(w.n_cpgs);
+      return methylome::decompress_counts(w.meta->count_width, w.data,
+                                          meth->cpgs);
+    }
+    meth->cpgs8.resize(w.n_cpgs);
+    return methylome::decompress_counts(w.data, meth->cpgs8);
+  }();
+  if (decompress_err)
+    return {nullptr, nullptr, methylome_set_code::error_reading_methylome_file};
+  // ADS: blocks are verified again after decompressing from memory,
+  // except for a chrom, which was verified when it was read
+  if (w.n_cpgs == w.meta->n_cpgs && meth->init_block_status(*w.meta))
+    return {nullptr, nullptr, methylome_set_code::error_reading_methylome_file};
+  return {std::move(meth), std::move(w.meta), methylome_set_code::ok};
+}
+
+auto
+methylome_set::make_hot(const std::string &key,
+                        std::shared_ptr<methylome> meth,
+                        std::shared_ptr<methylome_metadata> meta,
+                        std::vector<evicted_methylome> &evicted)
+  -> std::error_code {
+  const auto n_bytes = meth->get_n_bytes();
+  while (!hot_order.empty() &&
+         (hot_order.size() >= max_live_methylomes ||
+          (max_hot_bytes > 0 && hot_bytes + n_bytes > max_hot_bytes))) {
+    // ADS: a copy, since evicting erases the key from hot_order
+    const auto oldest = hot_order.oldest();
+    evict_hot(oldest, evicted);
+  }
+
+  const bool meth_inserted =
+    accession_to_methylome.emplace(key, std::move(meth)).second;
+  const bool meta_inserted =
+    accession_to_methylome_metadata.emplace(key, std::move(meta)).second;
+  if (!meth_inserted || !meta_inserted)
+    return methylome_set_code::methylome_already_live;
+  hot_order.touch(key);
+  hot_bytes += n_bytes;
+  return methylome_set_code::ok;
+}
+
+[[nodiscard]] auto
+methylome_set::find_hot(const std::string &key)
+  -> std::tuple<std::shared_ptr<methylome>, std::shared_ptr<methylome_metadata>,
+                std::error_code> {
+  const auto meth_itr = accession_to_methylome.find(key);
+  const auto meta_itr = accession_to_methylome_metadata.find(key);
+  if (meth_itr != std::cend(accession_to_methylome) &&
+      meta_itr != std::cend(accession_to_methylome_metadata)) {
+    hot_order.touch(key);
+    return {meth_itr->second, meta_itr->second, methylome_set_code::ok};
+  }
+  if (meth_itr != std::cend(accession_to_methylome) ||
+      meta_itr != std::cend(accession_to_methylome_metadata))
+    return {nullptr, nullptr, methylome_set_code::methylome_already_live};
+  return {nullptr, nullptr, methylome_set_code::ok};
+}
+
+[[nodiscard]] auto
+methylome_set::publish(const std::string &key, std::shared_ptr<methylome> meth,
+                       std::shared_ptr<methylome_metadata> meta)
   -> std::tuple<std::shared_ptr<methylome>, std::shared_ptr<methylome_metadata>,
                 std::error_code> {
-  static constexpr auto filename_format = "{}/{}{}";
+  // ADS: counts stored with 8 bits are kept with 8 bits while hot, so
+  // they take half the bytes against max_hot_bytes
+  meth->narrow(meta->count_width);
+  std::vector<evicted_methylome> evicted;
+  {
+    std::scoped_lock lock{mtx};
+    // ADS: another request may have loaded the same methylome while
+    // the mutex was released, and the first one published is used
+    if (auto [hot_meth, hot_meta, hot_err] = find_hot(key); hot_meth || hot_err)
+      return {std::move(hot_meth), std::move(hot_meta), hot_err};
+    if (const auto hot_err = make_hot(key, meth, meta, evicted))
+      return {nullptr, nullptr, hot_err};
+  }
+  make_warm(std::move(evicted));
+  return {std::move(meth), std::move(meta), methylome_set_code::ok};
+}
 
+[[nodiscard]] auto
+methylome_set::get_methylome(const std::string &accession)
+  -> std::tuple<std::shared_ptr<methylome>, std::shared_ptr<methylome_metadata>,
+                std::error_code> {
   if (!is_valid_accession(accession))
     return {nullptr, nullptr, methylome_set_code::invalid_accession};
 
-  // clang-format off
-  std::unordered_map<std::string, std::shared_ptr<methylome>>::const_iterator meth{};
-  std::unordered_map<std::string, std::shared_ptr<methylome_metadata>>::const_iterator meta{};
-  // clang-format on
+  warm_methylome w;
+  const methylome_pack *pack{};
+  {
+    std::scoped_lock lock{mtx};
+    auto [meth, meta, hot_err] = find_hot(accession);
+    if (meth || hot_err)
+      return {std::move(meth), std::move(meta), hot_err};
+    w = take_warm(accession);
+    // ADS: accessions in a pack are read from the already open pack;
+    // packs are only opened before any requests
+    if (const auto pack_itr = accession_to_pack.find(accession);
+        pack_itr != std::cend(accession_to_pack))
+      pack = &packs[pack_itr->second];
+  }
+
+  // ADS: the methylome is decompressed from the warm tier or read
+  // from disk without holding the mutex
+  if (w.meta != nullptr) {
+    auto [meth, meta, warm_err] = from_warm(std::move(w));
+    if (warm_err)
+      return {nullptr, nullptr, warm_err};
+    return publish(accession, std::move(meth), std::move(meta));
+  }
+
+  const auto methylome_filename =
+    get_methylome_filename(methylome_directory, accession);
+  const auto metadata_filename =
+    get_metadata_filename(methylome_directory, accession);
+
+  // ADS: a v2 methylome file is opened once and its header is all
+  // the metadata needed; files are only checked for after a failure
+  auto [m, mm, ec] = pack != nullptr
+                       ? pack->read(accession)
+                       : read_methylome(methylome_filename, metadata_filename);
+  if (ec)
+    return {nullptr, nullptr,
+            get_read_error(pack != nullptr, ec, methylome_filename,
+                           metadata_filename)};
+  return publish(accession, std::make_shared<methylome>(std::move(m)),
+                 std::make_shared<methylome_metadata>(std::move(mm)));
+}
+
+[[nodiscard]] auto
+methylome_set::get_metadata_locked(const std::string &accession)
+  -> std::tuple<std::shared_ptr<methylome_metadata>, std::error_code> {
+  if (const auto itr = accession_to_metadata.find(accession);
+      itr != std::cend(accession_to_metadata)) {
+    metadata_order.touch(accession);
+    return {itr->second, methylome_set_code::ok};
+  }
+  if (const auto itr = accession_to_methylome_metadata.find(accession);
+      itr != std::cend(accession_to_methylome_metadata))
+    return {itr->second, methylome_set_code::ok};
+
+  const auto pack_itr = accession_to_pack.find(accession);
+  const bool in_pack = pack_itr != std::cend(accession_to_pack);
+  const auto methylome_filename =
+    get_methylome_filename(methylome_directory, accession);
+  const auto metadata_filename =
+    get_metadata_filename(methylome_directory, accession);
+  auto [mm, meta_err] =
+    in_pack ? packs[pack_itr->second].read_metadata(accession)
+            : methylome::read_v2_metadata(methylome_filename);
+  // ADS: a v1 methylome file has its metadata only in the JSON file
+  if (!in_pack && meta_err == methylome_code::methylome_file_without_header)
+    std::tie(mm, meta_err) = methylome_metadata::read(metadata_filename);
+  if (meta_err)
+    return {nullptr,
+            get_read_error(in_pack, meta_err, methylome_filename,
+                           metadata_filename)};
+  auto meta = std::make_shared<methylome_metadata>(std::move(mm));
+  while (metadata_order.size() >= max_metadata) {
+    // ADS: a copy, since erasing from metadata_order frees the key
+    const auto oldest = metadata_order.oldest();
+    accession_to_metadata.erase(oldest);
+    metadata_order.erase(oldest);
+  }
+  accession_to_metadata.emplace(accession, meta);
+  metadata_order.touch(accession);
+  return {std::move(meta), methylome_set_code::ok};
+}
 
+[[nodiscard]] auto
+methylome_set::get_methylome_metadata(const std::string &accession)
+  -> std::tuple<std::shared_ptr<methylome_metadata>, std::error_code> {
+  if (!is_valid_accession(accession))
+    return {nullptr, methylome_set_code::invalid_accession};
   std::scoped_lock lock{mtx};
+  return get_metadata_locked(accession);
+}
 
-  // check if methylome is loaded
-  const auto meth_itr = accession_to_methylome.find(accession);
-  const auto meta_itr = accession_to_methylome_metadata.find(accession);
-  if (meth_itr == std::cend(accession_to_methylome) &&
-      meta_itr == std::cend(accession_to_methylome_metadata)) {
-    const auto methylome_filename =
-      std::format(filename_format, methylome_directory, accession,
-                  methylome::filename_extension);
-    if (!std::filesystem::exists(methylome_filename))
-      return {nullptr, nullptr, methylome_set_code::methylome_file_not_found};
-
-    const auto metadata_filename =
-      std::format(filename_format, methylome_directory, accession,
-                  methylome_metadata::filename_extension);
-    if (!std::filesystem::exists(metadata_filename))
-      return {nullptr, nullptr,
-              methylome_set_code::methylome_metadata_file_not_found};
-
-    const std::string to_eject = accessions.push(accession);
-    if (!to_eject.empty()) {
-      const auto to_eject_meth_itr = accession_to_methylome.find(to_eject);
-      const auto to_eject_meta_itr =
-        accession_to_methylome_metadata.find(to_eject);
-      if (to_eject_meth_itr == std::cend(accession_to_methylome) ||
-          to_eject_meta_itr == std::cend(accession_to_methylome_metadata))
-        return {nullptr, nullptr,
-                methylome_set_code::error_updating_live_methylomes};
-
-      accession_to_methylome.erase(to_eject_meth_itr);
-      accession_to_methylome_metadata.erase(to_eject_meta_itr);
-    }
+[[nodiscard]] auto
+methylome_set::get_methylome_chrom(const std::string &accession,
+                                   const std::int32_t ch_id,
+                                   const std::uint32_t chrom_first,
+                                   const std::uint32_t chrom_n)
+  -> std::tuple<std::shared_ptr<methylome>, std::shared_ptr<methylome_metadata>,
+                std::uint32_t, std::error_code> {
+  if (!is_valid_accession(accession))
+    return {nullptr, nullptr, 0, methylome_set_code::invalid_accession};
+  const auto key = get_chrom_key(accession, ch_id);
 
-    const auto [mm, meta_ec] = methylome_metadata::read(metadata_filename);
-    if (meta_ec)
-      return {nullptr, nullptr,
+  // ADS: a whole methylome serves the chrom where it is, so the chrom
+  // is never held a second time as a copy
+  const auto from_whole = [&](std::shared_ptr<methylome> whole,
+                              std::shared_ptr<methylome_metadata> whole_meta)
+    -> std::tuple<std::shared_ptr<methylome>,
+                  std::shared_ptr<methylome_metadata>, std::uint32_t,
+                  std::error_code> {
+    if (static_cast<std::uint64_t>(chrom_first) + chrom_n >
+          whole->get_n_cpgs() ||
+        whole->verify_blocks(chrom_first, chrom_first + chrom_n))
+      return {nullptr, nullptr, 0,
               methylome_set_code::error_reading_methylome_file};
+    return {std::move(whole), std::move(whole_meta), 0,
+            methylome_set_code::ok};
+  };
 
-    // ADS: get an error code from methylome::read and use it
-    const auto [m, ec] = methylome::read(methylome_filename, mm);
-    if (ec)
-      return {nullptr, nullptr,
-              methylome_set_code::error_reading_methylome_file};
+  std::unique_lock lock{mtx};
+
+  if (auto [meth, meta, hot_err] = find_hot(key); meth || hot_err)
+    return {std::move(meth), std::move(meta), chrom_first, hot_err};
 
-    bool insertion_happened{false};
-    std::tie(meth, insertion_happened) = accession_to_methylome.emplace(
-      accession, std::make_shared<methylome>(std::move(m)));
-    if (!insertion_happened)
-      return {nullptr, nullptr, methylome_set_code::methylome_already_live};
-
-    std::tie(meta, insertion_happened) =
-      accession_to_methylome_metadata.emplace(
-        accession, std::make_shared<methylome_metadata>(std::move(mm)));
-    if (!insertion_happened)
-      return {nullptr, nullptr, methylome_set_code::methylome_already_live};
+  if (auto [meth, meta, hot_err] = find_hot(accession); meth || hot_err) {
+    lock.unlock();
+    if (hot_err)
+      return {nullptr, nullptr, 0, hot_err};
+    return from_whole(std::move(meth), std::move(meta));
   }
-  else if (meth_itr == std::cend(accession_to_methylome) ||
-           meta_itr == std::cend(accession_to_methylome_metadata)) {
-    return {nullptr, nullptr, methylome_set_code::methylome_already_live};
+
+  if (auto w = take_warm(key); w.meta != nullptr) {
+    lock.unlock();
+    auto [meth, meta, warm_err] = from_warm(std::move(w));
+    if (warm_err)
+      return {nullptr, nullptr, 0, warm_err};
+    auto [hot_meth, hot_meta, hot_err] =
+      publish(key, std::move(meth), std::move(meta));
+    return {std::move(hot_meth), std::move(hot_meta), chrom_first, hot_err};
   }
-  else {
-    meth = meth_itr;  // already loaded
-    meta = meta_itr;
+
+  auto [meta, meta_err] = get_metadata_locked(accession);
+  if (meta_err)
+    return {nullptr, nullptr, 0, meta_err};
+  const methylome_pack *pack{};
+  if (const auto pack_itr = accession_to_pack.find(accession);
+      pack_itr != std::cend(accession_to_pack))
+    pack = &packs[pack_itr->second];
+  lock.unlock();
+
+  // ADS: a compressed methylome can only be decompressed whole, so it
+  // is loaded whole into the hot tier and each chrom is served from
+  // there, rather than decompressing it again for every chrom
+  if (meta->is_compressed) {
+    auto [whole, whole_meta, whole_err] = get_methylome(accession);
+    if (whole_err)
+      return {nullptr, nullptr, 0, whole_err};
+    return from_whole(std::move(whole), std::move(whole_meta));
   }
 
-  return {meth->second, meta->second, methylome_set_code::ok};
+  auto [m, slice_err] =
+    pack != nullptr
+      ? pack->read_slice(accession, *meta, chrom_first, chrom_n)
+      : methylome::read_slice(
+          get_methylome_filename(methylome_directory, accession), *meta,
+          chrom_first, chrom_n);
+  if (slice_err)
+    return {nullptr, nullptr, 0,
+            methylome_set_code::error_reading_methylome_file};
+  auto [hot_meth, hot_meta, hot_err] = publish(
+    key, std::make_shared<methylome>(std::move(m)), std::move(meta));
+  return {std::move(hot_meth), std::move(hot_meta), chrom_first, hot_err};
+}
+
+[[nodiscard]] auto
+methylome_set::get_resident_accessions() -> std::vector<std::string> {
+  std::scoped_lock lock{mtx};
+  // ADS: a chrom counts as its whole methylome, once, where it is
+  // first found
+  std::vector<std::string> accessions;
+  std::unordered_set<std::string> seen;
+  for (const auto *order : {&hot_order.order, &warm_order.order})
+    for (const auto &key : *order)
+      if (auto accession = key.substr(0, key.find(':'));
+          seen.insert(accession).second)
+        accessions.push_back(std::move(accession));
+  return accessions;
+}
+
+[[nodiscard]] auto
+methylome_set::open_packs() -> std::error_code {
+  std::error_code ec;
+  std::vector<std::string> pack_files;
+  for (const auto &dir_entry :
+       std::filesystem::directory_iterator(methylome_directory, ec))
+    if (dir_entry.path().extension() == methylome_pack::filename_extension)
+      pack_files.push_back(dir_entry.path().string());
+  if (ec)
+    return ec;
+  // ADS: if an accession is in more than one pack, the first pack in
+  // sorted order is used
+  std::ranges::sort(pack_files);
+
+  std::scoped_lock lock{mtx};
+  for (const auto &pack_file : pack_files) {
+    // ADS: a bad pack only makes its own methylomes unavailable
+    auto [pack, pack_err] = methylome_pack::open(pack_file);
+    if (pack_err) {
+      logger::instance().warning("Skipping methylome pack {}: {}", pack_file,
+                                 pack_err);
+      continue;
+    }
+    const std::uint32_t pack_id = std::size(packs);
+    for (const auto &acc_entry : pack.directory)
+      accession_to_pack.emplace(acc_entry.first, pack_id);
+    packs.push_back(std::move(pack));
+  }
+  return {};
 }
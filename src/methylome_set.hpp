@@ -26,13 +26,14 @@
 
 #include "methylome.hpp"
 #include "methylome_metadata.hpp"
+#include "methylome_pack.hpp"
 
 #include <algorithm>
 #include <cstdint>  // std::uint32_t
 #include <cstdlib>  // std::size_t
-#include <initializer_list>
-#include <iterator>  // std::begin
-#include <memory>    // std::shared_ptr, std::swap
+#include <iterator>  // std::begin, std::size
+#include <list>
+#include <memory>  // std::shared_ptr
 #include <mutex>
 #include <string>
 #include <system_error>
@@ -42,64 +43,179 @@
 #include <variant>
 #include <vector>
 
-template <typename T> struct ring_buffer {
-  // support queue ops and be iterable
-  explicit ring_buffer(const std::size_t capacity) :
-    capacity{capacity}, counter{0}, buf{capacity} {}
+// least recently used order of accessions
+struct lru_order {
+  // make accession the most recently used, adding it if not present
   auto
-  push(T t) -> T {
-    std::swap(buf[counter++ % capacity], t);
-    return t;
+  touch(const std::string &accession) -> void {
+    const auto pos_itr = pos.find(accession);
+    if (pos_itr != std::cend(pos))
+      order.splice(std::begin(order), order, pos_itr->second);
+    else {
+      order.push_front(accession);
+      pos.emplace(accession, std::begin(order));
+    }
+  }
+  auto
+  erase(const std::string &accession) -> void {
+    const auto pos_itr = pos.find(accession);
+    if (pos_itr == std::cend(pos))
+      return;
+    order.erase(pos_itr->second);
+    pos.erase(pos_itr);
   }
   // clang-format off
   [[nodiscard]] auto
-  size() const {return counter < capacity ? counter : capacity;}
-  [[nodiscard]] auto
-  front() const {return buf[counter < capacity ? 0 : (counter + 1) % capacity];}
-  [[nodiscard]] auto
-  begin() {return std::begin(buf);}
-  [[nodiscard]] auto
-  begin() const {return std::cbegin(buf);}
+  oldest() const -> const std::string & {return order.back();}
   [[nodiscard]] auto
-  end() {return std::begin(buf) + std::min(counter, capacity);}
+  empty() const -> bool {return order.empty();}
   [[nodiscard]] auto
-  end() const {return std::cbegin(buf) + std::min(counter, capacity);}
+  size() const -> std::size_t {return std::size(order);}
   // clang-format on
 
-  // ADS: just use capacity inside the vector?
-  // ADS: use boost circular buffer?
-  std::size_t capacity{};
-  std::size_t counter{};
-  std::vector<T> buf;
+  std::list<std::string> order;
+  std::unordered_map<std::string, std::list<std::string>::iterator> pos;
 };
 
+/*
+  methylome_set: methylomes are kept in two tiers. Hot methylomes are
+  ready for queries. When a hot methylome is evicted it is compressed
+  and kept in the warm tier, if there is one, so a later request only
+  pays for decompression and not for reading from disk. Each tier is
+  evicted in least recently used order to fit a byte budget; the hot
+  tier also has a limit on the number of methylomes. Methylomes can
+  also be cached one chrom at a time, keyed by accession and chrom, so
+  memory goes to the chroms that are queried; such slices are evicted
+  and kept warm the same way as whole methylomes. The mutex is not held
+  while methylomes are compressed or decompressed, so if two requests
+  load the same methylome at once, the first one published is kept.
+ */
 struct methylome_set {
   methylome_set(const methylome_set &) = delete;
   methylome_set &
   operator=(const methylome_set &) = delete;
 
   methylome_set(const std::uint32_t max_live_methylomes,
-                const std::string &methylome_directory) :
+                const std::string &methylome_directory,
+                const std::uint64_t max_hot_bytes = 0,
+                const std::uint64_t max_warm_bytes = 0,
+                const bool chrom_granular = false) :
     max_live_methylomes{max_live_methylomes},
-    methylome_directory{methylome_directory}, accessions{max_live_methylomes} {}
+    methylome_directory{methylome_directory}, max_hot_bytes{max_hot_bytes},
+    max_warm_bytes{max_warm_bytes}, chrom_granular{chrom_granular} {}
 
   [[nodiscard]] auto
   get_methylome(const std::string &accession)
     -> std::tuple<std::shared_ptr<methylome>,
                   std::shared_ptr<methylome_metadata>, std::error_code>;
 
+  // metadata alone, without loading the methylome
+  [[nodiscard]] auto
+  get_methylome_metadata(const std::string &accession)
+    -> std::tuple<std::shared_ptr<methylome_metadata>, std::error_code>;
+
+  // cpgs [chrom_first, chrom_first + chrom_n) of a methylome, which
+  // are those of chrom ch_id, cached apart from other chroms; a hot
+  // whole methylome is returned as it is, and for a compressed one
+  // the whole methylome is made hot. The index in the whole methylome
+  // of the first cpg held by the returned methylome is also returned.
+  [[nodiscard]] auto
+  get_methylome_chrom(const std::string &accession, const std::int32_t ch_id,
+                      const std::uint32_t chrom_first,
+                      const std::uint32_t chrom_n)
+    -> std::tuple<std::shared_ptr<methylome>,
+                  std::shared_ptr<methylome_metadata>, std::uint32_t,
+                  std::error_code>;
+
+  // accessions of hot then warm methylomes, each most recently used
+  // first; a server taking over from this one loads these
+  [[nodiscard]] auto
+  get_resident_accessions() -> std::vector<std::string>;
+
+  // open each pack in the methylome directory once, so methylomes in
+  // packs can be loaded without looking for files; packs that cannot
+  // be opened are logged and skipped
+  [[nodiscard]] auto
+  open_packs() -> std::error_code;
+
   static constexpr std::uint32_t default_max_live_methylomes{128};
+  static constexpr std::size_t max_metadata{16384};
+
+  struct warm_methylome {
+    std::vector<std::uint8_t> data;  // compressed methylome
+    std::shared_ptr<methylome_metadata> meta;
+    std::uint32_t n_cpgs{};  // fewer than meta->n_cpgs for a chrom
+  };
+
+  // a hot methylome evicted while the mutex is held, to be compressed
+  // into the warm tier once the mutex is released
+  struct evicted_methylome {
+    std::string key;
+    std::shared_ptr<methylome> meth;
+    std::shared_ptr<methylome_metadata> meta;
+  };
+
+  // these assume the mutex is held
+  auto
+  make_hot(const std::string &key, std::shared_ptr<methylome> meth,
+           std::shared_ptr<methylome_metadata> meta,
+           std::vector<evicted_methylome> &evicted) -> std::error_code;
+  auto
+  evict_hot(const std::string &key,
+            std::vector<evicted_methylome> &evicted) -> void;
+  // the meta of the result is null if key is not warm
+  [[nodiscard]] auto
+  take_warm(const std::string &key) -> warm_methylome;
+  [[nodiscard]] auto
+  find_hot(const std::string &key)
+    -> std::tuple<std::shared_ptr<methylome>,
+                  std::shared_ptr<methylome_metadata>, std::error_code>;
+  [[nodiscard]] auto
+  get_metadata_locked(const std::string &accession)
+    -> std::tuple<std::shared_ptr<methylome_metadata>, std::error_code>;
+
+  // these are called without the mutex held, so compressing and
+  // decompressing do not block requests for other methylomes; make_warm
+  // and publish take the mutex only to update the tiers
+  auto
+  make_warm(std::vector<evicted_methylome> evicted) -> void;
+  [[nodiscard]] static auto
+  from_warm(warm_methylome w)
+    -> std::tuple<std::shared_ptr<methylome>,
+                  std::shared_ptr<methylome_metadata>, std::error_code>;
+  [[nodiscard]] auto
+  publish(const std::string &key, std::shared_ptr<methylome> meth,
+          std::shared_ptr<methylome_metadata> meta)
+    -> std::tuple<std::shared_ptr<methylome>,
+                  std::shared_ptr<methylome_metadata>, std::error_code>;
 
   std::mutex mtx;
   std::uint32_t max_live_methylomes{};
   std::string methylome_directory;
+  std::uint64_t max_hot_bytes{};   // zero: only max_live_methylomes
+  std::uint64_t max_warm_bytes{};  // zero: no warm tier
+  bool chrom_granular{};  // intervals queries load only their chroms
+  std::uint64_t hot_bytes{};
+  std::uint64_t warm_bytes{};
 
-  ring_buffer<std::string> accessions;
-
+  lru_order hot_order;
   std::unordered_map<std::string, std::shared_ptr<methylome>>
     accession_to_methylome;
   std::unordered_map<std::string, std::shared_ptr<methylome_metadata>>
     accession_to_methylome_metadata;
+
+  lru_order warm_order;
+  std::unordered_map<std::string, warm_methylome> accession_to_warm;
+
+  // ADS: metadata is small, but with its block checksums not small
+  // enough to keep for every accession ever requested, so only the
+  // most recently used are kept
+  lru_order metadata_order;
+  std::unordered_map<std::string, std::shared_ptr<methylome_metadata>>
+    accession_to_metadata;
+
+  std::vector<methylome_pack> packs;
+  std::unordered_map<std::string, std::uint32_t> accession_to_pack;
 };
 
 #endif  // SRC_METHYLOME_SET_HPP_
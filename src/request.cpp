@@ -31,6 +31,7 @@
 #include <format>
 #include <ranges>  // IWYU pragma: keep
 #include <string>
+#include <utility>  // for std::cmp_greater
 
 [[nodiscard]] auto
 compose(char *first, [[maybe_unused]] char *last,
@@ -153,15 +154,27 @@ parse(const char *first, const char *last, request &req) -> parse_result {
 
 [[nodiscard]] auto
 bins_request::summary() const -> std::string {
-  return std::format(R"({{"bin_size": {}}})", bin_size);
+  std::string bin_sizes = std::format("{}", bin_size);
+  for (const auto b : more_bin_sizes)
+    bin_sizes += std::format(", {}", b);
+  return std::format(R"({{"bin_sizes": [{}], "n_regions": {}}})", bin_sizes,
+                     n_regions);
 }
 
 [[nodiscard]] auto
 compose(char *first, [[maybe_unused]] char *last,
         const bins_request &req) -> compose_result {
+  static constexpr auto delim = '\t';
+  static constexpr auto sizes_delim = ',';
   static constexpr auto term = '\n';
-  // ADS: use to_chars here
-  const std::string s = std::format("{}{}", req.bin_size, term);
+  // ADS: use to_chars here; with one bin size and without regions,
+  // this is the same as before either was possible
+  std::string s = std::format("{}", req.bin_size);
+  for (const auto bin_size : req.more_bin_sizes)
+    s += std::format("{}{}", sizes_delim, bin_size);
+  if (req.n_regions != 0)
+    s += std::format("{}{}", delim, req.n_regions);
+  s += term;
   assert(static_cast<std::iterator_traits<char *>::difference_type>(
            std::size(s)) < std::distance(first, last));
   // std::ranges::in_out_result::out
@@ -170,18 +183,212 @@ compose(char *first, [[maybe_unused]] char *last,
 
 [[nodiscard]] auto
 parse(const char *first, const char *last, bins_request &req) -> parse_result {
+  static constexpr auto delim = '\t';
+  static constexpr auto sizes_delim = ',';
   static constexpr auto term = '\n';
 
   auto cursor = first;
-  const auto [ptr, ec] = std::from_chars(cursor, last, req.bin_size);
-  if (ec != std::errc{})
-    return {ptr, request_error::bins_error_bin_size};
-  cursor = ptr;
+  {
+    const auto [ptr, ec] = std::from_chars(cursor, last, req.bin_size);
+    if (ec != std::errc{} || req.bin_size > max_bin_size)
+      return {ptr, request_error::bins_error_bin_size};
+    cursor = ptr;
+  }
+
+  // optional more bin sizes
+  req.more_bin_sizes.clear();
+  while (cursor != last && *cursor == sizes_delim) {
+    if (std::size(req.more_bin_sizes) + 1 >= bins_request::max_bin_sizes)
+      return {cursor, request_error::bins_error_n_bin_sizes};
+    ++cursor;
+    std::uint32_t bin_size{};
+    const auto [ptr, ec] = std::from_chars(cursor, last, bin_size);
+    if (ec != std::errc{} || bin_size > max_bin_size)
+      return {ptr, request_error::bins_error_bin_size};
+    req.more_bin_sizes.push_back(bin_size);
+    cursor = ptr;
+  }
+
+  // optional number of regions
+  req.n_regions = 0;
+  if (cursor != last && *cursor == delim) {
+    ++cursor;
+    const auto [ptr, ec] = std::from_chars(cursor, last, req.n_regions);
+    if (ec != std::errc{} || req.n_regions > max_n_regions)
+      return {ptr, request_error::bins_error_n_regions};
+    cursor = ptr;
+  }
 
   // check terminator
-  if (*cursor != term)
+  if (cursor == last || *cursor != term)
     return {cursor, request_error::bins_error_bin_size};
   ++cursor;
 
   return {cursor, request_error::ok};
 }
+
+// windows_request
+
+[[nodiscard]] auto
+windows_request::summary() const -> std::string {
+  return std::format(
+    R"({{"window_size": {}, "window_step": {}, "n_regions": {}}})",
+    window_size, window_step, n_regions);
+}
+
+[[nodiscard]] auto
+compose(char *first, [[maybe_unused]] char *last,
+        const windows_request &req) -> compose_result {
+  static constexpr auto delim = '\t';
+  static constexpr auto term = '\n';
+  const std::string s = std::format("{}{}{}{}{}{}", req.window_size, delim,
+                                    req.window_step, delim, req.n_regions, term);
+  assert(static_cast<std::iterator_traits<char *>::difference_type>(
+           std::size(s)) < std::distance(first, last));
+  return {std::ranges::copy(s, first).out, request_error::ok};
+}
+
+[[nodiscard]] auto
+parse(const char *first, const char *last,
+      windows_request &req) -> parse_result {
+  static constexpr auto delim = '\t';
+  static constexpr auto term = '\n';
+
+  auto cursor = first;
+  {
+    const auto [ptr, ec] = std::from_chars(cursor, last, req.window_size);
+    if (ec != std::errc{} || req.window_size > max_bin_size || ptr == last ||
+        *ptr != delim)
+      return {ptr, request_error::windows_error_window_size};
+    cursor = ptr + 1;
+  }
+  {
+    const auto [ptr, ec] = std::from_chars(cursor, last, req.window_step);
+    if (ec != std::errc{} || req.window_step > max_bin_size || ptr == last ||
+        *ptr != delim)
+      return {ptr, request_error::windows_error_window_step};
+    cursor = ptr + 1;
+  }
+  {
+    const auto [ptr, ec] = std::from_chars(cursor, last, req.n_regions);
+    if (ec != std::errc{} || req.n_regions > max_n_regions || ptr == last ||
+        *ptr != term)
+      return {ptr, request_error::windows_error_n_regions};
+    cursor = ptr + 1;
+  }
+  return {cursor, request_error::ok};
+}
+
+// named_request
+
+[[nodiscard]] auto
+named_request::summary() const -> std::string {
+  return std::format(
+    R"({{"set_name": "{}", "n_intervals": {}, "intervals_hash": {}}})",
+    set_name, n_intervals, intervals_hash);
+}
+
+[[nodiscard]] auto
+compose(char *first, [[maybe_unused]] char *last,
+        const named_request &req) -> compose_result {
+  static constexpr auto delim = '\t';
+  static constexpr auto term = '\n';
+  if (req.set_name.empty() ||
+      std::size(req.set_name) > named_request::max_set_name_size)
+    return {first, request_error::named_error_set_name};
+  const std::string s =
+    std::format("{}{}{}{}{}{}", req.set_name, delim, req.n_intervals, delim,
+                req.intervals_hash, term);
+  assert(static_cast<std::iterator_traits<char *>::difference_type>(
+           std::size(s)) < std::distance(first, last));
+  return {std::ranges::copy(s, first).out, request_error::ok};
+}
+
+[[nodiscard]] auto
+parse(const char *first, const char *last,
+      named_request &req) -> parse_result {
+  static constexpr auto delim = '\t';
+  static constexpr auto term = '\n';
+
+  const auto cursor = std::find(first, last, delim);
+  const auto name_size = std::distance(first, cursor);
+  if (cursor == last || name_size == 0 ||
+      std::cmp_greater(name_size, named_request::max_set_name_size))
+    return {cursor, request_error::named_error_set_name};
+  req.set_name = std::string(first, cursor);
+
+  const auto [ptr, ec] = std::from_chars(cursor + 1, last, req.n_intervals);
+  if (ec != std::errc{} || ptr == last || *ptr != delim)
+    return {ptr, request_error::named_error_n_intervals};
+  const auto [hash_ptr, hash_ec] =
+    std::from_chars(ptr + 1, last, req.intervals_hash);
+  if (hash_ec != std::errc{} || hash_ptr == last || *hash_ptr != term)
+    return {hash_ptr, request_error::named_error_intervals_hash};
+  return {hash_ptr + 1, request_error::ok};
+}
+
+// profile_request
+
+[[nodiscard]] auto
+profile_request::summary() const -> std::string {
+  return std::format(
+    R"({{"flank_size": {}, "n_flank_bins": {}, "n_body_bins": {}, )"
+    R"("n_anchors": {}, "set_name": "{}"}})",
+    flank_size, n_flank_bins, n_body_bins, n_anchors, set_name);
+}
+
+[[nodiscard]] auto
+compose(char *first, [[maybe_unused]] char *last,
+        const profile_request &req) -> compose_result {
+  static constexpr auto delim = '\t';
+  static constexpr auto term = '\n';
+  if (std::size(req.set_name) > named_request::max_set_name_size)
+    return {first, request_error::named_error_set_name};
+  std::string s = std::format("{}{}{}{}{}{}{}", req.flank_size, delim,
+                              req.n_flank_bins, delim, req.n_body_bins, delim,
+                              req.n_anchors);
+  if (!req.set_name.empty())
+    s += std::format("{}{}", delim, req.set_name);
+  s += term;
+  assert(static_cast<std::iterator_traits<char *>::difference_type>(
+           std::size(s)) < std::distance(first, last));
+  return {std::ranges::copy(s, first).out, request_error::ok};
+}
+
+[[nodiscard]] auto
+parse(const char *first, const char *last,
+      profile_request &req) -> parse_result {
+  static constexpr auto delim = '\t';
+  static constexpr auto term = '\n';
+
+  auto cursor = first;
+  for (auto field : {&req.flank_size, &req.n_flank_bins, &req.n_body_bins}) {
+    const auto [ptr, ec] = std::from_chars(cursor, last, *field);
+    if (ec != std::errc{} || ptr == last || *ptr != delim)
+      return {ptr, request_error::profile_error_bins};
+    cursor = ptr + 1;
+  }
+  {
+    const auto [ptr, ec] = std::from_chars(cursor, last, req.n_anchors);
+    if (ec != std::errc{})
+      return {ptr, request_error::profile_error_n_anchors};
+    cursor = ptr;
+  }
+
+  // optional name of a set of intervals on the server
+  req.set_name.clear();
+  if (cursor != last && *cursor == delim) {
+    ++cursor;
+    const auto name_end = std::find(cursor, last, term);
+    const auto name_size = std::distance(cursor, name_end);
+    if (name_size == 0 ||
+        std::cmp_greater(name_size, named_request::max_set_name_size))
+      return {name_end, request_error::named_error_set_name};
+    req.set_name = std::string(cursor, name_end);
+    cursor = name_end;
+  }
+
+  if (cursor == last || *cursor != term)
+    return {cursor, request_error::profile_error_n_anchors};
+  return {cursor + 1, request_error::ok};
+}
@@ -24,6 +24,7 @@
 #ifndef SRC_REQUEST_HPP_
 #define SRC_REQUEST_HPP_
 
+#include "genomic_interval.hpp"
 #include "utilities.hpp"     // for compose_result, parse_result
 #include "xfrase_error.hpp"  // IWYU pragma: keep
 
@@ -49,6 +50,20 @@ enum class request_error : std::uint32_t {
   bins_error_bin_size = 8,
   noref_error_chroms_n_bytes = 9,
   noref_error_n_intervals = 10,
+  bins_error_n_regions = 11,
+  bins_error_reading_regions = 12,
+  bins_error_regions = 13,
+  windows_error_window_size = 14,
+  windows_error_window_step = 15,
+  windows_error_n_regions = 16,
+  windows_error_reading_regions = 17,
+  named_error_set_name = 18,
+  named_error_n_intervals = 19,
+  bins_error_n_bin_sizes = 20,
+  profile_error_bins = 21,
+  profile_error_n_anchors = 22,
+  profile_error_reading_anchors = 23,
+  named_error_intervals_hash = 24,
 };
 
 // register request_error as error code enum
@@ -77,6 +92,20 @@ struct request_error_category : std::error_category {
     case 8: return "bins error bin size"s;
     case 9: return "noref error chroms_n_bytes"s;
     case 10: return "noref error n_intervals"s;
+    case 11: return "bins error n_regions"s;
+    case 12: return "bins error reading regions"s;
+    case 13: return "bins error regions"s;
+    case 14: return "windows error window size"s;
+    case 15: return "windows error window step"s;
+    case 16: return "windows error n_regions"s;
+    case 17: return "windows error reading regions"s;
+    case 18: return "named error set name"s;
+    case 19: return "named error n_intervals"s;
+    case 20: return "bins error number of bin sizes"s;
+    case 21: return "profile error flank or bins"s;
+    case 22: return "profile error n_anchors"s;
+    case 23: return "profile error reading anchors"s;
+    case 24: return "named error intervals hash"s;
     }
     // clang-format on
     std::unreachable();  // hopefully this is unreacheable
@@ -100,7 +129,18 @@ struct request_header {
     bin_counts_cov = 3,
     counts_noref = 4,
     counts_noref_cov = 5,
-    n_request_types = 6,
+    raw_counts = 6,
+    raw_counts_positions = 7,
+    window_counts = 8,
+    window_counts_cov = 9,
+    counts_ext = 10,
+    named_counts = 11,
+    named_counts_cov = 12,
+    named_counts_ext = 13,
+    methylome_hash = 14,
+    profile_counts = 15,
+    profile_counts_cov = 16,
+    n_request_types = 17,
   };
   std::string accession;
   std::uint32_t methylome_size{};
@@ -120,7 +160,8 @@ struct request_header {
   [[nodiscard]] auto
   is_intervals_request() const -> bool {
     return rq_type == request_type::counts ||
-           rq_type == request_type::counts_cov;
+           rq_type == request_type::counts_cov ||
+           rq_type == request_type::counts_ext;
   }
 
   [[nodiscard]] auto
@@ -134,6 +175,44 @@ struct request_header {
     return rq_type == request_type::counts_noref ||
            rq_type == request_type::counts_noref_cov;
   }
+
+  [[nodiscard]] auto
+  is_windows_request() const -> bool {
+    return rq_type == request_type::window_counts ||
+           rq_type == request_type::window_counts_cov;
+  }
+
+  // named requests are intervals requests for a set of intervals the
+  // server has already, so only the name of the set is sent
+  [[nodiscard]] auto
+  is_named_request() const -> bool {
+    return rq_type == request_type::named_counts ||
+           rq_type == request_type::named_counts_cov ||
+           rq_type == request_type::named_counts_ext;
+  }
+
+  // the response is the methylome_hash of the methylome, so a client
+  // can tell if counts it has kept are still those on the server
+  [[nodiscard]] auto
+  is_hash_request() const -> bool {
+    return rq_type == request_type::methylome_hash;
+  }
+
+  // the response is one profile summed over all anchors, so its size
+  // depends only on the number of bins
+  [[nodiscard]] auto
+  is_profile_request() const -> bool {
+    return rq_type == request_type::profile_counts ||
+           rq_type == request_type::profile_counts_cov;
+  }
+
+  // raw requests use the same offsets as intervals requests, but the
+  // response is each m_elem in the offset ranges
+  [[nodiscard]] auto
+  is_raw_request() const -> bool {
+    return rq_type == request_type::raw_counts ||
+           rq_type == request_type::raw_counts_positions;
+  }
 };
 
 template <>
@@ -197,10 +276,42 @@ compose(char *first, char *last, const request &req) -> compose_result;
 [[nodiscard]] auto
 parse(const char *first, const char *last, request &req) -> parse_result;
 
+// ADS: regions are read into memory before anything else is checked,
+// and no bin or window needs to be longer than any chrom
+static constexpr std::uint32_t max_n_regions{1u << 22};
+static constexpr std::uint32_t max_bin_size{1u << 31};
+
 struct bins_request {
+  // ADS: bin sizes after the first must fit in the request header
+  static constexpr std::uint32_t max_bin_sizes{8};
   std::uint32_t bin_size{};
+  std::uint32_t n_regions{};
+  // ADS: if there are regions, bins are only for those regions, each
+  // starting at the region start; otherwise bins cover every chrom
+  std::vector<genomic_interval> regions;
+  // ADS: more bin sizes computed in the same pass; the response holds
+  // the bins for each size, in order, starting with bin_size
+  std::vector<std::uint32_t> more_bin_sizes;
+
   [[nodiscard]] auto
   summary() const -> std::string;
+
+  [[nodiscard]] auto
+  get_bin_sizes() const -> std::vector<std::uint32_t> {
+    std::vector<std::uint32_t> bin_sizes{bin_size};
+    bin_sizes.insert(std::cend(bin_sizes), std::cbegin(more_bin_sizes),
+                     std::cend(more_bin_sizes));
+    return bin_sizes;
+  }
+
+  [[nodiscard]] auto
+  get_regions_n_bytes() const -> std::uint32_t {
+    return sizeof(decltype(regions)::value_type) * size(regions);
+  }
+  [[nodiscard]] auto
+  get_regions_data() -> char * {
+    return reinterpret_cast<char *>(regions.data());
+  }
   auto
   operator<=>(const bins_request &) const = default;
 };
@@ -211,4 +322,106 @@ compose(char *first, char *last, const bins_request &req) -> compose_result;
 [[nodiscard]] auto
 parse(const char *first, const char *last, bins_request &req) -> parse_result;
 
+struct windows_request {
+  std::uint32_t window_size{};
+  std::uint32_t window_step{};
+  std::uint32_t n_regions{};
+  // ADS: windows start at each multiple of window_step from the start
+  // of each region, or of each chrom if there are no regions, and are
+  // truncated at the end of the region or chrom
+  std::vector<genomic_interval> regions;
+
+  [[nodiscard]] auto
+  summary() const -> std::string;
+
+  [[nodiscard]] auto
+  get_regions_n_bytes() const -> std::uint32_t {
+    return sizeof(decltype(regions)::value_type) * size(regions);
+  }
+  [[nodiscard]] auto
+  get_regions_data() -> char * {
+    return reinterpret_cast<char *>(regions.data());
+  }
+  auto
+  operator<=>(const windows_request &) const = default;
+};
+
+[[nodiscard]] auto
+compose(char *first, char *last,
+        const windows_request &req) -> compose_result;
+
+[[nodiscard]] auto
+parse(const char *first, const char *last,
+      windows_request &req) -> parse_result;
+
+struct named_request {
+  static constexpr std::uint32_t max_set_name_size{64};
+  std::string set_name;
+  // ADS: the number of intervals the client has for the set and their
+  // checksum from get_intervals_hash, both checked against the
+  // server's set so results line up with the intervals
+  std::uint32_t n_intervals{};
+  std::uint64_t intervals_hash{};
+
+  [[nodiscard]] auto
+  summary() const -> std::string;
+
+  auto
+  operator<=>(const named_request &) const = default;
+};
+
+[[nodiscard]] auto
+compose(char *first, char *last, const named_request &req) -> compose_result;
+
+[[nodiscard]] auto
+parse(const char *first, const char *last,
+      named_request &req) -> parse_result;
+
+struct profile_request {
+  std::uint32_t flank_size{};
+  std::uint32_t n_flank_bins{};
+  std::uint32_t n_body_bins{};
+  std::uint32_t n_anchors{};
+  // ADS: anchors are sent after the request, unless they are a set of
+  // intervals the server has, named here
+  std::string set_name;
+  std::vector<profile_anchor> anchors;
+
+  [[nodiscard]] auto
+  summary() const -> std::string;
+
+  [[nodiscard]] auto
+  get_n_bins() const -> std::uint32_t {
+    return 2 * n_flank_bins + n_body_bins;
+  }
+
+  // ADS: flanks are divided into equal bins, so there must be bins if
+  // there are flanks, and the flank size must be a multiple of them
+  [[nodiscard]] auto
+  is_valid() const -> bool {
+    return get_n_bins() > 0 && (n_flank_bins == 0
+                                  ? flank_size == 0
+                                  : flank_size % n_flank_bins == 0 &&
+                                      flank_size >= n_flank_bins);
+  }
+
+  [[nodiscard]] auto
+  get_anchors_n_bytes() const -> std::uint32_t {
+    return sizeof(decltype(anchors)::value_type) * size(anchors);
+  }
+  [[nodiscard]] auto
+  get_anchors_data() -> char * {
+    return reinterpret_cast<char *>(anchors.data());
+  }
+  auto
+  operator<=>(const profile_request &) const = default;
+};
+
+[[nodiscard]] auto
+compose(char *first, char *last, const profile_request &req) -> compose_result;
+
+[[nodiscard]] auto
+parse(const char *first, const char *last,
+      profile_request &req) -> parse_result;
+
 #endif  // SRC_REQUEST_HPP_
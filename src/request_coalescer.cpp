@@ -0,0 +1,110 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "request_coalescer.hpp"
+
+#include "xfrase_error.hpp"
+
+#include <cstddef>    // for std::byte
+#include <exception>  // for std::uncaught_exceptions
+#include <iterator>   // for std::cbegin
+#include <memory>     // for std::make_shared
+#include <mutex>
+#include <span>
+#include <string>
+#include <utility>  // for std::move, std::pair
+#include <vector>
+
+// ADS: the payload is moved to memory held by reference count and
+// sent as a slice, so every response sharing it is written with no
+// copy; slices must follow the payload, so it becomes the first
+static inline auto
+make_shareable(response_payload &resp) -> void {
+  if (resp.payload.empty())
+    return;
+  auto buf =
+    std::make_shared<const std::vector<std::byte>>(std::move(resp.payload));
+  resp.payload.clear();
+  resp.slices.insert(std::cbegin(resp.slices), std::span{*buf});
+  if (resp.owner)
+    resp.owner = std::make_shared<const std::pair<
+      std::shared_ptr<const void>, std::shared_ptr<const void>>>(
+      std::move(resp.owner), std::move(buf));
+  else
+    resp.owner = std::move(buf);
+}
+
+auto
+request_coalescer::run(const std::string &key, const job &compute,
+                       response_header &resp_hdr, response_payload &resp,
+                       job done) -> bool {
+  {
+    std::scoped_lock lock{mtx};
+    auto [itr, inserted] = requests.try_emplace(key);
+    if (!inserted) {
+      itr->second.push_back({&resp_hdr, &resp, std::move(done)});
+      return true;
+    }
+  }
+
+  // ADS: if the computation throws, the exception goes on to the
+  // caller, but the requests sharing this one still get a response
+  struct publish_on_throw {
+    request_coalescer &coalescer;
+    const std::string &key;
+    const int n_uncaught{std::uncaught_exceptions()};
+    ~publish_on_throw() {
+      if (std::uncaught_exceptions() > n_uncaught)
+        coalescer.publish(key, {server_response_code::server_failure, 0},
+                          {});
+    }
+  } guard{*this, key};
+
+  compute();
+  make_shareable(resp);
+  publish(key, resp_hdr, resp);
+  done();
+  return false;
+}
+
+auto
+request_coalescer::publish(const std::string &key,
+                           const response_header &resp_hdr,
+                           const response_payload &resp) -> void {
+  // ADS: only requests arriving while the response is computed share
+  // it; any arriving from now on start over
+  std::vector<follower> followers;
+  {
+    std::scoped_lock lock{mtx};
+    const auto itr = requests.find(key);
+    if (itr == std::cend(requests))
+      return;
+    followers = std::move(itr->second);
+    requests.erase(itr);
+  }
+  for (auto &f : followers) {
+    *f.resp_hdr = resp_hdr;
+    *f.resp = resp;
+    f.done();
+  }
+}
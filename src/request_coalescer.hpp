@@ -0,0 +1,88 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_REQUEST_COALESCER_HPP_
+#define SRC_REQUEST_COALESCER_HPP_
+
+#include "response.hpp"
+
+#include <cstddef>     // for std::size_t
+#include <functional>  // for std::function
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+  request_coalescer: a request identical to one whose response is
+  being computed shares that response, held by reference count,
+  instead of computing it again. Popular requests that arrive
+  together, like bins at one size for the same methylome, are
+  computed once. Only requests in flight are shared: nothing is kept
+  after the first of them finishes, so this is independent of any
+  cache of results.
+
+  A request that shares a response does not wait for it: it leaves a
+  callback that the first request calls once the response is ready,
+  so no worker is held while another computes.
+ */
+struct request_coalescer {
+  typedef std::function<void()> job;
+
+  request_coalescer() = default;
+  request_coalescer(const request_coalescer &) = delete;
+  request_coalescer &
+  operator=(const request_coalescer &) = delete;
+
+  // run the computation, which fills resp_hdr and resp, then call
+  // done; if a request with the same key is in flight, return true at
+  // once, and that request copies its response to resp_hdr and resp
+  // and calls done when it finishes. If the computation throws, the
+  // requests sharing it get a server_failure response
+  auto
+  run(const std::string &key, const job &compute, response_header &resp_hdr,
+      response_payload &resp, job done) -> bool;
+
+  [[nodiscard]] auto
+  n_in_flight() const -> std::size_t {
+    std::scoped_lock lock{mtx};
+    return std::size(requests);
+  }
+
+private:
+  struct follower {
+    response_header *resp_hdr{};
+    response_payload *resp{};
+    job done;
+  };
+
+  // give the response to the requests sharing the one for key
+  auto
+  publish(const std::string &key, const response_header &resp_hdr,
+          const response_payload &resp) -> void;
+
+  mutable std::mutex mtx;
+  std::unordered_map<std::string, std::vector<follower>> requests;
+};
+
+#endif  // SRC_REQUEST_COALESCER_HPP_
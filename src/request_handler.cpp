@@ -23,6 +23,8 @@
 
 #include "request_handler.hpp"
 
+#include "cpg_index_meta.hpp"
+#include "genomic_interval.hpp"
 #include "logger.hpp"
 #include "methylome.hpp"
 #include "methylome_metadata.hpp"
@@ -32,20 +34,25 @@
 #include "utilities.hpp"
 #include "xfrase_error.hpp"
 
+#include <algorithm>
 #include <chrono>    // for std::chrono::high_resolution_clock
 #include <cstdint>   // for std::uint32_t
 #include <cstring>   // for std::memcpy
 #include <iterator>  // for std::size, std::pair
+#include <limits>
 #include <memory>    // for std::shared_ptr
 #include <print>
+#include <ranges>
 #include <regex>
+#include <span>
 #include <string>
+#include <system_error>
+#include <tuple>
 #include <type_traits>  // for std::remove_cvref_t
 #include <utility>      // for std::pair
 #include <variant>      // for std::get
 #include <vector>
 
-using std::get;
 using std::pair;
 using std::println;
 using std::string;
@@ -54,37 +61,194 @@ using std::uint32_t;
 [[nodiscard]] static auto
 is_valid_accession(const string &accession) -> bool {
   static constexpr auto experiment_ptrn = R"(^(D|E|S)RX\d+$)";
-  std::regex experiment_re(experiment_ptrn);
+  // ADS: compiled once; matching with a const regex is thread safe
+  static const std::regex experiment_re(experiment_ptrn);
   return std::regex_search(accession, experiment_re);
 }
 
 auto
-request_handler::add_response_size_for_bins(const request_header &req_hdr,
-                                            const bins_request &req,
+request_handler::resolve_methylome(const request_header &req_hdr,
+                                   request_context &ctx) -> std::error_code {
+  if (ctx.meth != nullptr)
+    return {};
+  auto [meth, meta, meth_err] = ms.get_methylome(req_hdr.accession);
+  if (meth_err)
+    return meth_err;
+  ctx.meth = std::move(meth);
+  ctx.meta = std::move(meta);
+  return {};
+}
+
+auto
+request_handler::resolve_index(request_context &ctx) -> std::error_code {
+  if (ctx.index != nullptr)
+    return {};
+  if (ctx.meta == nullptr)
+    return std::make_error_code(std::errc::invalid_argument);
+  const auto [index, cim, index_err] =
+    indexes.get_cpg_index_with_meta(ctx.meta->assembly);
+  if (index_err)
+    return index_err;
+  // ADS: the index set is not modified after it is constructed, so
+  // these stay valid for the life of the request handler
+  ctx.index = &index;
+  ctx.cim = &cim;
+  return {};
+}
+
+auto
+request_handler::add_response_size_for_bins(const bins_request &req,
+                                            const request_context &ctx,
                                             response_header &resp_hdr) -> void {
   auto &lgr = logger::instance();
   // assume methylome availability has been determined
-  const auto [meth, meth_meta, meth_err] = ms.get_methylome(req_hdr.accession);
-  if (meth_err) {
-    lgr.error("Failed to load methylome: {}", meth_err);
-    resp_hdr.status = server_response_code::server_failure;
+  if (ctx.cim == nullptr) {
+    lgr.error("Failed to load cpg index metadata for {}", ctx.meta->assembly);
+    resp_hdr.status = server_response_code::index_not_found;
     return;
   }
+  const auto &cim = *ctx.cim;
+  const auto bin_sizes = req.get_bin_sizes();
+  if (std::ranges::find(bin_sizes, 0u) != std::cend(bin_sizes)) {
+    lgr.warning("Invalid bin size: {}", req.summary());
+    resp_hdr.status = server_response_code::bad_request;
+    return;
+  }
+  if (!req.regions.empty() && !cim.regions_valid(req.regions)) {
+    lgr.warning("Invalid regions for bins request");
+    resp_hdr.status = server_response_code::bad_request;
+    return;
+  }
+  // ADS: with several bin sizes, the response is the bins for each
+  // size in order, and the client finds each from get_bins_offsets;
+  // the total over all sizes must be checked to fit the header
+  const auto n_bins =
+    req.regions.empty() ? cim.get_bins_offsets(bin_sizes).back()
+                        : cim.get_bins_offsets(bin_sizes, req.regions).back();
+  if (n_bins > std::numeric_limits<std::uint32_t>::max()) {
+    lgr.warning("Too many bins requested: {}", n_bins);
+    resp_hdr.status = server_response_code::bad_request;
+    return;
+  }
+  resp_hdr.response_size = n_bins;
+}
 
-  const auto [cim, meta_err] = indexes.get_cpg_index_meta(meth_meta->assembly);
-  if (meta_err) {
-    lgr.error("Failed to load cpg index metadata for {}: {}",
-              meth_meta->assembly, meta_err);
+auto
+request_handler::add_response_size_for_windows(const windows_request &req,
+                                               const request_context &ctx,
+                                               response_header &resp_hdr)
+  -> void {
+  auto &lgr = logger::instance();
+  // assume methylome availability has been determined
+  if (ctx.cim == nullptr) {
+    lgr.error("Failed to load cpg index metadata for {}", ctx.meta->assembly);
     resp_hdr.status = server_response_code::index_not_found;
     return;
   }
-  resp_hdr.response_size = cim.get_n_bins(req.bin_size);
+  const auto &cim = *ctx.cim;
+  if (req.window_size == 0 || req.window_step == 0) {
+    lgr.warning("Invalid window size or step: {}", req.summary());
+    resp_hdr.status = server_response_code::bad_request;
+    return;
+  }
+  if (!req.regions.empty() && !cim.regions_valid(req.regions)) {
+    lgr.warning("Invalid regions for windows request");
+    resp_hdr.status = server_response_code::bad_request;
+    return;
+  }
+  // ADS: one window starts at each multiple of the step, so there are
+  // as many windows as there would be bins of the step size; regions
+  // may repeat, so the total must be checked to fit the header
+  const auto n_windows = req.regions.empty()
+                           ? cim.get_n_bins(req.window_step)
+                           : cim.get_n_bins(req.window_step, req.regions);
+  if (n_windows > std::numeric_limits<std::uint32_t>::max()) {
+    lgr.warning("Too many windows requested: {}", n_windows);
+    resp_hdr.status = server_response_code::bad_request;
+    return;
+  }
+  resp_hdr.response_size = n_windows;
+}
+
+auto
+request_handler::add_response_size_for_named(const named_request &req,
+                                             request_context &ctx,
+                                             response_header &resp_hdr)
+  -> void {
+  auto &lgr = logger::instance();
+  auto [intervals, set_err] =
+    indexes.get_interval_set(ctx.meta->assembly, req.set_name);
+  if (set_err) {
+    lgr.warning("No interval set {} for {}", req.set_name, ctx.meta->assembly);
+    resp_hdr.status = server_response_code::interval_set_not_found;
+    return;
+  }
+  if (std::size(intervals->offsets) != req.n_intervals) {
+    lgr.warning("Wrong number of intervals for set {} (provided={}, "
+                "expected={})",
+                req.set_name, req.n_intervals, std::size(intervals->offsets));
+    resp_hdr.status = server_response_code::bad_request;
+    return;
+  }
+  if (intervals->intervals_hash != req.intervals_hash) {
+    lgr.warning("Different intervals for set {} (provided hash={}, "
+                "expected={})",
+                req.set_name, req.intervals_hash, intervals->intervals_hash);
+    resp_hdr.status = server_response_code::bad_request;
+    return;
+  }
+  ctx.intervals = std::move(intervals);
+  resp_hdr.response_size = req.n_intervals;
+}
+
+[[nodiscard]] static inline auto
+anchors_valid(const cpg_index_meta &cim,
+              const std::vector<profile_anchor> &anchors) -> bool {
+  const std::int32_t n_chroms = std::size(cim.chrom_size);
+  return std::ranges::all_of(anchors, [&](const profile_anchor &a) {
+    return 0 <= a.ch_id && a.ch_id < n_chroms && a.start <= a.stop &&
+           a.stop <= cim.chrom_size[a.ch_id];
+  });
+}
+
+auto
+request_handler::add_response_size_for_profile(const profile_request &req,
+                                               request_context &ctx,
+                                               response_header &resp_hdr)
+  -> void {
+  auto &lgr = logger::instance();
+  if (ctx.cim == nullptr) {
+    lgr.error("Failed to load cpg index metadata for {}", ctx.meta->assembly);
+    resp_hdr.status = server_response_code::index_not_found;
+    return;
+  }
+  if (!req.is_valid()) {
+    lgr.warning("Invalid profile bins: {}", req.summary());
+    resp_hdr.status = server_response_code::bad_request;
+    return;
+  }
+  if (!req.set_name.empty()) {
+    auto [intervals, set_err] =
+      indexes.get_interval_set(ctx.meta->assembly, req.set_name);
+    if (set_err) {
+      lgr.warning("No interval set {} for {}", req.set_name,
+                  ctx.meta->assembly);
+      resp_hdr.status = server_response_code::interval_set_not_found;
+      return;
+    }
+    ctx.intervals = std::move(intervals);
+  }
+  else if (!anchors_valid(*ctx.cim, req.anchors)) {
+    lgr.warning("Invalid anchors for profile request");
+    resp_hdr.status = server_response_code::bad_request;
+    return;
+  }
+  resp_hdr.response_size = req.get_n_bins();
 }
 
 auto
 request_handler::add_response_size_for_intervals(
-  [[maybe_unused]] const request_header &req_hdr, const request &req,
-  response_header &resp_hdr) -> void {
+  const request &req, response_header &resp_hdr) -> void {
   resp_hdr.response_size = req.n_intervals;
 }
 
@@ -93,8 +257,10 @@ request_handler::add_response_size_for_intervals(
 // into them.
 auto
 request_handler::handle_header(const request_header &req_hdr,
-                               response_header &resp_hdr) -> void {
+                               response_header &resp_hdr,
+                               request_context &ctx) -> void {
   resp_hdr.response_size = 0;
+  ctx = {};
 
   logger &lgr = logger::instance();
 
@@ -112,11 +278,16 @@ request_handler::handle_header(const request_header &req_hdr,
     return;
   }
 
-  // ADS TODO: move more of this into methylome_set?
-
+  // ADS: with chrom granular residency only the metadata is needed
+  // here; intervals requests load just the chroms they touch. The
+  // hash is in the metadata, so a hash request never loads counts
   const auto get_methylome_start{std::chrono::high_resolution_clock::now()};
-  const auto [meth, meth_meta, get_meth_err] =
-    ms.get_methylome(req_hdr.accession);
+  std::error_code get_meth_err;
+  if (ms.chrom_granular || req_hdr.is_hash_request())
+    std::tie(ctx.meta, get_meth_err) =
+      ms.get_methylome_metadata(req_hdr.accession);
+  else
+    get_meth_err = resolve_methylome(req_hdr, ctx);
   const auto get_methylome_stop{std::chrono::high_resolution_clock::now()};
   lgr.debug("Elapsed time for get methylome: {:.3}s",
             duration(get_methylome_start, get_methylome_stop));
@@ -129,24 +300,39 @@ request_handler::handle_header(const request_header &req_hdr,
   }
 
   // confirm that the methylome size is as expected
-  if (req_hdr.methylome_size != meth_meta->n_cpgs) {
+  if (req_hdr.methylome_size != ctx.meta->n_cpgs) {
     lgr.warning("Incorrect methylome size (provided={}, expected={})",
-                req_hdr.methylome_size, meth_meta->n_cpgs);
+                req_hdr.methylome_size, ctx.meta->n_cpgs);
     resp_hdr.status = server_response_code::invalid_methylome_size;
     return;
   }
 
-  // ADS: check for errors related to bins here also for early exit if an
-  // error is found
-
-  // ADS TODO: set up the methylome for loading here?
-  /* This would involve the methylome_set */
+  // ADS: not every request needs the index, so a missing one is an
+  // error only for the stages that use it
+  if (const auto index_err = resolve_index(ctx))
+    lgr.debug("No cpg index for {}: {}", ctx.meta->assembly, index_err);
 
   // ADS TODO: allocate the space to start reading offsets? Can't do
   // that if the number of intervals is not yet known
   resp_hdr.response_size = req_hdr.methylome_size;
 }
 
+// ADS: named requests give the same counts as intervals requests
+[[nodiscard]] static inline auto
+get_counts_type(const request_header &req_hdr) -> request_header::request_type {
+  using rt = request_header::request_type;
+  switch (req_hdr.rq_type) {
+  case rt::named_counts:
+    return rt::counts;
+  case rt::named_counts_cov:
+    return rt::counts_cov;
+  case rt::named_counts_ext:
+    return rt::counts_ext;
+  default:
+    return req_hdr.rq_type;
+  }
+}
+
 static inline auto
 counts_to_payload(const auto &counts) -> response_payload {
   using counts_res_type =
@@ -158,30 +344,153 @@ counts_to_payload(const auto &counts) -> response_payload {
   return r;
 }
 
+// ADS: results kept by an interval set are sent from where they are
+// held, without a copy
+static inline auto
+result_to_payload(std::shared_ptr<const interval_set::result_type> result)
+  -> response_payload {
+  response_payload r;
+  r.slices.emplace_back(std::span{*result});
+  r.owner = std::move(result);
+  return r;
+}
+
+// ADS: blocks are verified lazily, so the first request touching a
+// corrupt block is the one that finds it
+[[nodiscard]] static inline auto
+verify_offsets(const methylome &meth,
+               const std::vector<methylome::offset_pair> &offsets)
+  -> std::error_code {
+  for (const auto [first, last] : offsets)
+    if (const auto err = meth.verify_blocks(first, last))
+      return err;
+  return {};
+}
+
+// ADS: offsets are grouped by the chrom they fall in, and each chrom
+// of the methylome is loaded on its own; an offset range that spans
+// chroms makes this give up so the whole methylome is used instead
+template <typename counts_res_type>
+[[nodiscard]] static auto
+get_counts_by_chrom(methylome_set &ms, const std::string &accession,
+                    const cpg_index_meta &cim,
+                    const std::vector<methylome::offset_pair> &offsets)
+  -> std::tuple<std::vector<counts_res_type>, std::error_code, bool> {
+  std::vector<counts_res_type> res(std::size(offsets));
+  std::int32_t ch_id{genomic_interval::not_a_chrom};
+  std::uint32_t chrom_first{};
+  std::uint32_t chrom_last{};
+  std::uint32_t meth_first{};  // ADS: whole methylome index of cpg 0
+  std::shared_ptr<methylome> chrom_meth;
+  for (const auto [i, q] : std::views::enumerate(offsets)) {
+    if (q.first == q.second)
+      continue;  // ADS: no sites, so counts stay zero
+    if (chrom_meth == nullptr || q.first < chrom_first ||
+        q.first >= chrom_last) {
+      const auto ch_itr = std::ranges::upper_bound(cim.chrom_offset, q.first);
+      ch_id = std::distance(std::cbegin(cim.chrom_offset), ch_itr) - 1;
+      chrom_first = cim.chrom_offset[ch_id];
+      chrom_last = ch_id + 1 < std::ssize(cim.chrom_offset)
+                     ? cim.chrom_offset[ch_id + 1]
+                     : cim.n_cpgs;
+      auto [meth, meta, first, meth_err] =
+        ms.get_methylome_chrom(accession, ch_id, chrom_first,
+                               chrom_last - chrom_first);
+      if (meth_err)
+        return {{}, meth_err, true};
+      chrom_meth = std::move(meth);
+      meth_first = first;
+    }
+    if (q.second > chrom_last)
+      return {{}, {}, false};
+    if constexpr (std::is_same<counts_res_type, counts_res_ext>::value)
+      res[i] = chrom_meth->get_counts_ext(q.first - meth_first,
+                                          q.second - meth_first);
+    else if constexpr (std::is_same<counts_res_type, counts_res_cov>::value)
+      res[i] = chrom_meth->get_counts_cov(q.first - meth_first,
+                                          q.second - meth_first);
+    else
+      res[i] = chrom_meth->get_counts(q.first - meth_first,
+                                      q.second - meth_first);
+  }
+  return {std::move(res), {}, true};
+}
+
 auto
-request_handler::handle_get_counts(const request_header &req_hdr,
-                                   const request &req,
-                                   response_header &resp_hdr,
-                                   response_payload &resp_data) -> void {
+request_handler::handle_get_counts_by_chrom(const request_header &req_hdr,
+                                            const offsets_type &offsets,
+                                            const request_context &ctx,
+                                            response_header &resp_hdr,
+                                            response_payload &resp_data)
+  -> bool {
+  logger &lgr = logger::instance();
+  if (ctx.cim == nullptr) {
+    lgr.error("Failed to load cpg index metadata for {}", ctx.meta->assembly);
+    resp_hdr.status = server_response_code::index_not_found;
+    return true;
+  }
+  const auto &cim = *ctx.cim;
+
+  lgr.debug("Computing counts by chrom for methylome: {}", req_hdr.accession);
+
+  const auto respond = [&](auto by_chrom) {
+    auto [counts, counts_err, all_in_chroms] = std::move(by_chrom);
+    if (!all_in_chroms)
+      return false;
+    if (counts_err) {
+      lgr.error("Failed to load methylome chrom: {}", counts_err);
+      resp_hdr.status = server_response_code::server_failure;
+    }
+    else
+      resp_data = counts_to_payload(counts);
+    return true;
+  };
+  const auto counts_type = get_counts_type(req_hdr);
+  if (counts_type == request_header::request_type::counts_cov)
+    return respond(get_counts_by_chrom<counts_res_cov>(ms, req_hdr.accession,
+                                                       cim, offsets));
+  if (counts_type == request_header::request_type::counts_ext)
+    return respond(get_counts_by_chrom<counts_res_ext>(ms, req_hdr.accession,
+                                                       cim, offsets));
+  return respond(
+    get_counts_by_chrom<counts_res>(ms, req_hdr.accession, cim, offsets));
+}
+
+auto
+request_handler::get_counts(const request_header &req_hdr,
+                            const offsets_type &offsets, request_context &ctx,
+                            response_header &resp_hdr,
+                            response_payload &resp_data) -> void {
   logger &lgr = logger::instance();
 
   // assume methylome availability has been determined
-  const auto [meth, meta, get_meth_err] = ms.get_methylome(req_hdr.accession);
-  if (get_meth_err) {
+  if (const auto get_meth_err = resolve_methylome(req_hdr, ctx)) {
     lgr.error("Failed to load methylome: {}", get_meth_err);
     // keep methylome size in response header
     resp_hdr.status = server_response_code::server_failure;
     return;
   }
+  const auto &meth = ctx.meth;
+
+  if (const auto block_err = verify_offsets(*meth, offsets)) {
+    lgr.error("Corrupt methylome {}: {}", req_hdr.accession, block_err);
+    resp_hdr.status = server_response_code::server_failure;
+    return;
+  }
 
   lgr.debug("Computing counts for methylome: {}", req_hdr.accession);
 
-  if (req_hdr.rq_type == request_header::request_type::counts) {
-    resp_data = counts_to_payload(meth->get_counts(req.offsets));
+  const auto counts_type = get_counts_type(req_hdr);
+  if (counts_type == request_header::request_type::counts) {
+    resp_data = counts_to_payload(meth->get_counts(offsets));
     return;
   }
-  if (req_hdr.rq_type == request_header::request_type::counts_cov) {
-    resp_data = counts_to_payload(meth->get_counts_cov(req.offsets));
+  if (counts_type == request_header::request_type::counts_cov) {
+    resp_data = counts_to_payload(meth->get_counts_cov(offsets));
+    return;
+  }
+  if (counts_type == request_header::request_type::counts_ext) {
+    resp_data = counts_to_payload(meth->get_counts_ext(offsets));
     return;
   }
 
@@ -189,18 +498,80 @@ request_handler::handle_get_counts(const request_header &req_hdr,
   resp_hdr.status = server_response_code::bad_request;
 }
 
+auto
+request_handler::handle_get_counts(const request_header &req_hdr,
+                                   const request &req,
+                                   request_context &ctx,
+                                   response_header &resp_hdr,
+                                   response_payload &resp_data) -> void {
+  if (ctx.meth == nullptr && req_hdr.is_intervals_request()) {
+    if (handle_get_counts_by_chrom(req_hdr, req.offsets, ctx, resp_hdr,
+                                   resp_data))
+      return;
+    logger::instance().debug("Offsets span chroms; using whole methylome: {}",
+                             req_hdr.accession);
+  }
+  get_counts(req_hdr, req.offsets, ctx, resp_hdr, resp_data);
+}
+
+auto
+request_handler::handle_get_named(const request_header &req_hdr,
+                                  request_context &ctx,
+                                  response_header &resp_hdr,
+                                  response_payload &resp_data) -> void {
+  const auto &intervals = *ctx.intervals;
+  const auto methylome_hash = ctx.meta->methylome_hash;
+  const auto rq_type = std::to_underlying(req_hdr.rq_type);
+
+  if (auto cached = intervals.get_cached_result(methylome_hash, rq_type)) {
+    logger::instance().debug("Cached result for interval set {}: {}",
+                             intervals.name, req_hdr.accession);
+    resp_data = result_to_payload(std::move(cached));
+    return;
+  }
+
+  // ADS: the set knows if its offsets fit in chroms, so the whole
+  // methylome is only loaded when they do not
+  if (ctx.meth != nullptr || !intervals.within_chroms ||
+      !handle_get_counts_by_chrom(req_hdr, intervals.offsets, ctx, resp_hdr,
+                                  resp_data))
+    get_counts(req_hdr, intervals.offsets, ctx, resp_hdr, resp_data);
+
+  if (resp_hdr.error())
+    return;
+  auto result = std::make_shared<const interval_set::result_type>(
+    std::move(resp_data.payload));
+  ctx.intervals->add_cached_result(methylome_hash, rq_type, result);
+  resp_data = result_to_payload(std::move(result));
+}
+
+auto
+request_handler::handle_get_hash(const request_context &ctx,
+                                 response_header &resp_hdr,
+                                 response_payload &resp_data) -> void {
+  const std::vector<std::uint64_t> hash{ctx.meta->methylome_hash};
+  resp_data = counts_to_payload(hash);
+  resp_hdr.response_size = std::size(hash);
+}
+
 auto
 request_handler::handle_get_bins(const request_header &req_hdr,
                                  const bins_request &req,
+                                 request_context &ctx,
                                  response_header &resp_hdr,
                                  response_payload &resp_data) -> void {
   logger &lgr = logger::instance();
 
   // assume methylome availability has been determined
-  const auto [meth, mm, meth_err] = ms.get_methylome(req_hdr.accession);
-  if (meth_err) {
+  if (const auto meth_err = resolve_methylome(req_hdr, ctx)) {
     lgr.error("Failed to load methylome: {}", meth_err);
-    // keep methylome size in response header
+    resp_hdr.status = server_response_code::server_failure;
+    return;
+  }
+  const auto &meth = ctx.meth;
+
+  if (const auto block_err = meth->verify_blocks(0, size(*meth))) {
+    lgr.error("Corrupt methylome {}: {}", req_hdr.accession, block_err);
     resp_hdr.status = server_response_code::server_failure;
     return;
   }
@@ -208,24 +579,269 @@ request_handler::handle_get_bins(const request_header &req_hdr,
   lgr.debug("Computing bins for methylome: {}", req_hdr.accession);
 
   // need cpg index to know what is in each bin
-  const auto [index, cim, index_err] =
-    indexes.get_cpg_index_with_meta(mm->assembly);
-  if (index_err) {
-    lgr.error("Failed to load cpg index for {}: {}", mm->assembly, index_err);
+  if (const auto index_err = resolve_index(ctx)) {
+    lgr.error("Failed to load cpg index for {}: {}", ctx.meta->assembly,
+              index_err);
     resp_hdr.status = server_response_code::index_not_found;
     return;
   }
+  const auto &index = *ctx.index;
+  const auto &cim = *ctx.cim;
+
+  // ADS: several bin sizes are all computed in one pass
+  if (!req.more_bin_sizes.empty()) {
+    const auto bin_sizes = req.get_bin_sizes();
+    if (req_hdr.rq_type == request_header::request_type::bin_counts) {
+      resp_data = counts_to_payload(
+        req.regions.empty()
+          ? meth->get_multi_bins(bin_sizes, index, cim)
+          : meth->get_multi_bins(bin_sizes, index, cim, req.regions));
+      return;
+    }
+    if (req_hdr.rq_type == request_header::request_type::bin_counts_cov) {
+      resp_data = counts_to_payload(
+        req.regions.empty()
+          ? meth->get_multi_bins_cov(bin_sizes, index, cim)
+          : meth->get_multi_bins_cov(bin_sizes, index, cim, req.regions));
+      return;
+    }
+  }
 
   if (req_hdr.rq_type == request_header::request_type::bin_counts) {
-    resp_data = counts_to_payload(meth->get_bins(req.bin_size, index, cim));
+    resp_data = counts_to_payload(
+      req.regions.empty()
+        ? meth->get_bins(req.bin_size, index, cim)
+        : meth->get_bins(req.bin_size, index, cim, req.regions));
     return;
   }
 
   if (req_hdr.rq_type == request_header::request_type::bin_counts_cov) {
-    resp_data = counts_to_payload(meth->get_bins_cov(req.bin_size, index, cim));
+    resp_data = counts_to_payload(
+      req.regions.empty()
+        ? meth->get_bins_cov(req.bin_size, index, cim)
+        : meth->get_bins_cov(req.bin_size, index, cim, req.regions));
+    return;
+  }
+
+  // ADS: if we arrive here, the request was bad
+  resp_hdr.status = server_response_code::bad_request;
+}
+
+auto
+request_handler::handle_get_profile(const request_header &req_hdr,
+                                    const profile_request &req,
+                                    request_context &ctx,
+                                    response_header &resp_hdr,
+                                    response_payload &resp_data) -> void {
+  logger &lgr = logger::instance();
+
+  if (const auto meth_err = resolve_methylome(req_hdr, ctx)) {
+    lgr.error("Failed to load methylome: {}", meth_err);
+    resp_hdr.status = server_response_code::server_failure;
+    return;
+  }
+  const auto &meth = ctx.meth;
+
+  if (const auto block_err = meth->verify_blocks(0, size(*meth))) {
+    lgr.error("Corrupt methylome {}: {}", req_hdr.accession, block_err);
+    resp_hdr.status = server_response_code::server_failure;
+    return;
+  }
+
+  if (const auto index_err = resolve_index(ctx)) {
+    lgr.error("Failed to load cpg index for {}: {}", ctx.meta->assembly,
+              index_err);
+    resp_hdr.status = server_response_code::index_not_found;
+    return;
+  }
+  const auto &index = *ctx.index;
+  const auto &cim = *ctx.cim;
+
+  // ADS: anchors from a named set are already on the server
+  const auto &anchors = ctx.intervals ? ctx.intervals->anchors : req.anchors;
+  lgr.debug("Computing profile for methylome: {} ({} anchors)",
+            req_hdr.accession, std::size(anchors));
+
+  if (req_hdr.rq_type == request_header::request_type::profile_counts) {
+    resp_data = counts_to_payload(
+      meth->get_profile(req.flank_size, req.n_flank_bins, req.n_body_bins,
+                        index, cim, anchors));
+    return;
+  }
+
+  if (req_hdr.rq_type == request_header::request_type::profile_counts_cov) {
+    resp_data = counts_to_payload(
+      meth->get_profile_cov(req.flank_size, req.n_flank_bins, req.n_body_bins,
+                            index, cim, anchors));
+    return;
+  }
+
+  // ADS: if we arrive here, the request was bad
+  resp_hdr.status = server_response_code::bad_request;
+}
+
+auto
+request_handler::handle_get_windows(const request_header &req_hdr,
+                                    const windows_request &req,
+                                    request_context &ctx,
+                                    response_header &resp_hdr,
+                                    response_payload &resp_data) -> void {
+  logger &lgr = logger::instance();
+
+  // assume methylome availability has been determined
+  if (const auto meth_err = resolve_methylome(req_hdr, ctx)) {
+    lgr.error("Failed to load methylome: {}", meth_err);
+    resp_hdr.status = server_response_code::server_failure;
+    return;
+  }
+  const auto &meth = ctx.meth;
+
+  if (const auto block_err = meth->verify_blocks(0, size(*meth))) {
+    lgr.error("Corrupt methylome {}: {}", req_hdr.accession, block_err);
+    resp_hdr.status = server_response_code::server_failure;
+    return;
+  }
+
+  lgr.debug("Computing windows for methylome: {}", req_hdr.accession);
+
+  // need cpg index to know what is in each window
+  if (const auto index_err = resolve_index(ctx)) {
+    lgr.error("Failed to load cpg index for {}: {}", ctx.meta->assembly,
+              index_err);
+    resp_hdr.status = server_response_code::index_not_found;
+    return;
+  }
+  const auto &index = *ctx.index;
+  const auto &cim = *ctx.cim;
+
+  const auto size = req.window_size;
+  const auto step = req.window_step;
+  if (req_hdr.rq_type == request_header::request_type::window_counts) {
+    resp_data = counts_to_payload(
+      req.regions.empty()
+        ? meth->get_windows(size, step, index, cim)
+        : meth->get_windows(size, step, index, cim, req.regions));
+    return;
+  }
+
+  if (req_hdr.rq_type == request_header::request_type::window_counts_cov) {
+    resp_data = counts_to_payload(
+      req.regions.empty()
+        ? meth->get_windows_cov(size, step, index, cim)
+        : meth->get_windows_cov(size, step, index, cim, req.regions));
     return;
   }
 
   // ADS: if we arrive here, the request was bad
   resp_hdr.status = server_response_code::bad_request;
 }
+
+static inline auto
+add_position_slices(const cpg_index &index, const cpg_index_meta &cim,
+                    std::uint32_t first, const std::uint32_t last,
+                    std::vector<std::span<const std::byte>> &slices) -> void {
+  // ADS: offset ranges can span chromosomes, and chromosomes without
+  // CpG sites share an offset with the next one
+  const auto ch_itr = std::ranges::upper_bound(cim.chrom_offset, first);
+  auto ch_id = std::distance(std::cbegin(cim.chrom_offset), ch_itr) - 1;
+  while (first < last) {
+    const auto &positions = index.positions[ch_id];
+    const auto chrom_beg = cim.chrom_offset[ch_id];
+    const auto chrom_end = chrom_beg + std::size(positions);
+    if (first >= chrom_end) {
+      ++ch_id;
+      continue;
+    }
+    const auto n = std::min<std::uint32_t>(last, chrom_end) - first;
+    slices.emplace_back(std::as_bytes(
+      std::span{positions.data() + (first - chrom_beg), n}));
+    first += n;
+  }
+}
+
+auto
+request_handler::handle_get_raw(const request_header &req_hdr,
+                                const request &req, request_context &ctx,
+                                response_header &resp_hdr,
+                                response_payload &resp_data) -> void {
+  logger &lgr = logger::instance();
+
+  // assume methylome availability has been determined
+  if (const auto meth_err = resolve_methylome(req_hdr, ctx)) {
+    lgr.error("Failed to load methylome: {}", meth_err);
+    resp_hdr.status = server_response_code::server_failure;
+    return;
+  }
+  const auto &meth = ctx.meth;
+
+  // ADS: slices point into the methylome so offsets must be checked
+  const std::uint32_t n_cpgs = size(*meth);
+  std::uint64_t n_sites{};
+  for (const auto [first, last] : req.offsets) {
+    if (first > last || last > n_cpgs) {
+      lgr.warning("Invalid offsets for raw request: {}, {}", first, last);
+      resp_hdr.status = server_response_code::bad_request;
+      return;
+    }
+    n_sites += last - first;
+  }
+
+  // ADS: offsets may overlap or repeat, so the number of elements in
+  // the response, with positions if requested, must be checked to fit
+  const auto n_elems =
+    (req_hdr.rq_type == request_header::request_type::raw_counts ? 1 : 2) *
+    n_sites;
+  if (n_elems > std::numeric_limits<std::uint32_t>::max()) {
+    lgr.warning("Raw request too large: {} sites", n_sites);
+    resp_hdr.status = server_response_code::bad_request;
+    return;
+  }
+
+  if (const auto block_err = verify_offsets(*meth, req.offsets)) {
+    lgr.error("Corrupt methylome {}: {}", req_hdr.accession, block_err);
+    resp_hdr.status = server_response_code::server_failure;
+    return;
+  }
+
+  lgr.debug("Raw counts for methylome: {} ({} sites)", req_hdr.accession,
+            n_sites);
+
+  resp_data.owner = meth;
+  resp_data.slices.clear();
+  if (meth->is_narrow()) {
+    // ADS: counts are sent as m_elem, so 8-bit counts are widened into
+    // the payload, which is sent before any position slices
+    resp_data.payload.reserve(n_sites * methylome::record_size);
+    for (const auto [first, last] : req.offsets)
+      for (auto i = first; i < last; ++i) {
+        const methylome::m_elem cpg(meth->cpgs8[i].first,
+                                    meth->cpgs8[i].second);
+        const auto bytes = std::as_bytes(std::span{&cpg, 1});
+        resp_data.payload.insert(std::cend(resp_data.payload),
+                                 std::cbegin(bytes), std::cend(bytes));
+      }
+  }
+  else
+    for (const auto [first, last] : req.offsets)
+      if (first < last)
+        resp_data.slices.emplace_back(std::as_bytes(
+          std::span{meth->cpgs.data() + first, last - first}));
+  resp_hdr.response_size = n_sites;
+
+  if (req_hdr.rq_type == request_header::request_type::raw_counts)
+    return;
+
+  // positions have the same size as m_elem so response_size stays in
+  // units of m_elem
+  static_assert(sizeof(cpg_index::cpg_pos_t) == methylome::record_size);
+  if (const auto index_err = resolve_index(ctx)) {
+    lgr.error("Failed to load cpg index for {}: {}", ctx.meta->assembly,
+              index_err);
+    resp_hdr.status = server_response_code::index_not_found;
+    resp_data = {};
+    return;
+  }
+  for (const auto [first, last] : req.offsets)
+    add_position_slices(*ctx.index, *ctx.cim, first, last, resp_data.slices);
+  resp_hdr.response_size = n_elems;
+}
@@ -26,19 +26,46 @@
 
 #include "cpg_index_set.hpp"
 #include "methylome_set.hpp"
+#include "request_coalescer.hpp"
 
 #include <cstdint>  // for std::uint32_t
+#include <memory>   // for std::shared_ptr
 #include <string>
 #include <system_error>
+#include <utility>  // for std::pair
+#include <vector>
 
 struct bins_request;
+struct cpg_index;
+struct cpg_index_meta;
+struct interval_set;
+struct methylome;
+struct methylome_metadata;
+struct named_request;
+struct profile_request;
 struct request;
 struct request_header;
 struct response_header;
 struct response_payload;
+struct windows_request;
+
+// What one request needs from the methylome_set and cpg_index_set,
+// found once in handle_header and used by each later stage so those
+// sets are not searched again. In chrom granular mode only the
+// metadata is found up front and the methylome is loaded when a stage
+// needs all of it.
+struct request_context {
+  std::shared_ptr<methylome> meth;
+  std::shared_ptr<methylome_metadata> meta;
+  const cpg_index *index{};     // null if no index for the assembly
+  const cpg_index_meta *cim{};  // null if no index for the assembly
+  std::shared_ptr<interval_set> intervals;  // only for named sets
+};
 
 // handles all incoming requests
 struct request_handler {
+  typedef std::vector<std::pair<std::uint32_t, std::uint32_t>> offsets_type;
+
   request_handler(const request_handler &) = delete;
   request_handler &
   operator=(const request_handler &) = delete;
@@ -46,36 +73,107 @@ struct request_handler {
   explicit request_handler(const std::string &methylome_dir,
                            const std::string &index_file_dir,
                            const std::uint32_t max_live_methylomes,
-                           std::error_code &ec) :
+                           std::error_code &ec,
+                           const std::uint64_t max_hot_bytes = 0,
+                           const std::uint64_t max_warm_bytes = 0,
+                           const bool chrom_granular = false) :
     methylome_dir{methylome_dir}, index_file_dir{index_file_dir},
-    ms(max_live_methylomes, methylome_dir), indexes(index_file_dir, ec) {}
+    ms(max_live_methylomes, methylome_dir, max_hot_bytes, max_warm_bytes,
+       chrom_granular),
+    indexes(index_file_dir, ec) {
+    if (!ec)
+      ec = ms.open_packs();
+  }
 
   auto
-  handle_header(const request_header &req_hdr,
-                response_header &resp_hdr) -> void;
+  handle_header(const request_header &req_hdr, response_header &resp_hdr,
+                request_context &ctx) -> void;
 
   auto
   handle_get_counts(const request_header &req_hdr, const request &req,
-                    response_header &resp_hdr, response_payload &resp) -> void;
+                    request_context &ctx, response_header &resp_hdr,
+                    response_payload &resp) -> void;
+
+  // intervals requests with each chrom of the methylome loaded on its
+  // own; false if the offsets do not fit that, and nothing was done
+  [[nodiscard]] auto
+  handle_get_counts_by_chrom(const request_header &req_hdr,
+                             const offsets_type &offsets,
+                             const request_context &ctx,
+                             response_header &resp_hdr,
+                             response_payload &resp) -> bool;
+
+  auto
+  handle_get_named(const request_header &req_hdr, request_context &ctx,
+                   response_header &resp_hdr, response_payload &resp) -> void;
+
+  auto
+  handle_get_hash(const request_context &ctx, response_header &resp_hdr,
+                  response_payload &resp) -> void;
 
   auto
   handle_get_bins(const request_header &req_hdr, const bins_request &req,
-                  response_header &resp_hdr, response_payload &resp) -> void;
+                  request_context &ctx, response_header &resp_hdr,
+                  response_payload &resp) -> void;
+
+  auto
+  handle_get_windows(const request_header &req_hdr, const windows_request &req,
+                     request_context &ctx, response_header &resp_hdr,
+                     response_payload &resp) -> void;
+
+  auto
+  handle_get_profile(const request_header &req_hdr, const profile_request &req,
+                     request_context &ctx, response_header &resp_hdr,
+                     response_payload &resp) -> void;
 
   auto
-  add_response_size_for_bins(const request_header &req_hdr,
-                             const bins_request &req,
+  handle_get_raw(const request_header &req_hdr, const request &req,
+                 request_context &ctx, response_header &resp_hdr,
+                 response_payload &resp) -> void;
+
+  auto
+  add_response_size_for_bins(const bins_request &req,
+                             const request_context &ctx,
                              response_header &resp_hdr) -> void;
 
   auto
-  add_response_size_for_intervals(
-    [[maybe_unused]] const request_header &req_hdr, const request &req,
-    response_header &resp_hdr) -> void;
+  add_response_size_for_windows(const windows_request &req,
+                                const request_context &ctx,
+                                response_header &resp_hdr) -> void;
+
+  auto
+  add_response_size_for_profile(const profile_request &req,
+                                request_context &ctx,
+                                response_header &resp_hdr) -> void;
+
+  auto
+  add_response_size_for_named(const named_request &req, request_context &ctx,
+                              response_header &resp_hdr) -> void;
+
+  auto
+  add_response_size_for_intervals(const request &req,
+                                  response_header &resp_hdr) -> void;
+
+  // counts for intervals and named requests
+  auto
+  get_counts(const request_header &req_hdr, const offsets_type &offsets,
+             request_context &ctx, response_header &resp_hdr,
+             response_payload &resp) -> void;
+
+  // load the whole methylome into the context if it only has metadata
+  [[nodiscard]] auto
+  resolve_methylome(const request_header &req_hdr,
+                    request_context &ctx) -> std::error_code;
+
+  // find the cpg index for the assembly of the methylome in the context
+  [[nodiscard]] auto
+  resolve_index(request_context &ctx) -> std::error_code;
 
   std::string methylome_dir;   // dir of available methylomes
   std::string index_file_dir;  // dir of cpg index files
   methylome_set ms;
   cpg_index_set indexes;
+  request_coalescer inflight;  // shares responses of identical requests
 };
 
 #endif  // SRC_REQUEST_HANDLER_HPP_
@@ -0,0 +1,177 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "request_lanes.hpp"
+
+#include <algorithm>  // for std::min, std::max, std::ranges::min_element
+#include <chrono>
+#include <cstddef>  // for std::ptrdiff_t
+#include <cstdint>
+#include <iterator>  // for std::size, std::distance
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>  // for std::erase_if
+#include <utility>        // for std::move, std::to_underlying
+
+[[nodiscard]] auto
+request_lanes::submit(const lane l, const std::string &client,
+                      const std::uint64_t cost, job j) -> bool {
+  {
+    std::scoped_lock lock{mtx};
+    auto &q = queues[std::to_underlying(l)];
+    if (stopping || std::size(q.jobs) >= config.max_queued)
+      return false;
+    // ADS: clients with nothing queued start at the current virtual
+    // time, so idle time does not build up credit
+    if (std::size(q.finish_tags) > max_clients_tracked)
+      std::erase_if(q.finish_tags, [&](const auto &x) {
+        return x.second <= q.virtual_time;
+      });
+    auto &finish = q.finish_tags[client];
+    const auto start_tag = std::max(q.virtual_time, finish);
+    finish = start_tag + static_cast<double>(std::max<std::uint64_t>(cost, 1));
+    q.jobs.push_back({clock::now(), start_tag, std::move(j)});
+  }
+  // ADS: all workers wake because only some may take from this lane
+  cv.notify_all();
+  return true;
+}
+
+[[nodiscard]] auto
+request_lanes::pick_job(const lane home, const clock::time_point now) const
+  -> std::tuple<std::ptrdiff_t, std::size_t> {
+  // any job that has waited too long goes first, oldest first
+  std::ptrdiff_t aged_lane = -1;
+  std::size_t aged_job{};
+  for (std::size_t i = 0; i < n_lanes; ++i) {
+    const auto &jobs = queues[i].jobs;
+    for (std::size_t k = 0; k < std::size(jobs); ++k) {
+      if (now - jobs[k].enqueued < max_wait)
+        continue;
+      if (aged_lane < 0 ||
+          jobs[k].enqueued < queues[aged_lane].jobs[aged_job].enqueued) {
+        aged_lane = i;
+        aged_job = k;
+      }
+    }
+  }
+  if (aged_lane >= 0)
+    return {aged_lane, aged_job};
+
+  // otherwise the smallest start tag in the home lane, and bulk
+  // workers help with small jobs but not the other way around
+  std::ptrdiff_t l = std::to_underlying(home);
+  if (queues[l].jobs.empty() && home == lane::bulk)
+    l = std::to_underlying(lane::interactive);
+  const auto &jobs = queues[l].jobs;
+  if (jobs.empty())
+    return {-1, 0};
+  const auto fair = std::ranges::min_element(jobs, {}, &queued_job::start_tag);
+  const auto k = std::distance(std::cbegin(jobs), fair);
+  return {l, static_cast<std::size_t>(k)};
+}
+
+[[nodiscard]] auto
+request_lanes::take_job(const std::ptrdiff_t l, const std::size_t k) -> job {
+  auto &q = queues[l];
+  auto itr = std::begin(q.jobs) + k;
+  q.virtual_time = std::max(q.virtual_time, itr->start_tag);
+  auto j = std::move(itr->j);
+  q.jobs.erase(itr);
+  return j;
+}
+
+[[nodiscard]] auto
+request_lanes::next_job(const lane home, job &j) -> bool {
+  std::unique_lock lock{mtx};
+  while (true) {
+    // ADS: once stopping, every job counts as having waited too long,
+    // so any worker takes any job, oldest first, until all are done
+    const auto now = stopping ? clock::time_point::max() : clock::now();
+    if (const auto [l, k] = pick_job(home, now); l >= 0) {
+      j = take_job(l, k);
+      return true;
+    }
+    if (stopping)
+      return false;
+    // wake when the oldest waiting job would be old enough to take
+    auto wake = clock::time_point::max();
+    for (const auto &q : queues)
+      for (const auto &x : q.jobs)
+        wake = std::min(wake, x.enqueued + max_wait);
+    if (wake == clock::time_point::max())
+      cv.wait(lock);
+    else
+      cv.wait_until(lock, wake);
+  }
+}
+
+// ADS: a job must deal with its own failures, since only it can
+// answer its request; an exception that gets here anyway is dropped so
+// it does not end the worker and with it the process
+static inline auto
+run_job(const request_lanes::job &j) -> void {
+  try {
+    j();
+  }
+  catch (...) {
+  }
+}
+
+auto
+request_lanes::worker(const lane home) -> void {
+  job j;
+  while (next_job(home, j)) {
+    run_job(j);
+    j = nullptr;  // ADS: release what the job holds before waiting
+  }
+}
+
+auto
+request_lanes::start() -> void {
+  std::scoped_lock lock{mtx};
+  stopping = false;
+  const auto n_interactive = std::max(config.n_interactive_threads, 1u);
+  for (std::uint32_t i = 0; i < n_interactive; ++i)
+    workers.emplace_back([this] { worker(lane::interactive); });
+  for (std::uint32_t i = 0; i < config.n_bulk_threads; ++i)
+    workers.emplace_back([this] { worker(lane::bulk); });
+}
+
+auto
+request_lanes::stop() -> void {
+  {
+    std::scoped_lock lock{mtx};
+    stopping = true;
+  }
+  cv.notify_all();
+  workers.clear();  // ADS: jthread joins on destruction
+  // ADS: without workers, e.g., if never started, queued jobs are run
+  // here so none are dropped
+  job j;
+  while (next_job(lane::bulk, j)) {
+    run_job(j);
+    j = nullptr;
+  }
+}
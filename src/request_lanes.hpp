@@ -0,0 +1,143 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_REQUEST_LANES_HPP_
+#define SRC_REQUEST_LANES_HPP_
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>  // for std::size_t
+#include <cstdint>  // for std::uint32_t, std::uint64_t
+#include <deque>
+#include <functional>  // for std::function
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+struct request_lanes_config {
+  std::uint32_t n_interactive_threads{1};
+  std::uint32_t n_bulk_threads{1};
+  std::uint32_t max_queued{64};    // per lane; more are refused
+  std::uint32_t max_wait_ms{1000};  // after this any worker takes a job
+  std::uint64_t bulk_cost{1000000};  // cost at which a request is bulk
+};
+
+/*
+  request_lanes: computations for requests are queued in one of two
+  lanes by their estimated cost, and each lane has its own workers, so
+  a few large bins requests cannot occupy every thread while small
+  interval queries wait. Bulk workers take interactive jobs when they
+  have nothing else to do, but interactive workers only take a bulk
+  job after it has waited max_wait. Any job waiting that long is taken
+  first by the next free worker, so neither lane starves.
+
+  Within a lane, jobs from different clients are ordered by start-time
+  fair queuing: each job is tagged with the virtual time at which its
+  client's previous work, weighted by cost, would finish. A client
+  submitting many jobs gets its share of workers, not all of them.
+ */
+struct request_lanes {
+  enum class lane : std::uint8_t {
+    interactive = 0,
+    bulk = 1,
+  };
+  static constexpr std::size_t n_lanes = 2;
+  static constexpr std::size_t max_clients_tracked = 1024;
+
+  typedef std::function<void()> job;
+  typedef std::chrono::steady_clock clock;
+
+  request_lanes(const request_lanes &) = delete;
+  request_lanes &
+  operator=(const request_lanes &) = delete;
+
+  explicit request_lanes(const request_lanes_config &config) :
+    config{config}, max_wait{config.max_wait_ms} {}
+
+  ~request_lanes() { stop(); }
+
+  // ADS: cost is roughly the number of values computed plus the
+  // number of sites scanned; it decides the lane
+  [[nodiscard]] auto
+  get_lane(const std::uint64_t cost) const -> lane {
+    return cost >= config.bulk_cost ? lane::bulk : lane::interactive;
+  }
+
+  // returns false if the lane is full or the lanes are stopped
+  [[nodiscard]] auto
+  submit(const lane l, const std::string &client, const std::uint64_t cost,
+         job j) -> bool;
+
+  // ADS: workers are started separately from construction because a
+  // daemon forks after the server is constructed
+  auto
+  start() -> void;
+
+  // stop taking jobs; jobs already queued are run before the workers
+  // are joined, so none are dropped
+  auto
+  stop() -> void;
+
+  struct queued_job {
+    clock::time_point enqueued;
+    double start_tag{};
+    job j;
+  };
+
+  struct lane_queue {
+    std::vector<queued_job> jobs;
+    double virtual_time{};
+    // virtual time at which each client's queued work finishes
+    std::unordered_map<std::string, double> finish_tags;
+  };
+
+  // lane and position in that lane of the next job for a worker of
+  // the home lane; lane is negative if there is none
+  [[nodiscard]] auto
+  pick_job(const lane home, const clock::time_point now) const
+    -> std::tuple<std::ptrdiff_t, std::size_t>;
+
+  // remove a job from its lane, advancing that lane's virtual time
+  [[nodiscard]] auto
+  take_job(const std::ptrdiff_t l, const std::size_t k) -> job;
+
+  [[nodiscard]] auto
+  next_job(const lane home, job &j) -> bool;
+
+  auto
+  worker(const lane home) -> void;
+
+  request_lanes_config config;
+  std::chrono::milliseconds max_wait;
+  std::array<lane_queue, n_lanes> queues;
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool stopping{};
+  std::vector<std::jthread> workers;
+};
+
+#endif  // SRC_REQUEST_LANES_HPP_
@@ -33,6 +33,8 @@
 #include <cstddef>  // for std::byte
 #include <cstdint>
 #include <iterator>  // for std::size
+#include <memory>    // for std::shared_ptr
+#include <span>
 #include <string>
 #include <system_error>
 #include <vector>
@@ -73,9 +75,18 @@ parse(const std::array<char, response_buf_size> &buf,
 
 struct response_payload {
   std::vector<std::byte> payload;
+  // ADS: slices of memory owned elsewhere, sent after the payload with
+  // scatter-gather writes and no copy; 'owner' keeps them alive until
+  // the response has been written
+  std::vector<std::span<const std::byte>> slices;
+  std::shared_ptr<const void> owner;
+
   [[nodiscard]] auto
-  n_bytes() const -> std::uint32_t {
-    return std::size(payload);
+  n_bytes() const -> std::size_t {
+    std::size_t n = std::size(payload);
+    for (const auto &s : slices)
+      n += std::size(s);
+    return n;
   }
 };
 
@@ -24,13 +24,16 @@
 #include "server.hpp"
 #include "connection.hpp"
 #include "logger.hpp"  // for logger
+#include "socket_handoff.hpp"
 
 #include <boost/asio.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/system.hpp>  // for boost::system::error_code
 
+#include <algorithm>  // for std::max
 #include <cassert>
 #include <cerrno>
+#include <chrono>
 #include <csignal>  // std::raise
 #include <cstdint>
 #include <cstdlib>  // for std::exit, std::getenv, EXIT_SUCCESS
@@ -40,20 +43,22 @@
 #include <fstream>
 #include <iterator>  // for std::size
 #include <memory>    // std::make_shared<>
+#include <ranges>
 #include <string>
 #include <system_error>
 #include <thread>
 #include <utility>
 #include <vector>
 
-#include <fcntl.h>      // for open, O_APPEND, O_CREAT, O_RDONLY
-#include <sys/stat.h>   // for umask
-#include <sys/types.h>  // for pid_t, mode_t
+#include <fcntl.h>       // for open, O_APPEND, O_CREAT, O_RDONLY
+#include <sys/socket.h>  // for getsockname, sockaddr_storage
+#include <sys/stat.h>    // for umask
+#include <sys/types.h>   // for pid_t, mode_t
 #include <syslog.h>
 #include <unistd.h>
 
 static auto
-write_pid_to_file(std::error_code &ec) -> void {
+write_pid_to_file(const bool replace, std::error_code &ec) -> void {
   static const auto pid_file_rhs =
     std::filesystem::path(".config") / "xfrase" / "XFRASE_PID_FILE";
 
@@ -68,7 +73,7 @@ write_pid_to_file(std::error_code &ec) -> void {
   }
   const std::filesystem::path pid_file =
     std::filesystem::path(env_home) / pid_file_rhs;
-  if (std::filesystem::exists(pid_file)) {
+  if (!replace && std::filesystem::exists(pid_file)) {
     ec = std::make_error_code(std::errc::file_exists);
     lgr.error("Error: {}", ec);
     return;
@@ -94,8 +99,13 @@ write_pid_to_file(std::error_code &ec) -> void {
 server::server(const std::string &address, const std::string &port,
                const std::uint32_t n_threads, const std::string &methylome_dir,
                const std::string &cpg_index_file_dir,
-               const std::uint32_t max_live_methylomes, logger &lgr,
-               std::error_code &ec) :
+               const std::uint32_t max_live_methylomes,
+               const std::uint64_t max_hot_bytes,
+               const std::uint64_t max_warm_bytes, const bool chrom_granular,
+               const request_lanes_config &lanes_config,
+               const client_limits_config &limits_config,
+               const std::string &handoff_path, const bool takeover,
+               logger &lgr, std::error_code &ec) :
   // io_context ios uses default constructor
   n_threads{n_threads},
 #if defined(SIGQUIT)
@@ -104,7 +114,11 @@ server::server(const std::string &address, const std::string &port,
   signals(ioc, SIGINT, SIGTERM),
 #endif
   acceptor(ioc),
-  handler(methylome_dir, cpg_index_file_dir, max_live_methylomes, ec),
+  handler(methylome_dir, cpg_index_file_dir, max_live_methylomes, ec,
+          max_hot_bytes, max_warm_bytes, chrom_granular),
+  lanes(lanes_config), limits(limits_config), counters_timer(ioc),
+  handoff_path{handoff_path}, takeover{takeover}, handoff_acceptor(ioc),
+  drain_timer(ioc), wheels(std::max(n_threads, 1u)), wheel_timer(ioc),
   lgr{lgr} {
   // first check for errors in initializing members
   if (ec)
@@ -113,6 +127,18 @@ server::server(const std::string &address, const std::string &port,
   // ADS: after this line we need to raise signal
   do_await_stop();  // start waiting for signals
 
+  // ADS: a server taking over does not bind; it accepts on the socket
+  // the running server was listening on
+  if (takeover) {
+    take_over_acceptor(ec);
+    if (ec) {
+      std::raise(SIGTERM);
+      return;  // don't wait for signal handler
+    }
+    start_accepting();
+    return;
+  }
+
   boost::asio::ip::tcp::resolver resolver(ioc);
   boost::system::error_code resolver_ec;
   const auto resolved = resolver.resolve(address, port, resolver_ec);
@@ -161,14 +187,20 @@ server::server(const std::string &address, const std::string &port,
     std::raise(SIGTERM);
     return;  // don't wait for signal handler
   }
-  do_accept();
+  start_accepting();
 }
 
 server::server(const std::string &address, const std::string &port,
                const std::uint32_t n_threads, const std::string &methylome_dir,
                const std::string &cpg_index_file_dir,
-               const std::uint32_t max_live_methylomes, logger &lgr,
-               std::error_code &ec, [[maybe_unused]] const bool daemonize) :
+               const std::uint32_t max_live_methylomes,
+               const std::uint64_t max_hot_bytes,
+               const std::uint64_t max_warm_bytes, const bool chrom_granular,
+               const request_lanes_config &lanes_config,
+               const client_limits_config &limits_config,
+               const std::string &handoff_path, const bool takeover,
+               logger &lgr, std::error_code &ec,
+               [[maybe_unused]] const bool daemonize) :
   // io_context ioc uses default constructor
   n_threads{n_threads},
 #if defined(SIGQUIT)
@@ -178,7 +210,11 @@ server::server(const std::string &address, const std::string &port,
   signals(ioc, SIGINT, SIGTERM),
 #endif
   acceptor(ioc),
-  handler(methylome_dir, cpg_index_file_dir, max_live_methylomes, ec),
+  handler(methylome_dir, cpg_index_file_dir, max_live_methylomes, ec,
+          max_hot_bytes, max_warm_bytes, chrom_granular),
+  lanes(lanes_config), limits(limits_config), counters_timer(ioc),
+  handoff_path{handoff_path}, takeover{takeover}, handoff_acceptor(ioc),
+  drain_timer(ioc), wheels(std::max(n_threads, 1u)), wheel_timer(ioc),
   lgr{lgr} {
   // first check for errors in initializing members
   if (ec)
@@ -232,8 +268,9 @@ server::server(const std::string &address, const std::string &port,
     }
   }
 
-  // write the pid of the daemon to a file
-  write_pid_to_file(ec);
+  // write the pid of the daemon to a file, replacing that of the
+  // running daemon if taking over from it
+  write_pid_to_file(takeover, ec);
   // error reporting within the above function
   if (ec)
     return;
@@ -277,6 +314,18 @@ server::server(const std::string &address, const std::string &port,
   syslog(LOG_INFO | LOG_USER, "Daemon started.");
   lgr.info("Daemon started (pid: {})", getpid());
 
+  // ADS: a server taking over does not bind; it accepts on the socket
+  // the running server was listening on
+  if (takeover) {
+    take_over_acceptor(ec);
+    if (ec) {
+      std::raise(SIGTERM);
+      return;  // don't wait for signal handler
+    }
+    start_accepting();
+    return;
+  }
+
   boost::asio::ip::tcp::resolver resolver(ioc);
   boost::system::error_code resolver_ec;
   const auto resolved = resolver.resolve(address, port, resolver_ec);
@@ -325,7 +374,7 @@ server::server(const std::string &address, const std::string &port,
     std::raise(SIGTERM);
     return;  // don't wait for signal handler
   }
-  do_accept();
+  start_accepting();
 }
 
 auto
@@ -336,9 +385,30 @@ server::run() -> void {
      are equivalent and the io_context may choose any one of them to
      invoke a handler."
   */
-  std::vector<std::jthread> threads;
-  for (std::uint32_t i = 0; i < n_threads; ++i)
-    threads.emplace_back([this] { ioc.run(); });
+  lanes.start();
+  if (!preload_accessions.empty()) {
+    // ADS: load least recently used first, so the most recently used
+    // in the old server end up most recently used here
+    const bool queued = lanes.submit(
+      request_lanes::lane::bulk, "takeover", 1, [this] {
+        for (const auto &accession : preload_accessions | std::views::reverse)
+          if (const auto [meth, meta, err] =
+                handler.ms.get_methylome(accession);
+              err)
+            lgr.warning("Failed to preload {}: {}", accession, err);
+        lgr.info("Preloaded {} methylomes", std::size(preload_accessions));
+      });
+    if (!queued)
+      lgr.warning("Failed to queue preloading methylomes");
+  }
+  {
+    // ADS: these threads only do i/o; computations are done by the
+    // lane workers
+    std::vector<std::jthread> threads;
+    for (std::uint32_t i = 0; i < n_threads; ++i)
+      threads.emplace_back([this] { ioc.run(); });
+  }
+  lanes.stop();
 }
 
 auto
@@ -352,14 +422,185 @@ server::do_accept() -> void {
         return;
       if (!ec) {
         // ADS: accepted socket moved into connection which is started
-        std::make_shared<connection>(std::move(socket), handler, lgr,
-                                     connection_id++)
+        const auto conn_id = connection_id++;
+        auto &wheel = wheels[conn_id % std::size(wheels)];
+        std::make_shared<connection>(std::move(socket), handler, lanes,
+                                     limits, wheel, n_active_connections,
+                                     draining, lgr, conn_id)
           ->start();
       }
       do_accept();  // keep listening for more connections
     });
 }
 
+auto
+server::start_accepting() -> void {
+  listen_for_handoff();
+  wheel_epoch = std::chrono::steady_clock::now();
+  do_advance_wheels();
+  do_accept();
+  do_log_client_counters();
+}
+
+auto
+server::take_over_acceptor(std::error_code &ec) -> void {
+  auto [listen_fd, text, handoff_err] = receive_listening_socket(handoff_path);
+  if (handoff_err) {
+    ec = handoff_err;
+    lgr.error("Failed to take over from {}: {}", handoff_path, ec);
+    return;
+  }
+
+  // the protocol of the listening socket is whatever the old server used
+  sockaddr_storage addr{};
+  socklen_t addr_len = sizeof(addr);
+  if (getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr),
+                  &addr_len) < 0) {
+    ec = std::make_error_code(std::errc(errno));
+    lgr.error("Failed to get address of listening socket: {}", ec);
+    close(listen_fd);
+    return;
+  }
+  const auto protocol = addr.ss_family == AF_INET6
+                          ? boost::asio::ip::tcp::v6()
+                          : boost::asio::ip::tcp::v4();
+  boost::system::error_code assign_ec;
+  acceptor.assign(protocol, listen_fd, assign_ec);
+  if (assign_ec) {
+    ec = assign_ec;
+    lgr.error("Failed to assign listening socket: {}", ec);
+    close(listen_fd);
+    return;
+  }
+
+  for (const auto accession : text | std::views::split('\n'))
+    if (!accession.empty())
+      preload_accessions.emplace_back(std::begin(accession),
+                                      std::end(accession));
+  lgr.info("Took over listening socket from {} ({} methylomes to preload)",
+           handoff_path, std::size(preload_accessions));
+}
+
+auto
+server::listen_for_handoff() -> void {
+  if (handoff_path.empty())
+    return;
+  // ADS: the path may be stale, or belong to the server this one has
+  // just taken over from, which no longer needs it
+  std::error_code remove_ec;
+  std::filesystem::remove(handoff_path, remove_ec);
+
+  const boost::asio::local::stream_protocol::endpoint endpoint(handoff_path);
+  boost::system::error_code handoff_ec;
+  handoff_acceptor.open(endpoint.protocol(), handoff_ec);
+  if (!handoff_ec)
+    handoff_acceptor.bind(endpoint, handoff_ec);
+  if (!handoff_ec)
+    handoff_acceptor.listen(1, handoff_ec);
+  if (handoff_ec) {
+    lgr.warning("Not listening for handoff on {}: {}", handoff_path,
+                handoff_ec);
+    return;
+  }
+  // ADS: whoever connects gets the listening socket, so only the user
+  // running the server may connect
+  std::error_code perms_ec;
+  std::filesystem::permissions(handoff_path,
+                               std::filesystem::perms::owner_read |
+                                 std::filesystem::perms::owner_write,
+                               perms_ec);
+  if (perms_ec) {
+    lgr.warning("Not listening for handoff; failed to set permissions on "
+                "{}: {}",
+                handoff_path, perms_ec);
+    boost::system::error_code close_ec;
+    handoff_acceptor.close(close_ec);
+    return;
+  }
+  lgr.info("Listening for handoff on {}", handoff_path);
+  do_await_handoff();
+}
+
+auto
+server::do_await_handoff() -> void {
+  handoff_acceptor.async_accept(
+    [this](const boost::system::error_code ec,
+           boost::asio::local::stream_protocol::socket peer) {
+      if (!handoff_acceptor.is_open())
+        return;
+      if (ec) {
+        lgr.warning("Error accepting handoff: {}", ec);
+        do_await_handoff();
+        return;
+      }
+      const auto accessions = handler.ms.get_resident_accessions();
+      const auto joined = accessions | std::views::join_with('\n');
+      const std::string text(std::cbegin(joined), std::cend(joined));
+      if (const auto handoff_err = send_listening_socket(
+            peer.native_handle(), acceptor.native_handle(), text)) {
+        lgr.error("Failed to hand off listening socket: {}", handoff_err);
+        do_await_handoff();
+        return;
+      }
+      lgr.info("Handed off listening socket ({} methylomes resident)",
+               std::size(accessions));
+      // ADS: the new server accepts from now on; this one finishes
+      // what it has and then stops
+      draining = true;
+      boost::system::error_code close_ec;
+      acceptor.close(close_ec);
+      handoff_acceptor.close(close_ec);
+      do_drain();
+    });
+}
+
+auto
+server::do_drain() -> void {
+  // ADS: every connection has a deadline, and kept-alive connections
+  // close after their current request, so this finishes
+  if (n_active_connections == 0) {
+    lgr.info("Connections drained; stopping (pid: {})", getpid());
+    ioc.stop();
+    return;
+  }
+  lgr.debug("Draining {} connections", n_active_connections.load());
+  drain_timer.expires_after(std::chrono::milliseconds(drain_poll_ms));
+  drain_timer.async_wait([this](const boost::system::error_code ec) {
+    if (!ec)
+      do_drain();
+  });
+}
+
+// ADS: ticks are counted from the epoch rather than from each wait,
+// so a late timer catches up instead of letting deadlines drift
+auto
+server::do_advance_wheels() -> void {
+  const auto to = static_cast<std::uint64_t>(
+    (std::chrono::steady_clock::now() - wheel_epoch) / timer_wheel::tick);
+  for (auto &wheel : wheels)
+    for (const auto &on_expire : wheel.advance(to))
+      on_expire();
+  wheel_timer.expires_after(timer_wheel::tick);
+  wheel_timer.async_wait([this](const boost::system::error_code ec) {
+    if (!ec)
+      do_advance_wheels();
+  });
+}
+
+auto
+server::do_log_client_counters() -> void {
+  if (limits.config.stats_seconds == 0)
+    return;
+  counters_timer.expires_after(
+    std::chrono::seconds(limits.config.stats_seconds));
+  counters_timer.async_wait([this](const boost::system::error_code ec) {
+    if (ec)
+      return;  // cancelled when the server stops
+    limits.log_counters();
+    do_log_client_counters();
+  });
+}
+
 auto
 server::do_await_stop() -> void {
   // capture brings 'this' into search for names
@@ -24,18 +24,25 @@
 #ifndef SRC_SERVER_HPP_
 #define SRC_SERVER_HPP_
 
+#include "client_limits.hpp"
 #include "request_handler.hpp"
+#include "request_lanes.hpp"
+#include "timer_wheel.hpp"
 
 #include <boost/asio.hpp>
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <string>
 #include <system_error>
+#include <vector>
 
 class logger;
 
 struct server {
+  static constexpr std::uint32_t drain_poll_ms{100};
+
   server(const server &) = delete;
   server &
   operator=(const server &) = delete;
@@ -44,20 +51,40 @@ struct server {
                   const std::uint32_t n_threads,
                   const std::string &methylome_dir,
                   const std::string &index_file_dir,
-                  const std::uint32_t max_live_methylomes, logger &lgr,
-                  std::error_code &ec);
+                  const std::uint32_t max_live_methylomes,
+                  const std::uint64_t max_hot_bytes,
+                  const std::uint64_t max_warm_bytes,
+                  const bool chrom_granular,
+                  const request_lanes_config &lanes_config,
+                  const client_limits_config &limits_config,
+                  const std::string &handoff_path, const bool takeover,
+                  logger &lgr, std::error_code &ec);
 
   explicit server(const std::string &address, const std::string &port,
                   const std::uint32_t n_threads,
                   const std::string &methylome_dir,
                   const std::string &index_file_dir,
-                  const std::uint32_t max_live_methylomes, logger &lgr,
-                  std::error_code &ec, [[maybe_unused]] const bool daemonize);
+                  const std::uint32_t max_live_methylomes,
+                  const std::uint64_t max_hot_bytes,
+                  const std::uint64_t max_warm_bytes,
+                  const bool chrom_granular,
+                  const request_lanes_config &lanes_config,
+                  const client_limits_config &limits_config,
+                  const std::string &handoff_path, const bool takeover,
+                  logger &lgr, std::error_code &ec,
+                  [[maybe_unused]] const bool daemonize);
   // clang-format off
   auto run() -> void;
   auto do_accept() -> void;  // do async accept operation
   auto do_await_stop() -> void;  // wait for request to stop server
   auto do_daemon_await_stop() -> void;  // same but for daemon mode
+  auto do_log_client_counters() -> void;  // periodically log client counters
+  auto start_accepting() -> void;  // accept connections and handoffs
+  auto take_over_acceptor(std::error_code &ec) -> void;  // from old server
+  auto listen_for_handoff() -> void;  // for a new server to take over
+  auto do_await_handoff() -> void;  // wait for a new server
+  auto do_drain() -> void;  // stop once connections have finished
+  auto do_advance_wheels() -> void;  // expire connection deadlines
   // clang-format on
 
   std::uint32_t n_threads{};
@@ -65,6 +92,24 @@ struct server {
   boost::asio::signal_set signals;          // registers termination signals
   boost::asio::ip::tcp::acceptor acceptor;  // listens for connections
   request_handler handler;                  // handles incoming requests
+  request_lanes lanes;                      // workers for computations
+  client_limits limits;                     // per-client rate limits
+  boost::asio::steady_timer counters_timer;  // for logging client counters
+  std::string handoff_path;  // unix socket for handing off the acceptor
+  bool takeover{};           // take the acceptor from a running server
+  boost::asio::local::stream_protocol::acceptor handoff_acceptor;
+  boost::asio::steady_timer drain_timer;
+  // ADS: connection deadlines are split over as many wheels as io
+  // threads, each connection using the wheel for its id. Any thread,
+  // io or lane worker, may set or clear a deadline in any wheel, so
+  // each wheel keeps its lock; splitting only makes it rare that two
+  // threads want the same one. One timer moves all wheels each tick
+  std::vector<timer_wheel> wheels;
+  boost::asio::steady_timer wheel_timer;
+  std::chrono::steady_clock::time_point wheel_epoch;
+  std::vector<std::string> preload_accessions;  // resident in old server
+  std::atomic_uint32_t n_active_connections{};
+  std::atomic_bool draining{};  // connections close after their request
   logger &lgr;
   std::atomic_uint32_t connection_id{};  // incremented per thread
 };
@@ -0,0 +1,155 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "socket_handoff.hpp"
+
+#include <cerrno>
+#include <cstddef>  // for std::size_t
+#include <cstring>  // for std::memcpy
+#include <iterator>  // for std::size
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <utility>  // for std::move
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// ADS: a new process that dies during the handoff must not take the
+// running server down with SIGPIPE
+#if defined(MSG_NOSIGNAL)
+static constexpr int send_flags = MSG_NOSIGNAL;
+#else
+static constexpr int send_flags = 0;
+#endif
+
+[[nodiscard]] auto
+send_listening_socket(const int unix_fd, const int listen_fd,
+                      const std::string &text) -> std::error_code {
+  // ADS: at least one byte of data must go with the descriptor
+  const std::string payload = text + '\n';
+
+  iovec iov{};
+  iov.iov_base = const_cast<char *>(payload.data());
+  iov.iov_len = std::size(payload);
+
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(cmsg), &listen_fd, sizeof(int));
+
+  const auto n_sent = sendmsg(unix_fd, &msg, send_flags);
+  if (n_sent <= 0)
+    return socket_handoff_error::error_sending;
+
+  // the rest of the text, if sendmsg did not take it all
+  std::size_t sent = n_sent;
+  while (sent < std::size(payload)) {
+    const auto n = send(unix_fd, payload.data() + sent,
+                        std::size(payload) - sent, send_flags);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return socket_handoff_error::error_sending;
+    sent += n;
+  }
+  return {};
+}
+
+[[nodiscard]] auto
+receive_listening_socket(const std::string &path)
+  -> std::tuple<int, std::string, std::error_code> {
+  sockaddr_un addr{};
+  if (std::size(path) >= sizeof(addr.sun_path))
+    return {-1, {}, socket_handoff_error::error_connecting};
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.data(), std::size(path));
+
+  const int unix_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (unix_fd < 0)
+    return {-1, {}, std::make_error_code(std::errc(errno))};
+  if (connect(unix_fd, reinterpret_cast<const sockaddr *>(&addr),
+              sizeof(addr)) < 0) {
+    close(unix_fd);
+    return {-1, {}, socket_handoff_error::error_connecting};
+  }
+
+  static constexpr std::size_t buf_size = 4096;
+  char buf[buf_size];
+  iovec iov{};
+  iov.iov_base = buf;
+  iov.iov_len = buf_size;
+
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  const auto n_received = recvmsg(unix_fd, &msg, 0);
+  if (n_received <= 0) {
+    close(unix_fd);
+    return {-1, {}, socket_handoff_error::error_receiving};
+  }
+
+  int listen_fd = -1;
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg))
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      std::memcpy(&listen_fd, CMSG_DATA(cmsg), sizeof(int));
+  if (listen_fd < 0) {
+    close(unix_fd);
+    return {-1, {}, socket_handoff_error::no_socket_received};
+  }
+
+  // the rest of the text arrives until the sender closes
+  std::string text(buf, n_received);
+  while (true) {
+    const auto n = read(unix_fd, buf, buf_size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      close(unix_fd);
+      close(listen_fd);
+      return {-1, {}, socket_handoff_error::error_receiving};
+    }
+    if (n == 0)
+      break;
+    text.append(buf, n);
+  }
+  close(unix_fd);
+
+  if (!text.empty() && text.back() == '\n')
+    text.pop_back();
+  return {listen_fd, std::move(text), {}};
+}
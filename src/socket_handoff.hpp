@@ -0,0 +1,94 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_SOCKET_HANDOFF_HPP_
+#define SRC_SOCKET_HANDOFF_HPP_
+
+#include <cstdint>  // for std::uint32_t
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>  // for std::true_type
+#include <utility>      // for std::to_underlying, std::unreachable
+
+enum class socket_handoff_error : std::uint32_t {
+  ok = 0,
+  error_connecting = 1,
+  error_sending = 2,
+  error_receiving = 3,
+  no_socket_received = 4,
+};
+
+// register socket_handoff_error as error code enum
+template <>
+struct std::is_error_code_enum<socket_handoff_error> : public std::true_type {
+};
+
+// category to provide text descriptions
+struct socket_handoff_error_category : std::error_category {
+  const char *
+  name() const noexcept override {
+    return "socket_handoff_error";
+  }
+  std::string
+  message(int code) const override {
+    using std::string_literals::operator""s;
+    // clang-format off
+    switch (code) {
+    case 0: return "ok"s;
+    case 1: return "error connecting to handoff socket"s;
+    case 2: return "error sending listening socket"s;
+    case 3: return "error receiving listening socket"s;
+    case 4: return "no listening socket received"s;
+    }
+    // clang-format on
+    std::unreachable();  // hopefully this is unreacheable
+  }
+};
+
+inline std::error_code
+make_error_code(socket_handoff_error e) {
+  static auto category = socket_handoff_error_category{};
+  return std::error_code(std::to_underlying(e), category);
+}
+
+/*
+  A running server hands its listening socket to a new server process
+  over a unix domain socket using SCM_RIGHTS, so the listening socket
+  is never closed and no connection is refused during an upgrade. Text
+  sent with the socket, e.g., accessions of resident methylomes, lets
+  the new process start warm.
+ */
+
+// send listen_fd with the text over the connected unix socket unix_fd
+[[nodiscard]] auto
+send_listening_socket(const int unix_fd, const int listen_fd,
+                      const std::string &text) -> std::error_code;
+
+// connect to the unix socket at path and receive a listening socket
+// along with the text sent with it
+[[nodiscard]] auto
+receive_listening_socket(const std::string &path)
+  -> std::tuple<int, std::string, std::error_code>;
+
+#endif  // SRC_SOCKET_HANDOFF_HPP_
@@ -0,0 +1,116 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "timer_wheel.hpp"
+
+#include <algorithm>  // for std::max
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>  // for std::exchange
+#include <vector>
+
+auto
+timer_wheel::link(entry &e) -> void {
+  const auto span = e.expiry >> level0_bits;
+  const auto now_span = now >> level0_bits;
+  entry **head{};
+  if (e.expiry - now < n_level0_slots)
+    head = &level0[e.expiry % n_level0_slots];
+  else if (span - now_span < n_level1_slots)
+    head = &level1[span % n_level1_slots];
+  else
+    head = &level1[(now_span + n_level1_slots - 1) % n_level1_slots];
+  e.head = head;
+  e.prev = nullptr;
+  e.next = *head;
+  if (e.next)
+    e.next->prev = &e;
+  *head = &e;
+  ++pending;
+}
+
+auto
+timer_wheel::unlink(entry &e) -> void {
+  if (e.prev)
+    e.prev->next = e.next;
+  else
+    *e.head = e.next;
+  if (e.next)
+    e.next->prev = e.prev;
+  e.prev = e.next = nullptr;
+  e.head = nullptr;
+  --pending;
+}
+
+auto
+timer_wheel::set(entry &e, const std::uint64_t n_ticks) -> void {
+  std::scoped_lock lock{mtx};
+  if (e.head)
+    unlink(e);
+  e.expiry = now + std::max<std::uint64_t>(n_ticks, 1);
+  link(e);
+}
+
+auto
+timer_wheel::clear(entry &e) -> void {
+  std::scoped_lock lock{mtx};
+  if (e.head)
+    unlink(e);
+  e.expiry = never;
+}
+
+[[nodiscard]] auto
+timer_wheel::expired(const entry &e) const -> bool {
+  std::scoped_lock lock{mtx};
+  return e.expiry <= now;
+}
+
+[[nodiscard]] auto
+timer_wheel::advance(const std::uint64_t to)
+  -> std::vector<std::function<void()>> {
+  std::vector<std::function<void()>> expired_callbacks;
+  std::scoped_lock lock{mtx};
+  while (now < to) {
+    ++now;
+    // ADS: at the start of each span its entries move down a level,
+    // including any in the current tick, which expire below
+    if (now % n_level0_slots == 0) {
+      auto e = std::exchange(level1[(now >> level0_bits) % n_level1_slots],
+                             nullptr);
+      while (e) {
+        const auto next = e->next;
+        --pending;
+        link(*e);
+        e = next;
+      }
+    }
+    auto &head = level0[now % n_level0_slots];
+    while (head) {
+      auto &e = *head;
+      unlink(e);
+      expired_callbacks.push_back(e.on_expire);
+    }
+  }
+  return expired_callbacks;
+}
@@ -0,0 +1,111 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SRC_TIMER_WHEEL_HPP_
+#define SRC_TIMER_WHEEL_HPP_
+
+#include <array>
+#include <chrono>
+#include <cstddef>     // for std::size_t
+#include <cstdint>     // for std::uint32_t, std::uint64_t
+#include <functional>  // for std::function
+#include <limits>
+#include <mutex>
+#include <vector>
+
+/*
+  timer_wheel: deadlines for many connections at a coarse resolution of
+  one tick. The first level has a slot for each of the next 256 ticks
+  and the second a slot for each of the next 64 spans of 256 ticks;
+  when a span begins, its entries move down to the first level.
+  Deadlines past the second level wait in its last slot and are placed
+  again when it comes around. Setting or clearing a deadline links or
+  unlinks an entry in a list, so either is O(1) however many are
+  pending, and nothing wakes for a deadline that was cleared. Time only
+  moves when advance is called, so the owner decides what a tick is.
+ */
+struct timer_wheel {
+  static constexpr std::uint32_t level0_bits{8};
+  static constexpr std::uint32_t n_level0_slots{1u << level0_bits};
+  static constexpr std::uint32_t n_level1_slots{64};
+  static constexpr std::uint64_t never{
+    std::numeric_limits<std::uint64_t>::max()};
+  static constexpr std::chrono::milliseconds tick{100};
+
+  // ADS: an entry belongs to its owner, which must clear it before
+  // destroying it; on_expire is called without the wheel's lock held
+  struct entry {
+    std::function<void()> on_expire;
+    std::uint64_t expiry{never};
+    entry *prev{};
+    entry *next{};
+    entry **head{};  // slot holding this entry; null if not pending
+  };
+
+  timer_wheel() = default;
+  timer_wheel(const timer_wheel &) = delete;
+  timer_wheel &
+  operator=(const timer_wheel &) = delete;
+
+  [[nodiscard]] static auto
+  to_ticks(const std::chrono::milliseconds d) -> std::uint64_t {
+    return (d + tick - std::chrono::milliseconds{1}) / tick;
+  }
+
+  // expire the entry n_ticks from now, replacing any deadline it had
+  auto
+  set(entry &e, const std::uint64_t n_ticks) -> void;
+
+  auto
+  clear(entry &e) -> void;
+
+  // true if the deadline of the entry has passed; false if it was
+  // set again or cleared after expiring
+  [[nodiscard]] auto
+  expired(const entry &e) const -> bool;
+
+  // move time forward to tick 'to' and return what should be called
+  // for each entry that expired on the way
+  [[nodiscard]] auto
+  advance(const std::uint64_t to) -> std::vector<std::function<void()>>;
+
+  [[nodiscard]] auto
+  n_pending() const -> std::size_t {
+    std::scoped_lock lock{mtx};
+    return pending;
+  }
+
+private:
+  auto
+  link(entry &e) -> void;
+  auto
+  unlink(entry &e) -> void;
+
+  mutable std::mutex mtx;
+  std::uint64_t now{};
+  std::size_t pending{};
+  std::array<entry *, n_level0_slots> level0{};
+  std::array<entry *, n_level1_slots> level1{};
+};
+
+#endif  // SRC_TIMER_WHEEL_HPP_
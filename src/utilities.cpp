@@ -28,6 +28,8 @@
 
 #include <array>
 #include <cerrno>
+#include <cstddef>  // for std::size_t
+#include <cstdint>
 #include <cstdlib>  // for getenv
 #include <fstream>
 #include <string>
@@ -36,7 +38,7 @@
 
 // getpwuid_r
 #include <pwd.h>
-#include <unistd.h>  // for getuid
+#include <unistd.h>  // for getuid, pread
 
 [[nodiscard]] auto
 get_username() -> std::tuple<std::string, std::error_code> {
@@ -65,6 +67,24 @@ get_time_as_string() -> std::string {
   return std::format("{:%F} {:%T}", ymd, hms);
 }
 
+// ADS: pread can return fewer bytes than requested
+[[nodiscard]] auto
+pread_all(const int fd, void *buf, std::size_t n_bytes,
+          std::uint64_t offset) -> bool {
+  auto ptr = static_cast<char *>(buf);
+  while (n_bytes > 0) {
+    const auto n_read = ::pread(fd, ptr, n_bytes, static_cast<off_t>(offset));
+    if (n_read < 0 && errno == EINTR)
+      continue;
+    if (n_read <= 0)
+      return false;
+    ptr += n_read;
+    n_bytes -= n_read;
+    offset += n_read;
+  }
+  return true;
+}
+
 [[nodiscard]] auto
 get_xfrase_config_dir_default(std::error_code &ec) -> std::string {
   static const auto config_dir_rhs = std::filesystem::path(".config/xfrase");
@@ -29,7 +29,8 @@
  */
 
 #include <chrono>
-#include <cstdint>  // for std::uint32_t
+#include <cstddef>  // for std::size_t
+#include <cstdint>  // for std::uint32_t, std::uint64_t
 #include <filesystem>
 #include <format>
 #include <iterator>  // for std::size
@@ -81,6 +82,11 @@ get_username() -> std::tuple<std::string, std::error_code>;
 [[nodiscard]] auto
 get_time_as_string() -> std::string;
 
+// read exactly n_bytes at offset from an open file
+[[nodiscard]] auto
+pread_all(const int fd, void *buf, std::size_t n_bytes,
+          std::uint64_t offset) -> bool;
+
 [[nodiscard]]
 auto
 check_output_file(const std::string &filename) -> std::error_code;
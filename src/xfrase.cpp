@@ -24,15 +24,22 @@
 /* xfrase: methylome transfer engine
  */
 
+#include "command_batch.hpp"
 #include "command_bins.hpp"
 #include "command_check.hpp"
 #include "command_compress.hpp"
 #include "command_config.hpp"
+#include "command_corr.hpp"
 #include "command_format.hpp"
 #include "command_index.hpp"
 #include "command_intervals.hpp"
+#include "command_matrix.hpp"
 #include "command_merge.hpp"
+#include "command_pack.hpp"
+#include "command_profile.hpp"
 #include "command_server.hpp"
+#include "command_sites.hpp"
+#include "command_windows.hpp"
 
 #include <config.h>  // for VERSION
 
@@ -60,7 +67,14 @@ const std::tuple<std::string_view, main_fun, std::string_view> commands[] = {
   {"intervals", command_intervals_main, "get methylation levels in each interval"},
   {"merge", command_merge_main, "merge a set of xfrase format methylomes"},
   {"compress", command_compress_main, "make an xfrase format methylome smaller"},
+  {"pack", command_pack_main, "put many methylomes into one pack file"},
   {"bins", command_bins_main, "get methylation levels in each bin"},
+  {"windows", command_windows_main, "get methylation levels in sliding windows"},
+  {"profile", command_profile_main, "get a methylation profile around features"},
+  {"sites", command_sites_main, "get counts at each CpG site in intervals"},
+  {"corr", command_corr_main, "correlation matrix for a set of methylomes"},
+  {"matrix", command_matrix_main, "bins for many methylomes in one file"},
+  {"batch", command_batch_main, "run many intervals and bins queries at once"},
   {"server", command_server_main, "run a server to respond to lookup queries"},
   // clang-format on
 };
@@ -42,9 +42,12 @@ enum class server_response_code : std::uint32_t {
   index_not_found = 5,
   server_failure = 6,
   bad_request = 7,
+  server_busy = 8,
+  too_many_requests = 9,
+  interval_set_not_found = 10,
 };
 
-static constexpr std::uint32_t server_response_code_n = 8;
+static constexpr std::uint32_t server_response_code_n = 11;
 
 // register server_response_code as error code enum
 template <>
@@ -69,6 +72,9 @@ struct server_response_category : std::error_category {
     case 5: return "index not found"s;
     case 6: return "server failure"s;
     case 7: return "bad request"s;
+    case 8: return "server busy"s;
+    case 9: return "too many requests"s;
+    case 10: return "interval set not found"s;
     }
     // clang-format on
     std::unreachable();  // hopefully
@@ -143,9 +149,11 @@ enum class methylome_code : std::uint32_t {
   error_writing_methylome_header = 6,
   error_writing_methylome = 7,
   incorrect_methylome_size = 8,
+  block_checksum_mismatch = 9,
+  methylome_file_without_header = 10,
 };
 
-static constexpr std::uint32_t methylome_code_n = 9;
+static constexpr std::uint32_t methylome_code_n = 11;
 
 // register methylome_code as error code enum
 template <>
@@ -171,6 +179,8 @@ struct methylome_category : std::error_category {
     case 6: return "error writing methylome header"s;
     case 7: return "error writing methylome"s;
     case 8: return "incorrect methylome size"s;
+    case 9: return "methylome block checksum mismatch"s;
+    case 10: return "methylome file has no header"s;
     }
     // clang-format on
     std::unreachable();  // hopefully
@@ -193,6 +203,7 @@ enum class cpg_index_code : std::uint32_t {
   failure_reading_index_body = 4,
   inconsistent_chromosome_sizes = 5,
   failure_processing_genome_file = 6,
+  interval_set_not_found = 7,
 };
 
 // register cpg_index_code as error code enum
@@ -217,6 +228,7 @@ struct cpg_index_category : std::error_category {
     case 4: return "failure reading index body"s;
     case 5: return "inconsistent chromosome sizes"s;
     case 6: return "failure processing genome file"s;
+    case 7: return "interval set not found"s;
     }
     // clang-format on
     std::unreachable();  // hopefully
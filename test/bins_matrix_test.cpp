@@ -0,0 +1,118 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <bins_matrix.hpp>
+
+#include <cpg_index.hpp>
+#include <cpg_index_meta.hpp>
+#include <genomic_interval.hpp>
+#include <methylome.hpp>
+#include <methylome_metadata.hpp>
+#include <methylome_results_types.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>  // for std::ranges::equal
+#include <cstdint>
+#include <filesystem>
+#include <iterator>  // for std::size
+#include <string>
+#include <tuple>  // for std::get
+#include <vector>
+
+[[nodiscard]] static auto
+same_counts(const counts_res_cov &a, const counts_res_cov &b) -> bool {
+  return a.n_meth == b.n_meth && a.n_unmeth == b.n_unmeth &&
+         a.n_covered == b.n_covered;
+}
+
+TEST(bins_matrix_test, build_and_query) {
+  static constexpr auto bin_size = 1000u;
+  static constexpr auto chunk_size = 5u;  // ADS: small to cross chunks
+  const auto dir =
+    std::filesystem::temp_directory_path() / "xfrase_bins_matrix_test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  const auto matrix_file = (dir / "test.bmx").string();
+
+  const auto [index, cim, index_err] = read_cpg_index("data/tProrsus1.cpg_idx");
+  ASSERT_FALSE(index_err);
+  const auto [meta, meta_err] =
+    methylome_metadata::read("data/SRX012345.m16.json");
+  ASSERT_FALSE(meta_err);
+  const auto [meth, meth_err] = methylome::read("data/SRX012345.m16", meta);
+  ASSERT_FALSE(meth_err);
+  const auto bins = meth.get_bins_cov(bin_size, index, cim);
+
+  // ADS: one methylome twice under different names
+  const std::vector<bins_matrix::source> sources{
+    {"A", "data/SRX012345.m16", "data/SRX012345.m16.json"},
+    {"B", "data/SRX012345.m16", "data/SRX012345.m16.json"},
+  };
+  EXPECT_EQ(bins_matrix::build(matrix_file, index, cim, bin_size, chunk_size,
+                               {sources[0], sources[0]}),
+            bins_matrix_error::duplicate_sample);
+  EXPECT_EQ(bins_matrix::build(matrix_file, index, cim, bin_size, chunk_size,
+                               {{"C", "data/SRX012346.m16",
+                                 "data/SRX012346.m16.json"}}),
+            bins_matrix_error::inconsistent_index);
+  ASSERT_FALSE(bins_matrix::build(matrix_file, index, cim, bin_size,
+                                  chunk_size, sources));
+
+  const auto [matrix, open_err] = bins_matrix::open(matrix_file);
+  ASSERT_FALSE(open_err);
+  EXPECT_EQ(matrix.n_bins, std::size(bins));
+  EXPECT_EQ(matrix.samples, (std::vector<std::string>{"A", "B"}));
+
+  const auto [all, all_err] = matrix.read({0, 1}, 0, matrix.n_bins);
+  ASSERT_FALSE(all_err);
+  ASSERT_EQ(std::size(all), 2 * std::size(bins));
+  EXPECT_TRUE(std::ranges::equal(
+    std::vector(std::cbegin(all), std::cbegin(all) + std::size(bins)), bins,
+    same_counts));
+  EXPECT_TRUE(std::ranges::equal(
+    std::vector(std::cbegin(all) + std::size(bins), std::cend(all)), bins,
+    same_counts));
+
+  // chr2 starts inside a chunk and ends inside another
+  const auto [region, region_err] =
+    genomic_interval::parse_region(cim, "chr2:1500-9000");
+  ASSERT_FALSE(region_err);
+  const auto [first, last] = matrix.get_bin_range(cim, region);
+  EXPECT_EQ(last - first, 8u);
+  const auto [indexes, indexes_err] = matrix.get_sample_indexes({"B"});
+  ASSERT_FALSE(indexes_err);
+  const auto [part, part_err] = matrix.read(indexes, first, last);
+  ASSERT_FALSE(part_err);
+  EXPECT_TRUE(std::ranges::equal(
+    part,
+    std::vector(std::cbegin(bins) + first, std::cbegin(bins) + last),
+    same_counts));
+
+  EXPECT_EQ(std::get<1>(matrix.get_sample_indexes({"C"})),
+            bins_matrix_error::sample_not_in_matrix);
+  EXPECT_EQ(std::get<1>(matrix.read({0}, 0, matrix.n_bins + 1)),
+            bins_matrix_error::invalid_bin_range);
+
+  std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,104 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <block_cache.hpp>
+
+#include <methylome.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cstddef>  // for std::size_t
+#include <cstdint>
+#include <filesystem>
+#include <iterator>  // for std::size
+#include <system_error>
+#include <tuple>  // for std::get
+#include <vector>
+
+TEST(block_cache_test, add_then_load_without_server) {
+  static constexpr auto bs = block_cache::block_size;
+  static constexpr std::uint32_t n_cpgs = 3 * bs + 10;
+  static constexpr std::uint64_t methylome_hash = 0x0123456789abcdef;
+  const auto cache_dir =
+    (std::filesystem::temp_directory_path() / "xfrase_block_cache_test")
+      .string();
+  std::filesystem::remove_all(cache_dir);
+
+  // stands in for the methylome on the server
+  methylome remote;
+  remote.cpgs.resize(n_cpgs);
+  for (std::uint32_t i = 0; i < n_cpgs; ++i)
+    remote.cpgs[i] = {static_cast<methylome::m_count_t>(i % 7),
+                      static_cast<methylome::m_count_t>(i % 5)};
+
+  const std::vector<methylome::offset_pair> offsets{
+    {10, 20},
+    {3 * bs + 2, 3 * bs + 8},
+  };
+  {
+    auto [cache, open_err] = block_cache::open(cache_dir, methylome_hash,
+                                               n_cpgs);
+    EXPECT_FALSE(open_err);
+    const auto missing = cache.get_missing(offsets);
+    const std::vector<methylome::offset_pair> expected{
+      {0, bs},
+      {3 * bs, n_cpgs},
+    };
+    EXPECT_EQ(missing, expected);
+
+    // counts must line up with the missing ranges
+    EXPECT_EQ(cache.add(missing, {remote.cpgs.data(), 10}),
+              std::error_code{block_cache_error::inconsistent_counts});
+
+    methylome::vec fetched;
+    for (const auto [first, last] : missing)
+      fetched.insert(std::cend(fetched), std::cbegin(remote.cpgs) + first,
+                     std::cbegin(remote.cpgs) + last);
+    EXPECT_FALSE(cache.add(missing, fetched));
+  }
+
+  // ADS: a new cache for the same methylome finds the same blocks
+  auto [cache, open_err] = block_cache::open(cache_dir, methylome_hash,
+                                             n_cpgs);
+  EXPECT_FALSE(open_err);
+  EXPECT_TRUE(cache.get_missing(offsets).empty());
+  const auto [local, local_offsets, load_err] = cache.load(offsets);
+  EXPECT_FALSE(load_err);
+  // only the two blocks covering the offsets are held
+  EXPECT_EQ(std::size(local.cpgs), bs + (n_cpgs - 3 * bs));
+  const auto local_counts = local.get_counts(local_offsets);
+  const auto remote_counts = remote.get_counts(offsets);
+  EXPECT_EQ(std::size(local_counts), std::size(remote_counts));
+  for (std::size_t i = 0; i < std::size(local_counts); ++i) {
+    EXPECT_EQ(local_counts[i].n_meth, remote_counts[i].n_meth);
+    EXPECT_EQ(local_counts[i].n_unmeth, remote_counts[i].n_unmeth);
+  }
+
+  // a block that was never fetched
+  const std::vector<methylome::offset_pair> uncached{{bs + 1, bs + 2}};
+  EXPECT_EQ(std::size(cache.get_missing(uncached)), 1);
+  EXPECT_EQ(std::get<2>(cache.load(uncached)),
+            std::error_code{block_cache_error::block_not_cached});
+
+  std::filesystem::remove_all(cache_dir);
+}
@@ -0,0 +1,77 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <client_limits.hpp>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstddef>  // for std::size_t
+#include <format>
+#include <iterator>  // for std::size
+#include <tuple>     // for std::ignore
+
+TEST(client_limits_test, refused_until_refilled) {
+  client_limits_config config;
+  config.requests_per_second = 1;
+  config.request_burst = 2;
+  client_limits limits(config);
+  EXPECT_TRUE(limits.admit("a"));
+  EXPECT_TRUE(limits.admit("a"));
+  EXPECT_FALSE(limits.admit("a"));
+  // other clients have their own buckets
+  EXPECT_TRUE(limits.admit("b"));
+  EXPECT_EQ(limits.clients.at("a").counters.n_refused, 1u);
+}
+
+TEST(client_limits_test, idle_clients_forgotten) {
+  client_limits_config config;
+  config.requests_per_second = 1000;
+  config.request_burst = 1;
+  client_limits limits(config);
+  const auto n_clients = client_limits::max_clients_tracked;
+  for (std::size_t i = 0; i < n_clients; ++i)
+    EXPECT_TRUE(limits.admit(std::format("10.0.0.{}", i)));
+  EXPECT_EQ(std::size(limits.clients), n_clients);
+
+  // ADS: the buckets refill within a millisecond, so every client is
+  // idle by the time another is seen
+  const auto later = client_limits::clock::now() + std::chrono::seconds(1);
+  std::ignore = limits.get_client("10.0.1.0", later);
+  EXPECT_EQ(std::size(limits.clients), 1u);
+  EXPECT_TRUE(limits.clients.contains("10.0.1.0"));
+}
+
+TEST(client_limits_test, clients_in_debt_kept) {
+  client_limits_config config;
+  config.bytes_per_second = 1;
+  client_limits limits(config);
+  const auto n_clients = client_limits::max_clients_tracked;
+  for (std::size_t i = 0; i < n_clients; ++i) {
+    const auto client = std::format("10.0.0.{}", i);
+    EXPECT_TRUE(limits.admit(client));
+    limits.charge_bytes(client, 1000000);
+  }
+  std::ignore = limits.get_client("10.0.1.0", client_limits::clock::now());
+  EXPECT_EQ(std::size(limits.clients), n_clients + 1);
+}
@@ -0,0 +1,157 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <command_corr.hpp>
+
+#include <methylome.hpp>
+#include <methylome_metadata.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>  // for EXIT_SUCCESS
+#include <filesystem>
+#include <fstream>
+#include <iterator>  // for std::size
+#include <sstream>
+#include <string>
+#include <utility>  // for std::swap
+#include <vector>
+
+// ADS: direct two-pass Pearson correlation over the sites with at
+// least min_reads in both methylomes
+[[nodiscard]] static auto
+two_pass_corr(const methylome &a, const methylome &b,
+              const std::uint32_t min_reads) -> double {
+  const auto level = [](const auto &c) {
+    return static_cast<double>(c.first) / (c.first + c.second);
+  };
+  const auto covered = [&](const auto &c) {
+    const std::uint32_t n_reads = c.first + c.second;
+    return n_reads >= min_reads && n_reads > 0;
+  };
+  double n{}, mean_x{}, mean_y{};
+  for (std::size_t i = 0; i < std::size(a.cpgs); ++i)
+    if (covered(a.cpgs[i]) && covered(b.cpgs[i])) {
+      ++n;
+      mean_x += level(a.cpgs[i]);
+      mean_y += level(b.cpgs[i]);
+    }
+  mean_x /= n;
+  mean_y /= n;
+  double cov{}, var_x{}, var_y{};
+  for (std::size_t i = 0; i < std::size(a.cpgs); ++i)
+    if (covered(a.cpgs[i]) && covered(b.cpgs[i])) {
+      const auto dx = level(a.cpgs[i]) - mean_x;
+      const auto dy = level(b.cpgs[i]) - mean_y;
+      cov += dx * dy;
+      var_x += dx * dx;
+      var_y += dy * dy;
+    }
+  return cov / std::sqrt(var_x * var_y);
+}
+
+TEST(command_corr_test, matches_two_pass_correlation) {
+  static constexpr auto index_file = "data/tProrsus1.cpg_idx";
+  static constexpr auto meth_file = "data/SRX012345.m16";
+  const auto dir = std::filesystem::temp_directory_path();
+  const auto other_file = (dir / "xfrase_corr_test.m16").string();
+  const auto output_file = (dir / "xfrase_corr_test.tsv").string();
+
+  const auto [meta, meta_err] = methylome_metadata::read(
+    get_default_methylome_metadata_filename(meth_file));
+  ASSERT_FALSE(meta_err);
+  const auto [meth, meth_err] = methylome::read(meth_file, meta);
+  ASSERT_FALSE(meth_err);
+
+  // ADS: a second methylome on the same index, with some levels
+  // flipped and some reads dropped, written compressed so it is not
+  // streamed like the first
+  methylome other = meth;
+  for (std::size_t i = 0; i < std::size(other.cpgs); ++i) {
+    auto &[n_meth, n_unmeth] = other.cpgs[i];
+    if (i % 3 == 0)
+      std::swap(n_meth, n_unmeth);
+    if (i % 7 == 0)
+      n_meth = n_unmeth = 0;
+    if (i % 5 == 0)
+      ++n_meth;
+  }
+  auto other_meta = meta;
+  other_meta.is_compressed = true;
+  other_meta.methylome_hash = other.hash();
+  ASSERT_FALSE(other.write(other_file, true));
+  ASSERT_FALSE(
+    other_meta.write(get_default_methylome_metadata_filename(other_file)));
+
+  for (const auto min_reads : {"1", "4"}) {
+    const char *command_argv[] = {
+      // clang-format off
+      "corr",
+      "-x",
+      index_file,
+      "-r",
+      min_reads,
+      "-t",
+      "2",
+      "-o",
+      output_file.data(),
+      "-m",
+      meth_file,
+      other_file.data(),
+      // clang-format on
+    };
+    const int command_argc = sizeof(command_argv) / sizeof(command_argv[0]);
+    const int result =
+      command_corr_main(command_argc, const_cast<char **>(command_argv));
+    ASSERT_EQ(result, EXIT_SUCCESS);
+
+    // ADS: rows are the sample name followed by the correlations
+    std::ifstream in(output_file);
+    std::string line;
+    ASSERT_TRUE(std::getline(in, line));  // header
+    std::vector<std::vector<double>> matrix;
+    while (std::getline(in, line)) {
+      std::istringstream iss(line);
+      std::string name;
+      iss >> name;
+      auto &row = matrix.emplace_back();
+      for (double x{}; iss >> x;)
+        row.push_back(x);
+    }
+    ASSERT_EQ(std::size(matrix), 2u);
+    ASSERT_EQ(std::size(matrix[0]), 2u);
+    ASSERT_EQ(std::size(matrix[1]), 2u);
+
+    const auto expected = two_pass_corr(meth, other, std::stoul(min_reads));
+    EXPECT_NEAR(matrix[0][0], 1.0, 1e-4);
+    EXPECT_NEAR(matrix[1][1], 1.0, 1e-4);
+    EXPECT_NEAR(matrix[0][1], expected, 1e-4);
+    EXPECT_NEAR(matrix[1][0], expected, 1e-4);
+  }
+
+  std::filesystem::remove(other_file);
+  std::filesystem::remove(get_default_methylome_metadata_filename(other_file));
+  std::filesystem::remove(output_file);
+}
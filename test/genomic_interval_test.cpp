@@ -29,9 +29,15 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>  // for std::ranges::stable_sort
+#include <cstddef>
+#include <cstdint>
 #include <iterator>
+#include <random>
 #include <string>
+#include <tuple>  // for std::tie
 #include <unordered_map>
+#include <vector>
 
 TEST(genomic_interval_test, basic_assertions) {
   static constexpr auto index_file{"data/tProrsus1.cpg_idx"};
@@ -106,3 +112,46 @@ TEST(genomic_interval_test, stop_position_exceeds_chromosome_size) {
   EXPECT_EQ(result.start, 0);
   EXPECT_EQ(result.stop, 0);
 }
+
+TEST(genomic_interval_test, sort_intervals_restores_input_order) {
+  const std::vector<genomic_interval> input{
+    {1, 500, 600}, {0, 300, 400}, {1, 100, 200}, {0, 300, 350}, {0, 10, 20},
+  };
+  for (const std::uint32_t n_threads : {1u, 4u}) {
+    auto gis = input;
+    const auto order = sort_intervals(gis, n_threads);
+    const std::vector<genomic_interval> expected{
+      {0, 10, 20}, {0, 300, 400}, {0, 300, 350}, {1, 100, 200}, {1, 500, 600},
+    };
+    EXPECT_EQ(gis, expected);  // stable: equal starts keep input order
+    EXPECT_EQ(restore_input_order(gis, order), input);
+  }
+}
+
+TEST(genomic_interval_test, parallel_sort_intervals_matches_stable_sort) {
+  // ADS: enough intervals that each of 4 threads gets its own chunk;
+  // starts are drawn from a small range so many are equal, and the
+  // stops tell equal starts apart to check the sort is stable
+  static constexpr std::size_t n_intervals{300000};
+  static constexpr std::uint32_t n_threads{4};
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<std::int32_t> chrom(0, 23);
+  std::uniform_int_distribution<std::uint32_t> start(0, 100000);
+  std::uniform_int_distribution<std::uint32_t> length(1, 1000);
+  std::vector<genomic_interval> input(n_intervals);
+  for (auto &gi : input) {
+    gi.ch_id = chrom(rng);
+    gi.start = start(rng);
+    gi.stop = gi.start + length(rng);
+  }
+
+  auto expected = input;
+  std::ranges::stable_sort(expected, [](const auto &a, const auto &b) {
+    return std::tie(a.ch_id, a.start) < std::tie(b.ch_id, b.start);
+  });
+
+  auto gis = input;
+  const auto order = sort_intervals(gis, n_threads);
+  EXPECT_EQ(gis, expected);
+  EXPECT_EQ(restore_input_order(gis, order), input);
+}
@@ -0,0 +1,132 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <merge_accumulator.hpp>
+
+#include <methylome.hpp>
+#include <methylome_metadata.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <system_error>
+
+TEST(merge_accumulator_test, add_and_remove) {
+  static constexpr auto filename{"data/SRX012345.m16"};
+  const auto [meth, meta, meth_err] = read_methylome(filename);
+  EXPECT_FALSE(meth_err);
+
+  auto acc = merge_accumulator::init(meta);
+  EXPECT_EQ(size(acc), size(meth));
+
+  EXPECT_FALSE(acc.add(meth, meta));
+  EXPECT_TRUE(acc.contains(meta.methylome_hash));
+  EXPECT_EQ(acc.add(meth, meta),
+            std::error_code{merge_accumulator_error::methylome_already_merged});
+
+  const auto [merged, merged_meta, merged_err] = acc.get_methylome();
+  EXPECT_FALSE(merged_err);
+  EXPECT_TRUE(std::ranges::equal(merged.cpgs, meth.cpgs));
+  EXPECT_EQ(merged_meta.methylome_hash, meth.hash());
+  EXPECT_EQ(merged_meta.n_cpgs, meta.n_cpgs);
+
+  EXPECT_FALSE(acc.remove(meth, meta));
+  EXPECT_FALSE(acc.contains(meta.methylome_hash));
+  EXPECT_TRUE(std::ranges::all_of(acc.cpgs, [](const auto &x) {
+    return x == merge_accumulator::a_elem{};
+  }));
+  EXPECT_EQ(acc.remove(meth, meta),
+            std::error_code{merge_accumulator_error::methylome_not_merged});
+}
+
+TEST(merge_accumulator_test, inconsistent_methylome) {
+  const auto [meth, meta, meth_err] = read_methylome("data/SRX012345.m16");
+  EXPECT_FALSE(meth_err);
+  const auto [other, other_meta, other_err] =
+    read_methylome("data/SRX012346.m16");
+  EXPECT_FALSE(other_err);
+
+  auto acc = merge_accumulator::init(meta);
+  EXPECT_EQ(acc.add(other, other_meta),
+            std::error_code{merge_accumulator_error::inconsistent_methylome});
+}
+
+TEST(merge_accumulator_test, counts_rounded_to_fit) {
+  const auto [meth, meta, meth_err] = read_methylome("data/SRX012345.m16");
+  EXPECT_FALSE(meth_err);
+  auto acc = merge_accumulator::init(meta);
+  acc.cpgs[0] = {131070, 65535};
+  const auto [merged, merged_meta, merged_err] = acc.get_methylome();
+  EXPECT_FALSE(merged_err);
+  EXPECT_EQ(merged.cpgs[0], methylome::m_elem(65535, 32768));
+}
+
+TEST(merge_accumulator_test, counts_above_maximum) {
+  const auto [meth, meta, meth_err] = read_methylome("data/SRX012345.m16");
+  EXPECT_FALSE(meth_err);
+  auto acc = merge_accumulator::init(meta);
+  const auto itr = std::ranges::find_if(
+    meth.cpgs, [](const auto &x) { return x.first > 0; });
+  ASSERT_NE(itr, std::cend(meth.cpgs));
+  const auto i = std::distance(std::cbegin(meth.cpgs), itr);
+  acc.cpgs[i].first = std::numeric_limits<merge_accumulator::a_count_t>::max();
+  const auto before = acc.cpgs;
+  EXPECT_EQ(acc.add(meth, meta),
+            std::error_code{merge_accumulator_error::counts_above_maximum});
+  EXPECT_EQ(acc.cpgs, before);
+  EXPECT_FALSE(acc.contains(meta.methylome_hash));
+}
+
+TEST(merge_accumulator_test, write_then_read) {
+  const auto [meth, meta, meth_err] = read_methylome("data/SRX012345.m16");
+  EXPECT_FALSE(meth_err);
+  auto acc = merge_accumulator::init(meta);
+  EXPECT_FALSE(acc.add(meth, meta));
+
+  const auto dir = std::filesystem::temp_directory_path() /
+                   "xfrase_merge_accumulator_test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  const auto filename =
+    (dir / (std::string{"acc"} + merge_accumulator::filename_extension))
+      .string();
+  const auto meta_filename =
+    get_default_merge_accumulator_metadata_filename(filename);
+  EXPECT_FALSE(acc.write(filename, meta_filename));
+  // ADS: writing again replaces both files and leaves no others
+  EXPECT_FALSE(acc.write(filename, meta_filename));
+  EXPECT_EQ(std::distance(std::filesystem::directory_iterator(dir),
+                          std::filesystem::directory_iterator{}),
+            2);
+
+  const auto [read_acc, read_err] =
+    merge_accumulator::read(filename, meta_filename);
+  EXPECT_FALSE(read_err);
+  EXPECT_EQ(read_acc.cpgs, acc.cpgs);
+  EXPECT_EQ(read_acc.meta.methylome_hashes, acc.meta.methylome_hashes);
+  std::filesystem::remove_all(dir);
+}
@@ -24,14 +24,27 @@
 #include <methylome_set.hpp>
 #include <xfrase_error.hpp>
 
+#include <methylome.hpp>
+#include <methylome_metadata.hpp>
+#include <methylome_pack.hpp>
+
 #include <gtest/gtest.h>
 
-#include <cstdint>   // for std::uint32_t
+#include <algorithm>  // for std::equal
+#include <atomic>
+#include <cstdint>  // for std::uint32_t
+#include <filesystem>
+#include <format>
+#include <fstream>
 #include <iterator>  // for std::size
+#include <limits>
 #include <memory>    // for std::unique_ptr, std::shared_ptr
 #include <string>
+#include <system_error>
+#include <thread>
 #include <tuple>  // for std::get
 #include <unordered_map>
+#include <vector>
 
 class methylome_set_test : public ::testing::Test {
 protected:
@@ -66,3 +79,221 @@ TEST_F(methylome_set_test, methylome_file_not_found) {
   const auto result = methylome_set_ptr->get_methylome("DRX000000");
   EXPECT_EQ(std::get<2>(result), methylome_set_code::methylome_file_not_found);
 }
+
+TEST_F(methylome_set_test, get_methylome_from_pack) {
+  const auto pack_dir =
+    std::filesystem::temp_directory_path() / "xfrase_methylome_set_test";
+  std::filesystem::remove_all(pack_dir);
+  std::filesystem::create_directories(pack_dir);
+  const auto pack_file = (pack_dir / "test.mpk").string();
+
+  const std::vector<methylome_pack::source> first{
+    {"SRX012345", "data/SRX012345.m16", "data/SRX012345.m16.json"},
+  };
+  const std::vector<methylome_pack::source> second{
+    {"SRX012346", "data/SRX012346.m16", "data/SRX012346.m16.json"},
+  };
+  EXPECT_FALSE(methylome_pack::append(pack_file, first));
+  EXPECT_EQ(methylome_pack::append(pack_file, first),
+            methylome_pack_error::accession_already_in_pack);
+  EXPECT_FALSE(methylome_pack::append(pack_file, second));
+
+  // appends leave no temporary files behind
+  EXPECT_EQ(std::distance(std::filesystem::directory_iterator(pack_dir),
+                          std::filesystem::directory_iterator{}),
+            1);
+
+  // a pack that cannot be opened is skipped
+  std::ofstream(pack_dir / "bad.mpk") << "not a pack";
+
+  methylome_set ms(max_live_methylomes, pack_dir.string());
+  EXPECT_FALSE(ms.open_packs());
+  EXPECT_EQ(std::size(ms.packs), 1);
+  EXPECT_EQ(std::size(ms.accession_to_pack), 2);
+
+  const auto [meth, meta, ec] = ms.get_methylome("SRX012346");
+  EXPECT_FALSE(ec);
+  const auto [file_meth, file_meta, file_ec] =
+    read_methylome("data/SRX012346.m16");
+  EXPECT_FALSE(file_ec);
+  ASSERT_TRUE(meth != nullptr && meta != nullptr);
+  EXPECT_EQ(meth->cpgs, file_meth.cpgs);
+  EXPECT_EQ(meta->methylome_hash, file_meta.methylome_hash);
+
+  std::filesystem::remove_all(pack_dir);
+}
+
+TEST_F(methylome_set_test, pack_entry_sizes_cannot_wrap) {
+  const auto pack_dir =
+    std::filesystem::temp_directory_path() / "xfrase_pack_entry_test";
+  std::filesystem::remove_all(pack_dir);
+  std::filesystem::create_directories(pack_dir);
+  const auto pack_file = (pack_dir / "test.mpk").string();
+  EXPECT_FALSE(methylome_pack::append(
+    pack_file,
+    {{"SRX012345", "data/SRX012345.m16", "data/SRX012345.m16.json"}}));
+  const auto size_before = std::filesystem::file_size(pack_file);
+
+  // ADS: with one entry, its data_size is the last field in the file;
+  // a size that would wrap past the directory offset must be refused
+  {
+    std::fstream f(pack_file, std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(-static_cast<std::streamoff>(sizeof(std::uint64_t)),
+            std::ios::end);
+    const auto bad_size = std::numeric_limits<std::uint64_t>::max();
+    f.write(reinterpret_cast<const char *>(&bad_size), sizeof(bad_size));
+  }
+  EXPECT_EQ(std::get<1>(methylome_pack::open(pack_file)),
+            std::error_code{methylome_pack_error::invalid_pack_directory});
+
+  // ADS: an append that fails leaves the file as it was
+  EXPECT_TRUE(methylome_pack::append(
+    pack_file,
+    {{"SRX012346", "data/SRX012346.m16", "data/SRX012346.m16.json"}}));
+  EXPECT_EQ(std::filesystem::file_size(pack_file), size_before);
+  std::filesystem::remove_all(pack_dir);
+}
+
+TEST_F(methylome_set_test, evicted_methylome_kept_warm) {
+  static constexpr std::uint64_t max_warm_bytes = 64 * 1024 * 1024;
+  methylome_set ms(1, methylome_directory, 0, max_warm_bytes);
+
+  const auto [first_meth, first_meta, first_ec] =
+    ms.get_methylome("SRX012345");
+  EXPECT_FALSE(first_ec);
+  const auto [second_meth, second_meta, second_ec] =
+    ms.get_methylome("SRX012346");
+  EXPECT_FALSE(second_ec);
+
+  // the first is evicted from the hot tier but kept warm
+  EXPECT_EQ(std::size(ms.accession_to_methylome), 1);
+  EXPECT_TRUE(ms.accession_to_warm.contains("SRX012345"));
+  EXPECT_GT(ms.warm_bytes, 0);
+
+  const auto [meth, meta, ec] = ms.get_methylome("SRX012345");
+  EXPECT_FALSE(ec);
+  EXPECT_FALSE(ms.accession_to_warm.contains("SRX012345"));
+  EXPECT_TRUE(ms.accession_to_warm.contains("SRX012346"));
+  ASSERT_TRUE(meth != nullptr && first_meth != nullptr);
+  EXPECT_EQ(meth->cpgs, first_meth->cpgs);
+}
+
+TEST_F(methylome_set_test, concurrent_requests_through_warm_tier) {
+  static constexpr std::uint64_t max_warm_bytes = 64 * 1024 * 1024;
+  static constexpr auto n_threads = 4;
+  static constexpr auto n_requests = 50;
+  // ADS: one hot methylome, so every other request is evicting,
+  // compressing and decompressing while other threads do the same
+  methylome_set ms(1, methylome_directory, 0, max_warm_bytes);
+  const std::vector<std::string> accessions{"SRX012345", "SRX012346"};
+  std::vector<methylome> expected;
+  for (const auto &accession : accessions) {
+    auto [meth, meta, ec] = read_methylome(
+      std::format("{}/{}.m16", methylome_directory, accession));
+    ASSERT_FALSE(ec);
+    expected.push_back(std::move(meth));
+  }
+
+  std::atomic<std::uint32_t> n_errors{};
+  {
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < n_threads; ++i)
+      threads.emplace_back([&, i] {
+        for (auto j = 0; j < n_requests; ++j) {
+          const auto k = (i + j) % std::size(accessions);
+          const auto [meth, meta, ec] = ms.get_methylome(accessions[k]);
+          if (ec || meth == nullptr || meth->cpgs != expected[k].cpgs)
+            ++n_errors;
+        }
+      });
+  }
+  EXPECT_EQ(n_errors.load(), 0u);
+  EXPECT_EQ(std::size(ms.accession_to_methylome), 1);
+}
+
+TEST_F(methylome_set_test, chrom_loaded_on_its_own) {
+  methylome_set ms(max_live_methylomes, methylome_directory, 0, 0, true);
+  const auto [meta, meta_ec] = ms.get_methylome_metadata("SRX012345");
+  EXPECT_FALSE(meta_ec);
+  ASSERT_TRUE(meta != nullptr);
+  EXPECT_TRUE(ms.accession_to_methylome.empty());
+
+  const std::uint32_t first = meta->n_cpgs / 3;
+  const std::uint32_t n = meta->n_cpgs / 3;
+  const auto [chrom, chrom_meta, chrom_first, chrom_ec] =
+    ms.get_methylome_chrom("SRX012345", 1, first, n);
+  EXPECT_FALSE(chrom_ec);
+  ASSERT_TRUE(chrom != nullptr);
+  EXPECT_EQ(chrom_first, first);
+  EXPECT_TRUE(ms.accession_to_methylome.contains("SRX012345:1"));
+  EXPECT_FALSE(ms.accession_to_methylome.contains("SRX012345"));
+
+  const auto [whole, whole_meta, whole_ec] =
+    read_methylome("data/SRX012345.m16");
+  EXPECT_FALSE(whole_ec);
+  ASSERT_EQ(std::size(chrom->cpgs), n);
+  EXPECT_TRUE(std::equal(std::cbegin(chrom->cpgs), std::cend(chrom->cpgs),
+                         std::cbegin(whole.cpgs) + first));
+
+  // a chrom counts as its whole methylome for a server taking over
+  EXPECT_EQ(ms.get_resident_accessions(),
+            std::vector<std::string>{"SRX012345"});
+}
+
+TEST_F(methylome_set_test, compressed_chroms_served_from_whole) {
+  const auto dir =
+    std::filesystem::temp_directory_path() / "xfrase_compressed_chroms";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  auto [whole, whole_meta, whole_ec] = read_methylome("data/SRX012345.m16");
+  ASSERT_FALSE(whole_ec);
+  whole_meta.is_compressed = true;
+  const auto filename = (dir / "SRX012345.m16").string();
+  ASSERT_FALSE(whole.write(filename, true));
+  ASSERT_FALSE(
+    whole_meta.write(get_default_methylome_metadata_filename(filename)));
+
+  // ADS: the whole methylome is decompressed once and made hot, and
+  // both chroms are served from it without a copy of either
+  methylome_set ms(max_live_methylomes, dir.string(), 0, 0, true);
+  const std::uint32_t n = whole_meta.n_cpgs / 3;
+  for (const std::int32_t ch_id : {0, 1}) {
+    const auto [chrom, chrom_meta, chrom_first, chrom_ec] =
+      ms.get_methylome_chrom("SRX012345", ch_id, ch_id * n, n);
+    EXPECT_FALSE(chrom_ec);
+    ASSERT_TRUE(chrom != nullptr);
+    EXPECT_EQ(chrom_first, 0u);
+    ASSERT_EQ(std::size(chrom->cpgs), std::size(whole.cpgs));
+    EXPECT_TRUE(std::equal(std::cbegin(chrom->cpgs) + ch_id * n,
+                           std::cbegin(chrom->cpgs) + (ch_id + 1) * n,
+                           std::cbegin(whole.cpgs) + ch_id * n));
+  }
+  EXPECT_TRUE(ms.accession_to_methylome.contains("SRX012345"));
+  EXPECT_EQ(std::size(ms.accession_to_methylome), 1);
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(methylome_set_test, v2_read_error_not_missing_metadata) {
+  const auto dir = std::filesystem::temp_directory_path() / "xfrase_v2_error";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  const auto [meth, meta, ec] = read_methylome("data/SRX012345.m16");
+  ASSERT_FALSE(ec);
+  const auto filename = (dir / "SRX012345.m16").string();
+  ASSERT_FALSE(meth.write_v2(filename, meta));
+  // ADS: a v2 file cut short has a header that does not fit the file,
+  // and no JSON file is needed to say so
+  std::filesystem::resize_file(filename, methylome_file_header::n_bytes + 8);
+
+  methylome_set ms(max_live_methylomes, dir.string());
+  const auto [v2_meth, v2_meta, v2_ec] = ms.get_methylome("SRX012345");
+  EXPECT_EQ(v2_ec,
+            std::error_code{methylome_code::invalid_methylome_header});
+
+  methylome_set chrom_ms(max_live_methylomes, dir.string(), 0, 0, true);
+  const auto [chrom, chrom_meta, chrom_first, chrom_ec] =
+    chrom_ms.get_methylome_chrom("SRX012345", 0, 0, 1);
+  EXPECT_EQ(chrom_ec,
+            std::error_code{methylome_code::invalid_methylome_header});
+  std::filesystem::remove_all(dir);
+}
@@ -23,12 +23,24 @@
 
 #include <methylome.hpp>
 
+#include <cpg_index.hpp>
+#include <cpg_index_meta.hpp>
+#include <genomic_interval.hpp>
 #include <methylome_metadata.hpp>
+#include <methylome_results_types.hpp>
+#include <xfrase_error.hpp>
 
 #include <gtest/gtest.h>
 
+#include <cstddef>  // for offsetof
 #include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <system_error>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 TEST(methylome_test, basic_assertions) {
   std::uint32_t n_meth{65536};
@@ -49,3 +61,442 @@ TEST(methylome_test, valid_read) {
 
   EXPECT_EQ(size(meth), 6053);
 }
+
+TEST(methylome_test, windows_sliding_sums) {
+  // ADS: one chrom of size 100 with CpGs at 5, 15, ..., 95
+  cpg_index index;
+  index.positions.push_back({5, 15, 25, 35, 45, 55, 65, 75, 85, 95});
+  cpg_index_meta cim;
+  cim.chrom_size = {100};
+  cim.chrom_offset = {0};
+  methylome meth;
+  for (std::uint16_t i = 0; i < 10; ++i)
+    meth.cpgs.emplace_back(i, 1);
+
+  // windows of 30 stepping by 10 start at 0, 10, ..., 90
+  const auto windows = meth.get_windows(30, 10, index, cim);
+  EXPECT_EQ(std::size(windows), 10);
+  EXPECT_EQ(windows[0].n_meth, 0 + 1 + 2);
+  EXPECT_EQ(windows[1].n_meth, 1 + 2 + 3);
+  EXPECT_EQ(windows[8].n_meth, 8 + 9);
+  EXPECT_EQ(windows[9].n_meth, 9);
+  EXPECT_EQ(windows[0].n_unmeth, 3);
+  EXPECT_EQ(windows[9].n_unmeth, 1);
+
+  // windows with step equal to size are the same as bins
+  const auto bins = meth.get_bins(20, index, cim);
+  const auto same = meth.get_windows(20, 20, index, cim);
+  ASSERT_EQ(std::size(bins), std::size(same));
+  for (std::size_t i = 0; i < std::size(bins); ++i) {
+    EXPECT_EQ(bins[i].n_meth, same[i].n_meth);
+    EXPECT_EQ(bins[i].n_unmeth, same[i].n_unmeth);
+  }
+
+  // gaps between windows when the step exceeds the size
+  const auto gapped = meth.get_windows_cov(10, 40, index, cim);
+  EXPECT_EQ(std::size(gapped), 3);
+  EXPECT_EQ(gapped[1].n_meth, 4);
+  EXPECT_EQ(gapped[1].n_covered, 1);
+
+  const std::vector<genomic_interval> regions{{0, 40, 70}};
+  const auto in_region = meth.get_windows(20, 10, index, cim, regions);
+  EXPECT_EQ(std::size(in_region), 3);
+  EXPECT_EQ(in_region[0].n_meth, 4 + 5);
+  EXPECT_EQ(in_region[2].n_meth, 6);
+}
+
+TEST(methylome_test, bins_near_end_of_long_chrom) {
+  // ADS: a region starting past 2^31 with bins that would end past
+  // 2^32 if positions were kept in 32 bits
+  static constexpr std::uint32_t chrom_size{4'000'000'000u};
+  static constexpr std::uint32_t bin_size{2'000'000'000u};
+  cpg_index index;
+  index.positions.push_back({5, 3'500'000'000u});
+  cpg_index_meta cim;
+  cim.chrom_size = {chrom_size};
+  cim.chrom_offset = {0};
+  methylome meth;
+  meth.cpgs.emplace_back(1, 2);
+  meth.cpgs.emplace_back(3, 4);
+
+  const std::vector<genomic_interval> regions{{0, 3'000'000'000u, chrom_size}};
+  EXPECT_EQ(cim.get_n_bins(bin_size, regions), 1u);
+  const auto bins = meth.get_bins(bin_size, index, cim, regions);
+  ASSERT_EQ(std::size(bins), 1u);
+  EXPECT_EQ(bins[0].n_meth, 3);
+  const auto windows = meth.get_windows(bin_size, bin_size, index, cim,
+                                        regions);
+  ASSERT_EQ(std::size(windows), 1u);
+  EXPECT_EQ(windows[0].n_unmeth, 4);
+
+  // whole chrom: bins at 0 and 2e9 only
+  EXPECT_EQ(cim.get_n_bins(bin_size), 2u);
+  EXPECT_EQ(std::size(meth.get_bins(bin_size, index, cim)), 2u);
+
+  // ADS: repeated regions give more bins than fit in 32 bits
+  const std::vector<genomic_interval> repeated(3, {0, 0, chrom_size});
+  EXPECT_EQ(cim.get_n_bins(1, repeated), 3ull * chrom_size);
+}
+
+TEST(methylome_test, multi_bins_one_pass) {
+  cpg_index index;
+  index.positions.push_back({5, 15, 25, 35, 45, 55, 65, 75, 85, 95});
+  index.positions.push_back({3, 33});
+  cpg_index_meta cim;
+  cim.chrom_size = {100, 50};
+  cim.chrom_offset = {0, 10};
+  methylome meth;
+  for (std::uint16_t i = 0; i < 12; ++i)
+    meth.cpgs.emplace_back(i, 1);
+
+  const auto check = [&](const std::vector<std::uint32_t> &bin_sizes,
+                         const auto &multi, const auto &get_single) {
+    const auto offsets = cim.get_bins_offsets(bin_sizes);
+    ASSERT_EQ(std::size(multi), offsets.back());
+    for (std::size_t k = 0; k < std::size(bin_sizes); ++k) {
+      const auto single = get_single(bin_sizes[k]);
+      ASSERT_EQ(std::size(single), offsets[k + 1] - offsets[k]);
+      for (std::size_t i = 0; i < std::size(single); ++i) {
+        EXPECT_EQ(multi[offsets[k] + i].n_meth, single[i].n_meth);
+        EXPECT_EQ(multi[offsets[k] + i].n_unmeth, single[i].n_unmeth);
+      }
+    }
+  };
+  const auto bins = [&](const auto b) { return meth.get_bins(b, index, cim); };
+
+  // sizes that nest are rolled up from the smallest
+  const std::vector<std::uint32_t> nested{40, 10, 20};
+  check(nested, meth.get_multi_bins(nested, index, cim), bins);
+
+  // sizes that do not nest are counted in a single scan
+  const std::vector<std::uint32_t> fused{30, 7, 20};
+  check(fused, meth.get_multi_bins(fused, index, cim), bins);
+
+  const std::vector<genomic_interval> regions{{0, 12, 70}, {1, 0, 40}};
+  const auto in_regions = [&](const auto b) {
+    return meth.get_bins(b, index, cim, regions);
+  };
+  const auto offsets = cim.get_bins_offsets(fused, regions);
+  ASSERT_EQ(std::size(offsets), 4);
+  check(fused, meth.get_multi_bins(fused, index, cim, regions), in_regions);
+  check(nested, meth.get_multi_bins(nested, index, cim, regions), in_regions);
+
+  const auto cov = meth.get_multi_bins_cov(nested, index, cim);
+  EXPECT_EQ(cov[0].n_covered, 4);
+}
+
+TEST(methylome_test, profile_around_anchors) {
+  cpg_index index;
+  index.positions.push_back({5, 15, 25, 35, 45, 55, 65, 75, 85, 95});
+  cpg_index_meta cim;
+  cim.chrom_size = {100};
+  cim.chrom_offset = {0};
+  methylome meth;
+  for (std::uint16_t i = 0; i < 10; ++i)
+    meth.cpgs.emplace_back(i, 1);
+
+  const auto n_meth = [](const auto &profile) {
+    std::vector<std::uint32_t> v;
+    for (const auto &x : profile)
+      v.push_back(x.n_meth);
+    return v;
+  };
+  using v32 = std::vector<std::uint32_t>;
+
+  // two flank bins of 10 on each side and two bins in the body
+  const std::vector<profile_anchor> fwd{{0, 40, 60, 0}};
+  const std::vector<profile_anchor> rev{{0, 40, 60, 1}};
+  EXPECT_EQ(n_meth(meth.get_profile(20, 2, 2, index, cim, fwd)),
+            (v32{2, 3, 4, 5, 6, 7}));
+  EXPECT_EQ(n_meth(meth.get_profile(20, 2, 2, index, cim, rev)),
+            (v32{7, 6, 5, 4, 3, 2}));
+
+  // without body bins the flanks are around the 5' end
+  EXPECT_EQ(n_meth(meth.get_profile(20, 2, 0, index, cim, fwd)),
+            (v32{2, 3, 4, 5}));
+  EXPECT_EQ(n_meth(meth.get_profile(20, 2, 0, index, cim, rev)),
+            (v32{7, 6, 5, 4}));
+
+  // profiles are summed over anchors, and flanks stop at chrom ends
+  const std::vector<profile_anchor> both{{0, 0, 10, 0}, {0, 40, 60, 0}};
+  const auto profile = meth.get_profile_cov(20, 2, 0, index, cim, both);
+  EXPECT_EQ(n_meth(profile), (v32{2, 3, 4, 6}));
+  EXPECT_EQ(profile[0].n_covered, 1);
+  EXPECT_EQ(profile[3].n_covered, 2);
+}
+
+TEST(methylome_test, lazy_block_verification) {
+  methylome meth;
+  for (std::uint16_t i = 0; i < 10; ++i)
+    meth.cpgs.emplace_back(i, 1);
+
+  methylome_metadata meta;
+  meta.block_size = 4;
+  meta.block_hashes = meth.get_block_hashes(meta.block_size);
+  EXPECT_EQ(std::size(meta.block_hashes), 3);
+  EXPECT_FALSE(meth.init_block_status(meta));
+
+  // corrupt the last block after its checksum was taken
+  meth.cpgs[9].first = 100;
+  EXPECT_FALSE(meth.verify_blocks(0, 8));
+  EXPECT_TRUE(meth.verify_blocks(7, 9));
+  EXPECT_EQ(meth.verify_all_blocks(2),
+            std::error_code{methylome_code::block_checksum_mismatch});
+
+  // without block checksums nothing is verified
+  methylome_metadata old_meta;
+  EXPECT_FALSE(meth.init_block_status(old_meta));
+  EXPECT_FALSE(meth.verify_all_blocks(2));
+}
+
+TEST(methylome_test, extended_counts_in_one_pass) {
+  methylome meth;
+  meth.cpgs = {{1, 3}, {0, 0}, {2, 0}, {0, 4}, {0, 0}};
+
+  const auto ext = meth.get_counts_ext(0, 5);
+  const auto cov = meth.get_counts_cov(0, 5);
+  EXPECT_EQ(ext.n_meth, cov.n_meth);
+  EXPECT_EQ(ext.n_unmeth, cov.n_unmeth);
+  EXPECT_EQ(ext.n_covered, cov.n_covered);
+  EXPECT_EQ(ext.n_sites, 5);
+  // ADS: levels of covered sites are 0.25, 1 and 0
+  EXPECT_DOUBLE_EQ(ext.sum_levels, 1.25);
+  EXPECT_DOUBLE_EQ(ext.sum_sq_levels, 1.0625);
+  EXPECT_DOUBLE_EQ(get_mean_level(ext), 1.25 / 3);
+  EXPECT_DOUBLE_EQ(get_covered_fraction(ext), 0.6);
+
+  const std::vector<methylome::offset_pair> offsets{{0, 2}, {4, 5}};
+  const auto by_offsets = meth.get_counts_ext(offsets);
+  ASSERT_EQ(std::size(by_offsets), 2);
+  EXPECT_EQ(by_offsets[0].n_covered, 1);
+  EXPECT_DOUBLE_EQ(get_level_variance(by_offsets[0]), 0.0);
+  EXPECT_EQ(by_offsets[1].n_sites, 1);
+  EXPECT_DOUBLE_EQ(get_mean_level(by_offsets[1]), 0.0);
+}
+
+TEST(methylome_test, narrow_count_width_round_trip) {
+  methylome meth;
+  meth.cpgs = {{1, 3}, {0, 0}, {600, 300}, {255, 0}};
+  meth.round_to_width(8);
+  EXPECT_EQ(meth.cpgs[0], methylome::m_elem(1, 3));
+  EXPECT_EQ(meth.cpgs[2], methylome::m_elem(255, 128));
+  EXPECT_EQ(meth.cpgs[3], methylome::m_elem(255, 0));
+
+  methylome_metadata meta;
+  meta.n_cpgs = std::size(meth.cpgs);
+  meta.count_width = 8;
+  meta.block_size = 2;
+  meta.block_hashes = meth.get_block_hashes(meta.block_size);
+
+  const auto filename = (std::filesystem::temp_directory_path() /
+                         "xfrase_count_width_test.m16")
+                          .string();
+  for (const auto zip : {false, true}) {
+    meta.is_compressed = zip;
+    ASSERT_FALSE(meth.write(filename, zip, meta.count_width));
+    if (!zip)
+      EXPECT_EQ(std::filesystem::file_size(filename),
+                meta.n_cpgs * sizeof(methylome::m8_elem));
+    const auto [from_file, read_err] = methylome::read(filename, meta);
+    EXPECT_FALSE(read_err);
+    EXPECT_EQ(from_file.cpgs, meth.cpgs);
+    EXPECT_FALSE(from_file.verify_all_blocks(1));
+  }
+
+  // ADS: a slice of narrow counts is checked against the same hashes
+  meta.is_compressed = false;
+  ASSERT_FALSE(meth.write(filename, false, meta.count_width));
+  const auto [slice, slice_err] = methylome::read_slice(filename, meta, 2, 2);
+  EXPECT_FALSE(slice_err);
+  EXPECT_EQ(slice.cpgs[0], meth.cpgs[2]);
+  std::filesystem::remove(filename);
+}
+
+TEST(methylome_test, narrow_counts_match_wide_counts) {
+  methylome wide;
+  for (std::uint16_t i = 0; i < 10; ++i)
+    wide.cpgs.emplace_back(i % 3, 25 * i);
+  methylome_metadata meta;
+  meta.n_cpgs = std::size(wide.cpgs);
+  meta.count_width = 8;
+  meta.block_size = 4;
+  meta.block_hashes = wide.get_block_hashes(meta.block_size);
+
+  auto narrow = wide;
+  narrow.narrow(meta.count_width);
+  ASSERT_TRUE(narrow.is_narrow());
+  EXPECT_TRUE(std::empty(narrow.cpgs));
+  EXPECT_EQ(narrow.get_n_cpgs(), wide.get_n_cpgs());
+  EXPECT_EQ(2 * narrow.get_n_bytes(), wide.get_n_bytes());
+
+  // ADS: checksums are of the counts as m_count_t for either width
+  EXPECT_EQ(narrow.hash(), wide.hash());
+  EXPECT_EQ(narrow.get_block_hashes(meta.block_size), meta.block_hashes);
+  EXPECT_FALSE(narrow.init_block_status(meta));
+  EXPECT_FALSE(narrow.verify_all_blocks(2));
+
+  const std::vector<methylome::offset_pair> offsets{{0, 3}, {2, 9}, {5, 10}};
+  const auto narrow_counts = narrow.get_counts_cov(offsets);
+  const auto wide_counts = wide.get_counts_cov(offsets);
+  ASSERT_EQ(std::size(narrow_counts), std::size(wide_counts));
+  for (std::size_t i = 0; i < std::size(offsets); ++i) {
+    EXPECT_EQ(narrow_counts[i].n_meth, wide_counts[i].n_meth);
+    EXPECT_EQ(narrow_counts[i].n_unmeth, wide_counts[i].n_unmeth);
+    EXPECT_EQ(narrow_counts[i].n_covered, wide_counts[i].n_covered);
+  }
+  EXPECT_EQ(narrow.total_counts().n_unmeth, wide.total_counts().n_unmeth);
+
+  const auto [slice, slice_err] = narrow.get_slice(2, 5);
+  EXPECT_FALSE(slice_err);
+  ASSERT_TRUE(slice.is_narrow());
+  EXPECT_EQ(slice.get_n_cpgs(), 5);
+
+  std::vector<std::uint8_t> narrow_buf;
+  std::vector<std::uint8_t> wide_buf;
+  EXPECT_FALSE(narrow.get_compressed(meta.count_width, narrow_buf));
+  EXPECT_FALSE(wide.get_compressed(meta.count_width, wide_buf));
+  EXPECT_EQ(narrow_buf, wide_buf);
+
+  narrow.widen();
+  EXPECT_FALSE(narrow.is_narrow());
+  EXPECT_EQ(narrow.cpgs, wide.cpgs);
+}
+
+TEST(methylome_test, v2_file_has_its_own_metadata) {
+  methylome meth;
+  for (std::uint16_t i = 0; i < 10; ++i)
+    meth.cpgs.emplace_back(i, 10 - i);
+
+  methylome_metadata meta;
+  meta.assembly = "hg38";
+  meta.index_hash = 1234;
+  meta.n_cpgs = std::size(meth.cpgs);
+  meta.methylome_hash = meth.hash();
+  meta.block_size = 4;
+  meta.block_hashes = meth.get_block_hashes(meta.block_size);
+
+  const auto filename = (std::filesystem::temp_directory_path() /
+                         "xfrase_v2_file_test.m16")
+                          .string();
+  for (const auto zip : {false, true}) {
+    meta.is_compressed = zip;
+    ASSERT_FALSE(meth.write_v2(filename, meta));
+    const auto [from_file, file_meta, read_err] = methylome::read_v2(filename);
+    EXPECT_FALSE(read_err);
+    EXPECT_EQ(from_file.cpgs, meth.cpgs);
+    EXPECT_EQ(file_meta.assembly, meta.assembly);
+    EXPECT_EQ(file_meta.index_hash, meta.index_hash);
+    EXPECT_EQ(file_meta.methylome_hash, meta.methylome_hash);
+    EXPECT_EQ(file_meta.is_compressed, zip);
+    EXPECT_EQ(file_meta.block_hashes, meta.block_hashes);
+
+    // ADS: reading with separate metadata skips the header
+    const auto [with_meta, with_meta_err] = methylome::read(filename, meta);
+    EXPECT_FALSE(with_meta_err);
+    EXPECT_EQ(with_meta.cpgs, meth.cpgs);
+  }
+
+  meta.is_compressed = false;
+  ASSERT_FALSE(meth.write_v2(filename, meta));
+  const auto [slice, slice_err] = methylome::read_slice(filename, meta, 5, 3);
+  EXPECT_FALSE(slice_err);
+  ASSERT_EQ(std::size(slice.cpgs), 3);
+  EXPECT_EQ(slice.cpgs[0], meth.cpgs[5]);
+
+  // ADS: a v1 file has no header and needs its JSON metadata
+  ASSERT_FALSE(meth.write(filename));
+  const auto [v1_meth, v1_meta, v1_err] = methylome::read_v2(filename);
+  EXPECT_EQ(v1_err,
+            std::error_code{methylome_code::methylome_file_without_header});
+  std::filesystem::remove(filename);
+}
+
+TEST(methylome_test, v2_header_offsets_cannot_overflow) {
+  methylome meth;
+  for (std::uint16_t i = 0; i < 10; ++i)
+    meth.cpgs.emplace_back(i, 1);
+  methylome_metadata meta;
+  meta.n_cpgs = std::size(meth.cpgs);
+  meta.block_size = 4;
+  meta.block_hashes = meth.get_block_hashes(meta.block_size);
+
+  const auto filename = (std::filesystem::temp_directory_path() /
+                         "xfrase_v2_overflow_test.m16")
+                          .string();
+  ASSERT_FALSE(meth.write_v2(filename, meta));
+  {
+    // ADS: an offset that wraps around when the block table size is
+    // added to it must not pass as inside the file
+    const std::uint64_t wrapping_offset =
+      std::numeric_limits<std::uint64_t>::max() - 7;
+    std::fstream out(filename, std::ios::in | std::ios::out |
+                                 std::ios::binary);
+    out.seekp(offsetof(methylome_file_header, block_table_offset));
+    out.write(reinterpret_cast<const char *>(&wrapping_offset),
+              sizeof(wrapping_offset));
+  }
+  const auto [from_file, file_meta, read_err] = methylome::read_v2(filename);
+  EXPECT_EQ(read_err,
+            std::error_code{methylome_code::invalid_methylome_header});
+  std::filesystem::remove(filename);
+}
+
+TEST(methylome_test, bins_in_regions_match_whole_genome_bins) {
+  static constexpr std::uint32_t bin_size{500};
+  const auto [index, cim, index_err] = read_cpg_index("data/tProrsus1.cpg_idx");
+  ASSERT_FALSE(index_err);
+  const auto [meta, meta_err] =
+    methylome_metadata::read("data/SRX012345.m16.json");
+  ASSERT_FALSE(meta_err);
+  const auto [meth, meth_err] = methylome::read("data/SRX012345.m16", meta);
+  ASSERT_FALSE(meth_err);
+
+  // ADS: regions start on bin boundaries and stop on one or at the
+  // chrom end, so each bin in a region is also a whole-genome bin
+  const auto chr1 = cim.chrom_index.at("chr1");
+  const auto chr3 = cim.chrom_index.at("chr3");
+  const auto chr7 = cim.chrom_index.at("chr7");
+  const std::vector<genomic_interval> regions{
+    {chr1, 1000, 5000},
+    {chr3, 0, cim.chrom_size[chr3]},
+    {chr7, 9000, cim.chrom_size[chr7]},
+  };
+
+  const auto n_chrom_bins = [&](const auto ch_id) {
+    return (cim.chrom_size[ch_id] + bin_size - 1) / bin_size;
+  };
+  std::vector<std::uint32_t> chrom_bins_offset{0};
+  for (std::size_t i = 0; i < std::size(cim.chrom_size); ++i)
+    chrom_bins_offset.push_back(chrom_bins_offset.back() + n_chrom_bins(i));
+
+  const auto filter = [&](const auto &all) {
+    std::remove_cvref_t<decltype(all)> filtered;
+    for (const auto &r : regions) {
+      const auto first = chrom_bins_offset[r.ch_id] + r.start / bin_size;
+      const auto last =
+        chrom_bins_offset[r.ch_id] + (r.stop + bin_size - 1) / bin_size;
+      filtered.insert(std::cend(filtered), std::cbegin(all) + first,
+                      std::cbegin(all) + last);
+    }
+    return filtered;
+  };
+
+  const auto expected = filter(meth.get_bins(bin_size, index, cim));
+  const auto in_regions = meth.get_bins(bin_size, index, cim, regions);
+  ASSERT_EQ(std::size(in_regions), std::size(expected));
+  ASSERT_EQ(std::size(in_regions), cim.get_n_bins(bin_size, regions));
+  for (std::size_t i = 0; i < std::size(expected); ++i) {
+    EXPECT_EQ(in_regions[i].n_meth, expected[i].n_meth);
+    EXPECT_EQ(in_regions[i].n_unmeth, expected[i].n_unmeth);
+  }
+
+  const auto expected_cov = filter(meth.get_bins_cov(bin_size, index, cim));
+  const auto in_regions_cov =
+    meth.get_bins_cov(bin_size, index, cim, regions);
+  ASSERT_EQ(std::size(in_regions_cov), std::size(expected_cov));
+  for (std::size_t i = 0; i < std::size(expected_cov); ++i) {
+    EXPECT_EQ(in_regions_cov[i].n_meth, expected_cov[i].n_meth);
+    EXPECT_EQ(in_regions_cov[i].n_unmeth, expected_cov[i].n_unmeth);
+    EXPECT_EQ(in_regions_cov[i].n_covered, expected_cov[i].n_covered);
+  }
+}
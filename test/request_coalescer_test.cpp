@@ -0,0 +1,121 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <request_coalescer.hpp>
+#include <response.hpp>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstddef>
+#include <future>
+#include <iterator>
+#include <latch>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+TEST(request_coalescer_test, identical_requests_computed_once) {
+  static constexpr auto n_requests = 4;
+  request_coalescer coalescer;
+  std::atomic_uint32_t n_computed{};
+  std::latch started{1};
+  std::latch finished{n_requests};
+  std::promise<void> release;
+  const auto released = release.get_future().share();
+
+  std::vector<response_header> hdrs(n_requests);
+  std::vector<response_payload> resps(n_requests);
+  const auto compute = [&](const auto i) {
+    return [&, i] {
+      ++n_computed;
+      started.count_down();
+      released.wait();
+      hdrs[i].response_size = 3;
+      resps[i].payload.assign(3, std::byte{1});
+    };
+  };
+  const auto done = [&] { finished.count_down(); };
+
+  auto first = std::async(std::launch::async, [&] {
+    return coalescer.run("key", compute(0), hdrs[0], resps[0], done);
+  });
+  started.wait();
+
+  // ADS: the others find the first in flight and return without
+  // waiting for it
+  auto n_shared = 0;
+  for (auto i = 1; i < n_requests; ++i)
+    n_shared += coalescer.run("key", compute(i), hdrs[i], resps[i], done);
+  EXPECT_EQ(coalescer.n_in_flight(), 1u);
+  release.set_value();
+  finished.wait();
+
+  n_shared += first.get();
+  EXPECT_EQ(n_computed.load(), 1u);
+  EXPECT_EQ(n_shared, n_requests - 1);
+  EXPECT_EQ(coalescer.n_in_flight(), 0u);
+  for (auto i = 0; i < n_requests; ++i) {
+    EXPECT_EQ(hdrs[i].response_size, 3u);
+    EXPECT_TRUE(resps[i].payload.empty());
+    ASSERT_EQ(std::size(resps[i].slices), 1u);
+    // ADS: every response refers to the same bytes
+    EXPECT_EQ(resps[i].slices[0].data(), resps[0].slices[0].data());
+    EXPECT_EQ(resps[i].n_bytes(), 3u);
+  }
+}
+
+TEST(request_coalescer_test, different_or_later_requests_not_shared) {
+  request_coalescer coalescer;
+  response_header hdr;
+  response_payload resp;
+  auto n_computed = 0;
+  auto n_done = 0;
+  const auto compute = [&] { ++n_computed; };
+  const auto done = [&] { ++n_done; };
+  EXPECT_FALSE(coalescer.run("a", compute, hdr, resp, done));
+  EXPECT_FALSE(coalescer.run("b", compute, hdr, resp, done));
+  // ADS: nothing is kept once a request finishes
+  EXPECT_FALSE(coalescer.run("a", compute, hdr, resp, done));
+  EXPECT_EQ(n_computed, 3);
+  EXPECT_EQ(n_done, 3);
+}
+
+TEST(request_coalescer_test, failed_computation_answers_sharing_requests) {
+  request_coalescer coalescer;
+  response_header first_hdr, other_hdr;
+  response_payload first_resp, other_resp;
+  auto n_done = 0;
+  const auto done = [&] { ++n_done; };
+  const auto compute = [&] {
+    // ADS: an identical request arrives while this one is computed
+    EXPECT_TRUE(coalescer.run("key", [] {}, other_hdr, other_resp, done));
+    throw std::runtime_error("compute failed");
+  };
+  EXPECT_THROW(coalescer.run("key", compute, first_hdr, first_resp, done),
+               std::runtime_error);
+  EXPECT_EQ(n_done, 1);
+  EXPECT_EQ(other_hdr.status,
+            std::error_code{server_response_code::server_failure});
+  EXPECT_EQ(coalescer.n_in_flight(), 0u);
+}
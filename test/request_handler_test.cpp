@@ -23,8 +23,25 @@
 
 #include <request_handler.hpp>
 
+#include <cpg_index.hpp>
+#include <cpg_index_meta.hpp>
+#include <cpg_index_set.hpp>
+#include <genomic_interval.hpp>
+#include <methylome.hpp>
+#include <methylome_results_types.hpp>
+#include <request.hpp>
+#include <response.hpp>
+#include <xfrase_error.hpp>
+
 #include <gtest/gtest.h>
 
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>  // for std::size
+#include <system_error>
+#include <tuple>  // for std::ignore
+
 TEST(request_handler_test, basic_assertions) {
   std::error_code ec;
   request_handler rh("data", "data", 8, ec);
@@ -32,3 +49,125 @@ TEST(request_handler_test, basic_assertions) {
   EXPECT_EQ(rh.methylome_dir, "data");
   EXPECT_EQ(rh.index_file_dir, "data");
 }
+
+TEST(request_handler_test, handle_get_raw) {
+  std::error_code ec;
+  request_handler rh("data", "data", 8, ec);
+  EXPECT_FALSE(ec);
+
+  request_header req_hdr{"SRX012345", 6053,
+                         request_header::request_type::raw_counts};
+  request req{2, {{0, 10}, {100, 105}}};
+  response_header resp_hdr;
+  response_payload resp;
+  request_context ctx;
+  rh.handle_header(req_hdr, resp_hdr, ctx);
+  EXPECT_FALSE(resp_hdr.error());
+  EXPECT_NE(ctx.meth, nullptr);
+  EXPECT_NE(ctx.meta, nullptr);
+  rh.handle_get_raw(req_hdr, req, ctx, resp_hdr, resp);
+  EXPECT_FALSE(resp_hdr.error());
+  EXPECT_EQ(resp_hdr.response_size, 15);
+  EXPECT_EQ(std::size(resp.slices), 2);
+  EXPECT_EQ(resp.n_bytes(), 15 * methylome::record_size);
+
+  req_hdr.rq_type = request_header::request_type::raw_counts_positions;
+  resp = {};
+  rh.handle_get_raw(req_hdr, req, ctx, resp_hdr, resp);
+  EXPECT_FALSE(resp_hdr.error());
+  EXPECT_EQ(resp_hdr.response_size, 30);
+  EXPECT_EQ(resp.n_bytes(), 30 * methylome::record_size);
+
+  // offsets past the end of the methylome
+  req = {1, {{6050, 6060}}};
+  resp = {};
+  rh.handle_get_raw(req_hdr, req, ctx, resp_hdr, resp);
+  EXPECT_TRUE(resp_hdr.error());
+}
+
+// ADS: the checksum a client sends for the promoters set, from the
+// intervals sorted as the server sorts them
+[[nodiscard]] static auto
+get_promoters_hash() -> std::uint64_t {
+  const auto [index, cim, index_err] =
+    read_cpg_index("data/pAntiquusx.cpg_idx");
+  EXPECT_FALSE(index_err);
+  auto [gis, gis_err] = genomic_interval::load(
+    cim, "data/interval_sets/pAntiquusx/promoters.bed");
+  EXPECT_FALSE(gis_err);
+  if (!intervals_sorted(cim, gis))
+    std::ignore = sort_intervals(gis);
+  return get_intervals_hash(gis);
+}
+
+TEST(request_handler_test, handle_get_named) {
+  std::error_code ec;
+  request_handler rh("data", "data", 8, ec);
+  EXPECT_FALSE(ec);
+
+  // ADS: the interval set is for the assembly of this methylome
+  request_header req_hdr{"SRX012346", 6,
+                         request_header::request_type::named_counts};
+  response_header resp_hdr;
+  response_payload resp;
+  request_context ctx;
+  rh.handle_header(req_hdr, resp_hdr, ctx);
+  EXPECT_FALSE(resp_hdr.error());
+
+  const auto hash = get_promoters_hash();
+  rh.add_response_size_for_named({"promoters", 3, hash}, ctx, resp_hdr);
+  EXPECT_FALSE(resp_hdr.error());
+  EXPECT_EQ(resp_hdr.response_size, 3);
+  rh.handle_get_named(req_hdr, ctx, resp_hdr, resp);
+  EXPECT_FALSE(resp_hdr.error());
+  EXPECT_EQ(resp.n_bytes(), 3 * sizeof(counts_res));
+
+  // the second time the result is the one kept with the set
+  response_payload cached;
+  rh.handle_get_named(req_hdr, ctx, resp_hdr, cached);
+  EXPECT_FALSE(resp_hdr.error());
+  EXPECT_EQ(cached.owner, resp.owner);
+
+  // the client must agree on the number of intervals
+  rh.add_response_size_for_named({"promoters", 4, hash}, ctx, resp_hdr);
+  EXPECT_EQ(resp_hdr.status,
+            std::error_code{server_response_code::bad_request});
+
+  // and on the intervals themselves
+  resp_hdr = {};
+  rh.add_response_size_for_named({"promoters", 3, hash + 1}, ctx, resp_hdr);
+  EXPECT_EQ(resp_hdr.status,
+            std::error_code{server_response_code::bad_request});
+
+  resp_hdr = {};
+  rh.add_response_size_for_named({"enhancers", 3, hash}, ctx, resp_hdr);
+  EXPECT_EQ(resp_hdr.status,
+            std::error_code{server_response_code::interval_set_not_found});
+}
+
+TEST(request_handler_test, bad_interval_set_skipped) {
+  const auto dir =
+    std::filesystem::temp_directory_path() / "xfrase_bad_interval_set";
+  const auto sets_dir = dir / cpg_index_set::interval_sets_dirname;
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(sets_dir / "pAntiquusx");
+  for (const auto name : {"pAntiquusx.cpg_idx", "pAntiquusx.cpg_idx.json"})
+    std::filesystem::copy_file(std::filesystem::path{"data"} / name,
+                               dir / name);
+  std::filesystem::copy_file("data/interval_sets/pAntiquusx/promoters.bed",
+                             sets_dir / "pAntiquusx" / "promoters.bed");
+  std::ofstream(sets_dir / "pAntiquusx" / "bad.bed") << "chrNone 0 10\n";
+
+  // ADS: the server starts with the sets that could be read
+  std::error_code ec;
+  request_handler rh("data", dir.string(), 8, ec);
+  EXPECT_FALSE(ec);
+  const auto [good, good_err] =
+    rh.indexes.get_interval_set("pAntiquusx", "promoters");
+  EXPECT_FALSE(good_err);
+  EXPECT_EQ(good->intervals_hash, get_promoters_hash());
+  const auto [bad, bad_err] = rh.indexes.get_interval_set("pAntiquusx", "bad");
+  EXPECT_EQ(bad_err,
+            std::error_code{cpg_index_code::interval_set_not_found});
+  std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,173 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <request_lanes.hpp>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+TEST(request_lanes_test, lane_by_cost) {
+  request_lanes_config config;
+  config.bulk_cost = 100;
+  request_lanes lanes(config);
+  EXPECT_EQ(lanes.get_lane(99), request_lanes::lane::interactive);
+  EXPECT_EQ(lanes.get_lane(100), request_lanes::lane::bulk);
+}
+
+TEST(request_lanes_test, bounded_queue) {
+  request_lanes_config config;
+  config.max_queued = 2;
+  request_lanes lanes(config);
+  // ADS: not started, so nothing is taken from the queue
+  EXPECT_TRUE(lanes.submit(request_lanes::lane::bulk, "a", 1, [] {}));
+  EXPECT_TRUE(lanes.submit(request_lanes::lane::bulk, "a", 1, [] {}));
+  EXPECT_FALSE(lanes.submit(request_lanes::lane::bulk, "a", 1, [] {}));
+  EXPECT_TRUE(lanes.submit(request_lanes::lane::interactive, "a", 1, [] {}));
+}
+
+TEST(request_lanes_test, interactive_not_blocked_by_bulk) {
+  request_lanes_config config;
+  config.n_interactive_threads = 1;
+  config.n_bulk_threads = 1;
+  config.max_wait_ms = 60000;
+  request_lanes lanes(config);
+  lanes.start();
+
+  // occupy the bulk worker until released
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  EXPECT_TRUE(lanes.submit(request_lanes::lane::bulk, "a", 1,
+                           [released] { released.wait(); }));
+
+  std::promise<void> done;
+  auto finished = done.get_future();
+  EXPECT_TRUE(lanes.submit(request_lanes::lane::interactive, "b", 1,
+                           [&done] { done.set_value(); }));
+  EXPECT_EQ(finished.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+
+  release.set_value();
+  lanes.stop();
+}
+
+TEST(request_lanes_test, aged_bulk_taken_by_interactive) {
+  request_lanes_config config;
+  config.n_interactive_threads = 1;
+  config.n_bulk_threads = 0;
+  config.max_wait_ms = 10;
+  request_lanes lanes(config);
+  lanes.start();
+
+  std::promise<void> done;
+  auto finished = done.get_future();
+  EXPECT_TRUE(lanes.submit(request_lanes::lane::bulk, "a", 1,
+                           [&done] { done.set_value(); }));
+  EXPECT_EQ(finished.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  lanes.stop();
+}
+
+TEST(request_lanes_test, fair_across_clients) {
+  request_lanes_config config;
+  config.max_wait_ms = 60000;
+  request_lanes lanes(config);
+  // ADS: one client queues three jobs before another queues one; the
+  // second client should not wait for all three
+  const auto l = request_lanes::lane::interactive;
+  std::vector<char> order;
+  for (auto i = 0; i < 3; ++i)
+    EXPECT_TRUE(lanes.submit(l, "a", 10, [&order] { order.push_back('a'); }));
+  EXPECT_TRUE(lanes.submit(l, "b", 10, [&order] { order.push_back('b'); }));
+
+  // ADS: jobs are taken here as a single worker would take them
+  while (std::size(order) < 4) {
+    const auto [lane_id, k] = lanes.pick_job(l, request_lanes::clock::now());
+    ASSERT_GE(lane_id, 0);
+    lanes.take_job(lane_id, k)();
+  }
+  EXPECT_EQ(order[0], 'a');
+  EXPECT_EQ(order[1], 'b');
+}
+
+TEST(request_lanes_test, stop_runs_queued_jobs) {
+  request_lanes_config config;
+  config.n_interactive_threads = 1;
+  config.n_bulk_threads = 0;
+  config.max_wait_ms = 60000;
+  request_lanes lanes(config);
+  lanes.start();
+
+  // occupy the only worker, which would not take bulk jobs for a long
+  // time, and queue jobs behind it in both lanes
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  EXPECT_TRUE(lanes.submit(request_lanes::lane::interactive, "a", 1,
+                           [released] { released.wait(); }));
+  std::atomic<std::uint32_t> n_done{};
+  for (const auto l :
+       {request_lanes::lane::bulk, request_lanes::lane::interactive})
+    for (auto i = 0; i < 3; ++i)
+      EXPECT_TRUE(lanes.submit(l, "b", 1, [&n_done] { ++n_done; }));
+
+  release.set_value();
+  lanes.stop();
+  EXPECT_EQ(n_done.load(), 6u);
+  EXPECT_FALSE(lanes.submit(request_lanes::lane::bulk, "b", 1, [] {}));
+}
+
+TEST(request_lanes_test, stop_without_workers_runs_queued_jobs) {
+  request_lanes_config config;
+  request_lanes lanes(config);
+  std::uint32_t n_done{};
+  for (auto i = 0; i < 3; ++i)
+    EXPECT_TRUE(lanes.submit(request_lanes::lane::bulk, "a", 1,
+                             [&n_done] { ++n_done; }));
+  lanes.stop();
+  EXPECT_EQ(n_done, 3u);
+}
+
+TEST(request_lanes_test, throwing_job_does_not_stop_worker) {
+  request_lanes_config config;
+  config.n_interactive_threads = 1;
+  config.n_bulk_threads = 0;
+  request_lanes lanes(config);
+  lanes.start();
+
+  // ADS: the only worker must survive the first job to run the second
+  EXPECT_TRUE(lanes.submit(request_lanes::lane::interactive, "a", 1,
+                           [] { throw std::runtime_error("job failed"); }));
+  std::promise<void> done;
+  auto finished = done.get_future();
+  EXPECT_TRUE(lanes.submit(request_lanes::lane::interactive, "a", 1,
+                           [&done] { done.set_value(); }));
+  EXPECT_EQ(finished.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  lanes.stop();
+}
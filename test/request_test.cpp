@@ -25,7 +25,13 @@
 
 #include <gtest/gtest.h>
 
+#include <array>
+#include <cstdint>
+#include <cstring>  // for std::strlen
+#include <format>
+#include <iterator>  // for std::size
 #include <string>
+#include <system_error>
 #include <vector>
 
 TEST(request_header, basic_assertions) {
@@ -72,3 +78,129 @@ TEST(bins_request, basic_assertions) {
   const auto req = bins_request{100};
   EXPECT_EQ(req.bin_size, 100);
 }
+
+TEST(bins_request, compose_parse_with_regions) {
+  std::array<char, 64> buf{};
+  const auto req = bins_request{100, 2, {{0, 0, 1000}, {1, 50, 500}}};
+  const auto [ptr, compose_err] =
+    compose(buf.data(), buf.data() + std::size(buf), req);
+  EXPECT_FALSE(compose_err);
+  EXPECT_EQ(std::string(buf.data(), ptr), "100\t2\n");
+
+  bins_request parsed{};
+  const auto [parse_ptr, parse_err] = parse(buf.data(), ptr, parsed);
+  EXPECT_FALSE(parse_err);
+  EXPECT_EQ(parse_ptr, ptr);
+  EXPECT_EQ(parsed.bin_size, 100);
+  EXPECT_EQ(parsed.n_regions, 2);
+  EXPECT_EQ(req.get_regions_n_bytes(), 24);
+}
+
+TEST(bins_request, parse_without_regions) {
+  static constexpr auto hdr = "100\n";
+  bins_request parsed{};
+  parsed.n_regions = 7;
+  const auto [ptr, err] = parse(hdr, hdr + 4, parsed);
+  EXPECT_FALSE(err);
+  EXPECT_EQ(parsed.bin_size, 100);
+  EXPECT_EQ(parsed.n_regions, 0);
+}
+
+TEST(bins_request, parse_rejects_oversized) {
+  const auto parse_str = [](const std::string &hdr) {
+    bins_request parsed{};
+    return parse(hdr.data(), hdr.data() + std::size(hdr), parsed).error;
+  };
+  EXPECT_FALSE(parse_str(std::format("100\t{}\n", max_n_regions)));
+  EXPECT_EQ(parse_str(std::format("100\t{}\n", max_n_regions + 1)),
+            std::error_code{request_error::bins_error_n_regions});
+  EXPECT_EQ(parse_str(std::format("{}\n", max_bin_size + 1u)),
+            std::error_code{request_error::bins_error_bin_size});
+  EXPECT_EQ(parse_str(std::format("100,{}\n", max_bin_size + 1u)),
+            std::error_code{request_error::bins_error_bin_size});
+
+  windows_request windows{};
+  const std::string hdr = std::format("10\t10\t{}\n", max_n_regions + 1);
+  EXPECT_EQ(parse(hdr.data(), hdr.data() + std::size(hdr), windows).error,
+            std::error_code{request_error::windows_error_n_regions});
+}
+
+TEST(bins_request, compose_parse_several_bin_sizes) {
+  std::array<char, 64> buf{};
+  const auto req = bins_request{100, 1, {{0, 0, 1000}}, {1000, 10000}};
+  const std::vector<std::uint32_t> bin_sizes{100, 1000, 10000};
+  EXPECT_EQ(req.get_bin_sizes(), bin_sizes);
+  const auto [ptr, compose_err] =
+    compose(buf.data(), buf.data() + std::size(buf), req);
+  EXPECT_FALSE(compose_err);
+  EXPECT_EQ(std::string(buf.data(), ptr), "100,1000,10000\t1\n");
+
+  bins_request parsed{};
+  const auto [parse_ptr, parse_err] = parse(buf.data(), ptr, parsed);
+  EXPECT_FALSE(parse_err);
+  EXPECT_EQ(parse_ptr, ptr);
+  EXPECT_EQ(parsed.get_bin_sizes(), req.get_bin_sizes());
+  EXPECT_EQ(parsed.n_regions, 1);
+
+  static constexpr auto too_many = "1,2,3,4,5,6,7,8,9\n";
+  const auto [too_many_ptr, too_many_err] =
+    parse(too_many, too_many + std::strlen(too_many), parsed);
+  EXPECT_EQ(too_many_err,
+            std::error_code{request_error::bins_error_n_bin_sizes});
+}
+
+TEST(named_request, compose_parse) {
+  std::array<char, 64> buf{};
+  const auto req = named_request{"promoters", 3, 1234};
+  const auto [ptr, compose_err] =
+    compose(buf.data(), buf.data() + std::size(buf), req);
+  EXPECT_FALSE(compose_err);
+  EXPECT_EQ(std::string(buf.data(), ptr), "promoters\t3\t1234\n");
+
+  named_request parsed;
+  const auto [parse_ptr, parse_err] = parse(buf.data(), ptr, parsed);
+  EXPECT_FALSE(parse_err);
+  EXPECT_EQ(parse_ptr, ptr);
+  EXPECT_EQ(parsed, req);
+
+  // a set must have a name
+  constexpr char no_name[] = "\t3\t1234\n";
+  EXPECT_TRUE(parse(no_name, no_name + 8, parsed).error);
+
+  // and the checksum of its intervals
+  constexpr char no_hash[] = "promoters\t3\t\n";
+  EXPECT_EQ(parse(no_hash, no_hash + 13, parsed).error,
+            std::error_code{request_error::named_error_intervals_hash});
+}
+
+TEST(profile_request, compose_parse) {
+  std::array<char, 64> buf{};
+  const auto req = profile_request{5000, 50, 20, 2, {}, {}};
+  EXPECT_TRUE(req.is_valid());
+  EXPECT_EQ(req.get_n_bins(), 120);
+  const auto [ptr, compose_err] =
+    compose(buf.data(), buf.data() + std::size(buf), req);
+  EXPECT_FALSE(compose_err);
+  EXPECT_EQ(std::string(buf.data(), ptr), "5000\t50\t20\t2\n");
+
+  profile_request parsed{};
+  const auto [parse_ptr, parse_err] = parse(buf.data(), ptr, parsed);
+  EXPECT_FALSE(parse_err);
+  EXPECT_EQ(parse_ptr, ptr);
+  EXPECT_EQ(parsed, req);
+
+  // anchors named instead of sent
+  const auto named = profile_request{5000, 50, 0, 0, "promoters", {}};
+  const auto [named_ptr, named_err] =
+    compose(buf.data(), buf.data() + std::size(buf), named);
+  EXPECT_FALSE(named_err);
+  EXPECT_EQ(std::string(buf.data(), named_ptr), "5000\t50\t0\t0\tpromoters\n");
+  const auto [named_parse_ptr, named_parse_err] =
+    parse(buf.data(), named_ptr, parsed);
+  EXPECT_FALSE(named_parse_err);
+  EXPECT_EQ(parsed.set_name, "promoters");
+
+  // flank size must be a multiple of the number of flank bins
+  EXPECT_FALSE((profile_request{5000, 3, 0, 0, {}, {}}.is_valid()));
+  EXPECT_FALSE((profile_request{}.is_valid()));
+}
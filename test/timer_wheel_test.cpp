@@ -0,0 +1,93 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 Andrew D Smith
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <timer_wheel.hpp>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstddef>  // for std::size_t
+#include <cstdint>
+#include <iterator>  // for std::size
+#include <vector>
+
+TEST(timer_wheel_test, to_ticks_rounds_up) {
+  EXPECT_EQ(timer_wheel::to_ticks(std::chrono::seconds(10)), 100u);
+  EXPECT_EQ(timer_wheel::to_ticks(std::chrono::milliseconds(150)), 2u);
+}
+
+TEST(timer_wheel_test, expires_at_deadline) {
+  timer_wheel wheel;
+  std::uint32_t n_expired{};
+  timer_wheel::entry e;
+  e.on_expire = [&n_expired] { ++n_expired; };
+  wheel.set(e, 5);
+  EXPECT_EQ(wheel.n_pending(), 1u);
+  for (const auto &f : wheel.advance(4))
+    f();
+  EXPECT_EQ(n_expired, 0u);
+  EXPECT_FALSE(wheel.expired(e));
+  for (const auto &f : wheel.advance(5))
+    f();
+  EXPECT_EQ(n_expired, 1u);
+  EXPECT_TRUE(wheel.expired(e));
+  EXPECT_EQ(wheel.n_pending(), 0u);
+}
+
+TEST(timer_wheel_test, set_again_and_clear) {
+  timer_wheel wheel;
+  std::uint32_t n_expired{};
+  timer_wheel::entry a, b;
+  a.on_expire = b.on_expire = [&n_expired] { ++n_expired; };
+  wheel.set(a, 3);
+  wheel.set(b, 3);
+  wheel.set(a, 10);  // replaces the earlier deadline
+  wheel.clear(b);
+  EXPECT_EQ(wheel.n_pending(), 1u);
+  EXPECT_TRUE(wheel.advance(9).empty());
+  EXPECT_FALSE(wheel.expired(b));
+  EXPECT_EQ(std::size(wheel.advance(10)), 1u);
+}
+
+TEST(timer_wheel_test, far_deadlines_move_down_levels) {
+  // ADS: beyond both levels, past the first level, and at the start
+  // of a span
+  static constexpr auto n_level0 = timer_wheel::n_level0_slots;
+  const std::vector<std::uint64_t> deadlines{
+    n_level0 * timer_wheel::n_level1_slots * 3 + 7,
+    n_level0 + 1,
+    n_level0 * 2,
+  };
+  timer_wheel wheel;
+  std::vector<timer_wheel::entry> entries(std::size(deadlines));
+  std::vector<std::uint64_t> expired_at(std::size(deadlines));
+  std::uint64_t now{};
+  for (std::size_t i = 0; i < std::size(deadlines); ++i) {
+    entries[i].on_expire = [&, i] { expired_at[i] = now; };
+    wheel.set(entries[i], deadlines[i]);
+  }
+  while (wheel.n_pending() > 0)
+    for (const auto &f : wheel.advance(++now))
+      f();
+  EXPECT_EQ(expired_at, deadlines);
+}